@@ -0,0 +1,29 @@
+#ifndef __BTE_BASE64_H__
+#define __BTE_BASE64_H__
+
+
+#include "util.h"
+
+
+// Streaming base64 decoder. Input may be split anywhere, even within a quantum of 4
+// characters. Padding ends a quantum early, and whitespace is skipped
+struct base64 {
+	uint32_t acc; // Bits of the quantum so far
+	unsigned n;   // Number of characters in it
+	bool     bad; // Was there an invalid character?
+};
+
+
+// Most bytes n characters (plus a quantum carried over) decode to
+#define BASE64_DECODED_MAX(n) (((n) / 4 + 1) * 3)
+
+
+// Start decoding
+void base64_init(struct base64 *b);
+
+// Decode n characters of src into dst, which has room for BASE64_DECODED_MAX(n) bytes. Return
+// number of bytes decoded. Invalid characters are skipped, and set b->bad
+size_t base64_decode(struct base64 *b, const char *src, size_t n, uint8_t *dst);
+
+
+#endif // __BTE_BASE64_H__
@@ -0,0 +1,46 @@
+#ifndef __BTE_BOXDRAW_H__
+#define __BTE_BOXDRAW_H__
+
+
+#include "util.h"
+
+
+// Kinds of procedurally drawn glyphs (stored in the top 4 bits of a box code)
+enum boxdraw_kind {
+	BOXDRAW_NONE = 0,     // Not a procedural glyph. Use the font
+	BOXDRAW_LINES = 1,    // Box-drawing lines. Arms, dashes and arcs
+	BOXDRAW_RECT = 2,     // Block element. Rectangle in eighths of a cell, with shade
+	BOXDRAW_QUAD = 3,     // Block element. Quadrant mask
+	BOXDRAW_DIAG = 4,     // Diagonal lines
+	BOXDRAW_POINTER = 5,  // Powerline arrow pointing left or right
+	BOXDRAW_CORNER = 6,   // Powerline triangle filling a corner of the cell
+	BOXDRAW_DECOR = 7,    // Text decorations. Mask of enum boxdraw_decor
+};
+
+// Text decorations, drawn over the whole cell
+enum boxdraw_decor {
+	BOXDRAW_DECOR_UNDERLINE = 1,
+	BOXDRAW_DECOR_DOUBLE_UNDERLINE = 2,
+	BOXDRAW_DECOR_CURLY_UNDERLINE = 4,
+	BOXDRAW_DECOR_STRIKE = 8,
+};
+
+// Weights for arms of box-drawing lines
+enum boxdraw_weight {
+	BOXDRAW_W_NONE = 0,
+	BOXDRAW_W_LIGHT = 1,
+	BOXDRAW_W_HEAVY = 2,
+	BOXDRAW_W_DOUBLE = 3,
+};
+
+#define BOXDRAW_KIND(code) ((code) >> 28)
+
+#define BOXDRAW_DECOR_CODE(mask) (((uint32_t) BOXDRAW_DECOR << 28) | (mask))
+
+
+// Get compact code for drawing codepoint in the text shader. Returns 0 (BOXDRAW_NONE) if
+// the codepoint is to be drawn from the font
+uint32_t boxdraw_code(uint32_t codepoint);
+
+
+#endif // __BTE_BOXDRAW_H__
@@ -2,29 +2,66 @@
 #define __BTE_CHILD_H__
 
 
+#include <wchar.h>
 #include <pthread.h>
 #include <stdbool.h>
 #include <inttypes.h>
 #include <sys/types.h>
 
+#include "loop.h"
+#include "ring.h"
 #include "color.h"
 #include "render.h"
 #include "window.h"
 
 
+// Bytes to be written to the child
+struct child_buf {
+	char            *data;
+	size_t          off;         // Bytes of data already written
+	size_t          len;         // Bytes of data
+	size_t          cap;         // Allocated size of data
+};
+
+
 struct child {
 	// Handles
 	pid_t           pid;         // PID of child process
-	int             fd;          // File descriptor for talking to child
-	pthread_t       tid;         // Thread handle for reading from child
+	int             fd;          // File descriptor for talking to child (non-blocking)
+	bool            exited;      // Has the child exited (and been reaped)?
+	bool            hung_up;     // Has the child closed the pty? (event loop thread only)
+	// Watches on the I/O loop, and on the parser loop. The pty is either waited on, or read
+	// and written through io_uring
+	struct loop_watch *pty_watch;  // Output, and room for input (NULL with io_uring)
+	struct loop_watch *io_watch;   // Reads and writes done (io_uring, else NULL)
+	struct loop_watch *wake_watch; // Input queued, or room made for output
+	struct loop_watch *exit_watch; // Child exiting
+	struct loop_watch *parse_watch; // Output read (parser loop)
+	// Output. The I/O loop reads it into the ring, and the parser loop passes it on to the
+	// renderer
+	struct ring     *ring;       // Output read, not yet parsed
+	bool            paused;      // Has reading stopped until the parser makes room?
+	bool            reading;     // Is a read in flight? (io_uring, event loop thread only)
+	wchar_t         *wbuf;       // Decoded, not yet taken by the renderer (parser only)
+	size_t          wbuflen;
+	// Input. Keys and pastes of a turn of window_get_events() are gathered on the window
+	// thread, and queued for the event loop at the end of it, to be written as the child
+	// takes them
+	struct child_buf pending;    // Input of this turn (window thread only)
+	struct child_buf queue;      // Input queued for the event loop
+	pthread_mutex_t queue_mut;   // Lock for queue
+	struct child_buf writing;    // Input taken from the queue, being written (io_uring, event
+	                             // loop thread only)
+	unsigned        writes;      // Writes of it in flight
 	// Pointers to other subsystems
 	struct renderer *renderer;   // Renderer subsystem (not owned)
 	struct window   *window;     // Window subsystem (not owned)
 };
 
 
-// Initialize new child
-struct child* child_new(const char **argv, const char **envp, struct renderer *r, struct window *w);
+// Initialize new child, doing I/O with it on loop io, and parsing its output on loop parser
+struct child* child_new(const char **argv, const char **envp, struct loop *io,
+		struct loop *parser, struct renderer *r, struct window *w);
 
 // Shutdown child
 void child_fini(struct child *child);
@@ -32,6 +69,13 @@ void child_fini(struct child *child);
 // Callback for unicode codepoints (called by window)
 void child_char_cb(struct child *child, uint32_t codepoint);
 
+// Paste text (UTF-8), bracketed if the application asked for it (called by window)
+void child_paste(struct child *child, const char *text);
+
+// Queue input gathered since the last call, to be written in one go (called by window once
+// per turn of its events)
+void child_flush(struct child *child);
+
 // Callback for resize
 void child_resize_cb(struct child *child, uvec2_t dim);
 
@@ -13,6 +13,10 @@ struct color {
 // Parse color from HTML specification (e.g. #224433)
 bool color_parse(struct color *color_dest, const char *html_src);
 
+// Parse color from X11 specification (e.g. rgb:22/44/33, 1 to 4 hex digits per component),
+// or HTML specification
+bool color_parse_x11(struct color *color_dest, const char *x11_src);
+
 // Fill vector with normalized (0.0 - 1.0) color values
 void color_normalize(const struct color *color_src, vec4_t *vec_dest);
 
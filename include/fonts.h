@@ -17,24 +17,90 @@ struct glyph {
 };
 
 
+// Font styles. Variants are loaded the first time a glyph in that style is needed
+enum fonts_style {
+	FONTS_STYLE_REGULAR = 0,
+	FONTS_STYLE_BOLD = 1,
+	FONTS_STYLE_ITALIC = 2,
+	FONTS_STYLE_BOLD_ITALIC = 3,
+	FONTS_N_STYLES = 4,
+};
+
+
+// A loaded font size, with its own glyph cache (opaque)
+struct fontsz;
+
+// Background job rasterizing a new font size (opaque)
+struct fontjob;
+
+
 // Font loading subsystem
 struct fonts {
-	struct htu32 *glyphs;       // Hash table mapping codeoint to glyph
-	uvec2_t      advance;       // Advance to the next glyph
-	unsigned     line_height;   // Distance from top of glyphs to base
+	struct htu32   *glyphs;       // Hash table mapping codeoint and style to glyph (current size)
+	uvec2_t        advance;       // Advance to the next glyph
+	unsigned       line_height;   // Distance from top of glyphs to base
+	float          glyph_scale;   // Scale from glyph bitmap size to pixels (1 unless SDF)
+	bool           sdf;           // Are glyph textures signed distance fields?
+	// Sizes
+	unsigned       font_sz;       // Current pixel size
+	unsigned       default_sz;    // Pixel size at zoom level 0 and content scale 1
+	int            zoom;          // Zoom level (pixels added to default size)
+	float          scale;         // Content scale of the window
+	unsigned       want_sz;       // Most recently requested pixel size
+	struct fontsz  *cur;          // Current size
+	struct fontsz  *pending;      // Size ready to be switched to (NULL if none)
+	struct htu32   *sizes;        // Hash table mapping pixel size to loaded sizes
+	struct fontsz  *sdf_ref;      // Size owning the SDF glyphs (NULL unless SDF)
+	struct fontjob *job;          // Running rasterization job (NULL if none)
 	// Freetype
-	FT_Library   ft_lib;        // Handle to Freetype2 library
-	struct list  *faces;        // List of faces
+	char           *name;         // Font name
+	char           *file;         // Font file
+	FT_Library     ft_lib;        // Handle to Freetype2 library
+	struct list    *faces;        // List of faces
+	// Styles other than regular. Loaded lazily
+	bool           style_tried[FONTS_N_STYLES]; // Has loading the style been attempted?
+	char           *style_files[FONTS_N_STYLES]; // Font files of styles (NULL if not loaded)
+	FT_Face        style_faces[FONTS_N_STYLES]; // Faces of styles (NULL if not loaded)
+	unsigned       synth[FONTS_N_STYLES];       // Styles to synthesize (if the font lacks them)
 };
 
-// Initialize font-loading subsystem
-struct fonts* fonts_new(const char *default_font, unsigned font_sz);
+// Initialize font-loading subsystem. If sdf is true, glyphs are rasterized once as signed
+// distance fields and scaled to every size, instead of being rasterized per size
+struct fonts* fonts_new(const char *default_font, unsigned font_sz, bool sdf);
 
 // Free resources of font-loading subsystem
 void fonts_free(struct fonts *fonts);
 
-// Get glyph for codepoint
-const struct glyph* fonts_get_glyph(struct fonts *fonts, uint32_t codepoint);
+// Get glyph for codepoint in style. Falls back to the regular style if the styled font lacks
+// the glyph
+const struct glyph* fonts_get_glyph(struct fonts *fonts, uint32_t codepoint,
+		enum fonts_style style);
+
+// Get glyph with index id in the face of style (as returned by fonts_get_face()). Used for
+// glyphs produced by text shaping, which need not map to any codepoint
+const struct glyph* fonts_get_glyph_id(struct fonts *fonts, uint32_t id, enum fonts_style style);
+
+// Get face glyphs of style are loaded from. That is the styled font if it exists, and the
+// regular font otherwise
+FT_Face fonts_get_face(struct fonts *fonts, enum fonts_style style);
+
+// Change zoom level by step pixels. A step of 0 resets to the default size. The new size is
+// rasterized in the background, and becomes available through fonts_size_ready()
+void fonts_zoom(struct fonts *fonts, int step);
+
+// Set content scale of the window (e.g. when moving between monitors)
+void fonts_set_scale(struct fonts *fonts, float scale);
+
+// Check whether a requested size is ready to be switched to. Must be called from the thread
+// owning the OpenGL context, since it uploads rasterized glyphs
+bool fonts_size_ready(struct fonts *fonts);
+
+// Switch to the size made ready by fonts_size_ready(). Return false if there was none. The
+// caller is responsible for relayouting with the new metrics
+bool fonts_apply_size(struct fonts *fonts);
+
+// Is a size being rasterized, or ready to be switched to?
+bool fonts_size_pending(const struct fonts *fonts);
 
 
 #endif // __BTE_FONTS_H__
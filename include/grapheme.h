@@ -0,0 +1,42 @@
+#ifndef __BTE_GRAPHEME_H__
+#define __BTE_GRAPHEME_H__
+
+
+#include "util.h"
+
+
+// Maximum number of codepoints stored for a grapheme cluster. Further codepoints are dropped
+#define GRAPHEME_MAX 32
+
+// Zero width joiner
+#define GRAPHEME_ZWJ 0x200d
+
+
+// Table of interned multi-codepoint grapheme clusters, referenced from cells by id (opaque)
+struct graphemes;
+
+// Create a new cluster table
+struct graphemes* graphemes_new();
+
+// Free cluster table
+void graphemes_free(struct graphemes *g);
+
+// Get id of cluster of n (at most GRAPHEME_MAX) codepoints, interning it if it is new
+uint32_t graphemes_intern(struct graphemes *g, const uint32_t *cps, size_t n);
+
+// Get codepoints of cluster, and set *n to their number. Returns NULL (and sets *n to 0) if
+// there is no such cluster
+const uint32_t* graphemes_get(const struct graphemes *g, uint32_t id, size_t *n);
+
+// Is the table due for garbage collection?
+bool graphemes_should_collect(const struct graphemes *g);
+
+// Mark cluster as still referenced, for the next graphemes_sweep()
+void graphemes_mark(struct graphemes *g, uint32_t id);
+
+// Free clusters that were not marked since the last sweep. Every cluster still referenced
+// must have been marked
+void graphemes_sweep(struct graphemes *g);
+
+
+#endif // __BTE_GRAPHEME_H__
@@ -0,0 +1,64 @@
+#ifndef __BTE_IMAGE_H__
+#define __BTE_IMAGE_H__
+
+
+#include "util.h"
+
+
+// Image protocols
+enum image_proto {
+	IMAGE_NONE = 0,
+	IMAGE_KITTY,    // Kitty graphics protocol (APC G ...)
+	IMAGE_SIXEL,    // Sixel graphics (DCS ... q ...)
+};
+
+
+// Largest image accepted, in pixels along either side
+#define IMAGE_MAX_SIDE 8192
+
+
+// Image to be placed at the cursor, once a command has been received
+struct image_place {
+	uint32_t id;    // Id of the placement, for cells to refer to
+	uvec2_t  cells; // Columns and rows covered
+	bool     move;  // Should the cursor move past it? (to the right if kitty, else down)
+};
+
+
+// Images sent by the application, and their textures. Commands are fed in pieces as they
+// arrive, and decoded into a staging buffer as they are. Cells refer to placements of images
+// by id (an image may be placed several times, at different sizes), so images may be evicted
+// (least recently drawn first) to keep the memory they take, on either side, within a budget.
+// Commands are decoded on the reader thread, and textures are made on the render thread, with
+// the caller's lock held (opaque)
+struct images;
+
+// Create a new set of images, taking up to budget bytes
+struct images* images_new(size_t budget);
+
+// Free images, and their textures
+void images_free(struct images *im);
+
+// Start receiving a command of protocol proto
+void images_begin(struct images *im, enum image_proto proto);
+
+// Feed n bytes of the command being received
+void images_feed(struct images *im, const char *s, size_t n);
+
+// End command being received. If an image is to be placed, fill place and return true. Cells
+// cover cell pixels (the current cell size) of the image, unless the command asks otherwise
+bool images_end(struct images *im, uvec2_t cell, struct image_place *place);
+
+// Drop command being received
+void images_cancel(struct images *im);
+
+// Delete textures of images evicted. Called on the render thread, once a frame
+void images_collect(struct images *im);
+
+// Get texture of the image of placement id, uploading it if it hasn't been, and store the size
+// of a cell of the placement, in texture coordinates, in tile. Return 0 if there is no such
+// placement (any more). Called on the render thread
+unsigned images_texture(struct images *im, uint32_t id, vec2_t *tile);
+
+
+#endif // __BTE_IMAGE_H__
@@ -0,0 +1,89 @@
+#ifndef __BTE_LOOP_H__
+#define __BTE_LOOP_H__
+
+
+#include <sys/types.h>
+#include <sys/epoll.h>
+
+#include "util.h"
+
+
+// Event loop. A single thread waits, with epoll, on file descriptors, wakeups from other
+// threads, timers and child processes exiting, for all sessions at once, and calls back for
+// each that is ready. Callbacks run on that thread, one at a time (opaque)
+struct loop;
+
+// Something waited on by the loop (opaque)
+struct loop_watch;
+
+// Callback for a watch. For file descriptors, events holds the epoll events they are ready
+// for, and for child processes, their wait status. Otherwise it is 0
+typedef void (*loop_cb)(struct loop_watch *watch, uint32_t events, void *data);
+
+// Operations of I/O watches
+enum loop_op {
+	LOOP_READ,
+	LOOP_WRITE,
+};
+
+// Callback for an operation of an I/O watch done, with its result: the bytes transferred, or a
+// negated errno (-EAGAIN if it would still block, and -ECANCELED once a write it was linked
+// after falls short)
+typedef void (*loop_io_cb)(struct loop_watch *watch, enum loop_op op, int res, void *data);
+
+
+// Create a new event loop, and start its thread. If child processes can't be waited on with
+// pidfds, SIGCHLD is blocked in the calling thread, so it should be called before any other
+// thread is created
+struct loop* loop_new();
+
+// Stop event loop, and free it and the watches left
+void loop_free(struct loop *loop);
+
+// Wait on fd (not owned) for epoll events (level-triggered)
+struct loop_watch* loop_add_fd(struct loop *loop, int fd, uint32_t events, loop_cb cb,
+		void *data);
+
+// Change events waited on by a file descriptor watch
+void loop_mod_fd(struct loop_watch *watch, uint32_t events);
+
+// Add a watch called back on the loop thread after loop_wake(). Wakeups before the callback
+// runs are coalesced
+struct loop_watch* loop_add_wake(struct loop *loop, loop_cb cb, void *data);
+
+// Wake watch up (safe from any thread)
+void loop_wake(struct loop_watch *watch);
+
+// Add a timer called back every period_us microseconds
+struct loop_watch* loop_add_timer(struct loop *loop, unsigned period_us, loop_cb cb, void *data);
+
+// Add a watch called back once child process pid has exited, after it has been reaped. Without
+// pidfds, SIGCHLD goes to a single loop, so children should all be waited on by the same one
+struct loop_watch* loop_add_child(struct loop *loop, pid_t pid, loop_cb cb, void *data);
+
+// Remove watch. Once it returns, its callback isn't running, and won't be called again. Off
+// the loop thread, operations of I/O watches in flight are cancelled before it returns
+void loop_del(struct loop_watch *watch);
+
+// Do the I/O of I/O watches through io_uring, if bte was built with it (BTE_IO_URING), and the
+// kernel has it (5.7). Returns whether it does. Otherwise, file descriptors are waited on
+bool loop_use_uring(struct loop *loop);
+
+// Add an I/O watch on fd (not owned, and non-blocking), whose reads and writes are started by
+// the caller, and called back once fd is ready for them, and they are done. Returns NULL if the loop doesn't use io_uring
+struct loop_watch* loop_add_io(struct loop *loop, int fd, loop_io_cb cb, void *data);
+
+// Register n bytes at p as the buffer of I/O watch, so that reads into it don't map it again
+// each time. Reads must then go into it
+void loop_io_buffer(struct loop_watch *watch, void *p, size_t n);
+
+// Start reading up to n bytes into p. Operations queued on the loop thread are submitted
+// together, once events are handled
+void loop_read(struct loop_watch *watch, void *p, size_t n);
+
+// Start writing n bytes from p. If link, the next operation started begins once it is done,
+// and is cancelled if it falls short
+void loop_write(struct loop_watch *watch, const void *p, size_t n, bool link);
+
+
+#endif // __BTE_LOOP_H__
@@ -0,0 +1,24 @@
+#ifndef __BTE_LZ_H__
+#define __BTE_LZ_H__
+
+
+#include "util.h"
+
+
+// Fast LZ77 compression, in the LZ4 block format
+
+
+// Size of buffer compressed data of n bytes is guaranteed to fit in
+#define LZ_BOUND(n) ((n) + (n) / 255 + 16)
+
+
+// Compress n bytes of src into dst, which must have room for LZ_BOUND(n) bytes. Return
+// compressed size
+size_t lz_compress(const uint8_t *src, size_t n, uint8_t *dst);
+
+// Decompress n bytes of src into dst, which has room for cap bytes. Return false if the data
+// is corrupt or doesn't fit. Otherwise, set *out_n to the decompressed size
+bool lz_decompress(const uint8_t *src, size_t n, uint8_t *dst, size_t cap, size_t *out_n);
+
+
+#endif // __BTE_LZ_H__
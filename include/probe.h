@@ -0,0 +1,69 @@
+#ifndef __BTE_PROBE_H__
+#define __BTE_PROBE_H__
+
+
+#include "util.h"
+
+
+// Latency probe. Key presses are followed from the window callbacks, through the write to the
+// child and its echo read back and parsed, to the frame showing it being swapped in. Each hook
+// is called by the thread doing that stage, and does nothing unless the probe was started.
+// The echo is matched by the bytes sent for the key, so the child must echo input as is (a
+// shell at its prompt, or the echo program of bte --probe N)
+
+
+// Stages of a key press. Each is timed from the end of the one before
+enum probe_stage {
+	PROBE_INPUT,  // Key event handled by the window
+	PROBE_WRITE,  // Written to the child
+	PROBE_READ,   // Echo read back
+	PROBE_PARSE,  // Echo on the screen
+	PROBE_RENDER, // Frame showing it drawn
+	PROBE_SWAP,   // Frame swapped in
+	PROBE_STAGES,
+};
+
+
+// Start probing. Called before other threads are started
+void probe_start();
+
+// Print percentiles of the stage times of the keys followed, and stop probing. Called once
+// other threads are done
+void probe_stop();
+
+// Get number of keys followed to the end, or given up on (their echo was not found)
+size_t probe_done();
+
+// A key event came in. Returns its time, for probe_key_sent() (window thread)
+uint64_t probe_key();
+
+// Input of the key event of time t has been queued. Keys that queued no input are not followed
+// (window thread)
+void probe_key_sent(uint64_t t);
+
+// n bytes of input at p were queued, by a key or otherwise (window thread)
+void probe_input(const char *p, size_t n);
+
+// n bytes of input were written to the child (I/O thread)
+void probe_write(size_t n);
+
+// n bytes of output were read from the child, before the parser gets them (I/O thread)
+void probe_read(size_t n);
+
+// n bytes of output at p are being parsed. Echoes of keys written are looked for (parser
+// thread)
+void probe_match(const char *p, size_t n);
+
+// Output looked at by probe_match() is on the screen (parser thread, renderer locked)
+void probe_parsed();
+
+// The screen is being published for a frame. Returns the number of keys shown in it (window
+// thread, renderer locked)
+size_t probe_frame();
+
+// The frame showing keys up to keys (from probe_frame()) was drawn by t, and swapped in (window
+// thread)
+void probe_swap(size_t keys, uint64_t t);
+
+
+#endif // __BTE_PROBE_H__
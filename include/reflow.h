@@ -0,0 +1,62 @@
+#ifndef __BTE_REFLOW_H__
+#define __BTE_REFLOW_H__
+
+
+#include "util.h"
+
+
+struct termchar;
+struct graphemes;
+struct scrollback;
+
+
+// Position of a cell in scrollback
+struct reflow_pos {
+	uint64_t line; // Line number (UINT64_MAX if none)
+	unsigned col;  // Index of the cell in the line
+};
+
+
+// Lines of scrollback rewrapped to the width of the screen, as rows. Lines added since the
+// width last changed are rows as they are, numbered like the lines. Older lines are joined
+// where they were soft-wrapped, and the logical lines are rewrapped as their rows are asked
+// for. Their rows are numbered down from there, and may be negative. An index of rows of
+// logical lines is built from the most recent one, as far as rows are asked for, and further
+// by reflow_step(). Lines not yet indexed count as a row each (opaque)
+struct reflow;
+
+// Create a new reflow. Nothing is rewrapped until the width is set by reflow_reset()
+struct reflow* reflow_new();
+
+// Free reflow
+void reflow_free(struct reflow *rf);
+
+// Rewrap lines of sb (NULL if none) added so far to width. Lines added later are taken to be
+// width cells wide
+void reflow_reset(struct reflow *rf, struct scrollback *sb, unsigned width);
+
+// Index logical lines of sb for about budget_ns nanoseconds. Returns true if there are lines
+// left to index
+bool reflow_step(struct reflow *rf, struct scrollback *sb, uint64_t budget_ns);
+
+// Get number of rows of sb
+uint64_t reflow_size(struct reflow *rf, struct scrollback *sb);
+
+// Get row num of sb into n cells (row may be NULL if n is 0). Cells past the end of the row
+// are cleared. Grapheme clusters are interned in clusters (see scrollback_get()). If srcs
+// isn't NULL, the position in sb of each of the n cells is stored there. Returns the line the
+// row starts in, or UINT64_MAX if there is no such row
+uint64_t reflow_get(struct reflow *rf, struct scrollback *sb, int64_t num, struct termchar *row,
+		unsigned n, struct graphemes *clusters, struct reflow_pos *srcs);
+
+// Get number of the row holding the start of line of sb. Lines after the most recent one of
+// sb are taken to be rows as they are
+int64_t reflow_row(struct reflow *rf, struct scrollback *sb, uint64_t line);
+
+// Get line of sb as it is stored, and store its length in *n. Cells are valid until the next
+// call, and grapheme clusters are interned in clusters
+const struct termchar* reflow_line(struct reflow *rf, struct scrollback *sb, uint64_t line,
+		struct graphemes *clusters, unsigned *n);
+
+
+#endif // __BTE_REFLOW_H__
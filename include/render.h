@@ -2,11 +2,19 @@
 #define __BTE_RENDER_H__
 
 
+#include <time.h>
 #include <pthread.h>
 #include <inttypes.h>
 
 #include "util.h"
+#include "color.h"
 #include "fonts.h"
+#include "shape.h"
+#include "grapheme.h"
+#include "scrollback.h"
+#include "viewport.h"
+#include "search.h"
+#include "image.h"
 #include "window.h"
 
 
@@ -17,32 +25,142 @@ enum renderer_clear_type {
 };
 
 
+// Palette entries. 256 indexed colors, followed by the default foreground and background
+enum renderer_palette_idx {
+	RENDERER_COLOR_FG = 256,
+	RENDERER_COLOR_BG = 257,
+	RENDERER_PALETTE_SZ = 258,
+};
+
+// Cell colors are packed into 32 bits. Either an index into the palette, or (if the RGB flag
+// is set) a direct RGB color. They are resolved by the shaders
+#define RENDERER_COLOR_RGB_FLAG 0x1000000
+#define RENDERER_COLOR_RGB(r, g, b) \
+	(RENDERER_COLOR_RGB_FLAG | ((uint32_t) (r) << 16) | ((uint32_t) (g) << 8) | (uint32_t) (b))
+
+// Flags added to colors passed to the shaders, for attributes resolved there. Never stored
+// in cells
+#define RENDERER_COLOR_DIM_FLAG   0x2000000
+#define RENDERER_COLOR_BLINK_FLAG 0x4000000
+
+
+// Text attributes (SGR)
+enum renderer_attr {
+	RENDERER_ATTR_BOLD = 1 << 0,
+	RENDERER_ATTR_DIM = 1 << 1,
+	RENDERER_ATTR_ITALIC = 1 << 2,
+	RENDERER_ATTR_UNDERLINE = 1 << 3,
+	RENDERER_ATTR_DOUBLE_UNDERLINE = 1 << 4,
+	RENDERER_ATTR_CURLY_UNDERLINE = 1 << 5,
+	RENDERER_ATTR_BLINK = 1 << 6,
+	RENDERER_ATTR_REVERSE = 1 << 7,
+	RENDERER_ATTR_HIDDEN = 1 << 8,
+	RENDERER_ATTR_STRIKE = 1 << 9,
+};
+
+#define RENDERER_ATTR_ANY_UNDERLINE \
+	(RENDERER_ATTR_UNDERLINE | RENDERER_ATTR_DOUBLE_UNDERLINE | RENDERER_ATTR_CURLY_UNDERLINE)
+
+
+// Cell flags
+enum renderer_cell_flag {
+	RENDERER_CELL_WIDE = 1,      // First cell of a wide character
+	RENDERER_CELL_WIDE_CONT = 2, // Second cell of a wide character (continuation)
+	RENDERER_CELL_CLUSTER = 4,   // cp is the id of a multi-codepoint grapheme cluster
+	RENDERER_CELL_WRAPPED = 8,   // Last cell of a row that continues on the next (soft wrap)
+	RENDERER_CELL_IMAGE = 16,    // cp is the id of an image placement, and fg the cell of it
+	                             // shown (row << 16 | column)
+};
+
+
 struct termchar {
-	const struct glyph *glyph;  // Glyph to draw
-	vec4_t             fgcol;   // Foreground color
-	vec4_t             bgcol;   // Background color
+	uint32_t           cp;      // Codepoint to draw. Glyph is looked up at render time
+	uint32_t           box;     // Code for procedurally drawn glyph (0 if drawn from font)
+	uint32_t           fg;      // Foreground color (packed)
+	uint32_t           bg;      // Background color (packed)
+	uint16_t           attrs;   // Attributes (enum renderer_attr)
+	uint8_t            flags;   // Flags (enum renderer_cell_flag)
 	bool               to_draw; // Is this to be rendered?
 };
 
 
 struct termbuf {
 	struct termchar     *termbox;      // Glyphs buffer
+	struct termchar     **rows;        // Row indirection table. Screen row -> row in termbox
+	struct termchar     **spare_rows;  // Scratch space for rotating rows
 	uvec2_t             dim;           // Dimensions (no. of chars)
 	uvec2_t             cursor;        // Current cursor position
-	const struct glyph  *cursor_glyph; // Glyph to draw for cursor
+	uvec2_t             saved_cursor;  // Cursor position saved by DECSC
+	uint32_t            cursor_cp;     // Codepoint to draw for cursor
+	uint32_t            cursor_box;    // Code for procedurally drawn cursor (0 if none)
 	bool                cursor_vis;    // Is cursor supposed to be visible?
-	unsigned            toprow;        // Topmost row (prevent memcpy)
+	unsigned            scroll_top;    // First row of scroll region
+	unsigned            scroll_bot;    // Row after the last row of scroll region
+	struct graphemes    *clusters;     // Grapheme clusters referenced by cells
+	struct scrollback   *scrollback;   // Lines scrolled off the top (NULL if none)
+	bool                join_next;     // Was the last character a zero width joiner?
+};
+
+
+// Maximum length of a control string (OSC, DCS, APC), in bytes of UTF-8. Longer ones are
+// dropped
+#define RENDERER_STRING_MAX 4096
+
+// Maximum length of the window title (bytes of UTF-8, including the terminating NUL)
+#define RENDERER_TITLE_MAX 512
+
+
+// Kinds of control strings
+enum renderer_string {
+	RENDERER_STRING_NONE = 0, // Not in a control string
+	RENDERER_STRING_OSC,      // Operating system command (ESC ])
+	RENDERER_STRING_DCS,      // Device control string (ESC P)
+	RENDERER_STRING_APC,      // Application program command (ESC _)
+	RENDERER_STRING_IGNORE,   // Start of string (ESC X) or privacy message (ESC ^)
+};
+
+
+// Run of cells of a row in view showing part of an image
+struct renderer_image_run {
+	uint32_t id;   // Image
+	unsigned tex;  // Its texture
+	uint32_t next; // Cell of the image that would continue the run
+	unsigned row;  // Row in view
+	unsigned col;  // First column
+	unsigned len;  // Number of cells
+	vec4_t   uv;   // Part of the image shown (left, top, right, bottom, in texture coordinates)
 };
 
 
 struct renderer {
-	// Terminal screens (double buffering)
-	struct termbuf      *draw_buf;     // Buffer to draw
-	struct termbuf      *mod_buf;      // Buffer to modify
+	// Terminal screens
+	struct termbuf      *draw_buf;     // Buffer to draw (copy of the active screen, owned)
+	struct termbuf      *mod_buf;      // Buffer to modify (active screen)
+	struct termbuf      *primary;      // Primary screen
+	struct termbuf      *alternate;    // Alternate screen (preallocated, never has scrollback)
 	pthread_mutex_t     buf_mut;       // Mutex for swapping buffers
+	uint64_t            sync_deadline; // End of synchronized update (ms since creation, 0 if none)
+	bool                bracketed_paste; // Should pastes be bracketed? (DECSET 2004)
 	// Pointers to other systems
 	struct window       *window;       // Pointer to window (not owned)
 	struct fonts        *fonts;        // Pointer to fonts subsystem (not owned)
+	struct shaper       *shaper;       // Shaper for ligatures (NULL if disabled)
+	// Scrolling back into scrollback
+	struct viewport     *view;         // View of the active screen
+	const struct termchar **view_rows; // Rows drawn in the last frame, from the top
+	unsigned            n_view_rows;   // Number of rows drawn
+	unsigned            view_rows_cap; // Allocated size of view_rows
+	unsigned            view_hist;     // Number of rows at the top drawn from scrollback
+	float               view_shift;    // Pixels rows are moved up by (for partial rows)
+	bool                scrolling;     // Is scrolling being animated?
+	// Searching screen and scrollback
+	struct search       *search;       // Search
+	uint8_t             *view_marks;   // Marks of cells of rows drawn (enum search_mark)
+	size_t              view_marks_cap; // Allocated size of view_marks
+	bool                view_marked;   // Are there marks in view_marks?
+	bool                searching;     // Are there lines left to search?
+	bool                reflowing;     // Are there lines of scrollback left to rewrap?
+	uint64_t            last_frame;    // Time of the last frame (ms since creation)
 	// OpenGL stuff
 	GLuint              VAO_text;
 	GLuint              VBO_text;
@@ -50,18 +168,47 @@ struct renderer {
 	GLuint              VAO_bg;
 	GLuint              VBO_bg;
 	GLuint              bg_shader;     // Shader program for background
+	GLuint              VAO_img;
+	GLuint              VBO_img;
+	GLuint              img_shader;    // Shader program for images
+	GLuint              palette_tex;   // Palette texture (RENDERER_PALETTE_SZ x 1)
+	// Colors
+	uint32_t            fg;            // Current foreground color (packed)
+	uint32_t            bg;            // Current background color (packed)
+	uint16_t            attrs;         // Current attributes
+	struct color        palette[RENDERER_PALETTE_SZ];      // Palette (changed by OSC 4/10/11)
+	struct color        init_palette[RENDERER_PALETTE_SZ]; // Palette at startup
+	bool                palette_dirty; // Does the palette texture need to be uploaded?
+	// Control strings. They may be split across calls to renderer_add_codepoints(), so they
+	// are collected into a fixed buffer until they end
+	uint8_t             str_kind;      // Kind of string being received (enum renderer_string)
+	bool                str_overflow;  // Did it not fit? It is dropped when it ends
+	size_t              str_len;       // Length of it so far (bytes)
+	char                str[RENDERER_STRING_MAX + 1]; // It so far, as UTF-8
+	bool                str_image;     // Is it being passed on to images, as it arrives?
+	// Images. Cells showing them are drawn as a run at a time, with a draw call per image
+	struct images       *images;       // Images sent by the application
+	struct renderer_image_run *image_runs; // Runs of cells showing images in the last frame
+	size_t              n_image_runs;  // Number of runs
+	size_t              image_runs_cap; // Allocated size of image_runs
+	GLfloat             *image_verts;  // Vertices of runs
+	size_t              image_verts_cap; // Allocated size of image_verts (floats)
+	// Window title (OSC 0/2). Picked up by the window once a frame
+	char                title[RENDERER_TITLE_MAX]; // Title set last
+	bool                title_dirty;   // Has it been set since it was picked up?
+	// Blinking
+	struct timespec     start_time;    // Time renderer was created. Base of the time uniform
+	bool                has_blink;     // Did the last frame have blinking text?
+	uint64_t            blink_phase;   // Blink phase of the last frame
 	// Misc
-	vec4_t              fgcol;         // Normalized foreground color
-	vec4_t              bgcol;         // Normalized background color
-	vec4_t              default_fgcol; // Normalized default foreground color
-	vec4_t              default_bgcol; // Normalized default background color
 	bool                req_render;    // Has an updated render been requested?
-	const struct color  *palette;      // Standard palette of 16 colors
 };
 
 
-// Create a new renderer
-struct renderer *renderer_new(struct window *w, struct fonts *f, const char *fg, const char *bg, uint32_t cursor, const struct color *palette);
+// Create a new renderer. If ligatures is true (and bte was built with HarfBuzz), runs of text
+// are shaped. The primary screen keeps about scrollback bytes of scrollback (see
+// scrollback_new() for spill). If smooth_scroll is true, scrolling through it is animated
+struct renderer *renderer_new(struct window *w, struct fonts *f, const char *fg, const char *bg, uint32_t cursor, const struct color *palette, bool ligatures, size_t scrollback, bool spill, bool smooth_scroll);
 
 // Free renderer resources
 void renderer_free(struct renderer *renderer);
@@ -73,10 +220,39 @@ void renderer_render(struct renderer *renderer);
 // Do whatever the renderer needs to do
 void renderer_update(struct renderer *renderer);
 
+// Has a render been requested since the last frame? (safe from any thread)
+bool renderer_pending(struct renderer *renderer);
+
+// Does the renderer need frames even if the screen doesn't change? (animated scrolling,
+// search and rewrapping in progress, blinking text, or a synchronized update that may time out)
+bool renderer_animating(struct renderer *renderer);
+
 // Add codepoints to renderer. Return number of codepoints added
 size_t renderer_add_codepoints(struct renderer *renderer, uint32_t *cps, size_t n_cps);
 
-// Resize renderer to match window (called by window subsystem)
+// If the window title was set since the last call, copy it into buf of n bytes and return
+// true
+bool renderer_get_title(struct renderer *renderer, char *buf, size_t n);
+
+// Has the application asked for pastes to be bracketed?
+bool renderer_bracketed_paste(struct renderer *renderer);
+
+// Scroll view of the active screen back into scrollback by rows (towards the bottom if
+// negative). Rows may be fractional
+void renderer_scroll(struct renderer *renderer, double rows);
+
+// Scroll view of the active screen back to the bottom, following output
+void renderer_scroll_reset(struct renderer *renderer);
+
+// Search screen and scrollback for query of n codepoints, highlighting matches. The view
+// jumps to the most recent match once it is found. An empty query ends the search
+void renderer_search(struct renderer *renderer, const uint32_t *query, size_t n);
+
+// Jump to the next older match (or newer, if older is false). Return false if there is none
+bool renderer_search_next(struct renderer *renderer, bool older);
+
+// Resize renderer to match window and font size (called by window subsystem). Switches to a
+// font size made ready by fonts_size_ready()
 uvec2_t renderer_resize(struct renderer *renderer);
 
 
@@ -0,0 +1,36 @@
+#ifndef __BTE_RING_H__
+#define __BTE_RING_H__
+
+
+#include "util.h"
+
+
+// Lock-free ring buffer of bytes, for a single producer and a single consumer thread. Its
+// memory is mapped twice in a row, so that free space and bytes to consume are always
+// contiguous: the producer reads into it, and the consumer parses it, in place (opaque)
+struct ring;
+
+
+// Create a new ring of at least size bytes (rounded up to a power of two, of whole pages)
+struct ring* ring_new(size_t size);
+
+// Free ring
+void ring_free(struct ring *ring);
+
+// Get the memory of ring: both mappings, n bytes from p (to register it for I/O)
+void ring_memory(const struct ring *ring, char **p, size_t *n);
+
+// Get free space to produce into. Store its start in p, and return its size (producer)
+size_t ring_write_space(struct ring *ring, char **p);
+
+// Make n bytes written into the free space available to the consumer (producer)
+void ring_produce(struct ring *ring, size_t n);
+
+// Get bytes to consume. Store their start in p, and return how many there are (consumer)
+size_t ring_read_space(struct ring *ring, const char **p);
+
+// Give the first n bytes to consume back to the producer (consumer)
+void ring_consume(struct ring *ring, size_t n);
+
+
+#endif // __BTE_RING_H__
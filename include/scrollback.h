@@ -0,0 +1,51 @@
+#ifndef __BTE_SCROLLBACK_H__
+#define __BTE_SCROLLBACK_H__
+
+
+#include "util.h"
+
+
+struct termchar;
+struct graphemes;
+
+
+// Lines scrolled off the top of a screen, within a byte budget. The most recent lines are
+// kept as compact cells. Older ones are compressed in blocks, stored in fixed-size pages, and
+// the oldest blocks are dropped when the pages run out (opaque)
+struct scrollback;
+
+// Create scrollback using about budget bytes. If spill is true, pages are backed by an
+// unlinked temporary file instead of anonymous memory, so that deep histories can be paged
+// out to disk. Returns NULL if budget is 0
+struct scrollback* scrollback_new(size_t budget, bool spill);
+
+// Free scrollback
+void scrollback_free(struct scrollback *sb);
+
+// Append line of n cells. Cells holding grapheme clusters are looked up in clusters. If the
+// last cell is flagged as wrapped, the line is kept with all its cells
+void scrollback_push(struct scrollback *sb, const struct termchar *line, unsigned n,
+		const struct graphemes *clusters);
+
+// Get number of lines stored
+size_t scrollback_size(const struct scrollback *sb);
+
+// Get number of the line after the most recent one. Lines are numbered in the order they are
+// added, from 0, and numbers are never reused (not even after scrollback_clear()). Line number
+// num is at index scrollback_end() - 1 - num
+uint64_t scrollback_end(const struct scrollback *sb);
+
+// Get length of the longest line added, so far. Lines are no longer than that
+unsigned scrollback_width(const struct scrollback *sb);
+
+// Get line idx (0 is the most recent) into n cells. Cells past the end of the line are
+// cleared, and grapheme clusters are interned in clusters (if NULL, cells holding clusters
+// are left without a codepoint). Return length of the line, or 0 if there is no such line
+unsigned scrollback_get(struct scrollback *sb, size_t idx, struct termchar *line, unsigned n,
+		struct graphemes *clusters);
+
+// Drop all lines
+void scrollback_clear(struct scrollback *sb);
+
+
+#endif // __BTE_SCROLLBACK_H__
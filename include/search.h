@@ -0,0 +1,63 @@
+#ifndef __BTE_SEARCH_H__
+#define __BTE_SEARCH_H__
+
+
+#include "util.h"
+
+
+struct termchar;
+struct graphemes;
+struct scrollback;
+
+
+// Marks of cells covered by matches (see search_mark_row())
+enum search_mark {
+	SEARCH_MARK_NONE = 0,
+	SEARCH_MARK_MATCH = 1,   // Part of a match
+	SEARCH_MARK_CURRENT = 2, // Part of the current match
+};
+
+
+// Incremental search over a screen and its scrollback. Lines are numbered as in scrollback,
+// and rows of the screen follow the most recent line of scrollback. Text of lines in
+// scrollback is cached in chunks, so that refining the query doesn't decode them again
+// (opaque)
+struct search;
+
+// Create a new search, without a query
+struct search* search_new();
+
+// Free search
+void search_free(struct search *s);
+
+// Set query of n codepoints, and start searching again. ASCII letters match either case,
+// unless the query has upper case letters. An empty query ends the search
+void search_set_query(struct search *s, const uint32_t *query, size_t n);
+
+// Is there a query?
+bool search_active(const struct search *s);
+
+// Search rows of the screen (dim.y rows of dim.x cells, with clusters), and lines of sb (NULL
+// if none) for about budget_ns nanoseconds. Lines added since the last step are searched
+// first, then older ones, from the most recent. Returns true if there are lines left to search
+bool search_step(struct search *s, struct scrollback *sb, struct termchar *const *rows,
+		uvec2_t dim, const struct graphemes *clusters, uint64_t budget_ns);
+
+// Mark cells of row (line number line, n cells with clusters) covered by matches in marks
+// (enum search_mark)
+void search_mark_row(const struct search *s, uint64_t line, const struct termchar *row,
+		unsigned n, const struct graphemes *clusters, uint8_t *marks);
+
+// Make the next older match (or newer, if older is false) the current one, and set *line to
+// its line. Without a current match, the most recent match is picked. Returns false if there
+// is no such match
+bool search_next(struct search *s, bool older, uint64_t *line);
+
+// Does the search have a current match?
+bool search_has_current(const struct search *s);
+
+// Get number of matches found so far
+size_t search_count(const struct search *s);
+
+
+#endif // __BTE_SEARCH_H__
@@ -0,0 +1,53 @@
+#ifndef __BTE_SHAPE_H__
+#define __BTE_SHAPE_H__
+
+
+#include "util.h"
+#include "fonts.h"
+
+
+// A glyph of a shaped run
+struct shaped_glyph {
+	uint32_t id;   // Glyph index in the face of the run's style
+	unsigned cell; // Cell (from start of run) the glyph belongs to
+	int      x;    // Horizontal offset from the left of the cell, in glyph pixels
+};
+
+// Result of shaping a run of cells
+struct shaped_run {
+	bool                plain;    // Is it one nominal glyph per cell? Then cells are drawn as usual
+	struct shaped_glyph *glyphs;  // Glyphs (NULL if plain)
+	size_t              n_glyphs; // Number of glyphs
+};
+
+// Shaping statistics
+struct shaper_stats {
+	uint64_t frames;   // Number of frames
+	uint64_t hits;     // Runs found in the cache
+	uint64_t misses;   // Runs shaped
+	uint64_t shape_ns; // Time spent shaping
+};
+
+
+// Shapes runs of text with HarfBuzz, caching the results (opaque)
+struct shaper;
+
+// Create a new shaper. Returns NULL if bte was built without HarfBuzz
+struct shaper* shaper_new(struct fonts *fonts);
+
+// Free shaper
+void shaper_free(struct shaper *shaper);
+
+// Shape run of n codepoints (one per cell) in style, at the current font size. The result is
+// owned by the shaper, and valid until the next call
+const struct shaped_run* shaper_shape(struct shaper *shaper, const uint32_t *cps, size_t n,
+		enum fonts_style style);
+
+// Count a rendered frame in the statistics
+void shaper_end_frame(struct shaper *shaper);
+
+// Get statistics since the shaper was created
+void shaper_get_stats(const struct shaper *shaper, struct shaper_stats *stats);
+
+
+#endif // __BTE_SHAPE_H__
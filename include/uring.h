@@ -0,0 +1,53 @@
+#ifndef __BTE_URING_H__
+#define __BTE_URING_H__
+
+
+#include "util.h"
+
+
+// io_uring instance, set up with the raw system calls. Operations are queued, and submitted
+// in one go by uring_submit(). Each carries user data, handed back with its result once it
+// is done. Not thread safe (opaque)
+struct uring;
+
+
+// Create a new io_uring with room for entries operations queued. Returns NULL if bte was built
+// without io_uring (BTE_IO_URING), or the kernel doesn't have what is needed of it
+struct uring* uring_new(unsigned entries);
+
+// Free io_uring. Operations still in flight are cancelled
+void uring_free(struct uring *u);
+
+// Get file descriptor of io_uring, readable once operations are done
+int uring_fd(const struct uring *u);
+
+// Register n bytes at p as a buffer, that reads into it can skip mapping each time. Returns
+// its index, or -1 if buffers can't be registered
+int uring_add_buffer(struct uring *u, void *p, size_t n);
+
+// Unregister buffer of index buf
+void uring_del_buffer(struct uring *u, int buf);
+
+// Queue wait for fd to become ready for poll events. If link, the next operation queued starts
+// once it is
+void uring_poll(struct uring *u, int fd, unsigned events, bool link, uint64_t user);
+
+// Queue read of up to n bytes from fd into p, which lies in buffer buf (if not -1)
+void uring_read(struct uring *u, int fd, void *p, size_t n, int buf, uint64_t user);
+
+// Queue write of n bytes from p to fd. If link, the next operation queued starts once this
+// one is done, and is cancelled if this one falls short
+void uring_write(struct uring *u, int fd, const void *p, size_t n, bool link, uint64_t user);
+
+// Queue cancelling of the first operation in flight with user data user. It is done with
+// result -ECANCELED, and the cancel itself with user data 0
+void uring_cancel(struct uring *u, uint64_t user);
+
+// Submit operations queued
+void uring_submit(struct uring *u);
+
+// Take the result of the next operation done, and its user data. Returns false if none is
+bool uring_reap(struct uring *u, uint64_t *user, int *res);
+
+
+#endif // __BTE_URING_H__
@@ -68,6 +68,23 @@ typedef struct { float x, y, z, w; } vec4_t;
 #define gl_check_error() _gl_check_error(__FILE__, __func__, __LINE__)
 
 
+// -------- UTF-8 ----------------
+
+
+// Maximum length of UTF-8 encoding of a codepoint
+#define UTF8_MAX 4
+
+// Encode codepoint as UTF-8 into out (at least UTF8_MAX bytes). Return number of bytes
+size_t utf8_encode(uint32_t cp, char *out);
+
+
+// -------- TIME ----------------
+
+
+// Get monotonic time (ns)
+uint64_t now_ns();
+
+
 // -------- HASH TABLE ----------------
 
 
@@ -97,6 +114,15 @@ void* htu32_get(struct htu32 *ht, uint32_t k, enum htres *res);
 // Get value for key, and remove it from table. If res is not NULL, set res to result
 void* htu32_pop(struct htu32 *ht, uint32_t k, enum htres *res);
 
+// Get number of entries in hash table
+size_t htu32_size(const struct htu32 *ht);
+
+// Callback for iterating over hash table entries
+typedef void (*htu32_foreach_cb_t) (uint32_t k, void *v, void *arg);
+
+// Call cb for every key-value pair in hash table, in no particular order
+void htu32_foreach(struct htu32 *ht, htu32_foreach_cb_t cb, void *arg);
+
 
 // -------- LINKED LIST ----------------
 
@@ -0,0 +1,85 @@
+#ifndef __BTE_VIEWPORT_H__
+#define __BTE_VIEWPORT_H__
+
+
+#include "util.h"
+
+
+struct termchar;
+struct graphemes;
+struct scrollback;
+struct search;
+struct reflow;
+struct reflow_pos;
+
+
+// View of a screen, scrolled back into its scrollback. The position is in rows, and may be
+// fractional for smooth scrolling. Rows revealed from scrollback are decoded into a window of
+// rows larger than the screen, so that scrolling only decodes the rows coming into view.
+// Scrollback is rewrapped to the width of the screen as it comes into view (see struct reflow),
+// and rows are numbered as there
+struct viewport {
+	// Position
+	double           pos;       // Rows scrolled back from the bottom (0 follows output)
+	double           target;    // Position being scrolled towards
+	uint64_t         end;       // Scrollback end at the last update, to keep the view anchored
+	bool             smooth;    // Is scrolling animated?
+	// Rows decoded from scrollback. Row num is kept in row num % cap
+	struct termchar  *cells;    // Cells of rows
+	int64_t          *nums;     // Number of each row (INT64_MIN if none)
+	uvec2_t          dim;       // Screen dimensions rows were decoded for
+	unsigned         cap;       // Number of rows
+	struct graphemes *clusters; // Grapheme clusters referenced by decoded rows
+	// Rewrapping scrollback
+	struct reflow    *reflow;   // Rows of scrollback
+	unsigned         width;     // Width scrollback is rewrapped to
+	// Marking search matches
+	struct termchar  *scratch;  // Row being marked
+	struct reflow_pos *srcs;    // Positions of its cells in scrollback
+	uint8_t          *marks;    // Marks of a line of scrollback
+	unsigned         marks_cap; // Allocated size of marks
+};
+
+// Create a new viewport, following output. If smooth is true, scrolling is animated
+struct viewport* viewport_new(bool smooth);
+
+// Free viewport
+void viewport_free(struct viewport *vp);
+
+// Scroll back by rows (towards the bottom if negative)
+void viewport_scroll(struct viewport *vp, double rows);
+
+// Scroll to pos rows back from the bottom
+void viewport_scroll_to(struct viewport *vp, double pos);
+
+// Jump back to the bottom, following output
+void viewport_reset(struct viewport *vp);
+
+// Rewrap lines of sb (NULL if none) added so far to width, if that isn't the width it is
+// rewrapped to already. When scrolled back, the view stays on the line at its top
+void viewport_reflow(struct viewport *vp, struct scrollback *sb, unsigned width);
+
+// Rewrap more of sb for about budget_ns nanoseconds, in the background. Returns true if there
+// is more left
+bool viewport_step(struct viewport *vp, struct scrollback *sb, uint64_t budget_ns);
+
+// Update position for a frame, ms milliseconds after the last one. The view stays on the same
+// lines as lines are added to sb (NULL if the screen has none), and is clamped to the lines
+// there are. Returns true if scrolling is still being animated
+bool viewport_update(struct viewport *vp, struct scrollback *sb, uint64_t ms);
+
+// Get row num of sb as dim.x cells, decoding it if it isn't in the window of rows. Cells
+// holding grapheme clusters refer to vp->clusters
+const struct termchar* viewport_row(struct viewport *vp, struct scrollback *sb, int64_t num,
+		uvec2_t dim);
+
+// Mark cells of row num of sb covered by matches of s in marks (see search_mark_row())
+void viewport_mark_row(struct viewport *vp, struct scrollback *sb, const struct search *s,
+		int64_t num, uint8_t *marks);
+
+// Get number of the row holding the start of line of sb (NULL if none). Rows of the screen
+// follow the most recent line, and are numbered as lines
+int64_t viewport_line_row(struct viewport *vp, struct scrollback *sb, uint64_t line);
+
+
+#endif // __BTE_VIEWPORT_H__
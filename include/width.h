@@ -0,0 +1,13 @@
+#ifndef __BTE_WIDTH_H__
+#define __BTE_WIDTH_H__
+
+
+#include "util.h"
+
+
+// Get number of columns taken by codepoint. 0 for combining marks, formatting and control
+// characters, 2 for East Asian wide and fullwidth characters, 1 otherwise
+unsigned width_get(uint32_t codepoint);
+
+
+#endif // __BTE_WIDTH_H__
@@ -10,6 +10,10 @@
 #include "render.h"
 
 
+// Maximum length of search query (codepoints)
+#define WINDOW_SEARCH_MAX 256
+
+
 // Store information about a window
 struct window {
 	GLFWwindow      *window;      // GLFW window
@@ -17,9 +21,22 @@ struct window {
 	uvec2_t         dim;          // Window dimensions
 	char            *title;       // Window title
 	bool            should_close; // Whether window should close
+	bool            idle;         // Is there nothing to draw until something happens? Set by
+	                              // the window thread as it waits for events
 	float           projmat[16];  // Projection matrix
 	struct renderer *renderer;    // Pointer to renderer (not owned)
 	struct child    *child;       // Pointer to child (not owned)
+	// Resizing. While the window is being resized, the grid follows it at a bounded rate,
+	// and the last frame is drawn cropped or padded in between
+	bool            resize_pending; // Has the window been resized since the grid was?
+	double          resized_at;   // Time the window was last resized (s, GLFW time)
+	double          grid_at;      // Time the grid was last resized (s, GLFW time)
+	uvec2_t         grid;         // Grid size the child was last told about
+	// Search prompt. The query is shown in the title
+	bool            searching;    // Is the search prompt open?
+	uint32_t        search[WINDOW_SEARCH_MAX]; // Query
+	size_t          search_len;   // Length of query
+	uint32_t        typed;        // Codepoint typed by window_type(), not handled yet (or 0)
 };
 
 // Create a new window, and initialize OpenGL context
@@ -34,12 +51,21 @@ void window_set_child(struct window *window, struct child *child);
 // Check whether window should close
 bool window_should_close(const struct window *window);
 
-// Set that window should close
+// Set that window should close (safe from any thread)
 void window_set_should_close(struct window *window);
 
-// Wait for events on the window and process callbacks
+// Wait for events on the window and process callbacks. Returns once there are events, or
+// after window_wake()
 void window_get_events(struct window *window);
 
+// Wake window_get_events() up for a frame, unless there is nothing to draw. Called by the frame
+// timer, on the event loop thread
+void window_wake(struct window *window);
+
+// Type codepoint as if on the keyboard, once the window next handles events (safe from any
+// thread). A codepoint not handled yet is replaced
+void window_type(struct window *window, uint32_t codepoint);
+
 // Refresh window
 void window_refresh(struct window *window);
 
@@ -0,0 +1,131 @@
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "base64.h"
+
+
+// Value of each character, or one of these
+#define BASE64_PAD   0x40
+#define BASE64_SPACE 0x41
+#define BASE64_BAD   0x42
+
+
+// Get value of character c
+static uint8_t _value(unsigned char c) {
+	if (c >= 'A' && c <= 'Z') {
+		return c - 'A';
+	} else if (c >= 'a' && c <= 'z') {
+		return c - 'a' + 26;
+	} else if (c >= '0' && c <= '9') {
+		return c - '0' + 52;
+	}
+	switch (c) {
+	case '+':
+		return 62;
+	case '/':
+		return 63;
+	case '=':
+		return BASE64_PAD;
+	case ' ':
+	case '\t':
+	case '\r':
+	case '\n':
+		return BASE64_SPACE;
+	}
+	return BASE64_BAD;
+}
+
+
+#ifdef __SSE2__
+// Is c within [lo, hi]? (signed, so bytes over 127 never are)
+static __m128i _in_range(__m128i c, char lo, char hi) {
+	return _mm_and_si128(_mm_cmpgt_epi8(c, _mm_set1_epi8(lo - 1)),
+			_mm_cmplt_epi8(c, _mm_set1_epi8(hi + 1)));
+}
+
+
+// Decode 16 characters of src into 12 bytes of dst. Return false (and decode nothing) unless
+// all of them are valid, without padding or whitespace. Characters are mapped to values by
+// adding an offset picked by range, and pairs of values are then merged into 12 bits, and
+// pairs of those into 24
+static bool _decode16(const char *src, uint8_t *dst) {
+	__m128i c = _mm_loadu_si128((const __m128i*) src);
+	__m128i upper = _in_range(c, 'A', 'Z'), lower = _in_range(c, 'a', 'z');
+	__m128i digit = _in_range(c, '0', '9');
+	__m128i plus = _mm_cmpeq_epi8(c, _mm_set1_epi8('+'));
+	__m128i slash = _mm_cmpeq_epi8(c, _mm_set1_epi8('/'));
+	__m128i off, v, t;
+	uint32_t u[4];
+	unsigned i;
+	if (_mm_movemask_epi8(_mm_or_si128(_mm_or_si128(upper, lower),
+				_mm_or_si128(_mm_or_si128(digit, plus), slash))) != 0xffff) {
+		return false;
+	}
+	off = _mm_or_si128(_mm_and_si128(upper, _mm_set1_epi8(-'A')),
+			_mm_and_si128(lower, _mm_set1_epi8(26 - 'a')));
+	off = _mm_or_si128(off, _mm_and_si128(digit, _mm_set1_epi8(52 - '0')));
+	off = _mm_or_si128(off, _mm_and_si128(plus, _mm_set1_epi8(62 - '+')));
+	off = _mm_or_si128(off, _mm_and_si128(slash, _mm_set1_epi8(63 - '/')));
+	v = _mm_add_epi8(c, off);
+	t = _mm_or_si128(_mm_slli_epi16(_mm_and_si128(v, _mm_set1_epi16(0xff)), 6),
+			_mm_srli_epi16(v, 8));
+	v = _mm_or_si128(_mm_slli_epi32(_mm_and_si128(t, _mm_set1_epi32(0xffff)), 12),
+			_mm_srli_epi32(t, 16));
+	_mm_storeu_si128((__m128i*) u, v);
+	for (i = 0; i < 4; i++) {
+		dst[3 * i] = u[i] >> 16;
+		dst[3 * i + 1] = u[i] >> 8;
+		dst[3 * i + 2] = u[i];
+	}
+	return true;
+}
+#endif
+
+
+// Start decoding
+void base64_init(struct base64 *b) {
+	b->acc = 0;
+	b->n = 0;
+	b->bad = false;
+}
+
+
+// Decode n characters of src into dst
+size_t base64_decode(struct base64 *b, const char *src, size_t n, uint8_t *dst) {
+	size_t i = 0, out = 0;
+	uint8_t v;
+	while (i < n) {
+#ifdef __SSE2__
+		// Whole quanta at a time, while there is no quantum under way
+		if (b->n == 0) {
+			for ( ; i + 16 <= n && _decode16(&src[i], &dst[out]); i += 16, out += 12);
+			if (i >= n) {
+				break;
+			}
+		}
+#endif
+		v = _value(src[i++]);
+		if (v < 64) {
+			b->acc = (b->acc << 6) | v;
+			if (++b->n == 4) {
+				dst[out++] = b->acc >> 16;
+				dst[out++] = b->acc >> 8;
+				dst[out++] = b->acc;
+				b->acc = b->n = 0;
+			}
+		} else if (v == BASE64_PAD) {
+			// The quantum ends early. Its bits past the last whole byte are dropped
+			if (b->n >= 2) {
+				dst[out++] = b->acc >> (b->n == 2 ? 4 : 10);
+			}
+			if (b->n == 3) {
+				dst[out++] = b->acc >> 2;
+			}
+			b->acc = b->n = 0;
+		} else if (v == BASE64_BAD) {
+			b->bad = true;
+		}
+	}
+	return out;
+}
@@ -0,0 +1,168 @@
+#include "boxdraw.h"
+
+
+// Layout of a box code:
+//   bits 28-31: kind (enum boxdraw_kind)
+//   BOXDRAW_LINES:   bits 0-7 arm weights (left, right, up, down; 2 bits each),
+//                    bits 8-10 number of dashes (0 for solid), bit 11 rounded corner
+//   BOXDRAW_RECT:    bits 0-15 x0, x1, y0, y1 in eighths of the cell (4 bits each, y from top),
+//                    bits 16-17 shade (0 solid, 1 light, 2 medium, 3 dark)
+//   BOXDRAW_QUAD:    bits 0-3 quadrant mask (upper left, upper right, lower left, lower right)
+//   BOXDRAW_DIAG:    bit 0 "/", bit 1 "\"
+//   BOXDRAW_POINTER: bit 0 points left, bit 2 outline only
+//   BOXDRAW_CORNER:  bits 0-1 corner (lower left, lower right, upper left, upper right),
+//                    bit 2 outline only
+//   BOXDRAW_DECOR:   bits 0-3 mask of enum boxdraw_decor
+
+
+#define _KIND(k) ((uint32_t) (k) << 28)
+
+#define _ARMS(l, r, u, d) ((l) | ((r) << 2) | ((u) << 4) | ((d) << 6))
+
+#define _RECT(x0, x1, y0, y1) \
+	(_KIND(BOXDRAW_RECT) | (x0) | ((x1) << 4) | ((y0) << 8) | ((y1) << 12))
+
+#define _DASHES(n) ((n) << 8)
+
+#define _ARC (1 << 11)
+
+
+// Arm weights for U+2500 - U+257F. Diagonals (U+2571 - U+2573) are handled separately
+static const uint8_t _box_arms[128] = {
+	_ARMS(1, 1, 0, 0), _ARMS(2, 2, 0, 0), _ARMS(0, 0, 1, 1), _ARMS(0, 0, 2, 2), // 2500
+	_ARMS(1, 1, 0, 0), _ARMS(2, 2, 0, 0), _ARMS(0, 0, 1, 1), _ARMS(0, 0, 2, 2), // 2504
+	_ARMS(1, 1, 0, 0), _ARMS(2, 2, 0, 0), _ARMS(0, 0, 1, 1), _ARMS(0, 0, 2, 2), // 2508
+	_ARMS(0, 1, 0, 1), _ARMS(0, 2, 0, 1), _ARMS(0, 1, 0, 2), _ARMS(0, 2, 0, 2), // 250C
+	_ARMS(1, 0, 0, 1), _ARMS(2, 0, 0, 1), _ARMS(1, 0, 0, 2), _ARMS(2, 0, 0, 2), // 2510
+	_ARMS(0, 1, 1, 0), _ARMS(0, 2, 1, 0), _ARMS(0, 1, 2, 0), _ARMS(0, 2, 2, 0), // 2514
+	_ARMS(1, 0, 1, 0), _ARMS(2, 0, 1, 0), _ARMS(1, 0, 2, 0), _ARMS(2, 0, 2, 0), // 2518
+	_ARMS(0, 1, 1, 1), _ARMS(0, 2, 1, 1), _ARMS(0, 1, 2, 1), _ARMS(0, 1, 1, 2), // 251C
+	_ARMS(0, 1, 2, 2), _ARMS(0, 2, 2, 1), _ARMS(0, 2, 1, 2), _ARMS(0, 2, 2, 2), // 2520
+	_ARMS(1, 0, 1, 1), _ARMS(2, 0, 1, 1), _ARMS(1, 0, 2, 1), _ARMS(1, 0, 1, 2), // 2524
+	_ARMS(1, 0, 2, 2), _ARMS(2, 0, 2, 1), _ARMS(2, 0, 1, 2), _ARMS(2, 0, 2, 2), // 2528
+	_ARMS(1, 1, 0, 1), _ARMS(2, 1, 0, 1), _ARMS(1, 2, 0, 1), _ARMS(2, 2, 0, 1), // 252C
+	_ARMS(1, 1, 0, 2), _ARMS(2, 1, 0, 2), _ARMS(1, 2, 0, 2), _ARMS(2, 2, 0, 2), // 2530
+	_ARMS(1, 1, 1, 0), _ARMS(2, 1, 1, 0), _ARMS(1, 2, 1, 0), _ARMS(2, 2, 1, 0), // 2534
+	_ARMS(1, 1, 2, 0), _ARMS(2, 1, 2, 0), _ARMS(1, 2, 2, 0), _ARMS(2, 2, 2, 0), // 2538
+	_ARMS(1, 1, 1, 1), _ARMS(2, 1, 1, 1), _ARMS(1, 2, 1, 1), _ARMS(2, 2, 1, 1), // 253C
+	_ARMS(1, 1, 2, 1), _ARMS(1, 1, 1, 2), _ARMS(1, 1, 2, 2), _ARMS(2, 1, 2, 1), // 2540
+	_ARMS(1, 2, 2, 1), _ARMS(2, 1, 1, 2), _ARMS(1, 2, 1, 2), _ARMS(2, 2, 2, 1), // 2544
+	_ARMS(2, 2, 1, 2), _ARMS(2, 1, 2, 2), _ARMS(1, 2, 2, 2), _ARMS(2, 2, 2, 2), // 2548
+	_ARMS(1, 1, 0, 0), _ARMS(2, 2, 0, 0), _ARMS(0, 0, 1, 1), _ARMS(0, 0, 2, 2), // 254C
+	_ARMS(3, 3, 0, 0), _ARMS(0, 0, 3, 3), _ARMS(0, 3, 0, 1), _ARMS(0, 1, 0, 3), // 2550
+	_ARMS(0, 3, 0, 3), _ARMS(3, 0, 0, 1), _ARMS(1, 0, 0, 3), _ARMS(3, 0, 0, 3), // 2554
+	_ARMS(0, 3, 1, 0), _ARMS(0, 1, 3, 0), _ARMS(0, 3, 3, 0), _ARMS(3, 0, 1, 0), // 2558
+	_ARMS(1, 0, 3, 0), _ARMS(3, 0, 3, 0), _ARMS(0, 3, 1, 1), _ARMS(0, 1, 3, 3), // 255C
+	_ARMS(0, 3, 3, 3), _ARMS(3, 0, 1, 1), _ARMS(1, 0, 3, 3), _ARMS(3, 0, 3, 3), // 2560
+	_ARMS(3, 3, 0, 1), _ARMS(1, 1, 0, 3), _ARMS(3, 3, 0, 3), _ARMS(3, 3, 1, 0), // 2564
+	_ARMS(1, 1, 3, 0), _ARMS(3, 3, 3, 0), _ARMS(3, 3, 1, 1), _ARMS(1, 1, 3, 3), // 2568
+	_ARMS(3, 3, 3, 3), _ARMS(0, 1, 0, 1), _ARMS(1, 0, 0, 1), _ARMS(1, 0, 1, 0), // 256C
+	_ARMS(0, 1, 1, 0), 0,                 0,                 0,                 // 2570
+	_ARMS(1, 0, 0, 0), _ARMS(0, 0, 1, 0), _ARMS(0, 1, 0, 0), _ARMS(0, 0, 0, 1), // 2574
+	_ARMS(2, 0, 0, 0), _ARMS(0, 0, 2, 0), _ARMS(0, 2, 0, 0), _ARMS(0, 0, 0, 2), // 2578
+	_ARMS(1, 2, 0, 0), _ARMS(0, 0, 1, 2), _ARMS(2, 1, 0, 0), _ARMS(0, 0, 2, 1), // 257C
+};
+
+
+// Get code for box-drawing character (U+2500 - U+257F)
+static uint32_t _box_lines(uint32_t cp) {
+	uint32_t code;
+	switch (cp) {
+	case 0x2571:
+		return _KIND(BOXDRAW_DIAG) | 1;
+	case 0x2572:
+		return _KIND(BOXDRAW_DIAG) | 2;
+	case 0x2573:
+		return _KIND(BOXDRAW_DIAG) | 3;
+	}
+	code = _KIND(BOXDRAW_LINES) | _box_arms[cp - 0x2500];
+	if (cp >= 0x2504 && cp <= 0x2507) {
+		code |= _DASHES(3);
+	} else if (cp >= 0x2508 && cp <= 0x250b) {
+		code |= _DASHES(4);
+	} else if (cp >= 0x254c && cp <= 0x254f) {
+		code |= _DASHES(2);
+	} else if (cp >= 0x256d && cp <= 0x2570) {
+		code |= _ARC;
+	}
+	return code;
+}
+
+
+// Get code for block element (U+2580 - U+259F)
+static uint32_t _box_block(uint32_t cp) {
+	// Quadrant masks for U+2596 - U+259F
+	static const uint8_t quads[10] = { 4, 8, 1, 13, 9, 7, 11, 2, 6, 14 };
+	if (cp == 0x2580) {
+		// Upper half
+		return _RECT(0, 8, 0, 4);
+	}
+	if (cp <= 0x2588) {
+		// Lower 1/8 to full block
+		return _RECT(0, 8, 8 - (cp - 0x2580), 8);
+	}
+	if (cp <= 0x258f) {
+		// Left 7/8 to left 1/8
+		return _RECT(0, 8 - (cp - 0x2588), 0, 8);
+	}
+	switch (cp) {
+	case 0x2590:
+		// Right half
+		return _RECT(4, 8, 0, 8);
+	case 0x2591:
+	case 0x2592:
+	case 0x2593:
+		// Light, medium, dark shade
+		return _RECT(0, 8, 0, 8) | ((cp - 0x2590) << 16);
+	case 0x2594:
+		// Upper 1/8
+		return _RECT(0, 8, 0, 1);
+	case 0x2595:
+		// Right 1/8
+		return _RECT(7, 8, 0, 8);
+	}
+	return _KIND(BOXDRAW_QUAD) | quads[cp - 0x2596];
+}
+
+
+// Get code for powerline symbol (U+E0B0 - U+E0BF)
+static uint32_t _box_powerline(uint32_t cp) {
+	switch (cp) {
+	case 0xe0b0:
+	case 0xe0b1:
+	case 0xe0b2:
+	case 0xe0b3:
+		// Right/left pointing triangles and chevrons
+		return _KIND(BOXDRAW_POINTER) | ((cp - 0xe0b0) >> 1) | (((cp - 0xe0b0) & 1) << 2);
+	case 0xe0b8:
+	case 0xe0b9:
+	case 0xe0ba:
+	case 0xe0bb:
+	case 0xe0bc:
+	case 0xe0bd:
+	case 0xe0be:
+	case 0xe0bf:
+		// Corner triangles and their diagonals
+		return _KIND(BOXDRAW_CORNER) | ((cp - 0xe0b8) >> 1) | (((cp - 0xe0b8) & 1) << 2);
+	}
+	return 0;
+}
+
+
+// Get compact code for drawing codepoint in the text shader. Returns 0 (BOXDRAW_NONE) if
+// the codepoint is to be drawn from the font
+uint32_t boxdraw_code(uint32_t cp) {
+	if (cp < 0x2500) {
+		return 0;
+	}
+	if (cp < 0x2580) {
+		return _box_lines(cp);
+	}
+	if (cp < 0x25a0) {
+		return _box_block(cp);
+	}
+	if (cp >= 0xe0b0 && cp <= 0xe0bf) {
+		return _box_powerline(cp);
+	}
+	return 0;
+}
@@ -1,8 +1,10 @@
 #include "glad/glad.h"
-#include <time.h>
 #include <unistd.h>
 #include <locale.h>
+#include <termios.h>
 
+#include "loop.h"
+#include "probe.h"
 #include "fonts.h"
 #include "color.h"
 #include "child.h"
@@ -14,6 +16,11 @@
 
 #define BTE_FONT     "monospace"
 #define BTE_FONTSZ   13
+#define BTE_FONT_SDF false
+#define BTE_LIGATURES true
+#define BTE_SCROLLBACK (16 << 20)
+#define BTE_SCROLLBACK_SPILL false
+#define BTE_SMOOTH_SCROLL true
 #define BTE_WIDTH    1360
 #define BTE_HEIGHT   720
 #define BTE_TITLE    "bte"
@@ -22,7 +29,11 @@
 #define BTE_FPS      60
 #define BTE_CURSOR   CURSOR_BLOCK
 
-#define TDIFF_NSEC (1000000000UL / BTE_FPS)
+#define FRAME_USEC (1000000 / BTE_FPS)
+
+// With bte --probe N, a key is typed this often (us), into the echo program. It is not a
+// multiple of the frame period, so that keys land all over it
+#define PROBE_KEY_USEC 23000
 
 #define BTE_COLOR_FG "#d5c4a1"
 #define BTE_COLOR_BG "#282828"
@@ -49,9 +60,10 @@ static const char *BTE_COLOR_PALETTE[16] = {
 static struct color parsed_palette[16] = { 0 };
 
 
-static struct child* _spawn_child(const char **envp, struct window *w, struct renderer *r) {
+static struct child* _spawn_child(const char **argv, const char **envp, struct loop *io,
+		struct loop *parser, struct window *w, struct renderer *r) {
 	size_t i, n_env, term_i = SIZE_MAX, shell_i = SIZE_MAX;
-	const char **new_env, *new_argv[] = { BTE_SHELL, NULL };
+	const char **new_env;
 	char buf[128];
 	struct child *child;
 
@@ -77,7 +89,7 @@ static struct child* _spawn_child(const char **envp, struct window *w, struct re
 		}
 	}
 
-	child = child_new(new_argv, new_env, r, w);
+	child = child_new(argv, new_env, io, parser, r, w);
 
 	if (term_i != SIZE_MAX) {
 		free((void*) new_env[term_i]);
@@ -91,15 +103,82 @@ static struct child* _spawn_child(const char **envp, struct window *w, struct re
 }
 
 
+// Frame timer. Wakes the window up to draw, at most BTE_FPS times a second
+static void _frame_cb(struct loop_watch *watch, uint32_t events, void *data) {
+	window_wake((struct window*) data);
+}
+
+
+// Keys left to type with bte --probe N, and time the last one was typed (ns)
+static unsigned probe_keys_left;
+static uint64_t probe_last_key;
+
+// Probe timer. Types the next key, and closes the window once the keys typed are all shown (or
+// their echoes given up on)
+static void _probe_cb(struct loop_watch *watch, uint32_t events, void *data) {
+	static unsigned typed;
+	struct window *window = data;
+	if (probe_keys_left > 0) {
+		window_type(window, 'a' + typed++ % 26);
+		probe_keys_left--;
+		probe_last_key = now_ns();
+	} else if (probe_done() >= typed || now_ns() - probe_last_key > 2000000000ull) {
+		window_set_should_close(window);
+	}
+}
+
+
+// Echo program, standing in for a shell with bte --probe N. Input is written back as is, until
+// Ctrl + D
+static int _echo() {
+	struct termios tio;
+	char buf[BUFSIZ];
+	ssize_t n;
+	if (tcgetattr(0, &tio) == 0) {
+		cfmakeraw(&tio);
+		tcsetattr(0, TCSANOW, &tio);
+	}
+	while ((n = read(0, buf, sizeof(buf))) > 0 && !memchr(buf, 4, n)) {
+		if (write(1, buf, n) != n) {
+			break;
+		}
+	}
+	return 0;
+}
+
+
 int main(int argc, const char **argv, const char **envp) {
+	const char *shell_argv[] = { BTE_SHELL, NULL }, *echo_argv[] = { "/proc/self/exe",
+		"--echo", NULL }, **child_argv = shell_argv;
+	struct loop *io, *parser;
+	struct loop_watch *frame, *probe = NULL;
 	struct window * window;
 	struct fonts *fonts;
 	struct renderer *renderer;
 	struct child *child;
-	struct timespec last, cur;
-	uint64_t tdiff;
 	unsigned i;
 
+	// bte --probe times keys typed, from the key event to the frame showing their echo. With
+	// a number of keys, those are typed into an echo program instead of a shell
+	if (argc > 1 && !strcmp(argv[1], "--echo")) {
+		return _echo();
+	}
+	if (argc > 1 && !strcmp(argv[1], "--probe")) {
+		probe_start();
+		if (argc > 2 && (probe_keys_left = atoi(argv[2])) > 0) {
+			child_argv = echo_argv;
+		}
+	} else if (argc > 1) {
+		die_fmt("Usage: %s [--probe [KEYS]]", argv[0]);
+	}
+
+	// Before any other thread is started (see loop_new()). Output of children is read on one
+	// loop, and parsed on the other
+	io = loop_new();
+	parser = loop_new();
+	// Pty I/O goes through io_uring if built with it (BTE_IO_URING), else it is waited on
+	loop_use_uring(io);
+
 	setlocale(LC_ALL, "");
 
 	for (i = 0; i < 16; i++) {
@@ -109,31 +188,30 @@ int main(int argc, const char **argv, const char **envp) {
 	}
 
 	window = window_new(BTE_WIDTH, BTE_HEIGHT, BTE_TITLE);
-	fonts = fonts_new(BTE_FONT, BTE_FONTSZ);
-	renderer = renderer_new(window, fonts, BTE_COLOR_FG, BTE_COLOR_BG, BTE_CURSOR, parsed_palette);
+	fonts = fonts_new(BTE_FONT, BTE_FONTSZ, BTE_FONT_SDF);
+	renderer = renderer_new(window, fonts, BTE_COLOR_FG, BTE_COLOR_BG, BTE_CURSOR, parsed_palette,
+			BTE_LIGATURES, BTE_SCROLLBACK, BTE_SCROLLBACK_SPILL, BTE_SMOOTH_SCROLL);
 	window_set_renderer(window, renderer);
-	child = _spawn_child(envp, window, renderer);
+	child = _spawn_child(child_argv, envp, io, parser, window, renderer);
 	window_set_child(window, child);
 
-	clock_gettime(CLOCK_MONOTONIC, &last);
+	// Events wake the window up, and so does the frame timer while there is something to draw
+	frame = loop_add_timer(io, FRAME_USEC, _frame_cb, window);
+	if (probe_keys_left > 0) {
+		probe = loop_add_timer(io, PROBE_KEY_USEC, _probe_cb, window);
+	}
 	while (!window_should_close(window)) {
 		window_get_events(window);
 		renderer_update(renderer);
-
-		clock_gettime(CLOCK_MONOTONIC, &cur);
-		if (cur.tv_nsec < last.tv_nsec) {
-			tdiff = (cur.tv_sec - last.tv_sec - 1) * 1000000000 \
-				+ (1000000000 + cur.tv_nsec - last.tv_nsec);
-		} else {
-			tdiff = (cur.tv_sec - last.tv_sec) * 1000000000 \
-				+ (cur.tv_nsec - last.tv_nsec);
-		}
-		if (tdiff / 1000 < TDIFF_NSEC / 1000) {
-			usleep((TDIFF_NSEC - tdiff) / 1000);
-		}
-		last = cur;
 	}
 
+	loop_del(frame);
+	loop_del(probe);
+	window_set_child(window, NULL);
+	child_fini(child);
+	loop_free(io);
+	loop_free(parser);
+	probe_stop();
 	window_set_renderer(window, NULL);
 	renderer_free(renderer);
 	fonts_free(fonts);
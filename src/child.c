@@ -1,4 +1,5 @@
 #define _XOPEN_SOURCE 600
+#include <errno.h>
 #include <fcntl.h>
 #include <wchar.h>
 #include <stdlib.h>
@@ -10,6 +11,7 @@
 
 #include "util.h"
 #include "child.h"
+#include "probe.h"
 
 
 #if 0
@@ -29,6 +31,21 @@
 #endif
 
 
+// Most bytes written to the child at once. Larger input (pastes) is written a piece at a time,
+// with output read in between, so that neither side waits on the other
+#define CHILD_WRITE_MAX (64 << 10)
+
+// Most writes started at once with io_uring. They are linked, so that they are done in order
+#define CHILD_WRITE_LINKS 8
+
+// Most bytes of input queued. Input past it is dropped
+#define CHILD_QUEUE_MAX (64 << 20)
+
+// Bracketed paste (DECSET 2004) markers
+#define CHILD_PASTE_START "\33[200~"
+#define CHILD_PASTE_END   "\33[201~"
+
+
 // An escape sequence
 struct esc_seq {
 	unsigned nparam;     // Number of parameters
@@ -70,6 +87,7 @@ static void _get_fds(int *master, int *slave) {
 
 static void _spawn_child(struct child *child, const char **argv, const char **envp) {
 	pid_t pid;
+	sigset_t mask;
 	int fd_master, fd_slave;
 	uvec2_t r_dim;
 	// Get FD pair
@@ -81,6 +99,9 @@ static void _spawn_child(struct child *child, const char **argv, const char **en
 		die_err("fork()");
 	}
 	if (pid == 0) {
+		// Signals blocked for the event loop (see loop_new()) are not the child's business
+		sigemptyset(&mask);
+		sigprocmask(SIG_SETMASK, &mask, NULL);
 		close(fd_master);
 		setsid();
 		if (ioctl(fd_slave, TIOCSCTTY, NULL) < 0) {
@@ -94,48 +115,257 @@ static void _spawn_child(struct child *child, const char **argv, const char **en
 		exit(0);
 	}
 	close(fd_slave);
+	if (fcntl(fd_master, F_SETFL, fcntl(fd_master, F_GETFL) | O_NONBLOCK) < 0) {
+		die_err("fcntl()");
+	}
 	child->pid = pid;
 	child->fd = fd_master;
 }
 
 
+// Make room for n more bytes in b. Bytes already written are dropped once room runs out
+static void _buf_reserve(struct child_buf *b, size_t n) {
+	char *tmp;
+	if (b->len + n > b->cap && b->off > 0) {
+		memmove(b->data, b->data + b->off, b->len - b->off);
+		b->len -= b->off;
+		b->off = 0;
+	}
+	if (b->len + n <= b->cap) {
+		return;
+	}
+	for (b->cap = b->cap ? b->cap : 256; b->cap < b->len + n; b->cap *= 2);
+	if (!(tmp = realloc(b->data, b->cap))) {
+		die_err("realloc()");
+	}
+	b->data = tmp;
+}
+
+
+// Append n bytes of s to b
+static void _buf_append(struct child_buf *b, const char *s, size_t n) {
+	_buf_reserve(b, n);
+	memcpy(b->data + b->len, s, n);
+	b->len += n;
+}
+
+
+// Is there input queued?
+static bool _queued(struct child *child) {
+	bool ret;
+	pthread_mutex_lock(&child->queue_mut);
+	ret = child->queue.off < child->queue.len;
+	pthread_mutex_unlock(&child->queue_mut);
+	return ret;
+}
+
+
+// Write a piece of the input queued, as much of it as the child takes without blocking
+static void _write_queued(struct child *child) {
+	struct child_buf *q = &child->queue;
+	ssize_t ret;
+	pthread_mutex_lock(&child->queue_mut);
+	if (q->off < q->len) {
+		ret = write(child->fd, q->data + q->off,
+				q->len - q->off < CHILD_WRITE_MAX ? q->len - q->off : CHILD_WRITE_MAX);
+		if (ret > 0) {
+			q->off += ret;
+			probe_write(ret);
+		} else if (ret < 0 && errno != EAGAIN && errno != EINTR) {
+			// Child has closed. Its input goes nowhere
+			q->off = q->len;
+		}
+	}
+	if (q->off == q->len) {
+		q->off = q->len = 0;
+	}
+	pthread_mutex_unlock(&child->queue_mut);
+}
+
+
 #define WBUFSIZ (BUFSIZ >> 2)
 
+// Size of the ring output is read into. The pty is drained into it quickly, so that the child
+// seldom blocks on writing, while the parser catches up
+#define CHILD_RING_SIZE (4 << 20)
+
+
+// Stop waiting on the pty once the child has closed it. It may stay hung up until the child is
+// shut down, so it is disabled after one more event rather than removed
+static void _close_pty(struct child *child) {
+	child->hung_up = true;
+	if (child->pty_watch) {
+		loop_mod_fd(child->pty_watch, EPOLLONESHOT);
+	}
+	if (child->window) {
+		window_set_should_close(child->window);
+	}
+}
+
+
+// Wait on the pty for output while there is room for it in the ring, and for room for input
+// while any is queued
+static void _watch_pty(struct child *child) {
+	if (child->hung_up) {
+		return;
+	}
+	loop_mod_fd(child->pty_watch, (__atomic_load_n(&child->paused, __ATOMIC_ACQUIRE) ? 0 : EPOLLIN)
+			| (_queued(child) ? EPOLLOUT : 0));
+}
+
 
-static void* _reader_thread(void *arg) {
-	uint32_t cp;
-	struct child *child = (struct child*) arg;
-	struct esc_seq esc = { 0 };
-	bool in_num = false;
-	unsigned param = 0;
-	char *buf;
-	wchar_t *wbuf;
-	size_t buflen = 0, wbuflen = 0, cvtret, i;
+// Stop reading, the ring being full, until the parser makes room. Returns false if it already
+// has. The parser's wake can come late, once the ring was filled again, so room is checked
+// for again once woken, and reading stops anew if there is none
+static bool _pause(struct child *child) {
+	char *p;
+	__atomic_store_n(&child->paused, true, __ATOMIC_SEQ_CST);
+	return ring_write_space(child->ring, &p) == 0
+		|| !__atomic_exchange_n(&child->paused, false, __ATOMIC_SEQ_CST);
+}
+
+
+// Called back when the pty has output, or room for input. Output is read straight into the
+// ring, for the parser to pick up. Once the ring is full, reading stops until the parser makes
+// room, and the child is left blocked on the pty
+static void _pty_cb(struct loop_watch *watch, uint32_t events, void *data) {
+	struct child *child = data;
 	ssize_t ret;
-	mbstate_t ps;
+	size_t space;
+	char *p;
+	if (child->hung_up) {
+		return;
+	}
+	if (events & EPOLLOUT) {
+		_write_queued(child);
+		_watch_pty(child);
+	}
+	if (!(events & (EPOLLIN | EPOLLHUP | EPOLLERR))) {
+		return;
+	}
+	if ((space = ring_write_space(child->ring, &p)) == 0) {
+		if (_pause(child)) {
+			_watch_pty(child);
+		}
+		return;
+	}
+	// A single read per call, so that sessions take turns
+	if ((ret = read(child->fd, p, space)) <= 0) {
+		if (ret < 0 && (errno == EAGAIN || errno == EINTR)) {
+			return;
+		}
+		// Child has closed
+		_close_pty(child);
+		return;
+	}
+	probe_read(ret);
+	ring_produce(child->ring, ret);
+	loop_wake(child->parse_watch);
+	if (ret == space && _pause(child)) {
+		_watch_pty(child);
+	}
+}
 
-	// Allocate buffers
-	if (!(buf = malloc(BUFSIZ))) {
-		die_err("malloc()");
+
+// Start reading output into the ring, unless a read is in flight, or reading has stopped until
+// the parser makes room (io_uring)
+static void _start_read(struct child *child) {
+	size_t space;
+	char *p;
+	if (child->hung_up || child->reading || __atomic_load_n(&child->paused, __ATOMIC_ACQUIRE)) {
+		return;
 	}
-	// TODO: Ensure size of wchar_t == 4
-	if (!(wbuf = malloc(WBUFSIZ * sizeof(wchar_t)))) {
-		die_err("malloc()");
+	if ((space = ring_write_space(child->ring, &p)) == 0) {
+		if (_pause(child)) {
+			return;
+		}
+		space = ring_write_space(child->ring, &p);
 	}
+	child->reading = true;
+	loop_read(child->io_watch, p, space);
+}
 
-	while (1) {
-		// Read into buffer
-		if ((ret = read(child->fd, &buf[buflen], BUFSIZ - buflen)) < 0) {
-			// Child has closed
-			break;
+
+// Start writing input queued, unless writes are in flight (io_uring). The queue is taken whole,
+// so that the window thread can go on queueing, and written in linked pieces, all submitted
+// at once
+static void _start_write(struct child *child) {
+	struct child_buf *b = &child->writing, tmp;
+	size_t off, n;
+	unsigned i;
+	if (child->writes > 0) {
+		return;
+	}
+	if (b->off == b->len) {
+		b->off = b->len = 0;
+		pthread_mutex_lock(&child->queue_mut);
+		if (child->queue.off < child->queue.len) {
+			tmp = *b;
+			*b = child->queue;
+			child->queue = tmp;
 		}
-		buflen += ret;
+		pthread_mutex_unlock(&child->queue_mut);
+	}
+	for (off = b->off, i = 0; off < b->len && i < CHILD_WRITE_LINKS; off += n, i++) {
+		n = b->len - off < CHILD_WRITE_MAX ? b->len - off : CHILD_WRITE_MAX;
+		loop_write(child->io_watch, b->data + off, n,
+				off + n < b->len && i + 1 < CHILD_WRITE_LINKS);
+		child->writes++;
+	}
+}
+
 
+// Called back when a read or write through io_uring is done. Output is read straight into the
+// ring, as with _pty_cb(). Once the writes started are done, or one of them fell short, the
+// rest of the input is written
+static void _io_cb(struct loop_watch *watch, enum loop_op op, int res, void *data) {
+	struct child *child = data;
+	if (op == LOOP_WRITE) {
+		child->writes--;
+		if (res > 0) {
+			child->writing.off += res;
+			probe_write(res);
+		} else if (res != -ECANCELED && res != -EAGAIN && res != -EINTR) {
+			// Child has closed. Its input goes nowhere
+			child->writing.off = child->writing.len;
+		}
+		if (child->writes == 0) {
+			_start_write(child);
+		}
+		return;
+	}
+	child->reading = false;
+	if (res == -EAGAIN || res == -EINTR || res == -ECANCELED) {
+		_start_read(child);
+		return;
+	}
+	if (res <= 0) {
+		// Child has closed
+		_close_pty(child);
+		return;
+	}
+	probe_read(res);
+	ring_produce(child->ring, res);
+	loop_wake(child->parse_watch);
+	_start_read(child);
+}
+
+
+// Called back on the parser loop once output has been read. Output is converted and passed to
+// the renderer as it lies in the ring, and given back to the reader
+static void _parse_cb(struct loop_watch *watch, uint32_t events, void *data) {
+	struct child *child = data;
+	wchar_t *wbuf = child->wbuf;
+	const char *buf;
+	size_t buflen, cvtret, i, n;
+	mbstate_t ps;
+
+	while ((buflen = ring_read_space(child->ring, &buf)) > 0) {
 		// Convert to wchar_t string
 		i = 0;
 		memset(&ps, 0, sizeof(ps));
-		while (wbuflen < WBUFSIZ) {
-			cvtret = mbrtowc(&wbuf[wbuflen], &buf[i], buflen - i, &ps);
+		while (child->wbuflen < WBUFSIZ) {
+			cvtret = mbrtowc(&wbuf[child->wbuflen], &buf[i], buflen - i, &ps);
 			if (cvtret == (size_t) -2) {
 				// Incomplete. Break, send what we have to renderer
 				break;
@@ -147,52 +377,77 @@ static void* _reader_thread(void *arg) {
 				memset(&ps, 0, sizeof(ps));
 				continue;
 			}
-			i += cvtret;
-			wbuflen++;
+			// A NUL byte converts to 0, but is still a byte
+			i += cvtret ? cvtret : 1;
+			child->wbuflen++;
 		}
 
-		// Move read buffer
-		if (i > 0 && i < buflen) {
-			memcpy(buf, buf + i, buflen - i);
-			buflen -= i;
-		} else if (i > 0) {
-			buflen = 0;
+		// Give converted bytes back, and let the reader go on if it stopped for room
+		probe_match(buf, i);
+		ring_consume(child->ring, i);
+		if (i > 0 && __atomic_exchange_n(&child->paused, false, __ATOMIC_SEQ_CST)) {
+			loop_wake(child->wake_watch);
 		}
 
 		// Send to renderer
 		// TODO: Check size of wchar_t
-		i = renderer_add_codepoints(child->renderer, (uint32_t*) wbuf, wbuflen);
+		n = renderer_add_codepoints(child->renderer, (uint32_t*) wbuf, child->wbuflen);
 
 		// Denote that renderer should render
 		renderer_render(child->renderer);
 
 		// Move wchar_t buffer indices
 		// TODO: Check size of wchar_t
-		if (i > 0 && i < wbuflen) {
-			memcpy(wbuf, &wbuf[i], (wbuflen - i) * sizeof(wchar_t));
-			wbuflen = i;
-		} else if (i > 0) {
-			wbuflen = 0;
+		if (n > 0 && n < child->wbuflen) {
+			memmove(wbuf, &wbuf[n], (child->wbuflen - n) * sizeof(wchar_t));
+			child->wbuflen -= n;
+		} else if (n > 0) {
+			child->wbuflen = 0;
+		}
+
+		// Only the start of a sequence is left, or the renderer takes no more yet
+		if (i == 0) {
+			break;
 		}
 	}
+}
+
 
-out:
-	free(buf);
-	free(wbuf);
+// Called back when input has been queued, or when the parser has made room for output
+static void _wake_cb(struct loop_watch *watch, uint32_t events, void *data) {
+	struct child *child = data;
+	if (child->io_watch) {
+		_start_write(child);
+		_start_read(child);
+		return;
+	}
+	_write_queued(child);
+	_watch_pty(child);
+}
+
+
+// Called back when the child has exited
+static void _exit_cb(struct loop_watch *watch, uint32_t status, void *data) {
+	struct child *child = data;
+	child->exited = true;
 	if (child->window) {
 		window_set_should_close(child->window);
 	}
-
-	return NULL;
 }
 
 
 // Initialize new child
-struct child* child_new(const char **argv, const char **envp, struct renderer *r, struct window *w) {
+struct child* child_new(const char **argv, const char **envp, struct loop *io,
+		struct loop *parser, struct renderer *r, struct window *w) {
 	struct child *child;
+	size_t n;
+	char *p;
 	if (!argv || !*argv) {
 		die("NULL argv");
 	}
+	if (!io || !parser) {
+		die("NULL loop");
+	}
 	if (!r) {
 		die("NULL renderer");
 	}
@@ -203,14 +458,29 @@ struct child* child_new(const char **argv, const char **envp, struct renderer *r
 	if (!(child = calloc(1, sizeof(struct child)))) {
 		die_err("calloc()");
 	}
+	// Allocate buffers
+	child->ring = ring_new(CHILD_RING_SIZE);
+	// TODO: Ensure size of wchar_t == 4
+	if (!(child->wbuf = malloc(WBUFSIZ * sizeof(wchar_t)))) {
+		die_err("malloc()");
+	}
+	pthread_mutex_init(&child->queue_mut, NULL);
 	// Set pointers
 	child->renderer = r;
 	child->window = w;
 	// Get FD and spawn chid
 	_spawn_child(child, argv, envp);
-	// Start reader thread
-	if (pthread_create(&child->tid, NULL, _reader_thread, (void*) child)) {
-		die_err("pthread_create()");
+	// Wait on it
+	child->parse_watch = loop_add_wake(parser, _parse_cb, child);
+	child->wake_watch = loop_add_wake(io, _wake_cb, child);
+	child->exit_watch = loop_add_child(io, child->pid, _exit_cb, child);
+	if ((child->io_watch = loop_add_io(io, child->fd, _io_cb, child))) {
+		ring_memory(child->ring, &p, &n);
+		loop_io_buffer(child->io_watch, p, n);
+		// The first read is started on the I/O loop
+		loop_wake(child->wake_watch);
+	} else {
+		child->pty_watch = loop_add_fd(io, child->fd, EPOLLIN, _pty_cb, child);
 	}
 	return child;
 }
@@ -222,31 +492,102 @@ void child_fini(struct child *child) {
 		warn("NULL child");
 		return;
 	}
-	kill(child->pid, SIGKILL);
-	waitpid(child->pid, NULL, 0);
-	pthread_join(child->tid, NULL);
+	// Once the watches are removed, the event loop is done with the child, and reads and writes
+	// in flight are cancelled
+	loop_del(child->io_watch);
+	loop_del(child->pty_watch);
+	loop_del(child->wake_watch);
+	loop_del(child->exit_watch);
+	loop_del(child->parse_watch);
+	if (!child->exited) {
+		kill(child->pid, SIGKILL);
+		waitpid(child->pid, NULL, 0);
+	}
 	close(child->fd);
+	pthread_mutex_destroy(&child->queue_mut);
+	ring_free(child->ring);
+	free(child->wbuf);
+	free(child->pending.data);
+	free(child->queue.data);
+	free(child->writing.data);
 	free(child);
 }
 
 
-// Write codepoints to child
+// Queue input gathered since the last call, to be written in one go
+void child_flush(struct child *child) {
+	struct child_buf tmp;
+	if (!child) {
+		die("NULL child");
+	}
+	if (child->pending.len == 0) {
+		return;
+	}
+	pthread_mutex_lock(&child->queue_mut);
+	if (child->queue.len - child->queue.off + child->pending.len > CHILD_QUEUE_MAX) {
+		warn("Input queue full. Dropping input");
+	} else if (child->queue.off == child->queue.len) {
+		// Nothing is queued. Large pastes are handed over without being copied
+		tmp = child->queue;
+		child->queue = child->pending;
+		child->pending = tmp;
+	} else {
+		_buf_append(&child->queue, child->pending.data, child->pending.len);
+	}
+	pthread_mutex_unlock(&child->queue_mut);
+	child->pending.off = child->pending.len = 0;
+	loop_wake(child->wake_watch);
+}
+
+
+// Write codepoints to child. They are gathered with the rest of the input of this turn of
+// window events (see child_flush())
 static void _write_cps_to_child(struct child *child, wchar_t *cps) {
-	char tmp[128];
-	size_t tmplen = 0, i = 0;
-	ssize_t ret;
-	// Write codepoint to multibyte string
+	struct child_buf *b = &child->pending;
+	size_t start = b->len;
 	// TODO: Check size of wchar_t
-	if ((tmplen = wcstombs(tmp, cps, sizeof(tmp))) == (size_t) -1) {
+	for ( ; *cps; cps++) {
+		_buf_reserve(b, UTF8_MAX);
+		b->len += utf8_encode(*cps, b->data + b->len);
+	}
+	probe_input(b->data + start, b->len - start);
+}
+
+
+// Paste text (UTF-8). Line breaks are sent as carriage returns, as if typed. If the
+// application asked for pastes to be bracketed, the paste is put between markers, and escape
+// characters are dropped so that it can't end early
+void child_paste(struct child *child, const char *text) {
+	struct child_buf *b = &child->pending;
+	bool bracketed;
+	size_t n, start = b->len;
+	if (!child) {
+		die("NULL child");
+	}
+	if (!text || (n = strlen(text)) == 0) {
 		return;
 	}
-	// Write
-	while (i < tmplen) {
-		if ((ret = write(child->fd, tmp + i, tmplen - i)) < 0) {
-			die_err("write()");
+	if (n > CHILD_QUEUE_MAX) {
+		warn("Paste too large. Dropping it");
+		return;
+	}
+	if ((bracketed = renderer_bracketed_paste(child->renderer))) {
+		_buf_append(b, CHILD_PASTE_START, sizeof(CHILD_PASTE_START) - 1);
+	}
+	_buf_reserve(b, n + sizeof(CHILD_PASTE_END) - 1);
+	for ( ; *text; text++) {
+		if (*text == '\r' && text[1] == '\n') {
+			continue;
+		} else if (*text == '\n') {
+			b->data[b->len++] = '\r';
+		} else if (*text != 27 || !bracketed) {
+			b->data[b->len++] = *text;
 		}
-		i += ret;
 	}
+	if (bracketed) {
+		_buf_append(b, CHILD_PASTE_END, sizeof(CHILD_PASTE_END) - 1);
+	}
+	probe_input(b->data + start, b->len - start);
 }
 
 
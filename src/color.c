@@ -60,13 +60,58 @@ bool color_parse(struct color *color, const char *s) {
 }
 
 
+// Parse 1 to 4 hex chars of X11 color component into uint8_t, scaling to 8 bits. Store
+// pointer to the character after the component in end. Return false on error
+static bool parse_x11_component(const char *s, const char **end, uint8_t *val) {
+	unsigned i, v = 0, c;
+	for (i = 0; i < 4 && (c = parse_hex_char(s[i])) != 0xff; i++) {
+		v = (v << 4) | c;
+	}
+	if (i == 0) {
+		return false;
+	}
+	*val = v * 255 / ((1 << (4 * i)) - 1);
+	*end = &s[i];
+	return true;
+}
+
+
+// Parse color from X11 specification ("rgb:r/g/b") or HTML specification ("#rrggbbaa")
+bool color_parse_x11(struct color *color, const char *s) {
+	uint8_t c1, c2, c3;
+	if (!color || !s) {
+		die("NULL src or dest");
+	}
+	if (*s == '#') {
+		return color_parse(color, s);
+	}
+	if (strncmp(s, "rgb:", 4)) {
+		return false;
+	}
+	if (!parse_x11_component(&s[4], &s, &c1) || *s++ != '/') {
+		return false;
+	}
+	if (!parse_x11_component(s, &s, &c2) || *s++ != '/') {
+		return false;
+	}
+	if (!parse_x11_component(s, &s, &c3) || *s != '\0') {
+		return false;
+	}
+	color->r = c1;
+	color->g = c2;
+	color->b = c3;
+	color->a = 0xff;
+	return true;
+}
+
+
 // Fill vector with normalized (0.0 - 1.0) color values
 void color_normalize(const struct color *color, vec4_t *vec) {
 	if (!color || !vec) {
 		die("NULL src or dest");
 	}
 	vec->x = color->r ? ((float) color->r + 1) / 256.0 : 0.0f;
-	vec->y = color->b ? ((float) color->g + 1) / 256.0 : 0.0f;
+	vec->y = color->g ? ((float) color->g + 1) / 256.0 : 0.0f;
 	vec->z = color->b ? ((float) color->b + 1) / 256.0 : 0.0f;
 	vec->w = color->a ? ((float) color->a + 1) / 256.0 : 0.0f;
 }
@@ -1,14 +1,26 @@
 #include "glad/glad.h"
 
 #include <stdlib.h>
+#include <pthread.h>
 #include <fontconfig/fontconfig.h>
+#include <ft2build.h>
+#include FT_MODULE_H
+#include FT_SYNTHESIS_H
 
 #include "fonts.h"
 
 
+// FT_RENDER_MODE_SDF was added in Freetype 2.11
+#if FREETYPE_MAJOR > 2 || (FREETYPE_MAJOR == 2 && FREETYPE_MINOR >= 11)
+#define FONTS_HAVE_SDF 1
+#else
+#define FONTS_HAVE_SDF 0
+#endif
+
+
 // Get font file from fontconfig
 static char* get_font_file(const char *font_name) {
-	char *ret;
+	char *ret = NULL;
 	FcResult result;
 	FcChar8 *file;
 	FcConfig *config = FcInitLoadConfigAndFonts();
@@ -32,26 +44,131 @@ static char* get_font_file(const char *font_name) {
 }
 
 
-// Load a glyph from a face. Return NULL if not found
-static struct glyph* load_glyph(FT_Face face, uint32_t c) {
+// Glyph caches are keyed by codepoint and style. Glyphs loaded by glyph index (rather than
+// codepoint) have the ID flag set, which is above the Unicode range
+#define _GLYPH_ID_FLAG        0x800000
+#define _GLYPH_KEY(cp, style) ((uint32_t) (cp) | ((uint32_t) (style) << 24))
+#define _GLYPH_CP(key)        ((key) & 0xffffff)
+#define _GLYPH_STYLE(key)     ((key) >> 24)
+
+
+#define FONTS_MIN_SZ 4
+#define FONTS_MAX_SZ 256
+
+// Pixel size SDF glyphs are rasterized at, and distance (in pixels of that size) covered by
+// the field around the outline. Together they bound the size of a glyph's bitmap
+#define FONTS_SDF_PX     32
+#define FONTS_SDF_SPREAD 4
+
+
+// A loaded font size, with its own glyph cache
+struct fontsz {
+	unsigned     px;          // Pixel size
+	struct htu32 *glyphs;     // Hash table mapping codepoint to glyph
+	bool         shared;      // Are glyphs shared with other sizes (SDF mode)?
+	float        glyph_scale; // Scale from glyph bitmap size to pixel size
+	uvec2_t      advance;     // Advance to the next glyph
+	unsigned     line_height; // Distance from top of glyphs to base
+};
+
+
+// Glyph rasterized by a job, waiting for its texture to be created
+struct raster {
+	struct glyph *glyph;  // Glyph (owned by the size's glyph cache)
+	uint8_t      *bitmap; // Bitmap (size.x * size.y bytes)
+};
+
+
+// Background job rasterizing a new font size
+struct fontjob {
+	pthread_t     tid;       // Worker thread
+	unsigned      px;        // Pixel size to rasterize
+	bool          sdf;       // Rasterize signed distance fields?
+	const char    *files[FONTS_N_STYLES]; // Font files of styles (not owned, NULL if not loaded)
+	unsigned      synth[FONTS_N_STYLES];  // Styles to synthesize
+	uint32_t      *cps;      // Codepoints to rasterize
+	size_t        n_cps;     // Number of codepoints
+	struct fontsz *sz;       // Resulting size
+	struct raster *rasters;  // Rasterized glyphs, one per codepoint
+	size_t        n_rasters; // Number of rasterized glyphs
+	bool          done;      // Has the worker finished?
+};
+
+
+// Set spread of SDF renderers for library
+static void _set_sdf_spread(FT_Library lib) {
+#if FONTS_HAVE_SDF
+	FT_Int spread = FONTS_SDF_SPREAD;
+	FT_Property_Set(lib, "sdf", "spread", &spread);
+	FT_Property_Set(lib, "bsdf", "spread", &spread);
+#endif
+}
+
+
+// Load a glyph from a face, without creating its texture. c is a codepoint, or a glyph index
+// with _GLYPH_ID_FLAG set. If bitmap is not NULL, it is set to a copy of the glyph bitmap.
+// If sdf is true, the bitmap is a signed distance field. synth is a mask of styles (bold,
+// italic) to synthesize. Return NULL if not found
+static struct glyph* _load_glyph_metrics(FT_Face face, uint32_t c, bool sdf, unsigned synth,
+		uint8_t **bitmap) {
 	struct glyph *glyph;
-	unsigned glyph_idx;
+	unsigned glyph_idx, row;
+	const FT_Bitmap *bm;
+	FT_Render_Mode mode = FT_RENDER_MODE_NORMAL;
 
-	if (!(glyph_idx = FT_Get_Char_Index(face, c))) {
+	if (c & _GLYPH_ID_FLAG) {
+		glyph_idx = c & ~_GLYPH_ID_FLAG;
+	} else if (!(glyph_idx = FT_Get_Char_Index(face, c))) {
 		return NULL;
 	}
-	if (FT_Load_Glyph(face, glyph_idx, FT_LOAD_RENDER)) {
+#if FONTS_HAVE_SDF
+	if (sdf) {
+		mode = FT_RENDER_MODE_SDF;
+	}
+#endif
+	if (mode != FT_RENDER_MODE_NORMAL || synth) {
+		// Render separately, after the outline is transformed
+		if (FT_Load_Glyph(face, glyph_idx, FT_LOAD_DEFAULT)) {
+			return NULL;
+		}
+		if (synth & FONTS_STYLE_BOLD) {
+			FT_GlyphSlot_Embolden(face->glyph);
+		}
+		if (synth & FONTS_STYLE_ITALIC) {
+			FT_GlyphSlot_Oblique(face->glyph);
+		}
+		if (FT_Render_Glyph(face->glyph, mode)) {
+			return NULL;
+		}
+	} else if (FT_Load_Glyph(face, glyph_idx, FT_LOAD_RENDER)) {
 		return NULL;
 	}
 	// Allocate glyph and store character data
-	if (!(glyph = malloc(sizeof(struct glyph)))) {
-		die_err("malloc()");
+	if (!(glyph = calloc(1, sizeof(struct glyph)))) {
+		die_err("calloc()");
 	}
-	glyph->size.x = face->glyph->bitmap.width;
-	glyph->size.y = face->glyph->bitmap.rows;
+	bm = &face->glyph->bitmap;
+	glyph->size.x = bm->width;
+	glyph->size.y = bm->rows;
 	glyph->bearing.x = face->glyph->bitmap_left;
 	glyph->bearing.y = face->glyph->bitmap_top;
 	glyph->advance_x = face->glyph->advance.x;
+	if (!bitmap) {
+		return glyph;
+	}
+	// Copy bitmap, dropping row padding
+	if (!(*bitmap = malloc(bm->width * bm->rows + 1))) {
+		die_err("malloc()");
+	}
+	for (row = 0; row < bm->rows; row++) {
+		memcpy(*bitmap + row * bm->width, bm->buffer + row * bm->pitch, bm->width);
+	}
+	return glyph;
+}
+
+
+// Create texture for glyph from bitmap
+static void _upload_glyph(struct glyph *glyph, const uint8_t *bitmap) {
 	// Generate texture atlas
 	glGenTextures(1, &glyph->tex);
 	glBindTexture(GL_TEXTURE_2D, glyph->tex);
@@ -62,124 +179,605 @@ static struct glyph* load_glyph(FT_Face face, uint32_t c) {
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 	// Update texture data
 	glTexImage2D(GL_TEXTURE_2D, 0, GL_RED, glyph->size.x, glyph->size.y, 0, GL_RED,
-			GL_UNSIGNED_BYTE, face->glyph->bitmap.buffer);
-	// Return
+			GL_UNSIGNED_BYTE, bitmap);
+}
+
+
+// Load a glyph from a face and create its texture. Return NULL if not found
+static struct glyph* load_glyph(FT_Face face, uint32_t c, bool sdf, unsigned synth) {
+	struct glyph *glyph;
+	uint8_t *bitmap;
+	if (!(glyph = _load_glyph_metrics(face, c, sdf, synth, &bitmap))) {
+		return NULL;
+	}
+	_upload_glyph(glyph, bitmap);
+	free(bitmap);
 	return glyph;
 }
 
 
-// Initialize font-loading subsystem
-struct fonts* fonts_new(const char *default_font, unsigned font_sz) {
+// Free a glyph
+static void _glyph_free(struct glyph *glyph) {
+	if (!glyph) {
+		return;
+	}
+	glDeleteTextures(1, &glyph->tex);
+	free(glyph);
+}
+
+
+// Free a font size and its glyphs
+static void _fontsz_free(struct fontsz *sz) {
+	if (!sz->shared) {
+		htu32_free(sz->glyphs, (free_cb_t) _glyph_free);
+	}
+	free(sz);
+}
+
+
+// Compute metrics of font size from its ASCII glyphs
+static void _fontsz_compute_metrics(struct fontsz *sz) {
+	const struct glyph *glyph;
+	unsigned c, line_ht = 0, line_sp = 0;
+	sz->advance.x = 0;
+	for (c = 32; c < 127; c++) {
+		if (!(glyph = htu32_get(sz->glyphs, c, NULL))) {
+			continue;
+		}
+		// Update advance and line height
+		if (glyph->advance_x > 0 && glyph->advance_x > sz->advance.x) {
+			sz->advance.x = glyph->advance_x;
+		}
+		if (glyph->bearing.y > 0 && glyph->bearing.y > line_ht) {
+			line_ht = glyph->bearing.y;
+		}
+		if (line_sp + glyph->bearing.y < glyph->size.y) {
+			line_sp = glyph->size.y - glyph->bearing.y;
+		}
+	}
+	// Compute metrics
+	sz->advance.x >>= 6;
+	sz->advance.y = line_ht + line_sp;
+	if (sz->advance.x < 1) {
+		sz->advance.x = 1;
+	}
+	if (sz->advance.y < 1) {
+		sz->advance.y = 1;
+	}
+	sz->line_height = line_ht;
+}
+
+
+// Compute metrics of font size from outline metrics of its ASCII glyphs, without
+// rasterizing. Used for SDF sizes, whose glyph bitmaps are padded and scaled
+static void _fontsz_compute_outline_metrics(struct fontsz *sz, FT_Face face) {
+	const FT_Glyph_Metrics *m;
+	unsigned c, glyph_idx;
+	long adv = 0, line_ht = 0, line_sp = 0;
+	if (FT_Set_Pixel_Sizes(face, 0, sz->px)) {
+		die("Could not set pixel size");
+	}
+	for (c = 32; c < 127; c++) {
+		if (!(glyph_idx = FT_Get_Char_Index(face, c))) {
+			continue;
+		}
+		if (FT_Load_Glyph(face, glyph_idx, FT_LOAD_DEFAULT)) {
+			continue;
+		}
+		m = &face->glyph->metrics;
+		if (face->glyph->advance.x > adv) {
+			adv = face->glyph->advance.x;
+		}
+		if (m->horiBearingY > line_ht) {
+			line_ht = m->horiBearingY;
+		}
+		if (m->height - m->horiBearingY > line_sp) {
+			line_sp = m->height - m->horiBearingY;
+		}
+	}
+	// Metrics are in 26.6 fixed point
+	sz->advance.x = (adv + 63) >> 6;
+	sz->line_height = (line_ht + 63) >> 6;
+	sz->advance.y = sz->line_height + ((line_sp + 63) >> 6);
+	if (sz->advance.x < 1) {
+		sz->advance.x = 1;
+	}
+	if (sz->advance.y < 1) {
+		sz->advance.y = 1;
+	}
+	sz->glyph_scale = (float) sz->px / FONTS_SDF_PX;
+}
+
+
+// Rasterize the job's codepoints into a new size. Uses its own Freetype library handle,
+// since Freetype faces cannot be shared between threads
+static void _job_rasterize(struct fontjob *job) {
+	FT_Library lib;
+	FT_Face faces[FONTS_N_STYLES] = { 0 };
+	struct glyph *glyph;
+	uint8_t *bitmap;
+	unsigned style;
+	uint32_t cp;
+	size_t i;
+
+	if (!(job->sz = calloc(1, sizeof(struct fontsz)))) {
+		die_err("calloc()");
+	}
+	if (!(job->rasters = calloc(job->n_cps, sizeof(struct raster)))) {
+		die_err("calloc()");
+	}
+	job->sz->px = job->px;
+	job->sz->glyphs = htu32_new();
+	job->sz->glyph_scale = 1.0f;
+	if (FT_Init_FreeType(&lib)) {
+		die("Could not initialize the Freetype2 library");
+	}
+	_set_sdf_spread(lib);
+	for (style = 0; style < FONTS_N_STYLES; style++) {
+		if (!job->files[style]) {
+			continue;
+		}
+		if (FT_New_Face(lib, job->files[style], 0, &faces[style])) {
+			die_fmt("Could not load Freetype2 face for file: %s", job->files[style]);
+		}
+		if (FT_Set_Pixel_Sizes(faces[style], 0, job->px)) {
+			die("Could not set pixel size");
+		}
+	}
+	for (i = 0; i < job->n_cps; i++) {
+		// Styled glyphs fall back to the regular face, like in fonts_get_glyph(). Glyph
+		// indices only have meaning in the face they came from (see fonts_get_face())
+		cp = _GLYPH_CP(job->cps[i]);
+		style = _GLYPH_STYLE(job->cps[i]);
+		glyph = NULL;
+		if (style != FONTS_STYLE_REGULAR && faces[style]) {
+			glyph = _load_glyph_metrics(faces[style], cp, job->sdf, job->synth[style], &bitmap);
+			if (!glyph && (cp & _GLYPH_ID_FLAG)) {
+				continue;
+			}
+		}
+		if (!glyph && !(glyph = _load_glyph_metrics(faces[0], cp, job->sdf, 0, &bitmap))) {
+			continue;
+		}
+		if (htu32_set(job->sz->glyphs, job->cps[i], glyph) != HTRES_OK) {
+			free(bitmap);
+			free(glyph);
+			continue;
+		}
+		job->rasters[job->n_rasters].glyph = glyph;
+		job->rasters[job->n_rasters].bitmap = bitmap;
+		job->n_rasters++;
+	}
+	for (style = 0; style < FONTS_N_STYLES; style++) {
+		if (faces[style]) {
+			FT_Done_Face(faces[style]);
+		}
+	}
+	FT_Done_FreeType(lib);
+	_fontsz_compute_metrics(job->sz);
+}
+
+
+// Worker thread for rasterization jobs
+static void* _job_thread(void *arg) {
+	struct fontjob *job = (struct fontjob*) arg;
+	_job_rasterize(job);
+	__atomic_store_n(&job->done, true, __ATOMIC_RELEASE);
+	return NULL;
+}
+
+
+// Add codepoint and style of loaded glyph to job
+static void _job_add_cp(uint32_t k, void *v, void *arg) {
+	struct fontjob *job = (struct fontjob*) arg;
+	if (v && (k < 32 || k >= 127)) {
+		job->cps[job->n_cps++] = k;
+	}
+}
+
+
+// Create a job for rasterizing ASCII, and every glyph loaded at the current size
+static struct fontjob* _job_new(struct fonts *fonts, unsigned px) {
+	struct fontjob *job;
+	uint32_t c;
+	if (!(job = calloc(1, sizeof(struct fontjob)))) {
+		die_err("calloc()");
+	}
+	job->px = px;
+	job->sdf = fonts->sdf;
+	memcpy(job->files, fonts->style_files, sizeof(job->files));
+	memcpy(job->synth, fonts->synth, sizeof(job->synth));
+	job->files[FONTS_STYLE_REGULAR] = fonts->file;
+	if (!(job->cps = calloc(127 - 32 + (fonts->glyphs ? htu32_size(fonts->glyphs) : 0),
+					sizeof(uint32_t)))) {
+		die_err("calloc()");
+	}
+	for (c = 32; c < 127; c++) {
+		job->cps[job->n_cps++] = c;
+	}
+	if (fonts->glyphs) {
+		htu32_foreach(fonts->glyphs, _job_add_cp, job);
+	}
+	return job;
+}
+
+
+// Upload the job's glyphs, and free the job. Return the resulting size
+static struct fontsz* _job_finish(struct fontjob *job) {
+	struct fontsz *sz = job->sz;
+	size_t i;
+	for (i = 0; i < job->n_rasters; i++) {
+		_upload_glyph(job->rasters[i].glyph, job->rasters[i].bitmap);
+		free(job->rasters[i].bitmap);
+	}
+	glBindTexture(GL_TEXTURE_2D, 0);
+	free(job->rasters);
+	free(job->cps);
+	free(job);
+	return sz;
+}
+
+
+// Create a size sharing the SDF glyphs. Only the metrics need to be computed
+static struct fontsz* _sdf_size_new(struct fonts *fonts, unsigned px) {
+	struct fontsz *sz;
+	FT_Face face = fonts->faces->val;
+	unsigned style;
+	if (!(sz = calloc(1, sizeof(struct fontsz)))) {
+		die_err("calloc()");
+	}
+	sz->px = px;
+	sz->glyphs = fonts->sdf_ref->glyphs;
+	sz->shared = true;
+	_fontsz_compute_outline_metrics(sz, face);
+	// Glyphs are loaded at the reference size
+	if (FT_Set_Pixel_Sizes(face, 0, FONTS_SDF_PX)) {
+		die("Could not set pixel size");
+	}
+	for (style = 0; style < FONTS_N_STYLES; style++) {
+		face = fonts->style_faces[style];
+		if (face && FT_Set_Pixel_Sizes(face, 0, FONTS_SDF_PX)) {
+			die("Could not set pixel size");
+		}
+	}
+	return sz;
+}
+
+
+// Make px the size to switch to. Starts a job if it isn't loaded yet
+static void _request_size(struct fonts *fonts, unsigned px) {
+	struct fontsz *sz;
+	enum htres res;
+	if (px < FONTS_MIN_SZ) {
+		px = FONTS_MIN_SZ;
+	} else if (px > FONTS_MAX_SZ) {
+		px = FONTS_MAX_SZ;
+	}
+	fonts->want_sz = px;
+	if (fonts->job) {
+		// Checked again when the job finishes
+		return;
+	}
+	if (px == fonts->font_sz) {
+		fonts->pending = NULL;
+		return;
+	}
+	sz = htu32_get(fonts->sizes, px, &res);
+	if (res == HTRES_OK) {
+		fonts->pending = sz;
+		return;
+	}
+	if (fonts->sdf) {
+		// One rasterization serves all sizes. No job needed
+		fonts->pending = _sdf_size_new(fonts, px);
+		htu32_set(fonts->sizes, px, fonts->pending);
+		return;
+	}
+	fonts->pending = NULL;
+	fonts->job = _job_new(fonts, px);
+	if (pthread_create(&fonts->job->tid, NULL, _job_thread, (void*) fonts->job)) {
+		die_err("pthread_create()");
+	}
+}
+
+
+// Request size for current zoom level and content scale
+static void _request_scaled_size(struct fonts *fonts) {
+	int px = (int) ((fonts->default_sz + fonts->zoom) * fonts->scale + 0.5f);
+	_request_size(fonts, px < FONTS_MIN_SZ ? FONTS_MIN_SZ : px);
+}
+
+
+// Make sz the current size
+static void _set_size(struct fonts *fonts, struct fontsz *sz) {
+	struct list *node;
+	FT_Face face;
+	unsigned style;
+	fonts->cur = sz;
+	fonts->font_sz = sz->px;
+	fonts->glyphs = sz->glyphs;
+	fonts->glyph_scale = sz->glyph_scale;
+	fonts->advance = sz->advance;
+	fonts->line_height = sz->line_height;
+	if (fonts->sdf) {
+		// Glyphs stay at the reference size
+		return;
+	}
+	// Glyphs which aren't loaded yet are loaded at the new size
+	list_foreach(fonts->faces, node, face) {
+		if (FT_Set_Pixel_Sizes(face, 0, sz->px)) {
+			warn_fmt("Could not set pixel size: %u", sz->px);
+		}
+	}
+	for (style = 0; style < FONTS_N_STYLES; style++) {
+		face = fonts->style_faces[style];
+		if (face && FT_Set_Pixel_Sizes(face, 0, sz->px)) {
+			warn_fmt("Could not set pixel size: %u", sz->px);
+		}
+	}
+}
+
+
+// Get face for style, loading it on first use. If the font has no such variant, the regular
+// font is loaded again, and the style is synthesized. Return NULL on failure
+static FT_Face _style_face(struct fonts *fonts, enum fonts_style style) {
+	static const char *props[FONTS_N_STYLES] = {
+		"", ":weight=bold", ":slant=italic", ":weight=bold:slant=italic",
+	};
+	char name[256];
 	char *file;
+	FT_Face face;
+	if (fonts->style_tried[style]) {
+		return fonts->style_faces[style];
+	}
+	fonts->style_tried[style] = true;
+	snprintf(name, sizeof(name), "%s%s", fonts->name, props[style]);
+	if (!(file = get_font_file(name)) && !(file = strdup(fonts->file))) {
+		die_err("strdup()");
+	}
+	if (!strcmp(file, fonts->file)) {
+		fonts->synth[style] = style;
+	}
+	if (FT_New_Face(fonts->ft_lib, file, 0, &face)) {
+		warn_fmt("Could not load Freetype2 face for file: %s", file);
+		free(file);
+		return NULL;
+	}
+	if (FT_Set_Pixel_Sizes(face, 0, fonts->sdf ? FONTS_SDF_PX : fonts->font_sz)) {
+		warn_fmt("Could not set pixel size: %u", fonts->font_sz);
+	}
+	fonts->style_files[style] = file;
+	fonts->style_faces[style] = face;
+	return face;
+}
+
+
+// Initialize font-loading subsystem
+struct fonts* fonts_new(const char *default_font, unsigned font_sz, bool sdf) {
 	struct fonts *fonts;
+	struct fontjob *job;
+	struct fontsz *sz;
 	FT_Face face;
-	unsigned c, glyph_idx, line_ht = 0, line_sp = 0;
-	struct glyph *glyph;
 	// Allocate fonts
 	if (!(fonts = calloc(1, sizeof(struct fonts)))) {
 		die_err("calloc()");
 	}
-	fonts->glyphs = htu32_new();
+	fonts->sizes = htu32_new();
+	fonts->default_sz = font_sz;
+	fonts->scale = 1.0f;
+#if FONTS_HAVE_SDF
+	fonts->sdf = sdf;
+#else
+	if (sdf) {
+		warn("Freetype2 is too old for SDF glyphs. Using bitmaps");
+	}
+#endif
 	// Get font file
 	if (!default_font) {
 		warn("");
 		default_font = "monospace";
 	}
-	if (!(file = get_font_file(default_font))) {
+	if (!(fonts->file = get_font_file(default_font))) {
 		die_fmt("Failed to get font file for font: %s", default_font);
 	}
+	if (!(fonts->name = strdup(default_font))) {
+		die_err("strdup()");
+	}
 	// Initialize Freetype2
 	if (FT_Init_FreeType(&fonts->ft_lib)) {
 		die("Could not initialize the Freetype2 library");
 	}
-	if (FT_New_Face(fonts->ft_lib, file, 0, &face)) {
+	_set_sdf_spread(fonts->ft_lib);
+	if (FT_New_Face(fonts->ft_lib, fonts->file, 0, &face)) {
 		die_fmt("Could not load Freetype2 face for font: %s", default_font);
 	}
-	if (FT_Set_Pixel_Sizes(face, 0, font_sz)) {
-		die("Could not set pixel size");
-	}
 	// Push face to list
 	fonts->faces = list_new(face);
 	// Disable byte alignment restriction
 	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
-	// Load ASCII glyphs
-	for (c = 32; c < 127; c++) {
-		if (!(glyph = load_glyph(face, c))) {
-			warn_fmt("Could not load glyph for codepoint: %u\n", c);
-			continue;
-		}
-		// Update advance and line height
-		if (glyph->advance_x > 0 && glyph->advance_x > fonts->advance.x) {
-			fonts->advance.x = glyph->advance_x;
-		}
-		if (glyph->bearing.y > 0 && glyph->bearing.y > line_ht) {
-			line_ht = glyph->bearing.y;
-		}
-		if (line_sp + glyph->bearing.y < glyph->size.y) {
-			line_sp = glyph->size.y - glyph->bearing.y;
-		}
-		// Store in hash table
-		htu32_set(fonts->glyphs, c, glyph);
+	// Load ASCII glyphs for the initial size. Same as a background job, but synchronous. In
+	// SDF mode, glyphs are loaded once at a reference size, shared by all sizes
+	job = _job_new(fonts, fonts->sdf ? FONTS_SDF_PX : font_sz);
+	_job_rasterize(job);
+	sz = _job_finish(job);
+	if (fonts->sdf) {
+		fonts->sdf_ref = sz;
+		sz = _sdf_size_new(fonts, font_sz);
 	}
-	// Compute metrics
-	fonts->advance.x >>= 6;
-	fonts->advance.y = line_ht + line_sp;
-	if (fonts->advance.x < 1) {
-		fonts->advance.x = 1;
-	}
-	if (fonts->advance.y < 1) {
-		fonts->advance.y = 1;
-	}
-	fonts->line_height = line_ht;
-	// Unbind texture
-	glBindTexture(GL_TEXTURE_2D, 0);
+	htu32_set(fonts->sizes, sz->px, sz);
+	_set_size(fonts, sz);
+	fonts->want_sz = font_sz;
 	// Return font
 	return fonts;
 }
 
 
-// Free a glyph
-static void _glyph_free(struct glyph *glyph) {
-	if (!glyph) {
-		return;
-	}
-	glDeleteTextures(1, &glyph->tex);
-	free(glyph);
-}
-
-
 // Free resources of font-loading subsystem
 void fonts_free(struct fonts *fonts) {
+	struct fontsz *sz;
+	unsigned style;
 	if (!fonts) {
 		warn("NULL fonts");
+		return;
+	}
+	if (fonts->job) {
+		pthread_join(fonts->job->tid, NULL);
+		sz = _job_finish(fonts->job);
+		htu32_set(fonts->sizes, sz->px, sz);
+	}
+	htu32_free(fonts->sizes, (free_cb_t) _fontsz_free);
+	if (fonts->sdf_ref) {
+		_fontsz_free(fonts->sdf_ref);
 	}
-	htu32_free(fonts->glyphs, (free_cb_t) _glyph_free);
 	list_free(fonts->faces, (free_cb_t) FT_Done_Face);
+	for (style = 0; style < FONTS_N_STYLES; style++) {
+		if (fonts->style_faces[style]) {
+			FT_Done_Face(fonts->style_faces[style]);
+		}
+		free(fonts->style_files[style]);
+	}
 	FT_Done_FreeType(fonts->ft_lib);
+	free(fonts->file);
+	free(fonts->name);
 	free(fonts);
 }
 
 
-// Get glyph for codepoint
-const struct glyph* fonts_get_glyph(struct fonts *fonts, uint32_t codepoint) {
+// Get glyph for codepoint in style
+const struct glyph* fonts_get_glyph(struct fonts *fonts, uint32_t codepoint,
+		enum fonts_style style) {
 	struct glyph *glyph;
 	struct list *node;
 	FT_Face face;
 	enum htres res;
+	uint32_t key = _GLYPH_KEY(codepoint, style);
 	if (!fonts) {
 		die("NULL fonts");
 	}
-	glyph = htu32_get(fonts->glyphs, codepoint, &res);
+	glyph = htu32_get(fonts->glyphs, key, &res);
 	if (res == HTRES_OK) {
 		return glyph;
 	}
-	// Look for glyphs in loaded faces
+	// Look for glyph in styled face
+	if (style != FONTS_STYLE_REGULAR && (face = _style_face(fonts, style))) {
+		if ((glyph = load_glyph(face, codepoint, fonts->sdf, fonts->synth[style]))) {
+			htu32_set(fonts->glyphs, key, glyph);
+			return glyph;
+		}
+	}
+	// Look for glyphs in loaded faces. Each style gets its own copy of fallback glyphs
 	list_foreach(fonts->faces, node, face) {
-		if ((glyph = load_glyph(face, codepoint))) {
-			htu32_set(fonts->glyphs, codepoint, glyph);
+		if ((glyph = load_glyph(face, codepoint, fonts->sdf, 0))) {
+			htu32_set(fonts->glyphs, key, glyph);
 			return glyph;
 		}
 	}
 	// TODO: Handle loading glyph
+	// Remember that it is missing, so we don't look for it on every frame
+	warn_fmt("Could not get glyph for codepoint: %u", codepoint);
+	htu32_set(fonts->glyphs, key, NULL);
 	return NULL;
 }
+
+
+// Get face glyphs of style are loaded from
+FT_Face fonts_get_face(struct fonts *fonts, enum fonts_style style) {
+	FT_Face face;
+	if (!fonts) {
+		die("NULL fonts");
+	}
+	if (style != FONTS_STYLE_REGULAR && (face = _style_face(fonts, style))) {
+		return face;
+	}
+	return fonts->faces->val;
+}
+
+
+// Get glyph with index id in the face of style
+const struct glyph* fonts_get_glyph_id(struct fonts *fonts, uint32_t id, enum fonts_style style) {
+	struct glyph *glyph;
+	FT_Face face;
+	enum htres res;
+	uint32_t key = _GLYPH_KEY(id | _GLYPH_ID_FLAG, style);
+	if (!fonts) {
+		die("NULL fonts");
+	}
+	glyph = htu32_get(fonts->glyphs, key, &res);
+	if (res == HTRES_OK) {
+		return glyph;
+	}
+	face = fonts_get_face(fonts, style);
+	glyph = load_glyph(face, id | _GLYPH_ID_FLAG, fonts->sdf,
+			face == fonts->style_faces[style] ? fonts->synth[style] : 0);
+	// Missing glyphs are remembered too
+	htu32_set(fonts->glyphs, key, glyph);
+	return glyph;
+}
+
+
+// Change zoom level by step pixels. A step of 0 resets to the default size
+void fonts_zoom(struct fonts *fonts, int step) {
+	if (!fonts) {
+		die("NULL fonts");
+	}
+	if (step == 0) {
+		fonts->zoom = 0;
+	} else if ((int) fonts->default_sz + fonts->zoom + step >= FONTS_MIN_SZ) {
+		fonts->zoom += step;
+	}
+	_request_scaled_size(fonts);
+}
+
+
+// Set content scale of the window (e.g. when moving between monitors)
+void fonts_set_scale(struct fonts *fonts, float scale) {
+	if (!fonts) {
+		die("NULL fonts");
+	}
+	if (scale <= 0.0f) {
+		return;
+	}
+	fonts->scale = scale;
+	_request_scaled_size(fonts);
+}
+
+
+// Check whether a requested size is ready to be switched to
+bool fonts_size_ready(struct fonts *fonts) {
+	struct fontsz *sz;
+	if (!fonts) {
+		die("NULL fonts");
+	}
+	if (fonts->job && __atomic_load_n(&fonts->job->done, __ATOMIC_ACQUIRE)) {
+		pthread_join(fonts->job->tid, NULL);
+		sz = _job_finish(fonts->job);
+		fonts->job = NULL;
+		htu32_set(fonts->sizes, sz->px, sz);
+		// The wanted size might have changed while the job was running
+		_request_size(fonts, fonts->want_sz);
+	}
+	return fonts->pending != NULL;
+}
+
+
+// Switch to the size made ready by fonts_size_ready()
+bool fonts_apply_size(struct fonts *fonts) {
+	if (!fonts) {
+		die("NULL fonts");
+	}
+	if (!fonts->pending) {
+		return false;
+	}
+	_set_size(fonts, fonts->pending);
+	fonts->pending = NULL;
+	return true;
+}
+
+
+// Is a size being rasterized, or ready to be switched to?
+bool fonts_size_pending(const struct fonts *fonts) {
+	if (!fonts) {
+		die("NULL fonts");
+	}
+	return fonts->job || fonts->pending;
+}
@@ -0,0 +1,174 @@
+#include "grapheme.h"
+
+
+// Collect garbage when the table has grown to twice its size after the last collection, but
+// not before it has this many clusters
+#define GRAPHEME_MIN_COLLECT 64
+
+
+// An interned cluster
+struct grapheme {
+	uint32_t *cps;  // Codepoints (NULL if the slot is free)
+	uint32_t hash;  // Hash of codepoints
+	uint32_t n;     // Number of codepoints
+	uint32_t gen;   // Generation in which the cluster was last marked or created
+};
+
+
+// Table of interned clusters
+struct graphemes {
+	struct grapheme *entries;   // Clusters, indexed by id
+	uint32_t        n_entries;  // Number of slots used in entries (live or free)
+	uint32_t        cap;        // Allocated capacity of entries
+	uint32_t        *free_ids;  // Stack of free slots
+	uint32_t        n_free;     // Number of free slots
+	uint32_t        n_live;     // Number of live clusters
+	uint32_t        collect_at; // Collect garbage when n_live reaches this
+	uint32_t        gen;        // Current generation
+	struct htu32    *index;     // Hash table from hash (linearly probed) to id + 1
+};
+
+
+// Hash codepoints of cluster (FNV-1a)
+static uint32_t _hash_cps(const uint32_t *cps, size_t n) {
+	uint32_t h = 2166136261u;
+	size_t i;
+	for (i = 0; i < n; i++) {
+		h = (h ^ cps[i]) * 16777619u;
+	}
+	return h;
+}
+
+
+// Add cluster with given id to index
+static void _index_add(struct graphemes *g, uint32_t id) {
+	uint32_t k = g->entries[id].hash;
+	while (htu32_set(g->index, k, (void*) (uintptr_t) (id + 1)) != HTRES_OK) {
+		k++;
+	}
+}
+
+
+// Create a new cluster table
+struct graphemes* graphemes_new() {
+	struct graphemes *g;
+	if (!(g = calloc(1, sizeof(struct graphemes)))) {
+		die_err("calloc()");
+	}
+	g->index = htu32_new();
+	g->collect_at = GRAPHEME_MIN_COLLECT;
+	return g;
+}
+
+
+// Free cluster table
+void graphemes_free(struct graphemes *g) {
+	uint32_t i;
+	if (!g) {
+		warn("NULL graphemes");
+		return;
+	}
+	for (i = 0; i < g->n_entries; i++) {
+		free(g->entries[i].cps);
+	}
+	htu32_free(g->index, NULL);
+	free(g->free_ids);
+	free(g->entries);
+	free(g);
+}
+
+
+// Get id of cluster of n codepoints, interning it if it is new
+uint32_t graphemes_intern(struct graphemes *g, const uint32_t *cps, size_t n) {
+	uint32_t hash = _hash_cps(cps, n), k = hash, id;
+	struct grapheme *e;
+	uintptr_t v;
+	if (!g) {
+		die("NULL graphemes");
+	}
+	// Look for an existing cluster
+	while ((v = (uintptr_t) htu32_get(g->index, k, NULL))) {
+		e = &g->entries[v - 1];
+		if (e->hash == hash && e->n == n && !memcmp(e->cps, cps, n * sizeof(uint32_t))) {
+			return v - 1;
+		}
+		k++;
+	}
+	// Add a new one
+	if (g->n_free > 0) {
+		id = g->free_ids[--g->n_free];
+	} else {
+		if (g->n_entries == g->cap) {
+			g->cap = g->cap ? g->cap * 2 : 16;
+			if (!(g->entries = realloc(g->entries, g->cap * sizeof(struct grapheme)))
+					|| !(g->free_ids = realloc(g->free_ids, g->cap * sizeof(uint32_t)))) {
+				die_err("realloc()");
+			}
+		}
+		id = g->n_entries++;
+	}
+	e = &g->entries[id];
+	if (!(e->cps = malloc(n * sizeof(uint32_t)))) {
+		die_err("malloc()");
+	}
+	memcpy(e->cps, cps, n * sizeof(uint32_t));
+	e->hash = hash;
+	e->n = n;
+	e->gen = g->gen;
+	g->n_live++;
+	_index_add(g, id);
+	return id;
+}
+
+
+// Get codepoints of cluster, and set *n to their number
+const uint32_t* graphemes_get(const struct graphemes *g, uint32_t id, size_t *n) {
+	if (!g) {
+		die("NULL graphemes");
+	}
+	if (id >= g->n_entries || !g->entries[id].cps) {
+		*n = 0;
+		return NULL;
+	}
+	*n = g->entries[id].n;
+	return g->entries[id].cps;
+}
+
+
+// Is the table due for garbage collection?
+bool graphemes_should_collect(const struct graphemes *g) {
+	return g->n_live >= g->collect_at;
+}
+
+
+// Mark cluster as still referenced
+void graphemes_mark(struct graphemes *g, uint32_t id) {
+	if (id < g->n_entries) {
+		g->entries[id].gen = g->gen + 1;
+	}
+}
+
+
+// Free clusters that were not marked since the last sweep, and rebuild the index
+void graphemes_sweep(struct graphemes *g) {
+	struct grapheme *e;
+	uint32_t i;
+	g->gen++;
+	htu32_free(g->index, NULL);
+	g->index = htu32_new();
+	for (i = 0; i < g->n_entries; i++) {
+		e = &g->entries[i];
+		if (!e->cps) {
+			continue;
+		}
+		if (e->gen != g->gen) {
+			free(e->cps);
+			e->cps = NULL;
+			g->free_ids[g->n_free++] = i;
+			g->n_live--;
+			continue;
+		}
+		_index_add(g, i);
+	}
+	g->collect_at = g->n_live * 2 > GRAPHEME_MIN_COLLECT ? g->n_live * 2 : GRAPHEME_MIN_COLLECT;
+}
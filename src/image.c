@@ -0,0 +1,920 @@
+#include "glad/glad.h"
+
+#include <stdlib.h>
+
+#include "base64.h"
+#include "image.h"
+
+
+// Longest keys of a kitty graphics command
+#define IMAGE_KEYS_MAX 256
+
+// Characters of payload decoded at a time
+#define IMAGE_CHUNK 1024
+
+// Sixel images are drawn in bands of this many rows
+#define IMAGE_SIXEL_BAND 6
+
+// Number of sixel color registers
+#define IMAGE_SIXEL_COLORS 256
+
+// Most placements kept of an image. Cells of placements dropped past it show nothing
+#define IMAGE_PLACES_MAX 64
+
+
+// An image
+struct image {
+	uint32_t    id;        // Id of the image
+	uint32_t    client_id; // Id the application refers to it by (0 if none)
+	uvec2_t     dim;       // Size in pixels
+	uint8_t     *pixels;   // RGBA pixels, until they are uploaded
+	GLuint      tex;       // Texture (0 until it is uploaded)
+	uint64_t    used;      // When it was last drawn or added (for eviction)
+	struct list *places;   // Its placements, newest first
+	unsigned    n_places;  // Number of them
+};
+
+
+// A placement of an image. An image may be placed several times, each with its own size
+struct image_placement {
+	uint32_t     id;   // Id cells refer to it by
+	struct image *img; // Image placed
+	vec2_t       tile; // Size of a cell, in texture coordinates
+};
+
+
+// Keys of a kitty graphics command
+struct image_cmd {
+	char     action;      // a: t (transmit), T (transmit and display), p (display), d (delete)
+	char     del;         // d: what to delete
+	unsigned format;      // f: 24 (RGB), 32 (RGBA) or 100 (PNG)
+	char     medium;      // t: d (direct) only
+	char     compression; // o: none only
+	uvec2_t  size;        // s, v: size in pixels
+	uint32_t client_id;   // i
+	uvec2_t  cells;       // c, r: columns and rows to display over (0 to fit)
+	bool     more;        // m: are more chunks to follow?
+	bool     no_move;     // C: should the cursor stay where it is?
+};
+
+
+// Image being transmitted with the kitty graphics protocol, possibly over several commands
+struct image_load {
+	bool             active; // Is a transmission under way?
+	bool             bad;    // Is it being dropped?
+	struct image_cmd cmd;    // Keys of its first command
+	uint8_t          *pixels; // RGBA pixels
+	size_t           len;    // Bytes of pixel data (in cmd.format) received
+	struct base64    b64;    // Payload decoder
+};
+
+
+// Sixel image being decoded
+struct image_sixel {
+	bool     in_data;   // Past the parameters (at 'q')?
+	char     cmd;       // Command whose parameters are being read ('#', '!', '"', or 0)
+	unsigned args[5];   // Its parameters
+	unsigned n_args;    // Number of them
+	uint8_t  palette[IMAGE_SIXEL_COLORS][4]; // Color registers (RGBA)
+	unsigned color;     // Color register selected
+	uvec2_t  pos;       // Position of the next sixel (top of its band)
+	unsigned repeat;    // Number of times to repeat the next sixel
+	uvec2_t  size;      // Size given by raster attributes (0 if none)
+	uvec2_t  ext;       // Extent of the pixels drawn
+	uvec2_t  dim;       // Size of the staging buffer
+	uint8_t  *pixels;   // Staging buffer (RGBA)
+};
+
+
+struct images {
+	struct htu32       *images;  // Images by id
+	struct htu32       *clients; // Images by client id
+	struct htu32       *places;  // Placements by id
+	size_t             bytes;    // Bytes of pixels of images (and staging buffers)
+	size_t             budget;   // Most bytes to take
+	uint32_t           next_id;  // Id of the next image
+	uint32_t           next_place; // Id of the next placement
+	uint64_t           clock;    // Counter for use times
+	// Textures of images evicted, to be deleted on the render thread
+	GLuint             *dead;
+	size_t             n_dead;
+	size_t             dead_cap;
+	// Command being received
+	enum image_proto   proto;    // Its protocol (IMAGE_NONE if it is being dropped)
+	char               keys[IMAGE_KEYS_MAX]; // Keys of a kitty command
+	size_t             n_keys;   // Length of keys
+	bool               in_payload; // Past the keys?
+	struct image_cmd   cmd;      // Keys, once they are all in
+	struct image_load  load;     // Kitty transmission
+	struct image_sixel six;      // Sixel image
+};
+
+
+// Default sixel color registers (VT340), as percentages
+static const uint8_t _sixel_colors[16][3] = {
+	{ 0, 0, 0 }, { 20, 20, 80 }, { 80, 13, 13 }, { 20, 80, 20 },
+	{ 80, 20, 80 }, { 20, 80, 80 }, { 80, 80, 20 }, { 53, 53, 53 },
+	{ 26, 26, 26 }, { 33, 33, 60 }, { 60, 26, 26 }, { 33, 60, 33 },
+	{ 60, 33, 60 }, { 33, 60, 60 }, { 60, 60, 33 }, { 80, 80, 80 },
+};
+
+
+// Create a new set of images
+struct images* images_new(size_t budget) {
+	struct images *im;
+	if (!(im = calloc(1, sizeof(struct images)))) {
+		die_err("calloc()");
+	}
+	im->images = htu32_new();
+	im->clients = htu32_new();
+	im->places = htu32_new();
+	im->budget = budget;
+	im->next_id = 1;
+	im->next_place = 1;
+	return im;
+}
+
+
+// Free an image
+static void _image_free(void *arg) {
+	struct image *img = (struct image*) arg;
+	if (img->tex) {
+		glDeleteTextures(1, &img->tex);
+	}
+	list_free(img->places, NULL);
+	free(img->pixels);
+	free(img);
+}
+
+
+// Free images
+void images_free(struct images *im) {
+	if (!im) {
+		return;
+	}
+	images_collect(im);
+	htu32_free(im->clients, NULL);
+	htu32_free(im->places, free);
+	htu32_free(im->images, _image_free);
+	free(im->load.pixels);
+	free(im->six.pixels);
+	free(im->dead);
+	free(im);
+}
+
+
+// Get the next id of counter next. Ids are kept in 24 bits, which is what cells keep of
+// placement ids in scrollback, and 0 is no id
+static uint32_t _next_id(uint32_t *next) {
+	uint32_t id = *next;
+	*next = (*next + 1) & 0xffffff;
+	if (*next == 0) {
+		*next = 1;
+	}
+	return id;
+}
+
+
+// Drop placement. Cells still referring to it show nothing
+static void _unplace(struct images *im, struct image_placement *p) {
+	struct list **node, *tmp;
+	for (node = &p->img->places; (*node)->val != p; node = &(*node)->next);
+	tmp = *node;
+	*node = tmp->next;
+	free(tmp);
+	p->img->n_places--;
+	htu32_pop(im->places, p->id, NULL);
+	free(p);
+}
+
+
+// Evict image, and its placements
+static void _evict(struct images *im, struct image *img) {
+	GLuint *tmp;
+	while (img->places) {
+		_unplace(im, img->places->val);
+	}
+	htu32_pop(im->images, img->id, NULL);
+	if (img->client_id && htu32_get(im->clients, img->client_id, NULL) == img) {
+		htu32_pop(im->clients, img->client_id, NULL);
+	}
+	if (img->tex) {
+		if (im->n_dead == im->dead_cap) {
+			im->dead_cap = im->dead_cap ? im->dead_cap * 2 : 16;
+			if (!(tmp = realloc(im->dead, im->dead_cap * sizeof(GLuint)))) {
+				die_err("realloc()");
+			}
+			im->dead = tmp;
+		}
+		im->dead[im->n_dead++] = img->tex;
+	}
+	im->bytes -= (size_t) img->dim.x * img->dim.y * 4;
+	free(img->pixels);
+	free(img);
+}
+
+
+// Remember least recently used image
+static void _find_oldest(uint32_t k, void *v, void *arg) {
+	struct image *img = (struct image*) v, **oldest = (struct image**) arg;
+	if (!*oldest || img->used < (*oldest)->used) {
+		*oldest = img;
+	}
+}
+
+
+// Make room for bytes more, evicting images least recently used first. Return false if they
+// wouldn't fit even then
+static bool _reserve(struct images *im, size_t bytes) {
+	struct image *oldest;
+	if (bytes > im->budget) {
+		return false;
+	}
+	while (im->bytes + bytes > im->budget) {
+		oldest = NULL;
+		htu32_foreach(im->images, _find_oldest, &oldest);
+		if (!oldest) {
+			return false;
+		}
+		_evict(im, oldest);
+	}
+	im->bytes += bytes;
+	return true;
+}
+
+
+// Add image of dim pixels, taking over pixels (whose bytes are reserved already)
+static struct image* _add(struct images *im, uvec2_t dim, uint8_t *pixels, uint32_t client_id) {
+	struct image *img, *old;
+	if (!(img = calloc(1, sizeof(struct image)))) {
+		die_err("calloc()");
+	}
+	img->id = _next_id(&im->next_id);
+	if ((old = htu32_get(im->images, img->id, NULL))) {
+		// Wrapped around to an image that is still there
+		_evict(im, old);
+	}
+	img->client_id = client_id;
+	img->dim = dim;
+	img->pixels = pixels;
+	img->used = ++im->clock;
+	htu32_set(im->images, img->id, img);
+	if (client_id) {
+		// Replaces the image the application had under that id
+		if ((old = htu32_pop(im->clients, client_id, NULL))) {
+			old->client_id = 0;
+		}
+		htu32_set(im->clients, client_id, img);
+	}
+	return img;
+}
+
+
+// Get a placement of img whose cells are tile, in texture coordinates. One already made with
+// the same size is shared
+static struct image_placement* _placement(struct images *im, struct image *img, vec2_t tile) {
+	struct image_placement *p, *old;
+	struct list *node, *last;
+	list_foreach(img->places, node, p) {
+		if (p->tile.x == tile.x && p->tile.y == tile.y) {
+			return p;
+		}
+	}
+	if (img->n_places == IMAGE_PLACES_MAX) {
+		for (last = img->places; last->next; last = last->next);
+		_unplace(im, last->val);
+	}
+	if (!(p = calloc(1, sizeof(struct image_placement)))) {
+		die_err("calloc()");
+	}
+	p->id = _next_id(&im->next_place);
+	if ((old = htu32_get(im->places, p->id, NULL))) {
+		// Wrapped around to a placement that is still there
+		_unplace(im, old);
+	}
+	p->img = img;
+	p->tile = tile;
+	htu32_set(im->places, p->id, p);
+	img->places = list_push_front(img->places, p);
+	img->n_places++;
+	return p;
+}
+
+
+// Fill place for placing img over cells (0 to fit), with cells of cell pixels. If only one
+// of the columns and rows is given, the image keeps its aspect ratio. Either side covers at
+// most IMAGE_MAX_SIDE pixels of cells, whatever the application asks for
+static void _place(struct images *im, struct image *img, uvec2_t cell, uvec2_t cells,
+		bool move, struct image_place *place) {
+	float w = img->dim.x, h = img->dim.y;
+	unsigned max_x = IMAGE_MAX_SIDE / cell.x, max_y = IMAGE_MAX_SIDE / cell.y;
+	max_x = max_x ? max_x : 1;
+	max_y = max_y ? max_y : 1;
+	cells.x = cells.x < max_x ? cells.x : max_x;
+	cells.y = cells.y < max_y ? cells.y : max_y;
+	if (cells.x && cells.y) {
+		w = cells.x * cell.x;
+		h = cells.y * cell.y;
+	} else if (cells.x) {
+		w = cells.x * cell.x;
+		h = img->dim.y * w / img->dim.x;
+	} else if (cells.y) {
+		h = cells.y * cell.y;
+		w = img->dim.x * h / img->dim.y;
+	}
+	place->id = _placement(im, img, (vec2_t) { cell.x / w, cell.y / h })->id;
+	place->cells.x = cells.x ? cells.x : (unsigned) ((w + cell.x - 1) / cell.x);
+	place->cells.y = cells.y ? cells.y : (unsigned) ((h + cell.y - 1) / cell.y);
+	place->cells.x = place->cells.x ? place->cells.x : 1;
+	place->cells.y = place->cells.y ? place->cells.y : 1;
+	place->cells.x = place->cells.x < max_x ? place->cells.x : max_x;
+	place->cells.y = place->cells.y < max_y ? place->cells.y : max_y;
+	place->move = move;
+}
+
+
+// Start receiving a command of protocol proto
+void images_begin(struct images *im, enum image_proto proto) {
+	im->proto = proto;
+	im->n_keys = 0;
+	im->in_payload = false;
+	if (proto == IMAGE_SIXEL) {
+		memset(&im->six, 0, sizeof(struct image_sixel));
+	}
+}
+
+
+// ---- Kitty graphics protocol ----
+
+
+// Parse keys of kitty command into im->cmd. Keys are comma-separated, with a single character
+// name, and a number or single character value. Keys not known are ignored
+static void _kitty_keys(struct images *im) {
+	struct image_cmd *c = &im->cmd;
+	char *s, *end;
+	unsigned long v;
+	im->keys[im->n_keys] = '\0';
+	memset(c, 0, sizeof(struct image_cmd));
+	c->action = 't';
+	c->del = 'a';
+	c->format = 32;
+	c->medium = 'd';
+	for (s = im->keys; *s; s = *end ? end + 1 : end) {
+		if (!s[0] || s[1] != '=') {
+			im->proto = IMAGE_NONE;
+			return;
+		}
+		v = strtoul(&s[2], &end, 10);
+		if (end == &s[2] && *end && *end != ',') {
+			// A single character
+			v = *end++;
+		}
+		if (*end && *end != ',') {
+			im->proto = IMAGE_NONE;
+			return;
+		}
+		switch (s[0]) {
+		case 'a':
+			c->action = v;
+			break;
+		case 'd':
+			c->del = v;
+			break;
+		case 'f':
+			c->format = v;
+			break;
+		case 't':
+			c->medium = v;
+			break;
+		case 'o':
+			c->compression = v;
+			break;
+		case 's':
+			c->size.x = v;
+			break;
+		case 'v':
+			c->size.y = v;
+			break;
+		case 'i':
+			c->client_id = v;
+			break;
+		case 'c':
+			c->cells.x = v;
+			break;
+		case 'r':
+			c->cells.y = v;
+			break;
+		case 'm':
+			c->more = v == 1;
+			break;
+		case 'C':
+			c->no_move = v == 1;
+			break;
+		}
+	}
+}
+
+
+// Start transmission of an image with the keys of the command being received. Transmissions
+// it can't take (compressed, PNG, from files, or too large) are dropped as they arrive
+static void _kitty_load(struct images *im) {
+	struct image_load *l = &im->load;
+	const struct image_cmd *c = &im->cmd;
+	size_t bytes, i;
+	l->active = true;
+	l->cmd = *c;
+	l->len = 0;
+	base64_init(&l->b64);
+	l->bad = (c->format != 24 && c->format != 32) || c->medium != 'd' || c->compression
+		|| !c->size.x || !c->size.y || c->size.x > IMAGE_MAX_SIDE
+		|| c->size.y > IMAGE_MAX_SIDE;
+	bytes = (size_t) c->size.x * c->size.y * 4;
+	if (l->bad || !_reserve(im, bytes)) {
+		l->bad = true;
+		return;
+	}
+	if (!(l->pixels = malloc(bytes))) {
+		die_err("malloc()");
+	}
+	if (c->format == 24) {
+		// Only the colors are sent
+		for (i = 3; i < bytes; i += 4) {
+			l->pixels[i] = 0xff;
+		}
+	}
+}
+
+
+// Drop transmission
+static void _kitty_unload(struct images *im) {
+	struct image_load *l = &im->load;
+	if (l->pixels) {
+		im->bytes -= (size_t) l->cmd.size.x * l->cmd.size.y * 4;
+		free(l->pixels);
+		l->pixels = NULL;
+	}
+	l->active = false;
+}
+
+
+// The keys of the command being received are all in. A command while a transmission is under
+// way carries more of it
+static void _kitty_start(struct images *im) {
+	im->in_payload = true;
+	_kitty_keys(im);
+	if (im->proto == IMAGE_NONE) {
+		return;
+	}
+	if (im->load.active) {
+		im->load.cmd.more = im->cmd.more;
+	} else if (im->cmd.action == 't' || im->cmd.action == 'T') {
+		_kitty_load(im);
+	}
+}
+
+
+// Add n bytes of decoded pixel data to the transmission. Data past the size given is dropped
+static void _kitty_add(struct image_load *l, const uint8_t *data, size_t n) {
+	size_t total = (size_t) l->cmd.size.x * l->cmd.size.y * (l->cmd.format / 8), i;
+	if (n > total - l->len) {
+		n = total - l->len;
+	}
+	if (l->cmd.format == 32) {
+		memcpy(&l->pixels[l->len], data, n);
+		l->len += n;
+		return;
+	}
+	for (i = 0; i < n; i++, l->len++) {
+		l->pixels[l->len / 3 * 4 + l->len % 3] = data[i];
+	}
+}
+
+
+// Feed n bytes of a kitty command
+static void _kitty_feed(struct images *im, const char *s, size_t n) {
+	uint8_t buf[BASE64_DECODED_MAX(IMAGE_CHUNK)];
+	struct image_load *l = &im->load;
+	size_t k;
+	for ( ; n > 0 && !im->in_payload; s++, n--) {
+		if (*s == ';') {
+			_kitty_start(im);
+		} else if (im->n_keys + 1 < IMAGE_KEYS_MAX) {
+			im->keys[im->n_keys++] = *s;
+		} else {
+			im->proto = IMAGE_NONE;
+			return;
+		}
+	}
+	if (im->proto == IMAGE_NONE || !l->active || l->bad) {
+		return;
+	}
+	for ( ; n > 0; s += k, n -= k) {
+		k = n < IMAGE_CHUNK ? n : IMAGE_CHUNK;
+		_kitty_add(l, buf, base64_decode(&l->b64, s, k, buf));
+	}
+}
+
+
+// Delete images the command asks to. Cells still referring to them show nothing
+static void _kitty_delete(struct images *im) {
+	struct image *img = NULL;
+	switch (im->cmd.del) {
+	case 'a':
+	case 'A':
+		while (htu32_size(im->images) > 0) {
+			img = NULL;
+			htu32_foreach(im->images, _find_oldest, &img);
+			_evict(im, img);
+		}
+		break;
+	case 'i':
+	case 'I':
+		if ((img = htu32_get(im->clients, im->cmd.client_id, NULL))) {
+			_evict(im, img);
+		}
+		break;
+	}
+}
+
+
+// End kitty command
+static bool _kitty_end(struct images *im, uvec2_t cell, struct image_place *place) {
+	struct image_load *l = &im->load;
+	struct image *img;
+	size_t total;
+	if (!im->in_payload) {
+		_kitty_start(im);
+	}
+	if (im->proto == IMAGE_NONE) {
+		return false;
+	}
+	if (l->active) {
+		if (l->cmd.more) {
+			return false;
+		}
+		total = (size_t) l->cmd.size.x * l->cmd.size.y * (l->cmd.format / 8);
+		if (l->bad || l->b64.bad || l->len != total) {
+			_kitty_unload(im);
+			return false;
+		}
+		img = _add(im, l->cmd.size, l->pixels, l->cmd.client_id);
+		l->pixels = NULL;
+		l->active = false;
+		if (l->cmd.action != 'T') {
+			return false;
+		}
+		_place(im, img, cell, l->cmd.cells, !l->cmd.no_move, place);
+		return true;
+	}
+	switch (im->cmd.action) {
+	case 'p':
+		if (!(img = htu32_get(im->clients, im->cmd.client_id, NULL))) {
+			return false;
+		}
+		_place(im, img, cell, im->cmd.cells, !im->cmd.no_move, place);
+		return true;
+	case 'd':
+		_kitty_delete(im);
+		break;
+	}
+	return false;
+}
+
+
+// ---- Sixel ----
+
+
+// Make room in the staging buffer for w by h pixels. Pixels not drawn are transparent. Return
+// false if the image would be too large
+static bool _sixel_reserve(struct images *im, unsigned w, unsigned h) {
+	struct image_sixel *x = &im->six;
+	uvec2_t dim = x->dim;
+	size_t old = (size_t) dim.x * dim.y * 4;
+	uint8_t *tmp;
+	unsigned y;
+	if (w <= dim.x && h <= dim.y) {
+		return true;
+	}
+	if (w > IMAGE_MAX_SIDE || h > IMAGE_MAX_SIDE) {
+		return false;
+	}
+	// Grows by at least half, so that growing a band at a time doesn't copy all of it
+	if (w > dim.x) {
+		dim.x = w > dim.x + dim.x / 2 ? w : dim.x + dim.x / 2;
+		dim.x = dim.x < IMAGE_MAX_SIDE ? dim.x : IMAGE_MAX_SIDE;
+	}
+	if (h > dim.y) {
+		dim.y = h > dim.y + dim.y / 2 ? h : dim.y + dim.y / 2;
+		dim.y = dim.y < IMAGE_MAX_SIDE ? dim.y : IMAGE_MAX_SIDE;
+	}
+	// The old buffer is replaced, so only the new one counts against the budget
+	im->bytes -= old;
+	if (!_reserve(im, (size_t) dim.x * dim.y * 4)) {
+		im->bytes += old;
+		return false;
+	}
+	if (!(tmp = calloc((size_t) dim.x * dim.y, 4))) {
+		die_err("calloc()");
+	}
+	for (y = 0; y < x->dim.y; y++) {
+		memcpy(&tmp[(size_t) y * dim.x * 4], &x->pixels[(size_t) y * x->dim.x * 4],
+				(size_t) x->dim.x * 4);
+	}
+	free(x->pixels);
+	x->pixels = tmp;
+	x->dim = dim;
+	return true;
+}
+
+
+// Get a channel of an HLS color, at hue t (in turns) from it
+static uint8_t _hls_channel(float p, float q, float t) {
+	float v = p;
+	t = t < 0 ? t + 1 : (t > 1 ? t - 1 : t);
+	if (t < 1.0f / 6) {
+		v = p + (q - p) * 6 * t;
+	} else if (t < 0.5f) {
+		v = q;
+	} else if (t < 2.0f / 3) {
+		v = p + (q - p) * (2.0f / 3 - t) * 6;
+	}
+	return v * 255 + 0.5f;
+}
+
+
+// Convert HLS (hue in degrees from blue, as DEC has it, lightness and saturation in percent)
+// to RGB
+static void _sixel_hls(unsigned hue, unsigned l, unsigned s, uint8_t *rgb) {
+	float h = ((hue + 240) % 360) / 360.0f, lf = l / 100.0f, sf = s / 100.0f;
+	float q = lf < 0.5f ? lf * (1 + sf) : lf + sf - lf * sf, p = 2 * lf - q;
+	rgb[0] = _hls_channel(p, q, h + 1.0f / 3);
+	rgb[1] = _hls_channel(p, q, h);
+	rgb[2] = _hls_channel(p, q, h - 1.0f / 3);
+}
+
+
+// Carry out sixel command whose parameters have been read
+static void _sixel_cmd(struct images *im) {
+	struct image_sixel *x = &im->six;
+	unsigned *a = x->args, i;
+	uint8_t *c;
+	switch (x->cmd) {
+	case '#':
+		// Select color register, and set it if a color is given (in HLS or RGB)
+		x->color = a[0] % IMAGE_SIXEL_COLORS;
+		c = x->palette[x->color];
+		if (x->n_args >= 5 && a[1] == 1) {
+			_sixel_hls(a[2], a[3] <= 100 ? a[3] : 100, a[4] <= 100 ? a[4] : 100, c);
+		} else if (x->n_args >= 5 && a[1] == 2) {
+			for (i = 0; i < 3; i++) {
+				c[i] = (a[2 + i] <= 100 ? a[2 + i] : 100) * 255 / 100;
+			}
+		}
+		break;
+	case '!':
+		// Repeat the next sixel
+		x->repeat = a[0] ? a[0] : 1;
+		break;
+	case '"':
+		// Raster attributes. Only the size is used
+		if (x->n_args >= 4 && a[2] && a[3] && _sixel_reserve(im, a[2], a[3])) {
+			x->size.x = a[2];
+			x->size.y = a[3];
+		}
+		break;
+	}
+	x->cmd = 0;
+}
+
+
+// Draw sixel (the 6 bits of a column of a band, top first) x->repeat times
+static void _sixel_draw(struct images *im, unsigned bits) {
+	struct image_sixel *x = &im->six;
+	unsigned n = x->repeat, k, i;
+	uint8_t *row;
+	x->repeat = 1;
+	if (!_sixel_reserve(im, x->pos.x + n, x->pos.y + IMAGE_SIXEL_BAND)) {
+		// Clipped
+		if (x->pos.x >= x->dim.x || x->pos.y + IMAGE_SIXEL_BAND > x->dim.y) {
+			x->pos.x += n;
+			return;
+		}
+		n = x->dim.x - x->pos.x < n ? x->dim.x - x->pos.x : n;
+	}
+	for (k = 0; k < IMAGE_SIXEL_BAND; k++) {
+		if (!(bits & (1 << k))) {
+			continue;
+		}
+		row = &x->pixels[((size_t) (x->pos.y + k) * x->dim.x + x->pos.x) * 4];
+		for (i = 0; i < n; i++) {
+			memcpy(&row[i * 4], x->palette[x->color], 4);
+		}
+		if (x->pos.y + k + 1 > x->ext.y) {
+			x->ext.y = x->pos.y + k + 1;
+		}
+	}
+	x->pos.x += n;
+	if (bits && x->pos.x > x->ext.x) {
+		x->ext.x = x->pos.x;
+	}
+}
+
+
+// Feed n bytes of a sixel image. Parameters up to 'q' are skipped
+static void _sixel_feed(struct images *im, const char *s, size_t n) {
+	struct image_sixel *x = &im->six;
+	unsigned i;
+	char c;
+	for ( ; n > 0 && im->proto == IMAGE_SIXEL; s++, n--) {
+		c = *s;
+		if (!x->in_data) {
+			if (c == 'q') {
+				x->in_data = true;
+				x->repeat = 1;
+				for (i = 0; i < IMAGE_SIXEL_COLORS; i++) {
+					x->palette[i][0] = i < 16 ? _sixel_colors[i][0] * 255 / 100 : 0;
+					x->palette[i][1] = i < 16 ? _sixel_colors[i][1] * 255 / 100 : 0;
+					x->palette[i][2] = i < 16 ? _sixel_colors[i][2] * 255 / 100 : 0;
+					x->palette[i][3] = 0xff;
+				}
+			} else if ((c < '0' || c > '9') && c != ';') {
+				// Some other device control string
+				im->proto = IMAGE_NONE;
+			}
+			continue;
+		}
+		if (x->cmd) {
+			if (c >= '0' && c <= '9') {
+				if (x->n_args == 0) {
+					x->n_args = 1;
+				}
+				if (x->args[x->n_args - 1] < 100000) {
+					x->args[x->n_args - 1] = x->args[x->n_args - 1] * 10 + c - '0';
+				}
+				continue;
+			} else if (c == ';') {
+				if (x->n_args == 0) {
+					x->n_args = 1;
+				}
+				if (x->n_args < 5) {
+					x->args[x->n_args++] = 0;
+				}
+				continue;
+			}
+			_sixel_cmd(im);
+		}
+		if (c >= '?' && c <= '~') {
+			_sixel_draw(im, c - '?');
+		} else if (c == '#' || c == '!' || c == '"') {
+			x->cmd = c;
+			x->n_args = 0;
+			memset(x->args, 0, sizeof(x->args));
+		} else if (c == '$') {
+			// Carriage return
+			x->pos.x = 0;
+		} else if (c == '-') {
+			// Next band
+			x->pos.x = 0;
+			x->pos.y += IMAGE_SIXEL_BAND;
+		}
+	}
+}
+
+
+// End sixel image. It is as large as its raster attributes say, or else as what was drawn
+static bool _sixel_end(struct images *im, uvec2_t cell, struct image_place *place) {
+	struct image_sixel *x = &im->six;
+	struct image *img;
+	uvec2_t dim, none = { 0, 0 };
+	uint8_t *pixels;
+	unsigned y;
+	if (x->cmd) {
+		_sixel_cmd(im);
+	}
+	dim.x = x->size.x ? x->size.x : x->ext.x;
+	dim.y = x->size.y ? x->size.y : x->ext.y;
+	dim.x = dim.x < x->dim.x ? dim.x : x->dim.x;
+	dim.y = dim.y < x->dim.y ? dim.y : x->dim.y;
+	if (im->proto != IMAGE_SIXEL || !dim.x || !dim.y) {
+		return false;
+	}
+	// Cropped out of the staging buffer, which is then taken by the image
+	for (y = 1; y < dim.y && dim.x < x->dim.x; y++) {
+		memmove(&x->pixels[(size_t) y * dim.x * 4], &x->pixels[(size_t) y * x->dim.x * 4],
+				(size_t) dim.x * 4);
+	}
+	if (!(pixels = realloc(x->pixels, (size_t) dim.x * dim.y * 4))) {
+		die_err("realloc()");
+	}
+	im->bytes -= (size_t) x->dim.x * x->dim.y * 4;
+	im->bytes += (size_t) dim.x * dim.y * 4;
+	x->pixels = NULL;
+	x->dim = none;
+	img = _add(im, dim, pixels, 0);
+	_place(im, img, cell, none, true, place);
+	return true;
+}
+
+
+// Drop sixel staging buffer
+static void _sixel_free(struct images *im) {
+	if (im->six.pixels) {
+		im->bytes -= (size_t) im->six.dim.x * im->six.dim.y * 4;
+		free(im->six.pixels);
+		im->six.pixels = NULL;
+	}
+	im->six.dim.x = im->six.dim.y = 0;
+}
+
+
+// ----
+
+
+// Feed n bytes of the command being received
+void images_feed(struct images *im, const char *s, size_t n) {
+	switch (im->proto) {
+	case IMAGE_KITTY:
+		_kitty_feed(im, s, n);
+		break;
+	case IMAGE_SIXEL:
+		_sixel_feed(im, s, n);
+		break;
+	case IMAGE_NONE:
+		break;
+	}
+}
+
+
+// End command being received
+bool images_end(struct images *im, uvec2_t cell, struct image_place *place) {
+	bool ret = false;
+	if (cell.x == 0 || cell.y == 0) {
+		images_cancel(im);
+		return false;
+	}
+	switch (im->proto) {
+	case IMAGE_KITTY:
+		ret = _kitty_end(im, cell, place);
+		break;
+	case IMAGE_SIXEL:
+		ret = _sixel_end(im, cell, place);
+		break;
+	case IMAGE_NONE:
+		break;
+	}
+	_sixel_free(im);
+	im->proto = IMAGE_NONE;
+	return ret;
+}
+
+
+// Drop command being received. A kitty transmission in pieces is dropped altogether
+void images_cancel(struct images *im) {
+	if (im->proto == IMAGE_KITTY && im->load.active) {
+		_kitty_unload(im);
+	}
+	_sixel_free(im);
+	im->proto = IMAGE_NONE;
+}
+
+
+// Delete textures of images evicted
+void images_collect(struct images *im) {
+	if (im->n_dead > 0) {
+		glDeleteTextures(im->n_dead, im->dead);
+		im->n_dead = 0;
+	}
+}
+
+
+// Get texture of the image of placement id, uploading it if it hasn't been
+unsigned images_texture(struct images *im, uint32_t id, vec2_t *tile) {
+	static const GLfloat border[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+	struct image_placement *p;
+	struct image *img;
+	if (!(p = htu32_get(im->places, id, NULL))) {
+		return 0;
+	}
+	img = p->img;
+	img->used = ++im->clock;
+	*tile = p->tile;
+	if (img->tex) {
+		return img->tex;
+	}
+	glGenTextures(1, &img->tex);
+	glBindTexture(GL_TEXTURE_2D, img->tex);
+	// Cells past the edge of the image are transparent
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
+	glTexParameterfv(GL_TEXTURE_2D, GL_TEXTURE_BORDER_COLOR, border);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, img->dim.x, img->dim.y, 0, GL_RGBA,
+			GL_UNSIGNED_BYTE, img->pixels);
+	glBindTexture(GL_TEXTURE_2D, 0);
+	// The texture has the pixels now. They still count against the budget, on that side
+	free(img->pixels);
+	img->pixels = NULL;
+	return img->tex;
+}
@@ -0,0 +1,581 @@
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/wait.h>
+#include <sys/syscall.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <sys/signalfd.h>
+
+#include "loop.h"
+#include "uring.h"
+
+
+// Most events handled per wait
+#define LOOP_EVENTS_MAX 64
+
+// Most I/O operations queued for io_uring between submissions
+#define LOOP_URING_ENTRIES 256
+
+// User data of an I/O operation of a watch: the watch, with the operation in the low bits. On
+// top of reads and writes, there are the polls they are linked after
+#define LOOP_OP_MASK    3
+#define LOOP_POLL_READ  2
+#define LOOP_POLL_WRITE 3
+
+
+// Kinds of watches
+enum loop_kind {
+	LOOP_FD,
+	LOOP_WAKE,
+	LOOP_TIMER,
+	LOOP_CHILD,
+	LOOP_IO,
+};
+
+
+struct loop_watch {
+	struct loop       *loop;
+	enum loop_kind    kind;
+	int               fd;      // File descriptor waited on (owned unless LOOP_FD or LOOP_IO,
+	                           // -1 if none)
+	pid_t             pid;     // Child process (LOOP_CHILD)
+	bool              woken;   // Has it been woken up since it was called back? (LOOP_WAKE)
+	int               buf;     // Buffer registered with io_uring, or -1 (LOOP_IO)
+	unsigned          io;      // Operations in flight (LOOP_IO)
+	bool              linked;  // Was the last write linked to the next? (LOOP_IO)
+	bool              waited;  // Is loop_del() waiting for its operations to be cancelled?
+	bool              dead;    // Has it been removed? It is freed once events are handled, and
+	                           // its operations are done
+	loop_cb           cb;
+	loop_io_cb        io_cb;   // Callback (LOOP_IO)
+	void              *data;
+	struct loop_watch *next;
+};
+
+
+struct loop {
+	int               epfd;    // epoll instance
+	int               wakefd;  // eventfd for wakeups (and stopping)
+	bool              pidfd;   // Are children waited on with pidfds? (else SIGCHLD)
+	int               sigfd;   // signalfd for SIGCHLD, once a child is waited on without
+	                           // pidfds (else -1)
+	struct uring      *uring;  // io_uring for I/O watches (NULL if not used)
+	pthread_t         tid;     // Loop thread
+	pthread_mutex_t   mut;     // Held while handling events, and to change watches
+	pthread_cond_t    done;    // Signalled once events are handled
+	struct loop_watch *watches; // Watches, including removed ones not freed yet
+	bool              stop;    // Should the loop thread stop?
+};
+
+
+// Open pidfd of process pid, or return -1 if pidfds aren't supported
+static int _pidfd_open(pid_t pid) {
+#ifdef SYS_pidfd_open
+	return syscall(SYS_pidfd_open, pid, 0);
+#else
+	errno = ENOSYS;
+	return -1;
+#endif
+}
+
+
+// Is this the loop thread?
+static bool _on_loop(const struct loop *loop) {
+	return pthread_equal(pthread_self(), loop->tid);
+}
+
+
+// Lock loop, unless on the loop thread, which holds it while calling back
+static void _lock(struct loop *loop) {
+	if (!_on_loop(loop)) {
+		pthread_mutex_lock(&loop->mut);
+	}
+}
+
+
+// Unlock loop, unless on the loop thread
+static void _unlock(struct loop *loop) {
+	if (!_on_loop(loop)) {
+		pthread_mutex_unlock(&loop->mut);
+	}
+}
+
+
+// Add fd to epoll, with data pointing to ptr
+static void _epoll_add(struct loop *loop, int fd, uint32_t events, void *ptr) {
+	struct epoll_event ev = { .events = events, .data.ptr = ptr };
+	if (epoll_ctl(loop->epfd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+		die_err("epoll_ctl()");
+	}
+}
+
+
+// Signal the eventfd
+static void _signal(struct loop *loop) {
+	uint64_t one = 1;
+	if (write(loop->wakefd, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+		die_err("write()");
+	}
+}
+
+
+// Create a watch of kind, and add it to the loop. Called with the loop locked
+static struct loop_watch* _add(struct loop *loop, enum loop_kind kind, int fd, loop_cb cb,
+		void *data) {
+	struct loop_watch *watch;
+	if (!(watch = calloc(1, sizeof(struct loop_watch)))) {
+		die_err("calloc()");
+	}
+	watch->loop = loop;
+	watch->kind = kind;
+	watch->fd = fd;
+	watch->pid = -1;
+	watch->buf = -1;
+	watch->cb = cb;
+	watch->data = data;
+	watch->next = loop->watches;
+	loop->watches = watch;
+	return watch;
+}
+
+
+// Call back child process watches whose process has exited, once SIGCHLD was received
+static void _reap_children(struct loop *loop) {
+	struct signalfd_siginfo si;
+	struct loop_watch *watch;
+	int status;
+	while (read(loop->sigfd, &si, sizeof(si)) == sizeof(si));
+	for (watch = loop->watches; watch; watch = watch->next) {
+		if (watch->kind == LOOP_CHILD && !watch->dead && watch->pid > 0
+				&& waitpid(watch->pid, &status, WNOHANG) == watch->pid) {
+			watch->pid = -1;
+			watch->cb(watch, status, watch->data);
+		}
+	}
+}
+
+
+// Call back I/O watches whose operations are done
+static void _reap_io(struct loop *loop) {
+	struct loop_watch *watch;
+	uint64_t user;
+	int res;
+	while (uring_reap(loop->uring, &user, &res)) {
+		if (!user) {
+			continue;
+		}
+		watch = (struct loop_watch*) (uintptr_t) (user & ~(uint64_t) LOOP_OP_MASK);
+		watch->io--;
+		if (!watch->dead && (user & LOOP_OP_MASK) <= LOOP_WRITE) {
+			watch->io_cb(watch, user & LOOP_OP_MASK, res, watch->data);
+		}
+	}
+}
+
+
+// Handle events of watch
+static void _handle(struct loop *loop, struct loop_watch *watch, uint32_t events) {
+	uint64_t count;
+	int status;
+	if (watch->dead) {
+		return;
+	}
+	switch (watch->kind) {
+	case LOOP_FD:
+		watch->cb(watch, events, watch->data);
+		break;
+	case LOOP_TIMER:
+		if (read(watch->fd, &count, sizeof(count)) == sizeof(count)) {
+			watch->cb(watch, 0, watch->data);
+		}
+		break;
+	case LOOP_CHILD:
+		// The pidfd stays readable, so it is waited on no longer
+		epoll_ctl(loop->epfd, EPOLL_CTL_DEL, watch->fd, NULL);
+		if (waitpid(watch->pid, &status, WNOHANG) == watch->pid) {
+			watch->pid = -1;
+			watch->cb(watch, status, watch->data);
+		}
+		break;
+	case LOOP_WAKE:
+	case LOOP_IO:
+		break;
+	}
+}
+
+
+// Free watches removed. Called on the loop thread once events are handled, so that no event
+// left to handle refers to them. I/O watches are kept until their operations are done
+static void _collect(struct loop *loop) {
+	struct loop_watch **p, *watch;
+	for (p = &loop->watches; *p; ) {
+		watch = *p;
+		if (!watch->dead || watch->io > 0 || watch->waited) {
+			p = &watch->next;
+			continue;
+		}
+		*p = watch->next;
+		free(watch);
+	}
+}
+
+
+// Loop thread
+static void* _run(void *arg) {
+	struct loop *loop = arg;
+	struct epoll_event evs[LOOP_EVENTS_MAX];
+	struct loop_watch *watch;
+	uint64_t count;
+	int n, i;
+	while (!__atomic_load_n(&loop->stop, __ATOMIC_ACQUIRE)) {
+		if ((n = epoll_wait(loop->epfd, evs, LOOP_EVENTS_MAX, -1)) < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			die_err("epoll_wait()");
+		}
+		pthread_mutex_lock(&loop->mut);
+		for (i = 0; i < n; i++) {
+			if (evs[i].data.ptr == &loop->wakefd) {
+				if (read(loop->wakefd, &count, sizeof(count)) < 0 && errno != EAGAIN) {
+					die_err("read()");
+				}
+				for (watch = loop->watches; watch; watch = watch->next) {
+					if (watch->kind == LOOP_WAKE && !watch->dead
+							&& __atomic_exchange_n(&watch->woken, false,
+								__ATOMIC_ACQ_REL)) {
+						watch->cb(watch, 0, watch->data);
+					}
+				}
+			} else if (evs[i].data.ptr == &loop->sigfd) {
+				_reap_children(loop);
+			} else if (evs[i].data.ptr == &loop->uring) {
+				_reap_io(loop);
+			} else {
+				_handle(loop, evs[i].data.ptr, evs[i].events);
+			}
+		}
+		// Operations queued by the callbacks of all watches go in one system call
+		if (loop->uring) {
+			uring_submit(loop->uring);
+		}
+		_collect(loop);
+		pthread_cond_broadcast(&loop->done);
+		pthread_mutex_unlock(&loop->mut);
+	}
+	return NULL;
+}
+
+
+// Create a new event loop, and start its thread
+struct loop* loop_new() {
+	struct loop *loop;
+	sigset_t mask;
+	int fd;
+	if (!(loop = calloc(1, sizeof(struct loop)))) {
+		die_err("calloc()");
+	}
+	if ((loop->epfd = epoll_create1(EPOLL_CLOEXEC)) < 0) {
+		die_err("epoll_create1()");
+	}
+	if ((loop->wakefd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0) {
+		die_err("eventfd()");
+	}
+	_epoll_add(loop, loop->wakefd, EPOLLIN, &loop->wakefd);
+	// Children are waited on with pidfds if the kernel has them (5.3), else with SIGCHLD,
+	// read from a signalfd made once there is a child to wait on
+	loop->sigfd = -1;
+	if ((fd = _pidfd_open(getpid())) >= 0) {
+		close(fd);
+		loop->pidfd = true;
+	} else {
+		sigemptyset(&mask);
+		sigaddset(&mask, SIGCHLD);
+		if (pthread_sigmask(SIG_BLOCK, &mask, NULL)) {
+			die("pthread_sigmask()");
+		}
+	}
+	pthread_mutex_init(&loop->mut, NULL);
+	pthread_cond_init(&loop->done, NULL);
+	if (pthread_create(&loop->tid, NULL, _run, loop)) {
+		die_err("pthread_create()");
+	}
+	return loop;
+}
+
+
+// Stop event loop, and free it and the watches left
+void loop_free(struct loop *loop) {
+	struct loop_watch *watch, *next;
+	if (!loop) {
+		return;
+	}
+	__atomic_store_n(&loop->stop, true, __ATOMIC_RELEASE);
+	_signal(loop);
+	pthread_join(loop->tid, NULL);
+	// Operations still in flight are cancelled first, as their memory may go with the watches
+	uring_free(loop->uring);
+	for (watch = loop->watches; watch; watch = next) {
+		next = watch->next;
+		if (watch->kind != LOOP_FD && watch->kind != LOOP_IO && watch->fd >= 0) {
+			close(watch->fd);
+		}
+		free(watch);
+	}
+	close(loop->epfd);
+	close(loop->wakefd);
+	if (loop->sigfd >= 0) {
+		close(loop->sigfd);
+	}
+	pthread_cond_destroy(&loop->done);
+	pthread_mutex_destroy(&loop->mut);
+	free(loop);
+}
+
+
+// Wait on fd for epoll events
+struct loop_watch* loop_add_fd(struct loop *loop, int fd, uint32_t events, loop_cb cb,
+		void *data) {
+	struct loop_watch *watch;
+	if (!loop) {
+		die("NULL loop");
+	}
+	_lock(loop);
+	watch = _add(loop, LOOP_FD, fd, cb, data);
+	_epoll_add(loop, fd, events, watch);
+	_unlock(loop);
+	return watch;
+}
+
+
+// Change events waited on by a file descriptor watch
+void loop_mod_fd(struct loop_watch *watch, uint32_t events) {
+	struct epoll_event ev = { .events = events, .data.ptr = watch };
+	if (!watch || watch->kind != LOOP_FD) {
+		die("Not a file descriptor watch");
+	}
+	if (epoll_ctl(watch->loop->epfd, EPOLL_CTL_MOD, watch->fd, &ev) < 0) {
+		die_err("epoll_ctl()");
+	}
+}
+
+
+// Add a watch called back after loop_wake()
+struct loop_watch* loop_add_wake(struct loop *loop, loop_cb cb, void *data) {
+	struct loop_watch *watch;
+	if (!loop) {
+		die("NULL loop");
+	}
+	_lock(loop);
+	watch = _add(loop, LOOP_WAKE, -1, cb, data);
+	_unlock(loop);
+	return watch;
+}
+
+
+// Wake watch up
+void loop_wake(struct loop_watch *watch) {
+	if (!watch || watch->kind != LOOP_WAKE) {
+		die("Not a wake watch");
+	}
+	if (!__atomic_exchange_n(&watch->woken, true, __ATOMIC_ACQ_REL)) {
+		_signal(watch->loop);
+	}
+}
+
+
+// Add a timer called back every period_us microseconds
+struct loop_watch* loop_add_timer(struct loop *loop, unsigned period_us, loop_cb cb, void *data) {
+	struct loop_watch *watch;
+	struct itimerspec its = { 0 };
+	int fd;
+	if (!loop) {
+		die("NULL loop");
+	}
+	if ((fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC)) < 0) {
+		die_err("timerfd_create()");
+	}
+	its.it_interval.tv_sec = period_us / 1000000;
+	its.it_interval.tv_nsec = (period_us % 1000000) * 1000;
+	its.it_value = its.it_interval;
+	if (timerfd_settime(fd, 0, &its, NULL) < 0) {
+		die_err("timerfd_settime()");
+	}
+	_lock(loop);
+	watch = _add(loop, LOOP_TIMER, fd, cb, data);
+	_epoll_add(loop, fd, EPOLLIN, watch);
+	_unlock(loop);
+	return watch;
+}
+
+
+// Add a watch called back once child process pid has exited
+struct loop_watch* loop_add_child(struct loop *loop, pid_t pid, loop_cb cb, void *data) {
+	struct loop_watch *watch;
+	sigset_t mask;
+	int fd = -1;
+	if (!loop) {
+		die("NULL loop");
+	}
+	if (loop->pidfd && (fd = _pidfd_open(pid)) < 0) {
+		die_err("pidfd_open()");
+	}
+	_lock(loop);
+	if (!loop->pidfd && loop->sigfd < 0) {
+		sigemptyset(&mask);
+		sigaddset(&mask, SIGCHLD);
+		if ((loop->sigfd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC)) < 0) {
+			die_err("signalfd()");
+		}
+		_epoll_add(loop, loop->sigfd, EPOLLIN, &loop->sigfd);
+	}
+	watch = _add(loop, LOOP_CHILD, fd, cb, data);
+	watch->pid = pid;
+	if (fd >= 0) {
+		_epoll_add(loop, fd, EPOLLIN, watch);
+	}
+	_unlock(loop);
+	if (fd < 0) {
+		// It might have exited before the watch was added
+		kill(getpid(), SIGCHLD);
+	}
+	return watch;
+}
+
+
+// Remove watch
+void loop_del(struct loop_watch *watch) {
+	struct loop *loop;
+	if (!watch) {
+		return;
+	}
+	loop = watch->loop;
+	_lock(loop);
+	if (watch->kind == LOOP_IO) {
+		watch->dead = true;
+		if (watch->io > 0) {
+			uring_cancel(loop->uring, (uintptr_t) watch | LOOP_POLL_READ);
+			uring_cancel(loop->uring, (uintptr_t) watch | LOOP_POLL_WRITE);
+			uring_cancel(loop->uring, (uintptr_t) watch | LOOP_READ);
+			uring_cancel(loop->uring, (uintptr_t) watch | LOOP_WRITE);
+		}
+		uring_del_buffer(loop->uring, watch->buf);
+		watch->buf = -1;
+		watch->fd = -1;
+		if (!_on_loop(loop)) {
+			// The loop thread submits the cancels, and takes the results
+			watch->waited = true;
+			_signal(loop);
+			while (watch->io > 0) {
+				pthread_cond_wait(&loop->done, &loop->mut);
+			}
+			watch->waited = false;
+		}
+	} else if (watch->fd >= 0) {
+		epoll_ctl(loop->epfd, EPOLL_CTL_DEL, watch->fd, NULL);
+		if (watch->kind != LOOP_FD) {
+			close(watch->fd);
+		}
+		watch->fd = -1;
+	}
+	watch->dead = true;
+	_unlock(loop);
+	// The loop thread frees it once it next wakes up
+	if (!_on_loop(loop)) {
+		_signal(loop);
+	}
+}
+
+
+// Do I/O of I/O watches through io_uring, if possible
+bool loop_use_uring(struct loop *loop) {
+	bool ret;
+	if (!loop) {
+		die("NULL loop");
+	}
+	_lock(loop);
+	if (!loop->uring && (loop->uring = uring_new(LOOP_URING_ENTRIES))) {
+		_epoll_add(loop, uring_fd(loop->uring), EPOLLIN, &loop->uring);
+	}
+	ret = loop->uring != NULL;
+	_unlock(loop);
+	return ret;
+}
+
+
+// Add an I/O watch on fd
+struct loop_watch* loop_add_io(struct loop *loop, int fd, loop_io_cb cb, void *data) {
+	struct loop_watch *watch = NULL;
+	if (!loop) {
+		die("NULL loop");
+	}
+	_lock(loop);
+	if (loop->uring) {
+		watch = _add(loop, LOOP_IO, fd, NULL, data);
+		watch->io_cb = cb;
+	}
+	_unlock(loop);
+	return watch;
+}
+
+
+// Register n bytes at p as the buffer of I/O watch
+void loop_io_buffer(struct loop_watch *watch, void *p, size_t n) {
+	if (!watch || watch->kind != LOOP_IO) {
+		die("Not an I/O watch");
+	}
+	_lock(watch->loop);
+	if (watch->buf < 0) {
+		watch->buf = uring_add_buffer(watch->loop->uring, p, n);
+	}
+	_unlock(watch->loop);
+}
+
+
+// Lock loop of I/O watch, to queue an operation of it
+static struct loop* _lock_io(struct loop_watch *watch) {
+	if (!watch || watch->kind != LOOP_IO) {
+		die("Not an I/O watch");
+	}
+	_lock(watch->loop);
+	return watch->loop;
+}
+
+
+// Unlock loop of I/O watch, once an operation of it is queued. Off the loop thread, the loop
+// thread is woken up to submit it
+static void _unlock_io(struct loop_watch *watch) {
+	watch->io++;
+	_unlock(watch->loop);
+	if (!_on_loop(watch->loop)) {
+		_signal(watch->loop);
+	}
+}
+
+
+// Start reading up to n bytes into p. Reads and writes of ptys can't be tried without blocking,
+// so io_uring would block the submitting thread on them, unless the file descriptor is
+// non-blocking. Then it hands EAGAIN back rather than waiting, so they are linked after a poll
+// (done at once if the file descriptor is ready)
+void loop_read(struct loop_watch *watch, void *p, size_t n) {
+	struct loop *loop = _lock_io(watch);
+	uring_poll(loop->uring, watch->fd, EPOLLIN, true, (uintptr_t) watch | LOOP_POLL_READ);
+	watch->io++;
+	uring_read(loop->uring, watch->fd, p, n, watch->buf, (uintptr_t) watch | LOOP_READ);
+	_unlock_io(watch);
+}
+
+
+// Start writing n bytes from p
+void loop_write(struct loop_watch *watch, const void *p, size_t n, bool link) {
+	struct loop *loop = _lock_io(watch);
+	if (!watch->linked) {
+		uring_poll(loop->uring, watch->fd, EPOLLOUT, true, (uintptr_t) watch | LOOP_POLL_WRITE);
+		watch->io++;
+	}
+	watch->linked = link;
+	uring_write(loop->uring, watch->fd, p, n, link, (uintptr_t) watch | LOOP_WRITE);
+	_unlock_io(watch);
+}
@@ -0,0 +1,153 @@
+#include "lz.h"
+
+
+// Matches are found through a hash table of 4-byte sequences
+#define LZ_HASH_BITS 12
+
+#define LZ_MIN_MATCH 4
+
+// The format requires the last 5 bytes to be literals, and the last match to start at least
+// 12 bytes before the end
+#define LZ_LAST_LITERALS 5
+#define LZ_MF_LIMIT      12
+
+#define LZ_MAX_OFFSET 65535
+
+
+// Read 4 bytes, unaligned
+static uint32_t _read32(const uint8_t *p) {
+	uint32_t v;
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+
+// Hash 4 bytes
+static uint32_t _hash(uint32_t v) {
+	return (v * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+
+// Write the part of a length that doesn't fit in its token nibble
+static uint8_t* _put_len(uint8_t *op, size_t len) {
+	for ( ; len >= 255; len -= 255) {
+		*op++ = 255;
+	}
+	*op++ = len;
+	return op;
+}
+
+
+// Write a sequence of literals, followed by a match (unless mlen is 0)
+static uint8_t* _put_seq(uint8_t *op, const uint8_t *lit, size_t n_lit, size_t off, size_t mlen) {
+	uint8_t *token = op++;
+	*token = (n_lit >= 15 ? 15 : n_lit) << 4;
+	if (n_lit >= 15) {
+		op = _put_len(op, n_lit - 15);
+	}
+	memcpy(op, lit, n_lit);
+	op += n_lit;
+	if (mlen == 0) {
+		return op;
+	}
+	*op++ = off & 0xff;
+	*op++ = off >> 8;
+	mlen -= LZ_MIN_MATCH;
+	*token |= mlen >= 15 ? 15 : mlen;
+	if (mlen >= 15) {
+		op = _put_len(op, mlen - 15);
+	}
+	return op;
+}
+
+
+// Compress n bytes of src into dst
+size_t lz_compress(const uint8_t *src, size_t n, uint8_t *dst) {
+	uint32_t table[1 << LZ_HASH_BITS], h;
+	const uint8_t *ip = src, *anchor = src, *end = src + n, *ref;
+	const uint8_t *mf_limit = n > LZ_MF_LIMIT ? end - LZ_MF_LIMIT : src;
+	uint8_t *op = dst;
+	size_t mlen;
+	memset(table, 0, sizeof(table));
+	while (ip < mf_limit) {
+		h = _hash(_read32(ip));
+		ref = src + table[h];
+		table[h] = ip - src;
+		if (ref >= ip || ip - ref > LZ_MAX_OFFSET || _read32(ref) != _read32(ip)) {
+			ip++;
+			continue;
+		}
+		for (mlen = LZ_MIN_MATCH; ip + mlen < end - LZ_LAST_LITERALS && ip[mlen] == ref[mlen];
+				mlen++);
+		op = _put_seq(op, anchor, ip - anchor, ip - ref, mlen);
+		ip += mlen;
+		anchor = ip;
+	}
+	return _put_seq(op, anchor, end - anchor, 0, 0) - dst;
+}
+
+
+// Read the part of a length that doesn't fit in its token nibble. Return false on overrun
+static bool _get_len(const uint8_t **ip, const uint8_t *end, size_t *len) {
+	uint8_t b;
+	do {
+		if (*ip >= end) {
+			return false;
+		}
+		b = *(*ip)++;
+		*len += b;
+	} while (b == 255);
+	return true;
+}
+
+
+// Decompress n bytes of src into dst, which has room for cap bytes
+bool lz_decompress(const uint8_t *src, size_t n, uint8_t *dst, size_t cap, size_t *out_n) {
+	const uint8_t *ip = src, *end = src + n;
+	uint8_t *op = dst, *oend = dst + cap;
+	size_t n_lit, mlen, off, k;
+	uint8_t token;
+	while (ip < end) {
+		token = *ip++;
+		// Literals
+		n_lit = token >> 4;
+		if (n_lit == 15 && !_get_len(&ip, end, &n_lit)) {
+			return false;
+		}
+		if (n_lit > (size_t) (end - ip) || n_lit > (size_t) (oend - op)) {
+			return false;
+		}
+		memcpy(op, ip, n_lit);
+		op += n_lit;
+		ip += n_lit;
+		if (ip == end) {
+			// The last sequence has no match
+			break;
+		}
+		// Match
+		if (end - ip < 2) {
+			return false;
+		}
+		off = ip[0] | (ip[1] << 8);
+		ip += 2;
+		mlen = token & 15;
+		if (mlen == 15 && !_get_len(&ip, end, &mlen)) {
+			return false;
+		}
+		mlen += LZ_MIN_MATCH;
+		if (off == 0 || off > (size_t) (op - dst) || mlen > (size_t) (oend - op)) {
+			return false;
+		}
+		if (off >= mlen) {
+			memcpy(op, op - off, mlen);
+		} else {
+			// Overlapping. Repeats the last off bytes
+			for (k = 0; k < mlen; k++) {
+				op[k] = op[k - off];
+			}
+		}
+		op += mlen;
+	}
+	*out_n = op - dst;
+	return true;
+}
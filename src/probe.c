@@ -0,0 +1,286 @@
+#define _GNU_SOURCE
+#include <string.h>
+
+#include "probe.h"
+
+
+// Most keys followed. Keys past it are not
+#define PROBE_KEYS_MAX (1 << 16)
+
+// Most bytes of a key's input looked for in the output
+#define PROBE_ECHO_MAX 8
+
+// Reads remembered, to find the one an echo came with
+#define PROBE_READS 1024
+
+// A key whose echo hasn't turned up this long after it was written is given up on (ns)
+#define PROBE_TIMEOUT 1000000000ull
+
+
+// A key followed
+struct probe_key {
+	uint64_t t[PROBE_STAGES];        // End of each stage (ns)
+	size_t   in_end;                 // Bytes of input queued up to, and including, its own
+	char     echo[PROBE_ECHO_MAX];   // Start of its input, looked for in the output
+	unsigned n_echo;
+	bool     lost;                   // Was its echo not found?
+};
+
+// A read
+struct probe_read {
+	size_t   end;                    // Bytes of output read up to, and including, this read
+	uint64_t t;                      // When
+};
+
+
+// Keys go through the stages in order, so each thread only moves the count of keys through
+// its stage on, for the next to pick them up
+static struct {
+	bool              on;
+	struct probe_key  *keys;
+	// Window thread
+	size_t            n_keys;        // Keys queued (published)
+	char              staged[PROBE_ECHO_MAX]; // Start of input of the current key event
+	unsigned          n_staged;
+	size_t            queued;        // Bytes of input queued
+	size_t            n_swapped;     // Keys swapped in
+	// I/O thread
+	size_t            n_written;     // Keys written (published)
+	size_t            written;       // Bytes of input written
+	size_t            read;          // Bytes of output read
+	struct probe_read reads[PROBE_READS];
+	size_t            n_reads;       // Reads (published)
+	// Parser thread
+	size_t            n_matched;     // Keys whose echo was found (or given up on)
+	size_t            n_parsed;      // Keys on the screen (published, under renderer lock)
+	size_t            parsed;        // Bytes of output parsed
+	size_t            search_from;   // Bytes of output already searched for echoes
+	size_t            read_i;        // First read an echo could have come with
+} probe;
+
+
+// Start probing
+void probe_start() {
+	if (!(probe.keys = calloc(PROBE_KEYS_MAX, sizeof(struct probe_key)))) {
+		die_err("calloc()");
+	}
+	probe.on = true;
+}
+
+
+// Get number of keys followed to the end, or given up on
+size_t probe_done() {
+	return probe.on ? __atomic_load_n(&probe.n_swapped, __ATOMIC_ACQUIRE) : 0;
+}
+
+
+// A key event came in
+uint64_t probe_key() {
+	if (!probe.on) {
+		return 0;
+	}
+	probe.n_staged = 0;
+	return now_ns();
+}
+
+
+// Input of the key event of time t has been queued
+void probe_key_sent(uint64_t t) {
+	struct probe_key *k;
+	if (!probe.on || probe.n_staged == 0 || probe.n_keys == PROBE_KEYS_MAX) {
+		return;
+	}
+	k = &probe.keys[probe.n_keys];
+	k->t[PROBE_INPUT] = t;
+	k->in_end = probe.queued;
+	memcpy(k->echo, probe.staged, probe.n_staged);
+	k->n_echo = probe.n_staged;
+	probe.n_staged = 0;
+	__atomic_store_n(&probe.n_keys, probe.n_keys + 1, __ATOMIC_RELEASE);
+}
+
+
+// n bytes of input at p were queued
+void probe_input(const char *p, size_t n) {
+	size_t m;
+	if (!probe.on) {
+		return;
+	}
+	m = PROBE_ECHO_MAX - probe.n_staged < n ? PROBE_ECHO_MAX - probe.n_staged : n;
+	memcpy(probe.staged + probe.n_staged, p, m);
+	probe.n_staged += m;
+	probe.queued += n;
+}
+
+
+// n bytes of input were written to the child
+void probe_write(size_t n) {
+	size_t i, n_keys;
+	uint64_t now;
+	if (!probe.on) {
+		return;
+	}
+	probe.written += n;
+	n_keys = __atomic_load_n(&probe.n_keys, __ATOMIC_ACQUIRE);
+	now = now_ns();
+	for (i = probe.n_written; i < n_keys && probe.keys[i].in_end <= probe.written; i++) {
+		probe.keys[i].t[PROBE_WRITE] = now;
+	}
+	__atomic_store_n(&probe.n_written, i, __ATOMIC_RELEASE);
+}
+
+
+// n bytes of output were read from the child
+void probe_read(size_t n) {
+	struct probe_read *r;
+	if (!probe.on) {
+		return;
+	}
+	probe.read += n;
+	r = &probe.reads[probe.n_reads % PROBE_READS];
+	r->end = probe.read;
+	r->t = now_ns();
+	__atomic_store_n(&probe.n_reads, probe.n_reads + 1, __ATOMIC_RELEASE);
+}
+
+
+// Get time of the read that output up to byte end came with. If it was forgotten, the oldest
+// read remembered stands in
+static uint64_t _read_time(size_t end) {
+	size_t n_reads = __atomic_load_n(&probe.n_reads, __ATOMIC_ACQUIRE);
+	if (probe.read_i + PROBE_READS < n_reads) {
+		probe.read_i = n_reads - PROBE_READS;
+	}
+	while (probe.read_i + 1 < n_reads && probe.reads[probe.read_i % PROBE_READS].end < end) {
+		probe.read_i++;
+	}
+	return probe.reads[probe.read_i % PROBE_READS].t;
+}
+
+
+// n bytes of output at p are being parsed
+void probe_match(const char *p, size_t n) {
+	struct probe_key *k;
+	size_t n_written, from;
+	const char *echo;
+	if (!probe.on) {
+		return;
+	}
+	n_written = __atomic_load_n(&probe.n_written, __ATOMIC_ACQUIRE);
+	for ( ; probe.n_matched < n_written; probe.n_matched++) {
+		k = &probe.keys[probe.n_matched];
+		from = probe.search_from > probe.parsed ? probe.search_from - probe.parsed : 0;
+		if (from < n && (echo = memmem(p + from, n - from, k->echo, k->n_echo))) {
+			probe.search_from = probe.parsed + (echo - p) + k->n_echo;
+			k->t[PROBE_READ] = _read_time(probe.search_from);
+		} else if (now_ns() - k->t[PROBE_WRITE] > PROBE_TIMEOUT) {
+			// Not echoed, or not as typed
+			k->lost = true;
+		} else {
+			break;
+		}
+	}
+	probe.parsed += n;
+}
+
+
+// Output looked at by probe_match() is on the screen
+void probe_parsed() {
+	uint64_t now;
+	size_t i;
+	if (!probe.on) {
+		return;
+	}
+	now = now_ns();
+	for (i = probe.n_parsed; i < probe.n_matched; i++) {
+		probe.keys[i].t[PROBE_PARSE] = now;
+	}
+	__atomic_store_n(&probe.n_parsed, probe.n_matched, __ATOMIC_RELEASE);
+}
+
+
+// The screen is being published for a frame
+size_t probe_frame() {
+	return probe.on ? __atomic_load_n(&probe.n_parsed, __ATOMIC_ACQUIRE) : 0;
+}
+
+
+// The frame showing keys up to keys was drawn by t, and swapped in
+void probe_swap(size_t keys, uint64_t t) {
+	uint64_t now;
+	size_t i;
+	if (!probe.on || keys <= probe.n_swapped) {
+		return;
+	}
+	now = now_ns();
+	for (i = probe.n_swapped; i < keys; i++) {
+		probe.keys[i].t[PROBE_RENDER] = t;
+		probe.keys[i].t[PROBE_SWAP] = now;
+	}
+	__atomic_store_n(&probe.n_swapped, keys, __ATOMIC_RELEASE);
+}
+
+
+static int _cmp_u64(const void *a, const void *b) {
+	uint64_t x = *(const uint64_t*) a, y = *(const uint64_t*) b;
+	return x < y ? -1 : x > y;
+}
+
+
+// Print percentiles of n times (ns)
+static void _print_percentiles(const char *name, uint64_t *t, size_t n) {
+	qsort(t, n, sizeof(uint64_t), _cmp_u64);
+	fprintf(stderr, "  %-14s %9.3f %9.3f %9.3f %9.3f\n", name, t[n / 2] / 1e6,
+			t[n * 9 / 10] / 1e6, t[n * 99 / 100] / 1e6, t[n - 1] / 1e6);
+}
+
+
+// Print percentiles of the stage times of the keys followed, and stop probing
+void probe_stop() {
+	static const char *names[PROBE_STAGES] = {
+		[PROBE_WRITE]  = "input->write",
+		[PROBE_READ]   = "write->read",
+		[PROBE_PARSE]  = "parse",
+		[PROBE_RENDER] = "render",
+		[PROBE_SWAP]   = "swap",
+	};
+	struct probe_key *k;
+	uint64_t *t;
+	size_t i, n = 0, lost = 0;
+	unsigned s;
+	if (!probe.on) {
+		return;
+	}
+	probe.on = false;
+	if (!(t = malloc(probe.n_swapped * sizeof(uint64_t) + 1))) {
+		die_err("malloc()");
+	}
+	for (i = 0; i < probe.n_swapped; i++) {
+		lost += probe.keys[i].lost;
+	}
+	n = probe.n_swapped - lost;
+	fprintf(stderr, "Latency probe: %zu keys, %zu echoed and shown, %zu not echoed\n",
+			probe.n_keys, n, lost);
+	if (n > 0) {
+		fprintf(stderr, "  %-14s %9s %9s %9s %9s (ms)\n", "stage", "p50", "p90", "p99", "max");
+		for (s = PROBE_WRITE; s <= PROBE_STAGES; s++) {
+			for (i = 0, n = 0; i < probe.n_swapped; i++) {
+				k = &probe.keys[i];
+				if (k->lost) {
+					continue;
+				}
+				// Stages are stamped on different threads, so an echo can seem to be read
+				// just before its write is
+				if (s == PROBE_STAGES) {
+					t[n++] = k->t[PROBE_SWAP] - k->t[PROBE_INPUT];
+				} else {
+					t[n++] = k->t[s] > k->t[s - 1] ? k->t[s] - k->t[s - 1] : 0;
+				}
+			}
+			_print_percentiles(s == PROBE_STAGES ? "total" : names[s], t, n);
+		}
+	}
+	free(t);
+	free(probe.keys);
+	probe.keys = NULL;
+}
@@ -0,0 +1,335 @@
+#include "render.h"
+#include "reflow.h"
+#include "scrollback.h"
+
+
+// The time budget is checked every this many logical lines
+#define REFLOW_CHECK_LINES 64
+
+
+// A logical line older than the last width change. Counted back from there, so that it stays
+// the same as lines are added
+struct reflow_line {
+	uint32_t lines; // Number of lines from its first line to reflow.since
+	uint32_t rows;  // Number of rows from its first row to reflow.since
+};
+
+// Cursor over the cells of a logical line, as they are laid out in rows
+struct reflow_iter {
+	uint64_t line; // Line of the cell
+	uint64_t end;  // Line after the logical line
+	unsigned i;    // Index of the cell in its line
+	unsigned len;  // Number of cells of the line laid out
+	unsigned step; // Number of cells of the line taken by the cell
+	unsigned row;  // Row of the cell, from the first row of the logical line
+	unsigned col;  // Column of the cell
+	unsigned w;    // Number of columns taken by the cell
+};
+
+
+// Lazy reflow
+struct reflow {
+	unsigned           width;   // Width lines are rewrapped to
+	uint64_t           since;   // First line added since the width last changed
+	// Logical lines indexed, from the most recent
+	struct reflow_line *lines;
+	size_t             n_lines;
+	size_t             cap;
+	// Scrollback as of the last call
+	uint64_t           first;   // First line
+	uint64_t           end;     // Line after the most recent one
+	// Scratch
+	struct termchar    *row;    // Decoded line
+	unsigned           row_cap; // Length of row
+	uint64_t           row_line; // Line decoded without clusters (UINT64_MAX if none)
+	unsigned           row_len; // Its length
+};
+
+
+// Create a new reflow
+struct reflow* reflow_new() {
+	struct reflow *rf;
+	if (!(rf = calloc(1, sizeof(struct reflow)))) {
+		die_err("calloc()");
+	}
+	rf->row_line = UINT64_MAX;
+	return rf;
+}
+
+
+// Free reflow
+void reflow_free(struct reflow *rf) {
+	if (!rf) {
+		return;
+	}
+	free(rf->lines);
+	free(rf->row);
+	free(rf);
+}
+
+
+// Pick up lines added to and dropped from sb. Logical lines that lost their first line are
+// dropped from the index, and what is left of them is indexed again
+static void _update(struct reflow *rf, struct scrollback *sb) {
+	struct termchar *tmp;
+	if (scrollback_width(sb) > rf->row_cap) {
+		if (!(tmp = realloc(rf->row, scrollback_width(sb) * sizeof(struct termchar)))) {
+			die_err("realloc()");
+		}
+		rf->row = tmp;
+		rf->row_cap = scrollback_width(sb);
+		rf->row_line = UINT64_MAX;
+	}
+	rf->end = scrollback_end(sb);
+	rf->first = rf->end - scrollback_size(sb);
+	if (rf->since <= rf->first) {
+		rf->n_lines = 0;
+		return;
+	}
+	for ( ; rf->n_lines > 0 && rf->since - rf->lines[rf->n_lines - 1].lines < rf->first;
+			rf->n_lines--);
+}
+
+
+// Get line after the lines not yet indexed
+static uint64_t _indexed(const struct reflow *rf) {
+	return rf->since - (rf->n_lines > 0 ? rf->lines[rf->n_lines - 1].lines : 0);
+}
+
+
+// Get number of rows of logical lines indexed
+static uint64_t _rows(const struct reflow *rf) {
+	return rf->n_lines > 0 ? rf->lines[rf->n_lines - 1].rows : 0;
+}
+
+
+// Decode line into the scratch row, and return its length. Indexing looks at each line twice,
+// so the last line decoded without clusters isn't decoded again
+static unsigned _decode(struct reflow *rf, struct scrollback *sb, uint64_t line,
+		struct graphemes *clusters) {
+	unsigned n;
+	if (!clusters && line == rf->row_line) {
+		return rf->row_len;
+	}
+	n = scrollback_get(sb, rf->end - 1 - line, rf->row, rf->row_cap, clusters);
+	rf->row_line = clusters ? UINT64_MAX : line;
+	rf->row_len = n;
+	return n;
+}
+
+
+// Was line soft-wrapped?
+static bool _wrapped(struct reflow *rf, struct scrollback *sb, uint64_t line) {
+	unsigned n = _decode(rf, sb, line, NULL);
+	return n > 0 && (rf->row[n - 1].flags & RENDERER_CELL_WRAPPED);
+}
+
+
+// Start cursor before the first cell of the logical line of lines [first, end)
+static void _iter_start(struct reflow_iter *it, uint64_t first, uint64_t end) {
+	memset(it, 0, sizeof(struct reflow_iter));
+	it->line = first - 1;
+	it->end = end;
+}
+
+
+// Move cursor to the next cell of its logical line, decoding lines into the scratch row as it
+// gets to them. Returns false if there are no more cells
+static bool _next(struct reflow *rf, struct scrollback *sb, struct reflow_iter *it,
+		struct graphemes *clusters) {
+	const struct termchar *c;
+	it->col += it->w;
+	it->i += it->step;
+	while (it->i >= it->len) {
+		if (++it->line >= it->end) {
+			return false;
+		}
+		it->len = _decode(rf, sb, it->line, clusters);
+		// A soft-wrapped line ends with an empty cell if a wide character was wrapped early
+		if (it->len > 0 && (rf->row[it->len - 1].flags & RENDERER_CELL_WRAPPED)
+				&& !rf->row[it->len - 1].to_draw) {
+			it->len--;
+		}
+		it->i = 0;
+	}
+	// Wide characters take their continuation cell along, and move to the next row if they
+	// don't fit
+	c = &rf->row[it->i];
+	it->w = ((c->flags & RENDERER_CELL_WIDE) && rf->width > 1) ? 2 : 1;
+	it->step = ((c->flags & RENDERER_CELL_WIDE) && it->i + 1 < it->len
+			&& (c[1].flags & RENDERER_CELL_WIDE_CONT)) ? 2 : 1;
+	if (it->col > 0 && it->col + it->w > rf->width) {
+		it->row++;
+		it->col = 0;
+	}
+	return true;
+}
+
+
+// Index the next older logical line
+static void _index_one(struct reflow *rf, struct scrollback *sb) {
+	struct reflow_line *tmp;
+	struct reflow_iter it;
+	uint64_t end = _indexed(rf), first = end - 1;
+	// Earlier lines belong to it if they were soft-wrapped
+	while (first > rf->first && _wrapped(rf, sb, first - 1)) {
+		first--;
+	}
+	_iter_start(&it, first, end);
+	while (_next(rf, sb, &it, NULL));
+	if (rf->n_lines == rf->cap) {
+		rf->cap = rf->cap ? rf->cap * 2 : 256;
+		if (!(tmp = realloc(rf->lines, rf->cap * sizeof(struct reflow_line)))) {
+			die_err("realloc()");
+		}
+		rf->lines = tmp;
+	}
+	rf->lines[rf->n_lines].lines = rf->since - first;
+	rf->lines[rf->n_lines].rows = _rows(rf) + it.row + 1;
+	rf->n_lines++;
+}
+
+
+// Rewrap lines of sb added so far to width
+void reflow_reset(struct reflow *rf, struct scrollback *sb, unsigned width) {
+	rf->width = width > 0 ? width : 1;
+	rf->since = sb ? scrollback_end(sb) : 0;
+	rf->n_lines = 0;
+}
+
+
+// Index logical lines of sb for about budget_ns nanoseconds
+bool reflow_step(struct reflow *rf, struct scrollback *sb, uint64_t budget_ns) {
+	uint64_t start = now_ns();
+	unsigned k;
+	if (!sb) {
+		return false;
+	}
+	_update(rf, sb);
+	for (k = 0; _indexed(rf) > rf->first; ) {
+		_index_one(rf, sb);
+		if (++k % REFLOW_CHECK_LINES == 0 && now_ns() - start > budget_ns) {
+			return _indexed(rf) > rf->first;
+		}
+	}
+	return false;
+}
+
+
+// Get number of rows of sb
+uint64_t reflow_size(struct reflow *rf, struct scrollback *sb) {
+	_update(rf, sb);
+	if (rf->since <= rf->first) {
+		return rf->end - rf->first;
+	}
+	return rf->end - rf->since + _rows(rf) + (_indexed(rf) - rf->first);
+}
+
+
+// Get row num of sb into n cells
+uint64_t reflow_get(struct reflow *rf, struct scrollback *sb, int64_t num, struct termchar *row,
+		unsigned n, struct graphemes *clusters, struct reflow_pos *srcs) {
+	struct reflow_iter it;
+	uint64_t ret;
+	size_t lo, hi, mid;
+	unsigned j, len, want;
+	if (n > 0) {
+		memset(row, 0, n * sizeof(struct termchar));
+	}
+	for (j = 0; srcs && j < n; j++) {
+		srcs[j].line = UINT64_MAX;
+		srcs[j].col = 0;
+	}
+	_update(rf, sb);
+	if (num >= (int64_t) rf->since) {
+		// Added at the current width
+		if ((uint64_t) num < rf->first || (uint64_t) num >= rf->end) {
+			return UINT64_MAX;
+		}
+		len = scrollback_get(sb, rf->end - 1 - num, row, n, clusters);
+		for (j = 0; srcs && j < len; j++) {
+			srcs[j].line = num;
+			srcs[j].col = j;
+		}
+		return num;
+	}
+	// Index as far back as the row
+	while (num < (int64_t) (rf->since - _rows(rf)) && _indexed(rf) > rf->first) {
+		_index_one(rf, sb);
+	}
+	if (num < (int64_t) (rf->since - _rows(rf))) {
+		return UINT64_MAX;
+	}
+	// Find the logical line holding it, and lay it out up to the row
+	for (lo = 0, hi = rf->n_lines - 1; lo < hi; ) {
+		mid = (lo + hi) / 2;
+		if ((int64_t) (rf->since - rf->lines[mid].rows) <= num) {
+			hi = mid;
+		} else {
+			lo = mid + 1;
+		}
+	}
+	want = num - (int64_t) (rf->since - rf->lines[lo].rows);
+	ret = rf->since - rf->lines[lo].lines;
+	_iter_start(&it, ret, rf->since - (lo > 0 ? rf->lines[lo - 1].lines : 0));
+	while (_next(rf, sb, &it, clusters) && it.row <= want) {
+		if (it.row < want) {
+			continue;
+		}
+		if (it.col == 0) {
+			ret = it.line;
+		}
+		for (j = 0; j < it.w && j < it.step && it.col + j < n; j++) {
+			row[it.col + j] = rf->row[it.i + j];
+			row[it.col + j].flags &= ~RENDERER_CELL_WRAPPED;
+			if (srcs) {
+				srcs[it.col + j].line = it.line;
+				srcs[it.col + j].col = it.i + j;
+			}
+		}
+		if (it.w < it.step && it.col < n) {
+			// Narrowed to fit a single column
+			row[it.col].flags &= ~RENDERER_CELL_WIDE;
+		}
+	}
+	return ret;
+}
+
+
+// Get number of the row holding the start of line of sb
+int64_t reflow_row(struct reflow *rf, struct scrollback *sb, uint64_t line) {
+	struct reflow_iter it;
+	size_t lo, hi, mid;
+	_update(rf, sb);
+	if (line >= rf->since) {
+		return line;
+	}
+	while (_indexed(rf) > line && _indexed(rf) > rf->first) {
+		_index_one(rf, sb);
+	}
+	if (_indexed(rf) > line) {
+		// Dropped from scrollback
+		return (int64_t) (rf->since - _rows(rf)) - (int64_t) (_indexed(rf) - line);
+	}
+	for (lo = 0, hi = rf->n_lines - 1; lo < hi; ) {
+		mid = (lo + hi) / 2;
+		if (rf->since - rf->lines[mid].lines <= line) {
+			hi = mid;
+		} else {
+			lo = mid + 1;
+		}
+	}
+	_iter_start(&it, rf->since - rf->lines[lo].lines,
+			rf->since - (lo > 0 ? rf->lines[lo - 1].lines : 0));
+	while (_next(rf, sb, &it, NULL) && it.line < line);
+	return (int64_t) (rf->since - rf->lines[lo].rows) + it.row;
+}
+
+
+// Get line of sb as it is stored
+const struct termchar* reflow_line(struct reflow *rf, struct scrollback *sb, uint64_t line,
+		struct graphemes *clusters, unsigned *n) {
+	_update(rf, sb);
+	*n = _decode(rf, sb, line, clusters);
+	return rf->row;
+}
@@ -5,6 +5,24 @@
 #include "util.h"
 #include "color.h"
 #include "render.h"
+#include "width.h"
+#include "boxdraw.h"
+#include "probe.h"
+
+
+// Resolve packed cell color (see render.h) with the palette texture
+#define GLSL_RESOLVE_COLOR \
+"uniform sampler2D palette;\n" \
+"vec4 resolve_color(uint c) {\n" \
+"  if ((c & 0x1000000u) != 0u) {\n" \
+"    vec4 col = vec4(uvec4(c >> 16, c >> 8, c, 255u) & 255u) / 255.0;\n" \
+"    if ((c & 0x2000000u) != 0u) col.rgb *= 0.6;\n" \
+"    return col;\n" \
+"  }\n" \
+"  vec4 col = texelFetch(palette, ivec2(int(c & 511u), 0), 0);\n" \
+"  if ((c & 0x2000000u) != 0u) col.rgb *= 0.6;\n" \
+"  return col;\n" \
+"}\n"
 
 
 // Vertex shader for text
@@ -19,16 +37,201 @@ const char *vtxtsrc =
 "}";
 
 
-// Fragment shader for text
+// Fragment shader for text. If box_code is non-zero, the glyph is drawn procedurally over
+// the whole cell instead of being sampled from the glyph texture (see boxdraw.c for layout).
+// If sdf is true, the glyph texture is a signed distance field (0.5 on the outline). Text
+// with the blink flag is hidden for the second half of every second of time
 const char *ftxtsrc =
 "#version 330 core\n"
 "in vec2 tex_coords;\n"
 "out vec4 color;\n"
 "uniform sampler2D text;\n"
-"uniform vec3 text_color;\n"
+"uniform uint text_color;\n"
+"uniform uint box_code;\n"
+"uniform vec2 cell_size;\n"
+"uniform bool sdf;\n"
+"uniform float baseline;\n"
+"uniform float time;\n"
+GLSL_RESOLVE_COLOR
+// Is p within [lo, hi)?
+"float in_rect(vec2 p, vec2 lo, vec2 hi) {\n"
+"  return (all(greaterThanEqual(p, lo)) && all(lessThan(p, hi))) ? 1.0 : 0.0;\n"
+"}\n"
+// Antialiased coverage of a stroke of width w, at distance d from its center line
+"float stroke(float d, float w) {\n"
+"  return clamp(w / 2.0 + 0.5 - abs(d), 0.0, 1.0);\n"
+"}\n"
+"uint arm(uint i) {\n"
+"  return (box_code >> (2u * i)) & 3u;\n"
+"}\n"
+"float thickness(uint w, float lw) {\n"
+"  return float(w) * lw;\n"
+"}\n"
+// Rounded corner. Mirrored so that the arms always point right and down
+"float box_arc(vec2 p, vec2 c, float lw) {\n"
+"  vec2 m = c - floor(lw / 2.0) + lw / 2.0;\n"
+"  float rad = floor(min(cell_size.x, cell_size.y) / 2.0);\n"
+"  if (arm(0u) != 0u) p.x = 2.0 * m.x - p.x;\n"
+"  if (arm(2u) != 0u) p.y = 2.0 * m.y - p.y;\n"
+"  vec2 ctr = m + rad;\n"
+"  if (p.x < ctr.x && p.y < ctr.y) return stroke(length(p - ctr) - rad, lw);\n"
+"  if (p.y >= ctr.y) return stroke(p.x - m.x, lw);\n"
+"  return stroke(p.y - m.y, lw);\n"
+"}\n"
+// Dash mask along a stroke of length len
+"float dash(float q, float len, uint n) {\n"
+"  float seg = len / float(n);\n"
+"  float gap = max(1.0, floor(seg / 3.0));\n"
+"  float f = mod(q, seg);\n"
+"  return (f >= gap / 2.0 && f < seg - gap / 2.0) ? 1.0 : 0.0;\n"
+"}\n"
+// Box-drawing lines. Double lines are drawn as a solid triple-width stroke minus a gap, so
+// that corners and junctions join up. Light and heavy arms are added on top
+"float box_lines(vec2 p) {\n"
+"  float lw = max(1.0, floor(min(cell_size.x, cell_size.y) / 8.0 + 0.5));\n"
+"  vec2 c = floor(cell_size / 2.0);\n"
+"  uint l = arm(0u), r = arm(1u), u = arm(2u), d = arm(3u);\n"
+"  if ((box_code & 0x800u) != 0u) return box_arc(p, c, lw);\n"
+"  float tv = thickness(max(u, d), lw), th = thickness(max(l, r), lw);\n"
+"  vec2 lo = c - floor(vec2(tv, th) / 2.0);\n"
+"  vec2 hi = lo + vec2(tv, th);\n"
+"  if (tv == 0.0) { lo.x = c.x; hi.x = c.x; }\n"
+"  if (th == 0.0) { lo.y = c.y; hi.y = c.y; }\n"
+"  vec2 glo = c - floor(lw / 2.0);\n"
+"  float solid = 0.0, gap = 0.0, lines = 0.0;\n"
+// Extents of the arms along their axis (left/right, up/down). Arms without an opposite arm
+// stop at the nearest stroke of a double line running across them
+"  vec2 end = hi, start = lo;\n"
+"  if (r == 0u && u == 3u && d == 3u) end.x = lo.x + lw;\n"
+"  if (l == 0u && u == 3u && d == 3u) start.x = hi.x - lw;\n"
+"  if (d == 0u && l == 3u && r == 3u) end.y = lo.y + lw;\n"
+"  if (u == 0u && l == 3u && r == 3u) start.y = hi.y - lw;\n"
+"  uint w[4] = uint[4](l, r, u, d);\n"
+"  for (uint i = 0u; i < 4u; i++) {\n"
+"    if (w[i] == 0u) continue;\n"
+"    bool horiz = i < 2u;\n"
+"    float q = horiz ? p.x : p.y, a = horiz ? p.y : p.x;\n"
+"    float len = horiz ? cell_size.x : cell_size.y;\n"
+"    float ca = horiz ? c.y : c.x;\n"
+"    float s = (i == 0u || i == 2u) ? 0.0 : (horiz ? start.x : start.y);\n"
+"    float e = (i == 0u || i == 2u) ? (horiz ? end.x : end.y) : len;\n"
+"    if (w[i] == 3u) {\n"
+"      s = (i == 0u || i == 2u) ? 0.0 : (horiz ? lo.x : lo.y);\n"
+"      e = (i == 0u || i == 2u) ? (horiz ? hi.x : hi.y) : len;\n"
+"      float t = 3.0 * lw, b = ca - floor(t / 2.0);\n"
+"      solid = max(solid, (q >= s && q < e && a >= b && a < b + t) ? 1.0 : 0.0);\n"
+"      s = (i == 0u || i == 2u) ? 0.0 : (horiz ? glo.x : glo.y);\n"
+"      e = (i == 0u || i == 2u) ? (horiz ? glo.x : glo.y) + lw : len;\n"
+"      b = ca - floor(lw / 2.0);\n"
+"      gap = max(gap, (q >= s && q < e && a >= b && a < b + lw) ? 1.0 : 0.0);\n"
+"    } else {\n"
+"      float t = thickness(w[i], lw), b = ca - floor(t / 2.0);\n"
+"      lines = max(lines, (q >= s && q < e && a >= b && a < b + t) ? 1.0 : 0.0);\n"
+"    }\n"
+"  }\n"
+"  float cov = max(lines, solid * (1.0 - gap));\n"
+"  uint n = (box_code >> 8) & 7u;\n"
+"  if (n != 0u) cov *= (l != 0u) ? dash(p.x, cell_size.x, n) : dash(p.y, cell_size.y, n);\n"
+"  return cov;\n"
+"}\n"
+// Block elements, in eighths of a cell, with optional shade
+"float box_rect(vec2 p) {\n"
+"  uvec4 e = (uvec4(box_code) >> uvec4(0u, 4u, 8u, 12u)) & 15u;\n"
+"  vec2 lo = floor(vec2(e.xz) * cell_size / 8.0 + 0.5);\n"
+"  vec2 hi = floor(vec2(e.yw) * cell_size / 8.0 + 0.5);\n"
+"  uint shade = (box_code >> 16) & 3u;\n"
+"  return in_rect(p, lo, hi) * (shade == 0u ? 1.0 : float(shade) / 4.0);\n"
+"}\n"
+"float box_quad(vec2 p) {\n"
+"  vec2 h = floor(cell_size / 2.0 + 0.5);\n"
+"  float cov = 0.0;\n"
+"  if ((box_code & 1u) != 0u) cov += in_rect(p, vec2(0.0), h);\n"
+"  if ((box_code & 2u) != 0u) cov += in_rect(p, vec2(h.x, 0.0), vec2(cell_size.x, h.y));\n"
+"  if ((box_code & 4u) != 0u) cov += in_rect(p, vec2(0.0, h.y), vec2(h.x, cell_size.y));\n"
+"  if ((box_code & 8u) != 0u) cov += in_rect(p, h, cell_size);\n"
+"  return min(cov, 1.0);\n"
+"}\n"
+"float box_diag(vec2 p, float lw) {\n"
+"  vec2 q = p / cell_size;\n"
+"  float g = length(1.0 / cell_size), cov = 0.0;\n"
+"  if ((box_code & 1u) != 0u) cov = max(cov, stroke((q.x + q.y - 1.0) / g, lw));\n"
+"  if ((box_code & 2u) != 0u) cov = max(cov, stroke((q.x - q.y) / g, lw));\n"
+"  return cov;\n"
+"}\n"
+// Powerline arrows (pointing right, mirrored for left) and corner triangles (lower left,
+// mirrored for the other corners)
+"float box_pointer(vec2 p, float lw) {\n"
+"  if ((box_code & 1u) != 0u) p.x = cell_size.x - p.x;\n"
+"  vec2 q = p / cell_size;\n"
+"  float d = (q.x + abs(2.0 * q.y - 1.0) - 1.0) / length(vec2(1.0, 2.0) / cell_size);\n"
+"  return ((box_code & 4u) != 0u) ? stroke(d, lw) : clamp(0.5 - d, 0.0, 1.0);\n"
+"}\n"
+"float box_corner(vec2 p, float lw) {\n"
+"  if ((box_code & 1u) != 0u) p.x = cell_size.x - p.x;\n"
+"  if ((box_code & 2u) != 0u) p.y = cell_size.y - p.y;\n"
+"  vec2 q = p / cell_size;\n"
+"  float d = (q.x - q.y) / length(1.0 / cell_size);\n"
+"  return ((box_code & 4u) != 0u) ? stroke(d, lw) : clamp(0.5 - d, 0.0, 1.0);\n"
+"}\n"
+// Underlines below the baseline, and strikethrough
+"float box_decor(vec2 p, float lw) {\n"
+"  float cov = 0.0, y;\n"
+"  if ((box_code & 1u) != 0u) {\n"
+"    y = clamp(baseline + lw, 0.0, cell_size.y - lw);\n"
+"    cov = max(cov, in_rect(p, vec2(0.0, y), vec2(cell_size.x, y + lw)));\n"
+"  }\n"
+"  if ((box_code & 2u) != 0u) {\n"
+"    y = clamp(baseline + lw, 0.0, cell_size.y - 3.0 * lw);\n"
+"    cov = max(cov, in_rect(p, vec2(0.0, y), vec2(cell_size.x, y + lw)));\n"
+"    cov = max(cov, in_rect(p, vec2(0.0, y + 2.0 * lw), vec2(cell_size.x, y + 3.0 * lw)));\n"
+"  }\n"
+"  if ((box_code & 4u) != 0u) {\n"
+"    y = clamp(baseline + 2.0 * lw, 0.0, cell_size.y - 1.5 * lw);\n"
+"    cov = max(cov, stroke(p.y - y - lw * sin(6.2831853 * p.x / cell_size.x), lw));\n"
+"  }\n"
+"  if ((box_code & 8u) != 0u) {\n"
+"    y = floor(baseline * 0.65 - lw / 2.0);\n"
+"    cov = max(cov, in_rect(p, vec2(0.0, y), vec2(cell_size.x, y + lw)));\n"
+"  }\n"
+"  return cov;\n"
+"}\n"
+"float box_alpha(vec2 p) {\n"
+"  float lw = max(1.0, floor(min(cell_size.x, cell_size.y) / 8.0 + 0.5));\n"
+"  switch (box_code >> 28) {\n"
+"  case 1u: return box_lines(p);\n"
+"  case 2u: return box_rect(p);\n"
+"  case 3u: return box_quad(p);\n"
+"  case 4u: return box_diag(p, lw);\n"
+"  case 5u: return box_pointer(p, lw);\n"
+"  case 6u: return box_corner(p, lw);\n"
+"  case 7u: return box_decor(p, lw);\n"
+"  }\n"
+"  return 0.0;\n"
+"}\n"
 "void main() {\n"
-"  vec4 sampled = vec4(1.0, 1.0, 1.0, texture(text, tex_coords).r);\n"
-"  color = vec4(text_color, 1.0) * sampled;\n"
+"  float alpha;\n"
+"  if (box_code == 0u) {\n"
+"    alpha = texture(text, tex_coords).r;\n"
+"    if (sdf) {\n"
+"      float w = max(fwidth(alpha), 1.0 / 256.0);\n"
+"      alpha = smoothstep(0.5 - w, 0.5 + w, alpha);\n"
+"    }\n"
+"  } else {\n"
+"    alpha = box_alpha(tex_coords * cell_size);\n"
+"  }\n"
+"  if ((text_color & 0x4000000u) != 0u && fract(time) >= 0.5) alpha = 0.0;\n"
+"  color = vec4(resolve_color(text_color).rgb, alpha);\n"
+"}";
+
+
+// Fragment shader for images. Cells past the edge of an image sample the transparent border
+const char *fimgsrc =
+"#version 330 core\n"
+"in vec2 tex_coords;\n"
+"out vec4 color;\n"
+"uniform sampler2D image;\n"
+"void main() {\n"
+"  color = texture(image, tex_coords);\n"
 "}";
 
 
@@ -46,9 +249,10 @@ const char *vbgsrc =
 const char *fbgsrc =
 "#version 330 core\n"
 "out vec4 color;\n"
-"uniform vec4 bg_color;\n"
+"uniform uint bg_color;\n"
+GLSL_RESOLVE_COLOR
 "void main() {\n"
-"  color = bg_color;\n"
+"  color = resolve_color(bg_color);\n"
 "}";
 
 
@@ -56,6 +260,23 @@ const char *fbgsrc =
 
 #define BTE_TABSZ 8
 
+// Time spent searching per frame, while there are lines left to search
+#define RENDERER_SEARCH_NS 4000000
+
+// Time spent rewrapping scrollback per frame, after the width changed
+#define RENDERER_REFLOW_NS 2000000
+
+// Most memory taken by images, on either side (bytes)
+#define RENDERER_IMAGE_BUDGET (256 << 20)
+
+// Longest a synchronized update (DECSET 2026) holds back frames, in case the application never
+// ends it
+#define RENDERER_SYNC_MS 200
+
+// Background colors (palette indices) of cells in search matches, and in the current match
+#define RENDERER_SEARCH_BG         3
+#define RENDERER_SEARCH_CURRENT_BG 9
+
 
 // Compile and link vertex and fragment shaders
 static GLuint _load_shaders(const char *vsrc, const char *fsrc) {
@@ -97,37 +318,125 @@ static GLuint _load_shaders(const char *vsrc, const char *fsrc) {
 }
 
 
+// Point rows of terminal buffer at consecutive rows of termbox, and reset scroll region to
+// the whole screen
+static void _termbuf_reset_rows(struct termbuf *tb) {
+	unsigned i;
+	for (i = 0; i < tb->dim.y; i++) {
+		tb->rows[i] = &tb->termbox[i * tb->dim.x];
+	}
+	tb->scroll_top = 0;
+	tb->scroll_bot = tb->dim.y;
+}
+
+
 // Create a new terminal buffer
-static struct termbuf* _termbuf_new(uvec2_t dim, const struct glyph *cursor_glyph) {
+static struct termbuf* _termbuf_new(uvec2_t dim, uint32_t cursor_cp, uint32_t cursor_box) {
 	struct termbuf *ret;
 	if (!(ret = calloc(1, sizeof(struct termbuf)))) {
 		die_err("calloc()");
 	}
-	if (!(ret->termbox = calloc(dim.x * (dim.y + 1), sizeof(struct termchar)))) {
+	if (!(ret->termbox = calloc(dim.x * dim.y, sizeof(struct termchar)))) {
+		die_err("calloc()");
+	}
+	if (!(ret->rows = calloc(dim.y, sizeof(struct termchar*)))
+			|| !(ret->spare_rows = calloc(dim.y, sizeof(struct termchar*)))) {
 		die_err("calloc()");
 	}
 	ret->dim = dim;
-	ret->cursor_glyph = cursor_glyph;
+	ret->cursor_cp = cursor_cp;
+	ret->cursor_box = cursor_box;
 	ret->cursor.x = ret->cursor.y = 0;
 	ret->cursor_vis = true;
-	ret->toprow = 0;
+	ret->clusters = graphemes_new();
+	_termbuf_reset_rows(ret);
 	return ret;
 }
 
 
 // Free a terminal buffer
 static void _termbuf_free(struct termbuf *tb) {
+	scrollback_free(tb->scrollback);
+	graphemes_free(tb->clusters);
+	free(tb->spare_rows);
+	free(tb->rows);
 	free(tb->termbox);
 	free(tb);
 }
 
 
+// Free grapheme clusters no longer referenced by any cell, if the table has grown enough
+static void _termbuf_collect(struct termbuf *m) {
+	struct termchar *row;
+	unsigned x, y;
+	if (!graphemes_should_collect(m->clusters)) {
+		return;
+	}
+	for (y = 0; y < m->dim.y; y++) {
+		row = m->rows[y];
+		for (x = 0; x < m->dim.x; x++) {
+			if (row[x].flags & RENDERER_CELL_CLUSTER) {
+				graphemes_mark(m->clusters, row[x].cp);
+			}
+		}
+	}
+	graphemes_sweep(m->clusters);
+}
+
+
+// Fill palette with the 16 standard colors, the 6x6x6 color cube, the grayscale ramp, and
+// default foreground and background colors
+static void _palette_init(struct color *palette, const struct color *std, const struct color *fg,
+		const struct color *bg) {
+	static const uint8_t levels[6] = { 0, 95, 135, 175, 215, 255 };
+	unsigned i;
+	for (i = 0; i < 16; i++) {
+		palette[i] = std[i];
+	}
+	for (i = 0; i < 216; i++) {
+		palette[16 + i].r = levels[i / 36];
+		palette[16 + i].g = levels[(i / 6) % 6];
+		palette[16 + i].b = levels[i % 6];
+		palette[16 + i].a = 0xff;
+	}
+	for (i = 0; i < 24; i++) {
+		palette[232 + i].r = palette[232 + i].g = palette[232 + i].b = 8 + 10 * i;
+		palette[232 + i].a = 0xff;
+	}
+	palette[RENDERER_COLOR_FG] = *fg;
+	palette[RENDERER_COLOR_BG] = *bg;
+}
+
+
+// Create texture for palette, and point palette samplers of shaders to texture unit 1
+static void _palette_tex_new(struct renderer *r) {
+	GLuint shaders[2] = { r->text_shader, r->bg_shader };
+	unsigned i;
+	glGenTextures(1, &r->palette_tex);
+	glBindTexture(GL_TEXTURE_2D, r->palette_tex);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, RENDERER_PALETTE_SZ, 1, 0, GL_RGBA,
+			GL_UNSIGNED_BYTE, r->palette);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glBindTexture(GL_TEXTURE_2D, 0);
+	for (i = 0; i < 2; i++) {
+		glUseProgram(shaders[i]);
+		glUniform1i(glGetUniformLocation(shaders[i], "palette"), 1);
+	}
+	glUseProgram(0);
+	r->palette_dirty = false;
+}
+
+
 // Create a new renderer
-struct renderer *renderer_new(struct window *w, struct fonts *f, const char *fg, const char *bg, uint32_t cursor, const struct color *palette) {
+struct renderer *renderer_new(struct window *w, struct fonts *f, const char *fg, const char *bg, uint32_t cursor, const struct color *palette, bool ligatures, size_t scrollback, bool spill, bool smooth_scroll) {
 	struct renderer *r;
 	struct color fgc, bgc;
+	vec4_t clear_col;
 	uvec2_t dim;
-	const struct glyph *cursor_glyph;
+	uint32_t cursor_box;
 
 	if (!w) {
 		die("NULL window");
@@ -143,26 +452,49 @@ struct renderer *renderer_new(struct window *w, struct fonts *f, const char *fg,
 	if (!color_parse(&fgc, fg)) {
 		die_fmt("Unable to parse foreground color: %s", fg);
 	}
-	color_normalize(&fgc, &r->default_fgcol);
 	if (!color_parse(&bgc, bg)) {
 		die_fmt("Unable to parse foreground color: %s", bg);
 	}
-	color_normalize(&bgc, &r->default_bgcol);
-	r->fgcol = r->default_fgcol;
-	r->bgcol = r->default_bgcol;
-	// Allocate draw and modify buffers
+	_palette_init(r->init_palette, palette, &fgc, &bgc);
+	memcpy(r->palette, r->init_palette, sizeof(r->palette));
+	r->fg = RENDERER_COLOR_FG;
+	r->bg = RENDERER_COLOR_BG;
+	r->attrs = 0;
+	r->has_blink = false;
+	r->blink_phase = 0;
+	clock_gettime(CLOCK_MONOTONIC, &r->start_time);
+	r->last_frame = 0;
+	// Allocate primary and alternate screens. The alternate screen is allocated upfront, so
+	// that switching to it never allocates
 	dim.x = w->dim.x / f->advance.x;
 	dim.y = w->dim.y / f->advance.y;
-	cursor_glyph = fonts_get_glyph(f, cursor);
-	r->draw_buf = _termbuf_new(dim, cursor_glyph);
-	r->mod_buf = _termbuf_new(dim, cursor_glyph);
+	cursor_box = boxdraw_code(cursor);
+	r->primary = _termbuf_new(dim, cursor, cursor_box);
+	r->alternate = _termbuf_new(dim, cursor, cursor_box);
+	r->primary->scrollback = scrollback_new(scrollback, spill);
+	r->view = viewport_new(smooth_scroll);
+	r->view_rows = NULL;
+	r->n_view_rows = r->view_rows_cap = r->view_hist = 0;
+	r->view_shift = 0;
+	r->scrolling = false;
+	r->search = search_new();
+	r->view_marks = NULL;
+	r->view_marks_cap = 0;
+	r->view_marked = r->searching = r->reflowing = false;
+	viewport_reflow(r->view, r->primary->scrollback, dim.x);
+	r->mod_buf = r->primary;
+	r->draw_buf = _termbuf_new(dim, cursor, cursor_box);
+	r->sync_deadline = 0;
+	r->bracketed_paste = false;
 	// Set pointers
 	r->window = w;
 	r->fonts = f;
-	r->palette = palette;
+	r->shaper = ligatures ? shaper_new(f) : NULL;
 	// Compile and link shaders
 	r->text_shader = _load_shaders(vtxtsrc, ftxtsrc);
 	r->bg_shader = _load_shaders(vbgsrc, fbgsrc);
+	r->img_shader = _load_shaders(vtxtsrc, fimgsrc);
+	_palette_tex_new(r);
 	// Create and initialize VAO and VBO for text
 	glGenVertexArrays(1, &r->VAO_text);
 	glGenBuffers(1, &r->VBO_text);
@@ -173,6 +505,19 @@ struct renderer *renderer_new(struct window *w, struct fonts *f, const char *fg,
 	glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, 4 * sizeof(GLfloat), 0);
 	glBindBuffer(GL_ARRAY_BUFFER, 0);
 	glBindVertexArray(0);
+	// Create VAO and VBO for images. Their vertices are uploaded every frame
+	glGenVertexArrays(1, &r->VAO_img);
+	glGenBuffers(1, &r->VBO_img);
+	glBindVertexArray(r->VAO_img);
+	glBindBuffer(GL_ARRAY_BUFFER, r->VBO_img);
+	glEnableVertexAttribArray(0);
+	glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, 4 * sizeof(GLfloat), 0);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	glBindVertexArray(0);
+	r->images = images_new(RENDERER_IMAGE_BUDGET);
+	r->image_runs = NULL;
+	r->image_verts = NULL;
+	r->n_image_runs = r->image_runs_cap = r->image_verts_cap = 0;
 	// Create and initialize VAO and VBO for background
 	glGenVertexArrays(1, &r->VAO_bg);
 	glGenBuffers(1, &r->VBO_bg);
@@ -184,7 +529,8 @@ struct renderer *renderer_new(struct window *w, struct fonts *f, const char *fg,
 	glBindBuffer(GL_ARRAY_BUFFER, 0);
 	glBindVertexArray(0);
 	// Clear window
-	glClearColor(r->bgcol.x, r->bgcol.y, r->bgcol.z, r->bgcol.w);
+	color_normalize(&bgc, &clear_col);
+	glClearColor(clear_col.x, clear_col.y, clear_col.z, clear_col.w);
 	glClear(GL_COLOR_BUFFER_BIT);
 	window_refresh(r->window);
 	// Initialize mutexes
@@ -193,6 +539,25 @@ struct renderer *renderer_new(struct window *w, struct fonts *f, const char *fg,
 }
 
 
+#ifdef BTE_SHAPE_STATS
+// Print cache hit rate and shaping cost per frame
+static void _print_shape_stats(const struct renderer *r) {
+	struct shaper_stats st;
+	if (!r->shaper) {
+		return;
+	}
+	shaper_get_stats(r->shaper, &st);
+	if (st.frames == 0 || st.hits + st.misses == 0) {
+		return;
+	}
+	fprintf(stderr, "Shaping: %" PRIu64 " frames, %" PRIu64 " runs, %.1f%% cache hits, "
+			"%.1f runs and %.1f us shaped per frame\n", st.frames, st.hits + st.misses,
+			100.0 * st.hits / (st.hits + st.misses), (double) st.misses / st.frames,
+			st.shape_ns / 1000.0 / st.frames);
+}
+#endif
+
+
 // Free renderer resources
 void renderer_free(struct renderer *renderer) {
 	if (!renderer) {
@@ -200,20 +565,39 @@ void renderer_free(struct renderer *renderer) {
 		return;
 	}
 	pthread_mutex_destroy(&renderer->buf_mut);
+#ifdef BTE_SHAPE_STATS
+	_print_shape_stats(renderer);
+#endif
+	shaper_free(renderer->shaper);
 	glDeleteBuffers(1, &renderer->VBO_bg);
 	glDeleteVertexArrays(1, &renderer->VAO_bg);
 	glDeleteBuffers(1, &renderer->VBO_text);
 	glDeleteVertexArrays(1, &renderer->VAO_text);
 	glDeleteProgram(renderer->text_shader);
 	glDeleteProgram(renderer->bg_shader);
+	glDeleteBuffers(1, &renderer->VBO_img);
+	glDeleteVertexArrays(1, &renderer->VAO_img);
+	glDeleteProgram(renderer->img_shader);
+	images_free(renderer->images);
+	free(renderer->image_runs);
+	free(renderer->image_verts);
+	glDeleteTextures(1, &renderer->palette_tex);
+	_termbuf_free(renderer->primary);
+	_termbuf_free(renderer->alternate);
+	// The scrollback drawn belongs to the primary screen
+	renderer->draw_buf->scrollback = NULL;
 	_termbuf_free(renderer->draw_buf);
-	_termbuf_free(renderer->mod_buf);
+	viewport_free(renderer->view);
+	free(renderer->view_rows);
+	search_free(renderer->search);
+	free(renderer->view_marks);
 	free(renderer);
 }
 
 
-// Render glyph
-static void _render_glyph(struct renderer *r, unsigned i, unsigned j, const struct glyph *glyph) {
+// Render textured quad with top-left corner at (xpos, ypos + height)
+static void _render_quad(struct renderer *r, GLfloat xpos, GLfloat ypos, GLfloat width,
+		GLfloat height) {
 	GLfloat vertices[6][4] = {
 		{ 0.0f, 0.0f, 0.0f, 0.0f },
 		{ 0.0f, 0.0f, 0.0f, 1.0f },
@@ -222,16 +606,6 @@ static void _render_glyph(struct renderer *r, unsigned i, unsigned j, const stru
 		{ 0.0f, 0.0f, 1.0f, 1.0f },
 		{ 0.0f, 0.0f, 1.0f, 0.0f },
 	};
-	GLfloat xpos, ypos, width, height;
-	// Load texture
-	glBindTexture(GL_TEXTURE_2D, glyph->tex);
-	// Calculate dimensions
-	xpos = (j * r->fonts->advance.x + glyph->bearing.x);
-	ypos = i * r->fonts->advance.y + r->fonts->line_height \
-	       + glyph->size.y - glyph->bearing.y;
-	ypos = r->window->dim.y - ypos;
-	width = glyph->size.x;
-	height = glyph->size.y;
 	// Update vertices
 	vertices[0][0] = xpos;
 	vertices[0][1] = ypos + height;
@@ -254,23 +628,64 @@ static void _render_glyph(struct renderer *r, unsigned i, unsigned j, const stru
 }
 
 
+// Render glyph with pen at x pixels from the left, on row i
+static void _render_glyph_at(struct renderer *r, unsigned i, GLfloat x, const struct glyph *glyph) {
+	GLfloat xpos, ypos, scale = r->fonts->glyph_scale;
+	// Load texture
+	glBindTexture(GL_TEXTURE_2D, glyph->tex);
+	// Calculate dimensions. Glyph metrics are scaled if glyphs are signed distance fields
+	xpos = x + glyph->bearing.x * scale;
+	ypos = i * r->fonts->advance.y + r->fonts->line_height \
+	       + (glyph->size.y - glyph->bearing.y) * scale;
+	ypos = r->window->dim.y - ypos;
+	_render_quad(r, xpos, ypos, glyph->size.x * scale, glyph->size.y * scale);
+}
+
+
+// Render glyph
+static void _render_glyph(struct renderer *r, unsigned i, unsigned j, const struct glyph *glyph) {
+	_render_glyph_at(r, i, j * r->fonts->advance.x, glyph);
+}
+
+
+// Render procedurally drawn glyph, covering the whole cell. Uniform box_code should be set
+static void _render_box(struct renderer *r, unsigned i, unsigned j) {
+	GLfloat xpos, ypos;
+	xpos = j * r->fonts->advance.x;
+	ypos = r->window->dim.y - (i + 1) * r->fonts->advance.y;
+	_render_quad(r, xpos, ypos, r->fonts->advance.x, r->fonts->advance.y);
+}
+
+
+// Get projection matrix for drawing rows, moved up by the partial row of smooth scrolling
+static void _view_projmat(const struct renderer *r, float *projmat) {
+	unsigned i;
+	for (i = 0; i < 16; i++) {
+		projmat[i] = r->window->projmat[i];
+	}
+	projmat[13] += r->view_shift * projmat[5];
+}
+
+
+// Get search mark of cell (i, j) of the rows drawn
+static uint8_t _cell_mark(const struct renderer *r, unsigned i, unsigned j) {
+	return r->view_marked ? r->view_marks[i * r->draw_buf->dim.x + j] : SEARCH_MARK_NONE;
+}
+
+
 // Draw background for each location
 static void _render_bg(struct renderer *r) {
 	GLuint loc_bg_color, loc_proj_mat;
-	const vec4_t *bgcol;
-	const uvec2_t *advance, *dim;
-	unsigned i, j, toprow;
+	const uvec2_t *advance;
+	unsigned i, j;
+	uint8_t mark;
 	float projmat[16];
 	GLfloat vertices[6][2] = { 0 };
 	GLfloat xpos = 0.0f, ypos = 0.0f;
 	const struct termchar *tchar;
 
-	toprow = r->draw_buf->toprow;
 	advance = &r->fonts->advance;
-	dim = &r->draw_buf->dim;
-	for (i = 0; i < 16; i++) {
-		projmat[i] = r->window->projmat[i];
-	}
+	_view_projmat(r, projmat);
 	ypos = r->window->dim.y;
 
 	glUseProgram(r->bg_shader);
@@ -279,14 +694,19 @@ static void _render_bg(struct renderer *r) {
 	glUniformMatrix4fv(loc_proj_mat, 1, GL_FALSE, projmat);
 	glBindVertexArray(r->VAO_bg);
 
-	for (i = toprow; i != (toprow + dim->y) % (dim->y + 1); i = (i + 1) % (dim->y + 1)) {
-		for (j = 0; j < dim->x; j++) {
-			tchar = &r->draw_buf->termbox[i * dim->x + j];
-			if (!tchar->to_draw) {
+	for (i = 0; i < r->n_view_rows; i++) {
+		for (j = 0; j < r->draw_buf->dim.x; j++) {
+			tchar = &r->view_rows[i][j];
+			xpos = j * advance->x;
+			if ((mark = _cell_mark(r, i, j))) {
+				glUniform1ui(loc_bg_color, mark == SEARCH_MARK_CURRENT
+						? RENDERER_SEARCH_CURRENT_BG : RENDERER_SEARCH_BG);
+			} else if (tchar->to_draw) {
+				glUniform1ui(loc_bg_color,
+						(tchar->attrs & RENDERER_ATTR_REVERSE) ? tchar->fg : tchar->bg);
+			} else {
 				continue;
 			}
-			bgcol = &tchar->bgcol;
-			glUniform4f(loc_bg_color, bgcol->x, bgcol->y, bgcol->z, bgcol->w);
 			// Set vertices
 			vertices[0][0] = xpos;
 			vertices[0][1] = ypos - advance->y;
@@ -306,10 +726,7 @@ static void _render_bg(struct renderer *r) {
 			glBindBuffer(GL_ARRAY_BUFFER, 0);
 			// Render quad
 			glDrawArrays(GL_TRIANGLES, 0, 6);
-			// Advance coords
-			xpos += advance->x;
 		}
-		xpos = 0;
 		ypos -= advance->y;
 	}
 
@@ -317,88 +734,572 @@ static void _render_bg(struct renderer *r) {
 }
 
 
+// Order image runs by texture
+static int _cmp_image_run(const void *a, const void *b) {
+	const struct renderer_image_run *x = a, *y = b;
+	return x->tex < y->tex ? -1 : x->tex > y->tex;
+}
+
+
+// Find runs of cells in view showing images, and get textures of their images (making them,
+// if they haven't been). Runs are sorted by texture, so that each image is drawn at once.
+// Called with buf_mut held
+static void _update_images(struct renderer *r) {
+	struct renderer_image_run *run = NULL, *tmp;
+	const struct termchar *c;
+	unsigned i, j, tex;
+	vec2_t tile;
+	r->n_image_runs = 0;
+	images_collect(r->images);
+	for (i = 0; i < r->n_view_rows; i++, run = NULL) {
+		for (j = 0; j < r->draw_buf->dim.x; j++) {
+			c = &r->view_rows[i][j];
+			if (!(c->flags & RENDERER_CELL_IMAGE)) {
+				run = NULL;
+				continue;
+			}
+			if (run && run->id == c->cp && run->next == c->fg) {
+				run->uv.z += (run->uv.z - run->uv.x) / run->len;
+				run->len++;
+				run->next++;
+				continue;
+			}
+			if (!(tex = images_texture(r->images, c->cp, &tile))) {
+				run = NULL;
+				continue;
+			}
+			if (r->n_image_runs == r->image_runs_cap) {
+				r->image_runs_cap = r->image_runs_cap ? r->image_runs_cap * 2 : 64;
+				if (!(tmp = realloc(r->image_runs, r->image_runs_cap
+								* sizeof(struct renderer_image_run)))) {
+					die_err("realloc()");
+				}
+				r->image_runs = tmp;
+			}
+			run = &r->image_runs[r->n_image_runs++];
+			run->id = c->cp;
+			run->tex = tex;
+			run->next = c->fg + 1;
+			run->row = i;
+			run->col = j;
+			run->len = 1;
+			run->uv.x = (c->fg & 0xffff) * tile.x;
+			run->uv.y = (c->fg >> 16) * tile.y;
+			run->uv.z = run->uv.x + tile.x;
+			run->uv.w = run->uv.y + tile.y;
+		}
+	}
+	qsort(r->image_runs, r->n_image_runs, sizeof(struct renderer_image_run), _cmp_image_run);
+}
+
+
+// Render runs of cells showing images, with a draw call per image
+static void _render_images(struct renderer *r) {
+	const struct renderer_image_run *run;
+	const uvec2_t *advance = &r->fonts->advance;
+	GLfloat *v, x0, x1, y0, y1;
+	float projmat[16];
+	size_t k, end;
+	if (r->n_image_runs == 0) {
+		return;
+	}
+	if (r->image_verts_cap < r->n_image_runs * 24) {
+		free(r->image_verts);
+		r->image_verts_cap = r->n_image_runs * 24;
+		if (!(r->image_verts = malloc(r->image_verts_cap * sizeof(GLfloat)))) {
+			die_err("malloc()");
+		}
+	}
+	// Two triangles per run, like text quads
+	for (k = 0, v = r->image_verts; k < r->n_image_runs; k++, v += 24) {
+		run = &r->image_runs[k];
+		x0 = run->col * advance->x;
+		x1 = (run->col + run->len) * advance->x;
+		y1 = r->window->dim.y - run->row * advance->y;
+		y0 = y1 - advance->y;
+		GLfloat quad[24] = {
+			x0, y1, run->uv.x, run->uv.y,
+			x0, y0, run->uv.x, run->uv.w,
+			x1, y0, run->uv.z, run->uv.w,
+			x0, y1, run->uv.x, run->uv.y,
+			x1, y0, run->uv.z, run->uv.w,
+			x1, y1, run->uv.z, run->uv.y,
+		};
+		memcpy(v, quad, sizeof(quad));
+	}
+	_view_projmat(r, projmat);
+	glUseProgram(r->img_shader);
+	glUniformMatrix4fv(glGetUniformLocation(r->img_shader, "projection"), 1, GL_FALSE, projmat);
+	glActiveTexture(GL_TEXTURE0);
+	glBindVertexArray(r->VAO_img);
+	glBindBuffer(GL_ARRAY_BUFFER, r->VBO_img);
+	glBufferData(GL_ARRAY_BUFFER, r->n_image_runs * 24 * sizeof(GLfloat), r->image_verts,
+			GL_STREAM_DRAW);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	for (k = 0; k < r->n_image_runs; k = end) {
+		for (end = k + 1; end < r->n_image_runs
+				&& r->image_runs[end].tex == r->image_runs[k].tex; end++);
+		glBindTexture(GL_TEXTURE_2D, r->image_runs[k].tex);
+		glDrawArrays(GL_TRIANGLES, k * 6, (end - k) * 6);
+	}
+	glBindTexture(GL_TEXTURE_2D, 0);
+	glBindVertexArray(0);
+}
+
+
+// Render glyph for a cell, either from glyph texture or procedurally. cur_box tracks the
+// current value of the box_code uniform, to avoid redundant updates
+static void _render_cell(struct renderer *r, unsigned i, unsigned j, uint32_t cp, uint32_t box,
+		enum fonts_style style, GLint loc_box_code, uint32_t *cur_box) {
+	const struct glyph *glyph = NULL;
+	if (!box && !(glyph = fonts_get_glyph(r->fonts, cp, style))) {
+		return;
+	}
+	if (box != *cur_box) {
+		glUniform1ui(loc_box_code, box);
+		*cur_box = box;
+	}
+	if (box) {
+		_render_box(r, i, j);
+	} else {
+		_render_glyph(r, i, j, glyph);
+	}
+}
+
+
+// Get foreground color of cell for the text shader. Reverse video swaps colors, and dim and
+// blink are passed on as flags
+static uint32_t _cell_fg(const struct termchar *c) {
+	uint32_t fg = (c->attrs & RENDERER_ATTR_REVERSE) ? c->bg : c->fg;
+	if (c->attrs & RENDERER_ATTR_DIM) {
+		fg |= RENDERER_COLOR_DIM_FLAG;
+	}
+	if (c->attrs & RENDERER_ATTR_BLINK) {
+		fg |= RENDERER_COLOR_BLINK_FLAG;
+	}
+	return fg;
+}
+
+
+// Get font style of cell
+static enum fonts_style _cell_style(const struct termchar *c) {
+	enum fonts_style style = FONTS_STYLE_REGULAR;
+	if (c->attrs & RENDERER_ATTR_BOLD) {
+		style |= FONTS_STYLE_BOLD;
+	}
+	if (c->attrs & RENDERER_ATTR_ITALIC) {
+		style |= FONTS_STYLE_ITALIC;
+	}
+	return style;
+}
+
+
+// Get box code for decorations of cell. Return 0 if it has none
+static uint32_t _cell_decor(const struct termchar *c) {
+	uint32_t mask = 0;
+	if (c->attrs & RENDERER_ATTR_UNDERLINE) {
+		mask |= BOXDRAW_DECOR_UNDERLINE;
+	}
+	if (c->attrs & RENDERER_ATTR_DOUBLE_UNDERLINE) {
+		mask |= BOXDRAW_DECOR_DOUBLE_UNDERLINE;
+	}
+	if (c->attrs & RENDERER_ATTR_CURLY_UNDERLINE) {
+		mask |= BOXDRAW_DECOR_CURLY_UNDERLINE;
+	}
+	if (c->attrs & RENDERER_ATTR_STRIKE) {
+		mask |= BOXDRAW_DECOR_STRIKE;
+	}
+	return mask ? BOXDRAW_DECOR_CODE(mask) : 0;
+}
+
+
+// Render grapheme cluster in cell (i, j). The base character is drawn like any other, and
+// combining codepoints over it. Characters joined by a zero width joiner can't be composed
+// without an emoji font, so only the first one of a sequence is drawn
+static void _render_cluster(struct renderer *r, unsigned i, unsigned j,
+		const struct termchar *tchar, GLint loc_box_code, uint32_t *cur_box) {
+	const uint32_t *cps;
+	const struct glyph *glyph;
+	enum fonts_style style = _cell_style(tchar);
+	unsigned w = (tchar->flags & RENDERER_CELL_WIDE) ? 2 : 1;
+	size_t k, n;
+	// Rows from scrollback refer to the view's clusters. Both tables are only touched by this
+	// thread, so no lock is needed
+	if (!(cps = graphemes_get(i < r->view_hist ? r->view->clusters : r->draw_buf->clusters,
+					tchar->cp, &n)) || n == 0) {
+		return;
+	}
+	_render_cell(r, i, j, cps[0], tchar->box, style, loc_box_code, cur_box);
+	for (k = 1; k < n; k++) {
+		if (cps[k] == GRAPHEME_ZWJ || cps[k - 1] == GRAPHEME_ZWJ) {
+			continue;
+		}
+		if (!(glyph = fonts_get_glyph(r->fonts, cps[k], style))) {
+			continue;
+		}
+		if (*cur_box) {
+			glUniform1ui(loc_box_code, 0);
+			*cur_box = 0;
+		}
+		// Marks with a negative bearing are positioned relative to the end of the base
+		// character, others relative to its start
+		_render_glyph_at(r, i, (j + (glyph->bearing.x < 0 ? w : 0)) * r->fonts->advance.x,
+				glyph);
+	}
+}
+
+
+// Can cell be part of a shaped run? Runs are broken at spaces, so that words are cached
+// independently of each other
+static bool _cell_shapeable(const struct termchar *c) {
+	return c->to_draw && c->cp > ' ' && !c->box && !(c->attrs & RENDERER_ATTR_HIDDEN)
+		&& !(c->flags & (RENDERER_CELL_WIDE | RENDERER_CELL_WIDE_CONT | RENDERER_CELL_CLUSTER
+					| RENDERER_CELL_IMAGE));
+}
+
+
+// Get end of run of cells to be shaped together, starting at column j of row i. Cells of a
+// run share color and style. The cursor's cell (if cursor isn't NULL) and cells in search
+// matches are drawn in different colors, on their own
+static unsigned _run_end(const struct renderer *r, unsigned i, unsigned j,
+		const uvec2_t *cursor) {
+	const struct termchar *row = r->view_rows[i];
+	uint32_t fg = _cell_fg(&row[j]);
+	enum fonts_style style = _cell_style(&row[j]);
+	unsigned k;
+	if (cursor && i == cursor->y && j == cursor->x) {
+		return j + 1;
+	}
+	for (k = j + 1; k < r->draw_buf->dim.x; k++) {
+		if (!_cell_shapeable(&row[k]) || _cell_mark(r, i, k) || _cell_fg(&row[k]) != fg
+				|| _cell_style(&row[k]) != style
+				|| (cursor && i == cursor->y && k == cursor->x)) {
+			break;
+		}
+	}
+	return k;
+}
+
+
+// Shape and render run of cells [j, end) of row i. Return false if shaping changed nothing,
+// and cells are to be drawn individually
+static bool _render_run(struct renderer *r, unsigned i, unsigned j, unsigned end,
+		GLint loc_box_code, uint32_t *cur_box) {
+	const struct termchar *row = r->view_rows[i];
+	enum fonts_style style = _cell_style(&row[j]);
+	const struct shaped_run *run;
+	const struct glyph *glyph;
+	uint32_t cps[end - j];
+	size_t k;
+	for (k = j; k < end; k++) {
+		cps[k - j] = row[k].cp;
+	}
+	if (!(run = shaper_shape(r->shaper, cps, end - j, style)) || run->plain) {
+		return false;
+	}
+	if (*cur_box) {
+		glUniform1ui(loc_box_code, 0);
+		*cur_box = 0;
+	}
+	for (k = 0; k < run->n_glyphs; k++) {
+		if (!(glyph = fonts_get_glyph_id(r->fonts, run->glyphs[k].id, style))) {
+			continue;
+		}
+		_render_glyph_at(r, i, (j + run->glyphs[k].cell) * r->fonts->advance.x
+				+ run->glyphs[k].x * r->fonts->glyph_scale, glyph);
+	}
+	return true;
+}
+
+
+// Get milliseconds since renderer was created
+static uint64_t _elapsed_ms(const struct renderer *r) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - r->start_time.tv_sec) * 1000
+		+ (now.tv_nsec - r->start_time.tv_nsec) / 1000000;
+}
+
+
+// Blink phase changes every half second
+#define RENDERER_BLINK_MS 500
+
+
+// Pick rows to draw in the frame at now (ms since creation), from the active screen and the
+// scrollback it is scrolled back into. Only rows coming into view are decoded from
+// scrollback. Called with buf_mut held
+static void _update_view(struct renderer *r, uint64_t now) {
+	struct termbuf *d = r->draw_buf;
+	const struct termchar **tmp;
+	uint64_t back, end;
+	unsigned i;
+	r->reflowing = viewport_step(r->view, d->scrollback, RENDERER_REFLOW_NS);
+	r->scrolling = viewport_update(r->view, d->scrollback, now - r->last_frame);
+	r->last_frame = now;
+	if (r->view_rows_cap < d->dim.y + 1) {
+		if (!(tmp = realloc(r->view_rows, (d->dim.y + 1) * sizeof(struct termchar*)))) {
+			die_err("realloc()");
+		}
+		r->view_rows = tmp;
+		r->view_rows_cap = d->dim.y + 1;
+	}
+	// When scrolled back by a fractional number of rows, one more row is partially in view,
+	// and all rows are moved up by the rest
+	back = (uint64_t) r->view->pos;
+	if (back < r->view->pos) {
+		back++;
+	}
+	r->view_shift = (back - r->view->pos) * r->fonts->advance.y;
+	r->n_view_rows = d->dim.y + (r->view_shift > 0 ? 1 : 0);
+	r->view_hist = back < r->n_view_rows ? back : r->n_view_rows;
+	end = d->scrollback ? scrollback_end(d->scrollback) : 0;
+	for (i = 0; i < r->n_view_rows; i++) {
+		if (i < r->view_hist) {
+			r->view_rows[i] = viewport_row(r->view, d->scrollback,
+					(int64_t) end - (int64_t) back + i, d->dim);
+		} else {
+			r->view_rows[i] = d->rows[i - back];
+		}
+	}
+	// Mark search matches. Rows of the screen are numbered after the lines of scrollback
+	if (!(r->view_marked = search_active(r->search))) {
+		return;
+	}
+	if (r->view_marks_cap < r->n_view_rows * d->dim.x) {
+		free(r->view_marks);
+		r->view_marks_cap = r->n_view_rows * d->dim.x;
+		if (!(r->view_marks = malloc(r->view_marks_cap))) {
+			die_err("malloc()");
+		}
+	}
+	memset(r->view_marks, SEARCH_MARK_NONE, r->n_view_rows * d->dim.x);
+	for (i = 0; i < r->n_view_rows; i++) {
+		if (i < r->view_hist) {
+			viewport_mark_row(r->view, d->scrollback, r->search,
+					(int64_t) end - (int64_t) back + i, &r->view_marks[i * d->dim.x]);
+		} else {
+			search_mark_row(r->search, end - back + i, r->view_rows[i], d->dim.x,
+					d->clusters, &r->view_marks[i * d->dim.x]);
+		}
+	}
+}
+
+
+// Scroll view so that line (numbered as by search) is in view. If it isn't already, it is
+// brought to the middle of the screen. Called with buf_mut held
+static void _show_line(struct renderer *r, uint64_t line) {
+	// Relative to the end the view was last anchored at, as the next update moves the view
+	// along with lines added since
+	double back = (double) r->view->end
+		- viewport_line_row(r->view, r->mod_buf->scrollback, line);
+	double row = r->view->target - back;
+	if (row < 0 || row >= r->mod_buf->dim.y) {
+		viewport_scroll_to(r->view, back + r->mod_buf->dim.y / 2);
+	}
+}
+
+
+// Search lines added since the last frame, and older ones while time allows. Called with
+// buf_mut held
+static void _update_search(struct renderer *r) {
+	struct termbuf *d = r->draw_buf;
+	uint64_t line;
+	if (!search_active(r->search)) {
+		r->searching = false;
+		return;
+	}
+	r->searching = search_step(r->search, d->scrollback, d->rows, d->dim, d->clusters,
+			RENDERER_SEARCH_NS);
+	// Jump to the most recent match as soon as there is one
+	if (!search_has_current(r->search) && search_next(r->search, true, &line)) {
+		_show_line(r, line);
+	}
+}
+
+
+// Copy the active screen into the buffer drawn, so that it can be drawn while the active
+// screen is modified. Grapheme clusters are interned again, into the buffer drawn. Called with
+// buf_mut held
+static void _publish(struct renderer *r) {
+	struct termbuf *m = r->mod_buf, *d = r->draw_buf;
+	struct termchar *row;
+	const uint32_t *cps;
+	unsigned x, y;
+	size_t n;
+	if (d->dim.x != m->dim.x || d->dim.y != m->dim.y) {
+		d->scrollback = NULL;
+		_termbuf_free(d);
+		r->draw_buf = d = _termbuf_new(m->dim, m->cursor_cp, m->cursor_box);
+	}
+	for (y = 0; y < m->dim.y; y++) {
+		row = d->rows[y];
+		memcpy(row, m->rows[y], m->dim.x * sizeof(struct termchar));
+		for (x = 0; x < m->dim.x; x++) {
+			if (row[x].flags & RENDERER_CELL_CLUSTER) {
+				cps = graphemes_get(m->clusters, row[x].cp, &n);
+				row[x].cp = graphemes_intern(d->clusters, cps, n);
+			}
+		}
+	}
+	_termbuf_collect(d);
+	d->cursor = m->cursor;
+	d->cursor_cp = m->cursor_cp;
+	d->cursor_box = m->cursor_box;
+	d->cursor_vis = m->cursor_vis;
+	d->scrollback = m->scrollback;
+}
+
+
+// Is a synchronized update holding back frames at now (ms since creation)?
+static bool _sync_held(const struct renderer *r, uint64_t now) {
+	return __atomic_load_n(&r->sync_deadline, __ATOMIC_RELAXED) > now;
+}
+
+
 // Render current contents
 static void _do_render(struct renderer *r) {
-	const struct glyph *glyph;
-	GLuint loc_text_color, loc_proj_mat;
-	const vec4_t *fgcol, *bgcol;
+	GLuint loc_text_color, loc_proj_mat, loc_box_code, loc_cell_size, loc_sdf;
+	GLuint loc_baseline, loc_time;
+	struct color palette[RENDERER_PALETTE_SZ];
+	uint64_t now = _elapsed_ms(r);
+	uint32_t fg, decor;
+	bool palette_dirty;
+	vec4_t clear_col;
 	uvec2_t cursor;
 	const uvec2_t *dim;
-	unsigned i, j, toprow, y;
+	unsigned i, j, run_end, shaped_end;
+	uint32_t cur_box = 0;
 	float projmat[16];
 	const struct termchar *tchar;
-	struct termbuf *tmp_termbuf;
-	bool draw_cursor = r->draw_buf->cursor_vis;
+	bool draw_cursor;
+	size_t probe_keys = 0;
+	uint64_t drawn;
 
-	toprow = r->draw_buf->toprow;
-	cursor.x = r->draw_buf->cursor.x;
-	cursor.y = (toprow + r->draw_buf->cursor.y) % (r->draw_buf->dim.y + 1);
-	for (i = 0; i < 16; i++) {
-		projmat[i] = r->window->projmat[i];
+	// Pick up the active screen, unless a synchronized update is under way (the last screen
+	// published is drawn again then), the rows of it in view, and palette changes
+	pthread_mutex_lock(&r->buf_mut);
+	if (!_sync_held(r, now) || r->draw_buf->dim.x != r->mod_buf->dim.x
+			|| r->draw_buf->dim.y != r->mod_buf->dim.y) {
+		_publish(r);
+		probe_keys = probe_frame();
+	}
+	_update_search(r);
+	_update_view(r, now);
+	_update_images(r);
+	if ((palette_dirty = r->palette_dirty)) {
+		memcpy(palette, r->palette, sizeof(palette));
+		r->palette_dirty = false;
+	}
+	color_normalize(&r->palette[RENDERER_COLOR_BG], &clear_col);
+	pthread_mutex_unlock(&r->buf_mut);
+	if (palette_dirty) {
+		glBindTexture(GL_TEXTURE_2D, r->palette_tex);
+		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, RENDERER_PALETTE_SZ, 1, GL_RGBA,
+				GL_UNSIGNED_BYTE, palette);
+		glBindTexture(GL_TEXTURE_2D, 0);
 	}
+	// The cursor moves down with the screen when scrolled back
+	cursor = r->draw_buf->cursor;
+	cursor.y += r->view_hist;
+	draw_cursor = r->draw_buf->cursor_vis && cursor.y < r->n_view_rows;
+	_view_projmat(r, projmat);
 	dim = &r->draw_buf->dim;
 
 	// Clear window
-	glClearColor(r->default_bgcol.x, r->default_bgcol.y, r->default_bgcol.z, r->default_bgcol.w);
+	glClearColor(clear_col.x, clear_col.y, clear_col.z, clear_col.w);
 	glClear(GL_COLOR_BUFFER_BIT);
 
-	// Render background
+	// Colors are resolved from the palette texture by both shaders
+	glActiveTexture(GL_TEXTURE1);
+	glBindTexture(GL_TEXTURE_2D, r->palette_tex);
+	glActiveTexture(GL_TEXTURE0);
+
+	// Render background, and images over it
 	_render_bg(r);
+	_render_images(r);
 
 	// Render foreground
 	glUseProgram(r->text_shader);
 	loc_proj_mat = glGetUniformLocation(r->text_shader, "projection");
 	loc_text_color = glGetUniformLocation(r->text_shader, "text_color");
+	loc_box_code = glGetUniformLocation(r->text_shader, "box_code");
+	loc_cell_size = glGetUniformLocation(r->text_shader, "cell_size");
+	loc_sdf = glGetUniformLocation(r->text_shader, "sdf");
+	loc_baseline = glGetUniformLocation(r->text_shader, "baseline");
+	loc_time = glGetUniformLocation(r->text_shader, "time");
 	glUniformMatrix4fv(loc_proj_mat, 1, GL_FALSE, projmat);
+	glUniform1ui(loc_box_code, 0);
+	glUniform2f(loc_cell_size, r->fonts->advance.x, r->fonts->advance.y);
+	glUniform1i(loc_sdf, r->fonts->sdf);
+	glUniform1f(loc_baseline, r->fonts->line_height);
+	glUniform1f(loc_time, (now % 60000) / 1000.0f);
+	r->blink_phase = now / RENDERER_BLINK_MS;
+	r->has_blink = false;
 	glActiveTexture(GL_TEXTURE0);
 	glBindVertexArray(r->VAO_text);
 
-	y = 0;
-
-	for (i = toprow; i != (toprow + dim->y) % (dim->y + 1); i = (i + 1) % (dim->y + 1), y++) {
+	for (i = 0; i < r->n_view_rows; i++) {
+		run_end = shaped_end = 0;
 		for (j = 0; j < dim->x; j++) {
-			tchar = &r->draw_buf->termbox[i * dim->x + j];
-
-			bgcol = &tchar->bgcol;
-			fgcol = &tchar->fgcol;
-
-			if (i == cursor.y && j == cursor.x && draw_cursor && r->draw_buf->cursor_glyph) {
-				glUniform3f(loc_text_color, r->default_fgcol.x, r->default_fgcol.y,
-						r->default_fgcol.z);
-				_render_glyph(r, y, j, r->draw_buf->cursor_glyph);
-				if (!tchar->to_draw) {
-					continue;
-				}
-				if (!(glyph = tchar->glyph)) {
-					continue;
-				}
-				glUniform3f(loc_text_color, r->default_bgcol.x, r->default_bgcol.y,
-						r->default_bgcol.z);
-				_render_glyph(r, y, j, glyph);
-			} else {
-				if (!tchar->to_draw) {
-					continue;
+			tchar = &r->view_rows[i][j];
+
+			if (r->shaper && j >= run_end && _cell_shapeable(tchar) && !_cell_mark(r, i, j)) {
+				// Ligatures need the whole run
+				run_end = _run_end(r, i, j, draw_cursor ? &cursor : NULL);
+				glUniform1ui(loc_text_color, _cell_fg(tchar));
+				if (run_end > j + 1 && _render_run(r, i, j, run_end, loc_box_code,
+							&cur_box)) {
+					shaped_end = run_end;
 				}
-				if (!(glyph = tchar->glyph)) {
-					continue;
-				}
-				glUniform3f(loc_text_color, fgcol->x, fgcol->y, fgcol->z);
-				_render_glyph(r, y, j, glyph);
+			}
+			fg = _cell_fg(tchar);
+			if (i == cursor.y && j == cursor.x && draw_cursor) {
+				glUniform1ui(loc_text_color, RENDERER_COLOR_FG);
+				_render_cell(r, i, j, r->draw_buf->cursor_cp, r->draw_buf->cursor_box,
+						FONTS_STYLE_REGULAR, loc_box_code, &cur_box);
+				// Contents are drawn inverted over the cursor
+				fg = RENDERER_COLOR_BG;
+			} else if (_cell_mark(r, i, j)) {
+				// and over search matches
+				fg = RENDERER_COLOR_BG;
+			}
+			if (!tchar->to_draw || (tchar->attrs & RENDERER_ATTR_HIDDEN)
+					|| (tchar->flags & RENDERER_CELL_IMAGE)) {
+				continue;
+			}
+			if (tchar->attrs & RENDERER_ATTR_BLINK) {
+				r->has_blink = true;
+			}
+			glUniform1ui(loc_text_color, fg);
+			// Glyphs of wide characters cover their continuation cells
+			if (j < shaped_end) {
+				// Drawn as part of a shaped run
+			} else if (tchar->flags & RENDERER_CELL_CLUSTER) {
+				_render_cluster(r, i, j, tchar, loc_box_code, &cur_box);
+			} else if (!(tchar->flags & RENDERER_CELL_WIDE_CONT)) {
+				_render_cell(r, i, j, tchar->cp, tchar->box, _cell_style(tchar),
+						loc_box_code, &cur_box);
+			}
+			if ((decor = _cell_decor(tchar))) {
+				_render_cell(r, i, j, 0, decor, FONTS_STYLE_REGULAR, loc_box_code,
+						&cur_box);
 			}
 		}
 	}
 
 	glBindTexture(GL_TEXTURE_2D, 0);
+	glActiveTexture(GL_TEXTURE1);
+	glBindTexture(GL_TEXTURE_2D, 0);
+	glActiveTexture(GL_TEXTURE0);
 	glBindVertexArray(0);
+	if (r->shaper) {
+		shaper_end_frame(r->shaper);
+	}
 
-	// Swap buffers
 	if (r->window) {
+		drawn = now_ns();
 		window_refresh(r->window);
-		pthread_mutex_lock(&r->buf_mut);
-		tmp_termbuf = r->draw_buf;
-		r->draw_buf = r->mod_buf;
-		r->mod_buf = r->draw_buf;
-		pthread_mutex_unlock(&r->buf_mut);
+		probe_swap(probe_keys, drawn);
 	}
 }
 
@@ -414,22 +1315,97 @@ void renderer_render(struct renderer *r) {
 
 // Do whatever the renderer needs to do
 void renderer_update(struct renderer *r) {
+	uint64_t now;
 	if (!r) {
 		die("NULL renderer");
 	}
-	if (__sync_bool_compare_and_swap(&r->req_render, true, false)) {
+	// Blinking text needs a new frame whenever the blink phase changes, but the screen
+	// doesn't change. Updates to the screen are left pending during a synchronized update
+	now = _elapsed_ms(r);
+	if ((!_sync_held(r, now) && __sync_bool_compare_and_swap(&r->req_render, true, false))
+			|| r->scrolling || r->searching || r->reflowing
+			|| (r->has_blink && now / RENDERER_BLINK_MS != r->blink_phase)) {
 		_do_render(r);
 	}
 }
 
 
-// Move cursor up by n
-static void _move_up(struct renderer *r, unsigned n) {
+// Has a render been requested since the last frame?
+bool renderer_pending(struct renderer *r) {
 	if (!r) {
 		die("NULL renderer");
 	}
-	if (n == 0) {
-		n = 1;
+	return __atomic_load_n(&r->req_render, __ATOMIC_RELAXED);
+}
+
+
+// Does the renderer need frames even if the screen doesn't change?
+bool renderer_animating(struct renderer *r) {
+	if (!r) {
+		die("NULL renderer");
+	}
+	// A synchronized update only needs frames until it times out, whether or not it is ended
+	return r->scrolling || r->searching || r->reflowing || r->has_blink
+		|| _sync_held(r, _elapsed_ms(r));
+}
+
+
+// Scroll view of the active screen back into scrollback by rows
+void renderer_scroll(struct renderer *r, double rows) {
+	if (!r) {
+		die("NULL renderer");
+	}
+	viewport_scroll(r->view, rows);
+	renderer_render(r);
+}
+
+
+// Scroll view of the active screen back to the bottom
+void renderer_scroll_reset(struct renderer *r) {
+	if (!r) {
+		die("NULL renderer");
+	}
+	if (r->view->pos > 0 || r->view->target > 0) {
+		viewport_reset(r->view);
+		renderer_render(r);
+	}
+}
+
+
+// Search screen and scrollback for query of n codepoints
+void renderer_search(struct renderer *r, const uint32_t *query, size_t n) {
+	if (!r) {
+		die("NULL renderer");
+	}
+	search_set_query(r->search, query, n);
+	renderer_render(r);
+}
+
+
+// Jump to the next older match (or newer, if older is false)
+bool renderer_search_next(struct renderer *r, bool older) {
+	uint64_t line;
+	if (!r) {
+		die("NULL renderer");
+	}
+	if (!search_next(r->search, older, &line)) {
+		return false;
+	}
+	pthread_mutex_lock(&r->buf_mut);
+	_show_line(r, line);
+	pthread_mutex_unlock(&r->buf_mut);
+	renderer_render(r);
+	return true;
+}
+
+
+// Move cursor up by n
+static void _move_up(struct renderer *r, unsigned n) {
+	if (!r) {
+		die("NULL renderer");
+	}
+	if (n == 0) {
+		n = 1;
 	}
 	if (r->mod_buf->cursor.y < n) {
 		r->mod_buf->cursor.y = 0;
@@ -511,47 +1487,28 @@ static void _move_yx(struct renderer *r, unsigned y, unsigned x) {
 
 // Clear screen
 static void _clear_screen(struct renderer *r, enum renderer_clear_type type) {
-	unsigned i, tr, cy, dy, ydiff, charsz;
-	const uvec2_t *dim;
+	unsigned i;
+	struct termbuf *m;
 	const size_t chsz = sizeof(struct termchar);
-	struct termchar *termbox;
 	if (!r) {
 		die("NULL renderer");
 	}
-	termbox = r->mod_buf->termbox;
-	dim = &r->mod_buf->dim;
-	tr = r->mod_buf->toprow;
-	cy = (tr + r->mod_buf->cursor.y) % (dim->y + 1);
-	dy = (tr + dim->y) % (dim->y + 1);
-	i = cy * dim->x + r->mod_buf->cursor.x;
-	// NOTE: dy CANNOT be equal to cy
-	// NOTE: dy CANNOT be equal to tr
+	m = r->mod_buf;
 	switch (type) {
 	case RENDERER_CLEAR_TO_END:
-		if (dy < cy) {
-			memset(&termbox[i], 0, ((dim->y + 1) * dim->x - i) * chsz);
-			memset(&termbox[0], 0, dy * dim->x * chsz);
-		} else {
-			memset(&termbox[i], 0, (dy * dim->x - i) * chsz);
+		memset(&m->rows[m->cursor.y][m->cursor.x], 0, (m->dim.x - m->cursor.x) * chsz);
+		for (i = m->cursor.y + 1; i < m->dim.y; i++) {
+			memset(m->rows[i], 0, m->dim.x * chsz);
 		}
 		break;
 	case RENDERER_CLEAR_FROM_BEG:
-		if (tr <= cy) {
-			memset(&termbox[tr * dim->x], 0, i - (tr * dim->x) * chsz);
-		} else {
-			memset(&termbox[tr * dim->x], 0, (dim->y + 1 - tr) * dim->x * chsz);
-			memset(&termbox[0], 0, i * chsz);
+		for (i = 0; i < m->cursor.y; i++) {
+			memset(m->rows[i], 0, m->dim.x * chsz);
 		}
-		//memset(r->termbox, 0, i * sizeof(struct termchar));
+		memset(m->rows[m->cursor.y], 0, (m->cursor.x + 1) * chsz);
 		break;
 	case RENDERER_CLEAR_ALL:
-		if (tr < dy) {
-			memset(&termbox[tr * dim->x], 0, dim->x * dim->y * chsz);
-		} else {
-			ydiff = dim->y + 1 - tr;
-			memset(&termbox[tr * dim->x], 0, dim->x * ydiff * chsz);
-			memset(&termbox[0], 0, dim->x * dy * chsz);
-		}
+		memset(m->termbox, 0, m->dim.x * m->dim.y * chsz);
 		break;
 	}
 }
@@ -559,66 +1516,240 @@ static void _clear_screen(struct renderer *r, enum renderer_clear_type type) {
 
 // Clear line
 static void _clear_line(struct renderer *r, enum renderer_clear_type type) {
-	unsigned i, j, k, y;
+	struct termchar *row;
+	unsigned x;
 	if (!r) {
 		die("NULL renderer");
 	}
-	y = (r->mod_buf->toprow + r->mod_buf->cursor.y) % (r->mod_buf->dim.y + 1);
-	i = y * r->mod_buf->dim.x;
-	j = y * r->mod_buf->dim.x + r->mod_buf->cursor.x;
-	k = (y + 1) * r->mod_buf->dim.x;
+	row = r->mod_buf->rows[r->mod_buf->cursor.y];
+	x = r->mod_buf->cursor.x;
 	switch (type) {
 	case RENDERER_CLEAR_TO_END:
-		memset(&r->mod_buf->termbox[j], 0, (k - j) * sizeof(struct termchar));
+		memset(&row[x], 0, (r->mod_buf->dim.x - x) * sizeof(struct termchar));
 		break;
 	case RENDERER_CLEAR_FROM_BEG:
-		memset(&r->mod_buf->termbox[i], 0, (j - i) * sizeof(struct termchar));
+		memset(row, 0, (x + 1) * sizeof(struct termchar));
 		break;
 	case RENDERER_CLEAR_ALL:
-		memset(&r->mod_buf->termbox[i], 0, (k - i) * sizeof(struct termchar));
+		memset(row, 0, r->mod_buf->dim.x * sizeof(struct termchar));
 	}
 }
 
 
-// Set renderer foreground color
-static void _set_fgcol(struct renderer *r, const struct color *color) {
-	if (!r) {
-		die("NULL renderer");
+// Scroll rows [top, bot) up by n, clearing the rows which come in at the bottom. Only row
+// pointers are rotated, cells are never moved. If save, rows scrolled off the top of the
+// screen go to scrollback (rows deleted are dropped)
+static void _scroll_region_up(struct termbuf *m, unsigned top, unsigned bot, size_t n,
+		bool save) {
+	unsigned k;
+	if (top >= bot || n == 0) {
+		return;
+	}
+	if (n > bot - top) {
+		n = bot - top;
 	}
-	if (!color) {
-		die("NULL color");
+	if (save && top == 0 && m->scrollback) {
+		for (k = 0; k < n; k++) {
+			scrollback_push(m->scrollback, m->rows[k], m->dim.x, m->clusters);
+		}
+	}
+	memcpy(m->spare_rows, &m->rows[top], n * sizeof(struct termchar*));
+	memmove(&m->rows[top], &m->rows[top + n], (bot - top - n) * sizeof(struct termchar*));
+	memcpy(&m->rows[bot - n], m->spare_rows, n * sizeof(struct termchar*));
+	for (k = bot - n; k < bot; k++) {
+		memset(m->rows[k], 0, m->dim.x * sizeof(struct termchar));
 	}
-	color_normalize(color, &r->fgcol);
 }
 
 
-// Set renderer background color
-static void _set_bgcol(struct renderer *r, const struct color *color) {
-	if (!r) {
-		die("NULL renderer");
+// Scroll rows [top, bot) down by n, clearing the rows which come in at the top
+static void _scroll_region_down(struct termbuf *m, unsigned top, unsigned bot, size_t n) {
+	unsigned k;
+	if (top >= bot || n == 0) {
+		return;
+	}
+	if (n > bot - top) {
+		n = bot - top;
+	}
+	memcpy(m->spare_rows, &m->rows[bot - n], n * sizeof(struct termchar*));
+	memmove(&m->rows[top + n], &m->rows[top], (bot - top - n) * sizeof(struct termchar*));
+	memcpy(&m->rows[top], m->spare_rows, n * sizeof(struct termchar*));
+	for (k = top; k < top + n; k++) {
+		memset(m->rows[k], 0, m->dim.x * sizeof(struct termchar));
+	}
+}
+
+
+// Scroll scroll region up by n rows
+static void _scroll_up(struct termbuf *m, size_t n) {
+	_scroll_region_up(m, m->scroll_top, m->scroll_bot, n, true);
+}
+
+
+// Scroll scroll region down by n rows
+static void _scroll_down(struct termbuf *m, size_t n) {
+	_scroll_region_down(m, m->scroll_top, m->scroll_bot, n);
+}
+
+
+// Move cursor down a row, scrolling up if it is on the last row of the scroll region
+static void _index(struct termbuf *m) {
+	if (m->cursor.y + 1 == m->scroll_bot) {
+		_scroll_up(m, 1);
+	} else if (m->cursor.y + 1 < m->dim.y) {
+		m->cursor.y++;
+	}
+}
+
+
+// Move cursor up a row, scrolling down if it is on the first row of the scroll region
+static void _reverse_index(struct termbuf *m) {
+	if (m->cursor.y == m->scroll_top) {
+		_scroll_down(m, 1);
+	} else if (m->cursor.y > 0) {
+		m->cursor.y--;
+	}
+}
+
+
+// Insert n blank lines at cursor, pushing rows below it down within the scroll region
+static void _insert_lines(struct termbuf *m, unsigned n) {
+	if (m->cursor.y < m->scroll_top || m->cursor.y >= m->scroll_bot) {
+		return;
+	}
+	_scroll_region_down(m, m->cursor.y, m->scroll_bot, n);
+	m->cursor.x = 0;
+}
+
+
+// Delete n lines at cursor, pulling rows below it up within the scroll region
+static void _delete_lines(struct termbuf *m, unsigned n) {
+	if (m->cursor.y < m->scroll_top || m->cursor.y >= m->scroll_bot) {
+		return;
+	}
+	_scroll_region_up(m, m->cursor.y, m->scroll_bot, n, false);
+	m->cursor.x = 0;
+}
+
+
+// Insert n blank characters at cursor, shifting the rest of the row right. Characters
+// shifted past the right edge are lost
+static void _insert_chars(struct termbuf *m, unsigned n) {
+	struct termchar *row = m->rows[m->cursor.y];
+	unsigned x = m->cursor.x;
+	if (n > m->dim.x - x) {
+		n = m->dim.x - x;
 	}
-	if (!color) {
-		die("NULL color");
+	memmove(&row[x + n], &row[x], (m->dim.x - x - n) * sizeof(struct termchar));
+	memset(&row[x], 0, n * sizeof(struct termchar));
+}
+
+
+// Delete n characters at cursor, shifting the rest of the row left and clearing the end
+static void _delete_chars(struct termbuf *m, unsigned n) {
+	struct termchar *row = m->rows[m->cursor.y];
+	unsigned x = m->cursor.x;
+	if (n > m->dim.x - x) {
+		n = m->dim.x - x;
 	}
-	color_normalize(color, &r->bgcol);
+	memmove(&row[x], &row[x + n], (m->dim.x - x - n) * sizeof(struct termchar));
+	memset(&row[m->dim.x - n], 0, n * sizeof(struct termchar));
 }
 
 
-// Reset renderer foreground color
-static void _reset_fgcol(struct renderer *r) {
+// Erase n characters starting at cursor, without shifting the rest of the row
+static void _erase_chars(struct termbuf *m, unsigned n) {
+	unsigned x = m->cursor.x;
+	if (n > m->dim.x - x) {
+		n = m->dim.x - x;
+	}
+	memset(&m->rows[m->cursor.y][x], 0, n * sizeof(struct termchar));
+}
+
+
+// Switch between primary and alternate screens. The cursor carries over. If save_cursor is
+// set, the cursor is saved before entering the alternate screen and restored after leaving it,
+// and the alternate screen is cleared on entry (DECSET 1049)
+static void _set_alt_screen(struct renderer *r, bool alt, bool save_cursor) {
+	struct termbuf *from, *to;
 	if (!r) {
 		die("NULL renderer");
 	}
-	r->fgcol = r->default_fgcol;
+	from = r->mod_buf;
+	to = alt ? r->alternate : r->primary;
+	if (from == to) {
+		return;
+	}
+	if (alt && save_cursor) {
+		from->saved_cursor = from->cursor;
+		memset(to->termbox, 0, to->dim.x * to->dim.y * sizeof(struct termchar));
+	}
+	to->cursor = from->cursor;
+	if (!alt && save_cursor) {
+		to->cursor = to->saved_cursor;
+	}
+	r->mod_buf = to;
+}
+
+
+// Set or reset private (DEC) mode
+static void _set_private_mode(struct renderer *r, unsigned mode, bool set) {
+	switch (mode) {
+	case 25:
+		// Show cursor
+		r->mod_buf->cursor_vis = set;
+		break;
+	case 47:
+		// Alternate screen
+		_set_alt_screen(r, set, false);
+		break;
+	case 1047:
+		// Alternate screen, cleared when left
+		if (!set && r->mod_buf == r->alternate) {
+			memset(r->alternate->termbox, 0,
+					r->alternate->dim.x * r->alternate->dim.y * sizeof(struct termchar));
+		}
+		_set_alt_screen(r, set, false);
+		break;
+	case 1049:
+		// Alternate screen, saving cursor
+		_set_alt_screen(r, set, true);
+		break;
+	case 2004:
+		// Bracketed paste. Read by the window thread when pasting
+		__atomic_store_n(&r->bracketed_paste, set, __ATOMIC_RELAXED);
+		break;
+	case 2026:
+		// Synchronized update. Frames show the screen as it was when it began, until it
+		// ends or times out. Beginning another one restarts the timeout
+		__atomic_store_n(&r->sync_deadline, set ? _elapsed_ms(r) + RENDERER_SYNC_MS : 0,
+				__ATOMIC_RELAXED);
+		break;
+	}
 }
 
 
-// Reset renderer background color
-static void _reset_bgcol(struct renderer *r) {
+// Set scroll region to rows top to bot (1-based, inclusive). Parameters of 0 select the
+// whole screen. Moves cursor to the home position
+static void _set_scroll_region(struct renderer *r, unsigned top, unsigned bot) {
+	struct termbuf *m;
 	if (!r) {
 		die("NULL renderer");
 	}
-	r->bgcol = r->default_bgcol;
+	m = r->mod_buf;
+	if (top == 0) {
+		top = 1;
+	}
+	if (bot == 0 || bot > m->dim.y) {
+		bot = m->dim.y;
+	}
+	if (top >= bot) {
+		return;
+	}
+	m->scroll_top = top - 1;
+	m->scroll_bot = bot;
+	m->cursor.x = 0;
+	m->cursor.y = 0;
 }
 
 
@@ -626,11 +1757,158 @@ static void _reset_bgcol(struct renderer *r) {
 struct esc_seq {
 	unsigned nparam;     // Number of parameters
 	unsigned params[32]; // Parameters
+	uint32_t subparams;  // Mask of parameters separated by ':' (subparameters)
 	char     final;      // Final character
 	char     private;    // Character denoting private escape sequence
 };
 
 
+// Parse extended color (38/48;5;n or 38/48;2;r;g;b) from SGR parameters, starting at i (the
+// parameter after 38/48). Store packed color in color, and return number of parameters used
+static unsigned _sgr_ext_color(const struct esc_seq *esc, unsigned i, uint32_t *color) {
+	unsigned k;
+	if (i >= esc->nparam) {
+		return 0;
+	}
+	switch (esc->params[i]) {
+	case 5:
+		if (i + 1 >= esc->nparam) {
+			return 1;
+		}
+		if (esc->params[i + 1] <= 0xff) {
+			*color = esc->params[i + 1];
+		}
+		return 2;
+	case 2:
+		if (i + 3 >= esc->nparam) {
+			return esc->nparam - i;
+		}
+		for (k = 1; k <= 3; k++) {
+			if (esc->params[i + k] > 0xff) {
+				return 4;
+			}
+		}
+		*color = RENDERER_COLOR_RGB(esc->params[i + 1], esc->params[i + 2], esc->params[i + 3]);
+		return 4;
+	}
+	return 1;
+}
+
+
+// Set underline style from SGR 4:n
+static void _sgr_underline(struct renderer *r, unsigned style) {
+	r->attrs &= ~RENDERER_ATTR_ANY_UNDERLINE;
+	switch (style) {
+	case 0:
+		break;
+	case 2:
+		r->attrs |= RENDERER_ATTR_DOUBLE_UNDERLINE;
+		break;
+	case 3:
+		r->attrs |= RENDERER_ATTR_CURLY_UNDERLINE;
+		break;
+	default:
+		// Dotted and dashed underlines are drawn solid
+		r->attrs |= RENDERER_ATTR_UNDERLINE;
+	}
+}
+
+
+// Set attribute bits from SGR parameter. Return false if it isn't an attribute
+static bool _sgr_attr(struct renderer *r, unsigned p) {
+	switch (p) {
+	case 1:
+		r->attrs |= RENDERER_ATTR_BOLD;
+		return true;
+	case 2:
+		r->attrs |= RENDERER_ATTR_DIM;
+		return true;
+	case 3:
+		r->attrs |= RENDERER_ATTR_ITALIC;
+		return true;
+	case 4:
+		_sgr_underline(r, 1);
+		return true;
+	case 5:
+	case 6:
+		r->attrs |= RENDERER_ATTR_BLINK;
+		return true;
+	case 7:
+		r->attrs |= RENDERER_ATTR_REVERSE;
+		return true;
+	case 8:
+		r->attrs |= RENDERER_ATTR_HIDDEN;
+		return true;
+	case 9:
+		r->attrs |= RENDERER_ATTR_STRIKE;
+		return true;
+	case 21:
+		_sgr_underline(r, 2);
+		return true;
+	case 22:
+		r->attrs &= ~(RENDERER_ATTR_BOLD | RENDERER_ATTR_DIM);
+		return true;
+	case 23:
+		r->attrs &= ~RENDERER_ATTR_ITALIC;
+		return true;
+	case 24:
+		_sgr_underline(r, 0);
+		return true;
+	case 25:
+		r->attrs &= ~RENDERER_ATTR_BLINK;
+		return true;
+	case 27:
+		r->attrs &= ~RENDERER_ATTR_REVERSE;
+		return true;
+	case 28:
+		r->attrs &= ~RENDERER_ATTR_HIDDEN;
+		return true;
+	case 29:
+		r->attrs &= ~RENDERER_ATTR_STRIKE;
+		return true;
+	}
+	return false;
+}
+
+
+// Set graphic rendition. Colors are stored as packed palette indices or RGB values, so this
+// never touches floats. Attributes are stored as bits, and resolved by the shaders
+static void _sgr(struct renderer *r, const struct esc_seq *esc) {
+	unsigned i, p;
+	for (i = 0; i < esc->nparam; i++) {
+		p = esc->params[i];
+		if (p == 0) {
+			r->fg = RENDERER_COLOR_FG;
+			r->bg = RENDERER_COLOR_BG;
+			r->attrs = 0;
+		} else if (p == 4 && i + 1 < esc->nparam && (esc->subparams & (1u << (i + 1)))) {
+			// Underline style (4:n)
+			_sgr_underline(r, esc->params[++i]);
+		} else if (_sgr_attr(r, p)) {
+			continue;
+		} else if (p >= 30 && p <= 37) {
+			r->fg = p - 30;
+		} else if (p == 38) {
+			i += _sgr_ext_color(esc, i + 1, &r->fg);
+		} else if (p == 39) {
+			r->fg = RENDERER_COLOR_FG;
+		} else if (p >= 40 && p <= 47) {
+			r->bg = p - 40;
+		} else if (p == 48) {
+			i += _sgr_ext_color(esc, i + 1, &r->bg);
+		} else if (p == 49) {
+			r->bg = RENDERER_COLOR_BG;
+		} else if (p >= 90 && p <= 97) {
+			r->fg = p - 90 + 8;
+		} else if (p >= 100 && p <= 107) {
+			r->bg = p - 100 + 8;
+		}
+	}
+}
+
+
+
+
 static void _process_esc(struct renderer *r, struct esc_seq *esc) {
 	unsigned i;
 	printf("Escape: \\x1b[");
@@ -685,6 +1963,13 @@ static void _process_esc(struct renderer *r, struct esc_seq *esc) {
 			if (esc->nparam == 0) {
 				esc->params[0] = 0;
 			}
+			if (esc->params[0] == 3) {
+				// Clear scrollback
+				if (r->mod_buf->scrollback) {
+					scrollback_clear(r->mod_buf->scrollback);
+				}
+				return;
+			}
 			_clear_screen(r, esc->params[0]);
 			return;
 		case 'K':
@@ -693,134 +1978,592 @@ static void _process_esc(struct renderer *r, struct esc_seq *esc) {
 			}
 			_clear_line(r, esc->params[0]);
 			return;
+		// Insert/delete lines and characters
+		case 'L':
+			_insert_lines(r->mod_buf, esc->params[0] ? esc->params[0] : 1);
+			return;
+		case 'M':
+			_delete_lines(r->mod_buf, esc->params[0] ? esc->params[0] : 1);
+			return;
+		case '@':
+			_insert_chars(r->mod_buf, esc->params[0] ? esc->params[0] : 1);
+			return;
+		case 'P':
+			_delete_chars(r->mod_buf, esc->params[0] ? esc->params[0] : 1);
+			return;
+		case 'X':
+			_erase_chars(r->mod_buf, esc->params[0] ? esc->params[0] : 1);
+			return;
+		// Scrolling
+		case 'r':
+			_set_scroll_region(r, esc->params[0], esc->params[1]);
+			return;
+		case 'S':
+			_scroll_up(r->mod_buf, esc->params[0] ? esc->params[0] : 1);
+			return;
+		case 'T':
+			_scroll_down(r->mod_buf, esc->params[0] ? esc->params[0] : 1);
+			return;
 		// Attributes
 		case 'm':
-			// TODO: Handle attribs other than color (bold, underline etc)
-			i = 0;
-			while (i < esc->nparam) {
-				switch (esc->params[i]) {
-				case 0:
-					_reset_fgcol(r);
-					_reset_bgcol(r);
-					break;
-				case 30:
-					_set_fgcol(r, &r->palette[0]);
-					break;
-				case 31:
-					_set_fgcol(r, &r->palette[1]);
-					break;
-				case 32:
-					_set_fgcol(r, &r->palette[2]);
-					break;
-				case 33:
-					_set_fgcol(r, &r->palette[3]);
-					break;
-				case 34:
-					_set_fgcol(r, &r->palette[4]);
-					break;
-				case 35:
-					_set_fgcol(r, &r->palette[5]);
-					break;
-				case 36:
-					_set_fgcol(r, &r->palette[6]);
-					break;
-				case 37:
-					_set_fgcol(r, &r->palette[7]);
-					break;
-				case 39:
-					_reset_fgcol(r);
-					break;
-				case 40:
-					_set_bgcol(r, &r->palette[0]);
-					break;
-				case 41:
-					_set_bgcol(r, &r->palette[1]);
-					break;
-				case 42:
-					_set_bgcol(r, &r->palette[2]);
-					break;
-				case 43:
-					_set_bgcol(r, &r->palette[3]);
-					break;
-				case 44:
-					_set_bgcol(r, &r->palette[4]);
-					break;
-				case 45:
-					_set_bgcol(r, &r->palette[5]);
-					break;
-				case 46:
-					_set_bgcol(r, &r->palette[6]);
-					break;
-				case 47:
-					_set_bgcol(r, &r->palette[7]);
-					break;
-				case 49:
-					_reset_bgcol(r);
-					break;
-				case 90:
-					_set_fgcol(r, &r->palette[8]);
-					break;
-				case 91:
-					_set_fgcol(r, &r->palette[9]);
-					break;
-				case 92:
-					_set_fgcol(r, &r->palette[10]);
-					break;
-				case 93:
-					_set_fgcol(r, &r->palette[11]);
-					break;
-				case 94:
-					_set_fgcol(r, &r->palette[12]);
-					break;
-				case 95:
-					_set_fgcol(r, &r->palette[13]);
-					break;
-				case 96:
-					_set_fgcol(r, &r->palette[14]);
-					break;
-				case 97:
-					_set_fgcol(r, &r->palette[15]);
-					break;
-				case 100:
-					_set_bgcol(r, &r->palette[8]);
-					break;
-				case 101:
-					_set_bgcol(r, &r->palette[9]);
-					break;
-				case 102:
-					_set_bgcol(r, &r->palette[10]);
-					break;
-				case 103:
-					_set_bgcol(r, &r->palette[11]);
-					break;
-				case 104:
-					_set_bgcol(r, &r->palette[12]);
-					break;
-				case 105:
-					_set_bgcol(r, &r->palette[13]);
-					break;
-				case 106:
-					_set_bgcol(r, &r->palette[14]);
-					break;
-				case 107:
-					_set_bgcol(r, &r->palette[15]);
-					break;
+			_sgr(r, esc);
+			return;
+		// Save/restore cursor
+		case 's':
+			r->mod_buf->saved_cursor = r->mod_buf->cursor;
+			return;
+		case 'u':
+			r->mod_buf->cursor = r->mod_buf->saved_cursor;
+			return;
+		}
+	} else if (esc->private == '?') {
+		switch (esc->final) {
+		// Private modes
+		case 'h':
+		case 'l':
+			for (i = 0; i < esc->nparam; i++) {
+				_set_private_mode(r, esc->params[i], esc->final == 'h');
+			}
+			return;
+		}
+	}
+}
+
+
+// Find end of run of codepoints starting at i without escape sequences, and store it in
+// run_end. If the run has more line feeds than the screen has rows, everything up to the
+// dim_y'th last line feed is scrolled off before the end of the run, and never needs to be
+// written to the screen. Return index just after that line feed, or i if there is none
+static size_t _find_scrolled_off(const uint32_t *cps, size_t i, size_t n_cps, unsigned dim_y,
+		size_t *run_end) {
+	size_t j, n_lf = 0;
+	for (j = i; j < n_cps && cps[j] != 27; j++) {
+		n_lf += cps[j] == '\n';
+	}
+	*run_end = j;
+	if (dim_y == 0 || n_lf <= dim_y) {
+		return i;
+	}
+	// Skip past all but the last dim_y - 1 line feeds
+	n_lf -= dim_y - 1;
+	for (j = i; n_lf > 0; j++) {
+		n_lf -= cps[j] == '\n';
+	}
+	return j;
+}
+
+
+// Get number of cells taken by codepoint. Wide characters are narrowed if the screen has a
+// single column
+static unsigned _char_width(const struct termbuf *m, uint32_t cp) {
+	unsigned w = width_get(cp);
+	return (w == 2 && m->dim.x < 2) ? 1 : w;
+}
+
+
+// Write codepoint taking w (1 or 2) cells at cursor, with current attributes. Wide characters
+// are followed by a continuation cell. Wide characters partly overwritten are erased
+static void _put_char(struct renderer *r, struct termbuf *m, uint32_t cp, unsigned w) {
+	struct termchar *row = m->rows[m->cursor.y], *tchar;
+	unsigned x = m->cursor.x, k;
+	if ((row[x].flags & RENDERER_CELL_WIDE_CONT) && x > 0) {
+		memset(&row[x - 1], 0, sizeof(struct termchar));
+	}
+	if ((row[x + w - 1].flags & RENDERER_CELL_WIDE) && x + w < m->dim.x) {
+		memset(&row[x + w], 0, sizeof(struct termchar));
+	}
+	for (k = 0; k < w; k++) {
+		tchar = &row[x + k];
+		tchar->cp = k ? 0 : cp;
+		tchar->box = k ? 0 : boxdraw_code(cp);
+		tchar->fg = r->fg;
+		tchar->bg = r->bg;
+		tchar->attrs = r->attrs;
+		tchar->flags = w == 1 ? 0 : (k ? RENDERER_CELL_WIDE_CONT : RENDERER_CELL_WIDE);
+		tchar->to_draw = true;
+	}
+}
+
+
+// Get cell holding the character written before the cursor, or NULL if there is none
+static struct termchar* _prev_cell(struct termbuf *m) {
+	struct termchar *row;
+	unsigned x = m->cursor.x;
+	if (x > 0) {
+		row = m->rows[m->cursor.y];
+	} else if (m->cursor.y > 0) {
+		// Wrapped after it
+		row = m->rows[m->cursor.y - 1];
+		x = m->dim.x;
+	} else {
+		return NULL;
+	}
+	if ((row[x - 1].flags & RENDERER_CELL_WIDE_CONT) && x > 1) {
+		x--;
+	}
+	return row[x - 1].to_draw ? &row[x - 1] : NULL;
+}
+
+
+// Extend grapheme cluster of the previous character with codepoint. The cell refers to the
+// interned cluster afterwards. Plain characters stay inline in their cells
+static void _attach_char(struct termbuf *m, uint32_t cp) {
+	struct termchar *tchar;
+	uint32_t cps[GRAPHEME_MAX];
+	const uint32_t *src;
+	size_t n = 1;
+	if (!(tchar = _prev_cell(m)) || (tchar->flags & RENDERER_CELL_IMAGE)) {
+		return;
+	}
+	if (tchar->flags & RENDERER_CELL_CLUSTER) {
+		if (!(src = graphemes_get(m->clusters, tchar->cp, &n)) || n >= GRAPHEME_MAX) {
+			return;
+		}
+		memcpy(cps, src, n * sizeof(uint32_t));
+	} else {
+		cps[0] = tchar->cp;
+	}
+	cps[n++] = cp;
+	tchar->cp = graphemes_intern(m->clusters, cps, n);
+	tchar->flags |= RENDERER_CELL_CLUSTER;
+}
+
+
+// Move cursor over codepoints cps[i..end) exactly as renderer_add_codepoints would, but
+// without writing them to the screen. Scrolling is applied at the end, in one go. Return
+// number of lines advanced
+static size_t _skip_scrolled_off(struct termbuf *m, const uint32_t *cps, size_t i, size_t end) {
+	size_t lines = 0, scroll = 0;
+	unsigned x = m->cursor.x, y = m->cursor.y, w;
+	bool join = m->join_next;
+	for ( ; i < end; i++) {
+		if (cps[i] > 0x10ffff || (cps[i] >= 0xd800 && cps[i] < 0xe000)) {
+			die_fmt("Invalid Unicode codepoint: %u\n", cps[i]);
+		}
+		switch (cps[i]) {
+		case '\a':
+			break;
+		case '\b':
+			if (x > 0) {
+				x--;
+			}
+			break;
+		case '\t':
+			do {
+				x++;
+			} while (x % BTE_TABSZ != 0);
+			break;
+		case '\r':
+			x = 0;
+			break;
+		case '\n':
+			y++;
+			lines++;
+			break;
+		default:
+			if ((w = _char_width(m, cps[i])) == 0 || join) {
+				join = cps[i] == GRAPHEME_ZWJ;
+				break;
+			}
+			if (w == 2 && x + 1 >= m->dim.x) {
+				x = 0;
+				lines++;
+				if (++y >= m->dim.y) {
+					y = m->dim.y - 1;
+					scroll++;
 				}
-				i++;
 			}
+			x += w;
+		}
+		if (x >= m->dim.x) {
+			x = 0;
+			y++;
+			lines++;
+		}
+		if (y >= m->dim.y) {
+			y = m->dim.y - 1;
+			scroll++;
+		}
+	}
+	_scroll_up(m, scroll);
+	m->cursor.x = x;
+	m->cursor.y = y;
+	m->join_next = join;
+	return lines;
+}
+
+
+// Line on the last row is completed. It moves up a row, for characters to still combine with
+// it, and the line there goes to scrollback. The rows above go first, the first time (pushed
+// tells)
+static void _stage_line(struct termbuf *m, bool *pushed) {
+	struct termchar *row;
+	unsigned y, last = m->dim.y - 1;
+	if (!*pushed) {
+		for (y = 0; y + 1 < last; y++) {
+			scrollback_push(m->scrollback, m->rows[y], m->dim.x, m->clusters);
+		}
+		*pushed = true;
+	}
+	if (last > 0) {
+		scrollback_push(m->scrollback, m->rows[last - 1], m->dim.x, m->clusters);
+		row = m->rows[last - 1];
+		m->rows[last - 1] = m->rows[last];
+		m->rows[last] = row;
+	} else {
+		scrollback_push(m->scrollback, m->rows[last], m->dim.x, m->clusters);
+	}
+	memset(m->rows[last], 0, m->dim.x * sizeof(struct termchar));
+}
+
+
+// Write codepoints cps[i..end) exactly as renderer_add_codepoints would, with the cursor on
+// the last row, but send each line completed straight to scrollback instead of scrolling the
+// screen. The line feeds following end scroll everything on the screen off, so it is left
+// blank, with the cursor on the top row for them. Return number of lines advanced
+static size_t _stage_scrolled_off(struct renderer *r, struct termbuf *m, const uint32_t *cps,
+		size_t i, size_t end) {
+	size_t lines = 0;
+	unsigned w, y;
+	bool pushed = false;
+	for ( ; i < end; i++) {
+		if (cps[i] > 0x10ffff || (cps[i] >= 0xd800 && cps[i] < 0xe000)) {
+			die_fmt("Invalid Unicode codepoint: %u\n", cps[i]);
+		}
+		switch (cps[i]) {
+		case '\a':
+			break;
+		case '\b':
+			if (m->cursor.x > 0) {
+				m->cursor.x--;
+			}
+			break;
+		case '\t':
+			do {
+				m->cursor.x++;
+			} while (m->cursor.x % BTE_TABSZ != 0);
+			break;
+		case '\r':
+			m->cursor.x = 0;
+			break;
+		case '\n':
+			_stage_line(m, &pushed);
+			lines++;
+			break;
+		default:
+			if ((w = _char_width(m, cps[i])) == 0 || m->join_next) {
+				_attach_char(m, cps[i]);
+				m->join_next = cps[i] == GRAPHEME_ZWJ;
+				break;
+			}
+			if (w == 2 && m->cursor.x + 1 >= m->dim.x) {
+				m->rows[m->cursor.y][m->dim.x - 1].flags |= RENDERER_CELL_WRAPPED;
+				m->cursor.x = 0;
+				_stage_line(m, &pushed);
+				lines++;
+			}
+			_put_char(r, m, cps[i], w);
+			m->cursor.x += w;
+		}
+		if (m->cursor.x >= m->dim.x) {
+			m->rows[m->cursor.y][m->dim.x - 1].flags |= RENDERER_CELL_WRAPPED;
+			m->cursor.x = 0;
+			_stage_line(m, &pushed);
+			lines++;
+		}
+	}
+	if (pushed && m->dim.y > 1) {
+		scrollback_push(m->scrollback, m->rows[m->dim.y - 2], m->dim.x, m->clusters);
+	}
+	for (y = 0; y + 1 < m->dim.y; y++) {
+		memset(m->rows[y], 0, m->dim.x * sizeof(struct termchar));
+	}
+	m->cursor.y = 0;
+	return lines;
+}
+
+
+// Set palette entry idx from color specification, or reset it if spec is NULL. Queries ("?")
+// are ignored
+static void _set_palette(struct renderer *r, unsigned idx, const char *spec) {
+	struct color c;
+	if (!spec) {
+		r->palette[idx] = r->init_palette[idx];
+	} else if (color_parse_x11(&c, spec)) {
+		r->palette[idx] = c;
+	} else {
+		return;
+	}
+	r->palette_dirty = true;
+}
+
+
+// Set window title, to be picked up by the window. Titles too long are cut short at a
+// character boundary
+static void _set_title(struct renderer *r, const char *title) {
+	size_t len = strlen(title);
+	if (len >= RENDERER_TITLE_MAX) {
+		for (len = RENDERER_TITLE_MAX - 1; len > 0 && (title[len] & 0xc0) == 0x80; len--);
+	}
+	memcpy(r->title, title, len);
+	r->title[len] = '\0';
+	r->title_dirty = true;
+}
+
+
+// Process operating system command (without the "ESC ]" and terminator), as a NUL-terminated
+// string. Palette changes only touch the palette, never any cells. Commands not handled
+// (hyperlinks, working directory reports, clipboard, ...) are dropped
+static void _process_osc(struct renderer *r, char *buf) {
+	char *s, *tok, *spec, *save;
+	unsigned cmd, i;
+	long idx;
+	cmd = strtoul(buf, &s, 10);
+	if (s == buf || (*s != ';' && *s != '\0')) {
+		return;
+	}
+	if (*s == ';') {
+		s++;
+	}
+	switch (cmd) {
+	case 0:
+	case 2:
+		// Set window title. OSC 0 sets the icon name too, which there is none of
+		_set_title(r, s);
+		break;
+	case 4:
+		// Set palette colors. Pairs of index and color
+		for (tok = strtok_r(s, ";", &save); tok; tok = strtok_r(NULL, ";", &save)) {
+			if (!(spec = strtok_r(NULL, ";", &save))) {
+				break;
+			}
+			if ((idx = strtol(tok, NULL, 10)) >= 0 && idx < 256) {
+				_set_palette(r, idx, spec);
+			}
+		}
+		break;
+	case 10:
+		_set_palette(r, RENDERER_COLOR_FG, s);
+		break;
+	case 11:
+		_set_palette(r, RENDERER_COLOR_BG, s);
+		break;
+	case 104:
+		// Reset palette colors. All of them if no index is given
+		if (*s == '\0') {
+			for (i = 0; i < 256; i++) {
+				_set_palette(r, i, NULL);
+			}
+		}
+		for (tok = strtok_r(s, ";", &save); tok; tok = strtok_r(NULL, ";", &save)) {
+			if ((idx = strtol(tok, NULL, 10)) >= 0 && idx < 256) {
+				_set_palette(r, idx, NULL);
+			}
+		}
+		break;
+	case 110:
+		_set_palette(r, RENDERER_COLOR_FG, NULL);
+		break;
+	case 111:
+		_set_palette(r, RENDERER_COLOR_BG, NULL);
+		break;
+	}
+}
+
+
+// Write cells showing image place at cursor, a row of them at a time (scrolling as needed).
+// The cursor is then moved past the image if asked, else left where it was
+static void _place_image(struct renderer *r, const struct image_place *place) {
+	struct termbuf *m = r->mod_buf;
+	struct termchar *row, *tchar;
+	uvec2_t start = m->cursor;
+	unsigned x, y, top = m->cursor.y;
+	// Rows past the height of the screen would only scroll the top of the image off it
+	unsigned rows = place->cells.y < m->dim.y ? place->cells.y : m->dim.y;
+	for (y = 0; y < rows; y++) {
+		if (y > 0) {
+			_index(m);
+			if (m->cursor.y == top) {
+				start.y = start.y > 0 ? start.y - 1 : 0;
+			}
+			top = m->cursor.y;
+		}
+		row = m->rows[m->cursor.y];
+		if ((row[start.x].flags & RENDERER_CELL_WIDE_CONT) && start.x > 0) {
+			memset(&row[start.x - 1], 0, sizeof(struct termchar));
+		}
+		for (x = 0; x < place->cells.x && start.x + x < m->dim.x; x++) {
+			tchar = &row[start.x + x];
+			tchar->cp = place->id;
+			tchar->box = 0;
+			tchar->fg = (y << 16) | x;
+			tchar->bg = r->bg;
+			tchar->attrs = 0;
+			tchar->flags = RENDERER_CELL_IMAGE;
+			tchar->to_draw = true;
+		}
+		if (start.x + x < m->dim.x && (row[start.x + x].flags & RENDERER_CELL_WIDE_CONT)) {
+			memset(&row[start.x + x], 0, sizeof(struct termchar));
+		}
+	}
+	if (!place->move) {
+		m->cursor = start;
+	} else if (r->str_kind == RENDERER_STRING_APC) {
+		// Kitty leaves the cursor after the image, on its last row
+		m->cursor.x = start.x + place->cells.x < m->dim.x ? start.x + place->cells.x : m->dim.x - 1;
+	} else {
+		// Sixel moves it to the row below
+		_index(m);
+		m->cursor.x = start.x;
+	}
+}
+
+
+// Start receiving a control string of kind
+static void _start_string(struct renderer *r, enum renderer_string kind) {
+	r->str_kind = kind;
+	r->str_overflow = false;
+	r->str_len = 0;
+	r->str_image = false;
+}
+
+
+// Pass what has been received of a device control string or application program command on
+// to the image decoder, which takes it in pieces. Strings that aren't images are dropped
+static void _flush_string(struct renderer *r) {
+	size_t off = 0;
+	if (r->str_len == 0 || r->str_overflow) {
+		return;
+	}
+	if (!r->str_image) {
+		if (r->str_kind == RENDERER_STRING_APC && r->str[0] == 'G' && r->images) {
+			images_begin(r->images, IMAGE_KITTY);
+			off = 1;
+		} else if (r->str_kind == RENDERER_STRING_DCS && r->images) {
+			images_begin(r->images, IMAGE_SIXEL);
+		} else {
+			r->str_overflow = true;
 			return;
 		}
+		r->str_image = true;
+	}
+	images_feed(r->images, r->str + off, r->str_len - off);
+	r->str_len = 0;
+}
+
+
+// End control string being received. If it was terminated (rather than cancelled), it is
+// processed, unless it didn't fit
+static void _end_string(struct renderer *r, bool terminated) {
+	struct image_place place;
+	if (r->str_kind == RENDERER_STRING_DCS || r->str_kind == RENDERER_STRING_APC) {
+		_flush_string(r);
+	}
+	if (r->str_image) {
+		if (!terminated) {
+			images_cancel(r->images);
+		} else if (images_end(r->images, r->fonts->advance, &place)) {
+			_place_image(r, &place);
+		}
+		r->str_image = false;
+	} else if (terminated && !r->str_overflow && r->str_kind == RENDERER_STRING_OSC) {
+		r->str[r->str_len] = '\0';
+		_process_osc(r, r->str);
+	}
+	r->str_kind = RENDERER_STRING_NONE;
+}
+
+
+// Add codepoints [i, n_cps) to the control string being received, up to where it ends. It ends
+// with ST (ESC \ or 0x9c) or BEL, and is cancelled by CAN, SUB, or ESC starting another
+// sequence. Codepoints past the limit are dropped without being stored, and so is the string
+// when it ends, unless it is an image, which is passed on in pieces. Return index of the first
+// codepoint after it, or of the ESC it is cancelled by (left to be processed), or n_cps if it
+// hasn't ended. ESC as the last codepoint may be the start of ST, so its index is returned with
+// the string not ended
+static size_t _add_string(struct renderer *r, const uint32_t *cps, size_t i, size_t n_cps) {
+	uint32_t cp;
+	for ( ; i < n_cps; i++) {
+		cp = cps[i];
+		switch (cp) {
+		case 27:
+			if (i + 1 >= n_cps) {
+				if (r->str_kind == RENDERER_STRING_DCS || r->str_kind == RENDERER_STRING_APC) {
+					_flush_string(r);
+				}
+				return i;
+			}
+			if (cps[i + 1] == '\\') {
+				_end_string(r, true);
+				return i + 2;
+			}
+			_end_string(r, false);
+			return i;
+		case '\a':
+		case 0x9c:
+			_end_string(r, true);
+			return i + 1;
+		case 0x18:
+		case 0x1a:
+			_end_string(r, false);
+			return i + 1;
+		}
+		if (r->str_overflow || r->str_kind == RENDERER_STRING_IGNORE) {
+			continue;
+		}
+		if (r->str_len + UTF8_MAX > RENDERER_STRING_MAX
+				&& (r->str_kind == RENDERER_STRING_DCS || r->str_kind == RENDERER_STRING_APC)) {
+			_flush_string(r);
+		}
+		if (r->str_overflow) {
+			continue;
+		} else if (r->str_len + UTF8_MAX > RENDERER_STRING_MAX) {
+			r->str_overflow = true;
+		} else if (cp < 0x80) {
+			r->str[r->str_len++] = cp;
+		} else {
+			r->str_len += utf8_encode(cp, &r->str[r->str_len]);
+		}
+	}
+	if (r->str_kind == RENDERER_STRING_DCS || r->str_kind == RENDERER_STRING_APC) {
+		_flush_string(r);
+	}
+	return i;
+}
+
+
+// Has the application asked for pastes to be bracketed?
+bool renderer_bracketed_paste(struct renderer *r) {
+	if (!r) {
+		die("NULL renderer");
 	}
+	return __atomic_load_n(&r->bracketed_paste, __ATOMIC_RELAXED);
+}
+
+
+// If the window title was set since the last call, copy it into buf of n bytes and return
+// true
+bool renderer_get_title(struct renderer *r, char *buf, size_t n) {
+	bool ret;
+	if (!r) {
+		die("NULL renderer");
+	}
+	pthread_mutex_lock(&r->buf_mut);
+	if ((ret = r->title_dirty) && n > 0) {
+		snprintf(buf, n, "%s", r->title);
+		r->title_dirty = false;
+	}
+	pthread_mutex_unlock(&r->buf_mut);
+	return ret;
 }
 
 
 // Add codepoints to renderer. Return number of codepoints added
 size_t renderer_add_codepoints(struct renderer *r, uint32_t *cps, size_t n_cps) {
-	const struct glyph *glyph;
 	struct esc_seq esc = { 0 };
-	unsigned y, param;
+	unsigned param, w;
 	bool in_num = false;
-	size_t i, j, lines;
+	size_t i, j, lines, run_end = 0;
 	struct termbuf *m;
 
 	if (!r) {
@@ -838,12 +2581,67 @@ size_t renderer_add_codepoints(struct renderer *r, uint32_t *cps, size_t n_cps)
 		if (cps[i] > 0x10ffff || (cps[i] >= 0xd800 && cps[i] < 0xe000)) {
 			die_fmt("Invalid Unicode codepoint: %u\n", cps[i]);
 		}
+		if (r->str_kind != RENDERER_STRING_NONE) {
+			// In a control string, possibly started in an earlier call. ESC at the end is
+			// left for the next call, like escape sequences
+			if ((j = _add_string(r, cps, i, n_cps)) == i
+					&& r->str_kind != RENDERER_STRING_NONE) {
+				break;
+			}
+			i = j;
+			continue;
+		}
 		if (cps[i] == 27) {
 			// Escape
 			if ((j = i + 1) >= n_cps) {
 				break;
 			}
 			if (cps[j] != '[') {
+				switch (cps[j]) {
+				case ']':
+					_start_string(r, RENDERER_STRING_OSC);
+					i = j + 1;
+					continue;
+				case 'P':
+					_start_string(r, RENDERER_STRING_DCS);
+					i = j + 1;
+					continue;
+				case '_':
+					_start_string(r, RENDERER_STRING_APC);
+					i = j + 1;
+					continue;
+				case 'X':
+				case '^':
+					_start_string(r, RENDERER_STRING_IGNORE);
+					i = j + 1;
+					continue;
+				case 'D':
+					// Index
+					_index(m);
+					i = j + 1;
+					continue;
+				case 'E':
+					// Next line
+					m->cursor.x = 0;
+					_index(m);
+					i = j + 1;
+					continue;
+				case 'M':
+					// Reverse index
+					_reverse_index(m);
+					i = j + 1;
+					continue;
+				case '7':
+					// Save cursor
+					m->saved_cursor = m->cursor;
+					i = j + 1;
+					continue;
+				case '8':
+					// Restore cursor
+					m->cursor = m->saved_cursor;
+					i = j + 1;
+					continue;
+				}
 				i++;
 				continue;
 			}
@@ -861,10 +2659,13 @@ size_t renderer_add_codepoints(struct renderer *r, uint32_t *cps, size_t n_cps)
 				if (j >= n_cps) {
 					goto out;
 				}
-				if (cps[j] == ';') {
+				if (cps[j] == ';' || cps[j] == ':') {
 					if (esc.nparam < sizeof(esc.params) / sizeof(esc.params[0])) {
 						esc.params[esc.nparam++] = param;
 					}
+					if (cps[j] == ':' && esc.nparam < 32) {
+						esc.subparams |= 1u << esc.nparam;
+					}
 					param = 0;
 					in_num = false;
 					j++;
@@ -884,8 +2685,24 @@ size_t renderer_add_codepoints(struct renderer *r, uint32_t *cps, size_t n_cps)
 				break;
 			}
 			_process_esc(r, &esc);
+			// Escape sequence might have switched screens
+			m = r->mod_buf;
 			continue;
 		}
+		if (i >= run_end && m->scroll_top == 0 && m->scroll_bot == m->dim.y
+				&& (!m->scrollback || m->cursor.y + 1 == m->dim.y)) {
+			// Start of a run without escapes. During floods of lines, most of them are
+			// scrolled off before the screen can be presented, so don't write them to it.
+			// Lines kept in scrollback go there directly, once the cursor is on the last
+			// row (rows it moves down into keep what they had)
+			j = _find_scrolled_off(cps, i, n_cps, m->dim.y, &run_end);
+			if (j > i) {
+				lines += m->scrollback ? _stage_scrolled_off(r, m, cps, i, j)
+					: _skip_scrolled_off(m, cps, i, j);
+				i = j;
+				continue;
+			}
+		}
 		switch (cps[i]) {
 		case '\a':
 			// Ignore
@@ -904,45 +2721,47 @@ size_t renderer_add_codepoints(struct renderer *r, uint32_t *cps, size_t n_cps)
 			m->cursor.x = 0;
 			break;
 		case '\n':
-			y = (m->toprow + m->cursor.y) % (m->dim.y + 1);
-			m->cursor.y++;
+			_index(m);
 			lines++;
 			break;
 		default:
-			if (!(glyph = fonts_get_glyph(r->fonts, cps[i]))) {
-				warn_fmt("Could not get glyph for codepoint: %u", cps[i]);
-			} else {
-				y = (m->toprow + m->cursor.y) % (m->dim.y + 1);
-				m->termbox[y * m->dim.x + m->cursor.x].glyph = glyph;
-				m->termbox[y * m->dim.x + m->cursor.x].to_draw = true;
-				m->termbox[y * m->dim.x + m->cursor.x].fgcol = r->fgcol;
-				m->termbox[y * m->dim.x + m->cursor.x].bgcol = r->bgcol;
+			// Glyphs are looked up (and rasterized) by the render thread. Box-drawing
+			// characters are drawn procedurally and need no glyph at all
+			if ((w = _char_width(m, cps[i])) == 0 || m->join_next) {
+				// Combining characters, and characters following a zero width joiner,
+				// extend the grapheme cluster of the previous character
+				_attach_char(m, cps[i]);
+				m->join_next = cps[i] == GRAPHEME_ZWJ;
+				break;
+			}
+			if (w == 2 && m->cursor.x + 1 >= m->dim.x) {
+				// Doesn't fit on this row
+				m->rows[m->cursor.y][m->dim.x - 1].flags |= RENDERER_CELL_WRAPPED;
+				m->cursor.x = 0;
+				_index(m);
+				lines++;
 			}
-			m->cursor.x++;
+			_put_char(r, m, cps[i], w);
+			m->cursor.x += w;
 		}
 
 		// Is this default behaviour?
 		if (m->cursor.x >= m->dim.x) {
+			m->rows[m->cursor.y][m->dim.x - 1].flags |= RENDERER_CELL_WRAPPED;
 			m->cursor.x = 0;
-			m->cursor.y++;
+			_index(m);
 			lines++;
 		}
-		if (m->cursor.y >= m->dim.y) {
-			// Scroll 1 line up
-			m->toprow = (m->toprow + 1) % (m->dim.y + 1);
-			y = (m->toprow + m->dim.y - 1) % (m->dim.y + 1);
-			m->cursor.y = m->dim.y - 1;
-			memset(&m->termbox[m->dim.x * y], 0, m->dim.x * sizeof(struct termchar));
-		}
 		i++;
 	}
 
 out:
 	if (lines > 0) {
 		// Clear out last line
-		y = (m->toprow + m->cursor.y) % (m->dim.y + 1);
-		memset(&m->termbox[m->dim.x * y + m->cursor.x], 0, (m->dim.x - m->cursor.x) * sizeof(struct termchar));
+		memset(&m->rows[m->cursor.y][m->cursor.x], 0, (m->dim.x - m->cursor.x) * sizeof(struct termchar));
 	}
+	_termbuf_collect(m);
+	probe_parsed();
 
 	pthread_mutex_unlock(&r->buf_mut);
 
@@ -950,32 +2769,177 @@ out:
 }
 
 
-// Resize renderer to match window (called by window subsystem)
+// Does row y hold no text?
+static bool _termbuf_row_empty(const struct termbuf *tb, unsigned y) {
+	unsigned x;
+	for (x = 0; x < tb->dim.x; x++) {
+		if (tb->rows[y][x].to_draw) {
+			return false;
+		}
+	}
+	return true;
+}
+
+
+// Lay out rows [0, n) of tb in rows of width cells, joining rows where they were soft-wrapped,
+// into out (if not NULL). Store position of the cursor in the new rows in *cursor. Return
+// number of rows
+static unsigned _termbuf_rewrap(const struct termbuf *tb, unsigned n, unsigned width,
+		struct termchar *out, uvec2_t *cursor) {
+	const struct termchar *src;
+	unsigned x, y, j, len, w, step, row = 0, col = 0;
+	bool wrapped;
+	for (y = 0; y < n; y++) {
+		src = tb->rows[y];
+		wrapped = src[tb->dim.x - 1].flags & RENDERER_CELL_WRAPPED;
+		// Empty cells at the end of a logical line are dropped, and so is an empty cell left
+		// by a wide character wrapped early
+		len = tb->dim.x;
+		if (wrapped && !src[len - 1].to_draw) {
+			len--;
+		}
+		for ( ; !wrapped && len > 0 && !src[len - 1].to_draw; len--);
+		for (x = 0; x < len; x += step) {
+			// Wide characters take their continuation cell along, and move to the next row
+			// if they don't fit
+			w = ((src[x].flags & RENDERER_CELL_WIDE) && width > 1) ? 2 : 1;
+			step = ((src[x].flags & RENDERER_CELL_WIDE) && x + 1 < len
+					&& (src[x + 1].flags & RENDERER_CELL_WIDE_CONT)) ? 2 : 1;
+			if (col > 0 && col + w > width) {
+				if (out) {
+					out[(row + 1) * width - 1].flags |= RENDERER_CELL_WRAPPED;
+				}
+				row++;
+				col = 0;
+			}
+			if (y == tb->cursor.y && tb->cursor.x >= x && tb->cursor.x < x + step) {
+				cursor->x = col + tb->cursor.x - x;
+				cursor->y = row;
+			}
+			for (j = 0; out && j < w && j < step; j++) {
+				out[row * width + col + j] = src[x + j];
+				out[row * width + col + j].flags &= ~RENDERER_CELL_WRAPPED;
+			}
+			if (out && w < step) {
+				// Narrowed to fit a single column
+				out[row * width + col].flags &= ~RENDERER_CELL_WIDE;
+			}
+			col += w;
+		}
+		if (y == tb->cursor.y && tb->cursor.x >= len) {
+			// Past the end of the text. Stays on the row
+			cursor->x = col + tb->cursor.x - len;
+			cursor->y = row;
+		}
+		if (!wrapped) {
+			row++;
+			col = 0;
+		}
+	}
+	row += col > 0;
+	return row > cursor->y ? row : cursor->y + 1;
+}
+
+
+// Resize terminal buffer to dim. If reflow is true, logical lines are rewrapped to the new
+// width, otherwise rows are cut short. Rows that don't fit above the cursor are pushed to
+// scrollback
+static void _termbuf_resize(struct termbuf *tb, uvec2_t dim, bool reflow) {
+	struct termchar *tmp, **tmp_rows, *out;
+	uvec2_t cursor = tb->cursor;
+	unsigned n, n_out, top, x, y;
+	// Rows up to the last one with text, or the one with the cursor
+	for (n = tb->dim.y; n > tb->cursor.y + 1 && _termbuf_row_empty(tb, n - 1); n--);
+	if (tb->dim.x == 0 || tb->dim.y == 0 || dim.x == 0) {
+		n = 0;
+	}
+	if (reflow) {
+		n_out = _termbuf_rewrap(tb, n, dim.x, NULL, &cursor);
+		if (!(out = calloc((size_t) n_out * dim.x, sizeof(struct termchar)))) {
+			die_err("calloc()");
+		}
+		_termbuf_rewrap(tb, n, dim.x, out, &cursor);
+	} else {
+		n_out = n;
+		if (!(out = calloc((size_t) n_out * dim.x, sizeof(struct termchar)))) {
+			die_err("calloc()");
+		}
+		for (y = 0; y < n; y++) {
+			for (x = 0; x < dim.x && x < tb->dim.x; x++) {
+				out[y * dim.x + x] = tb->rows[y][x];
+				out[y * dim.x + x].flags &= ~RENDERER_CELL_WRAPPED;
+			}
+			// No half of a wide character is left
+			if (dim.x < tb->dim.x && (out[(y + 1) * dim.x - 1].flags & RENDERER_CELL_WIDE)) {
+				memset(&out[(y + 1) * dim.x - 1], 0, sizeof(struct termchar));
+			}
+		}
+	}
+	if (cursor.x >= dim.x && dim.x > 0) {
+		cursor.x = dim.x - 1;
+	}
+	top = n_out > dim.y ? n_out - dim.y : 0;
+	if (top > cursor.y) {
+		top = cursor.y;
+	}
+	for (y = 0; tb->scrollback && y < top; y++) {
+		scrollback_push(tb->scrollback, &out[y * dim.x], dim.x, tb->clusters);
+	}
+	tb->dim = dim;
+	// Realloc terminal box
+	if (!(tmp = realloc(tb->termbox, dim.x * dim.y * sizeof(struct termchar)))) {
+		die_err("realloc()");
+	}
+	tb->termbox = tmp;
+	if (!(tmp_rows = realloc(tb->rows, dim.y * sizeof(struct termchar*)))) {
+		die_err("realloc()");
+	}
+	tb->rows = tmp_rows;
+	if (!(tmp_rows = realloc(tb->spare_rows, dim.y * sizeof(struct termchar*)))) {
+		die_err("realloc()");
+	}
+	tb->spare_rows = tmp_rows;
+	memset(tb->termbox, 0, dim.x * dim.y * sizeof(struct termchar));
+	for (y = top; y < n_out && y - top < dim.y; y++) {
+		memcpy(&tb->termbox[(y - top) * dim.x], &out[y * dim.x], dim.x * sizeof(struct termchar));
+	}
+	free(out);
+	_termbuf_reset_rows(tb);
+	// Keep cursors on screen
+	tb->cursor.x = cursor.x;
+	tb->cursor.y = cursor.y - top;
+	if (tb->cursor.y >= dim.y && dim.y > 0) {
+		tb->cursor.y = dim.y - 1;
+	}
+	if (tb->saved_cursor.x >= dim.x && dim.x > 0) {
+		tb->saved_cursor.x = dim.x - 1;
+	}
+	if (tb->saved_cursor.y >= dim.y && dim.y > 0) {
+		tb->saved_cursor.y = dim.y - 1;
+	}
+}
+
+
+// Resize renderer to match window and font size (called by window subsystem)
 uvec2_t renderer_resize(struct renderer *r) {
-	struct termchar *tmp;
-	struct termbuf *m;
 	uvec2_t ret;
 	if (!r) {
 		die("NULL renderer");
 	}
 	pthread_mutex_lock(&r->buf_mut);
-	m = r->mod_buf;
+	// Switch to a new font size, if one is ready, so that metrics and grid change together
+	fonts_apply_size(r->fonts);
 	// Fill dimensions
-	ret.x = m->dim.x = r->window->dim.x / r->fonts->advance.x;
-	ret.y = m->dim.y = r->window->dim.y / r->fonts->advance.y;
-	// Realloc terminal box
-	if (!(tmp = realloc(m->termbox, m->dim.x * (m->dim.y + 1) * sizeof(struct termchar)))) {
-		die_err("realloc()");
+	ret.x = r->window->dim.x / r->fonts->advance.x;
+	ret.y = r->window->dim.y / r->fonts->advance.y;
+	if (ret.x != r->primary->dim.x || ret.y != r->primary->dim.y) {
+		// Scrollback is rewrapped as it comes into view. The screen is rewrapped now, and
+		// rows pushed off it are added at the new width
+		viewport_reflow(r->view, r->primary->scrollback, ret.x);
+		_termbuf_resize(r->primary, ret, true);
+		_termbuf_resize(r->alternate, ret, false);
 	}
-	m->termbox = tmp;
-	// Move cursor to 0
-	m->cursor.x = 0;
-	m->cursor.y = 0;
-	// FIXME: Reset?
-	m->toprow = 0;
-	memset(m->termbox, 0, m->dim.x * (m->dim.y + 1) * sizeof(struct termchar));
 	pthread_mutex_unlock(&r->buf_mut);
-	// TODO: Copy data?
 	// Render
 	renderer_render(r);
 	return ret;
@@ -0,0 +1,97 @@
+#define _GNU_SOURCE
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "ring.h"
+
+
+// Size of a cache line. The positions of either side are kept apart, so that they don't
+// bounce the same line between cores
+#define RING_LINE 64
+
+
+struct ring {
+	char   *data;                                 // size bytes, mapped twice in a row
+	size_t size;                                  // Size (a power of two)
+	size_t head __attribute__((aligned(RING_LINE))); // Bytes produced (written by producer)
+	size_t tail __attribute__((aligned(RING_LINE))); // Bytes consumed (written by consumer)
+};
+
+
+// Create a new ring of at least size bytes
+struct ring* ring_new(size_t size) {
+	struct ring *ring;
+	size_t page = sysconf(_SC_PAGESIZE), sz;
+	char *base;
+	int fd;
+	for (sz = page; sz < size; sz *= 2);
+	if (!(ring = aligned_alloc(RING_LINE, sizeof(struct ring)))) {
+		die_err("aligned_alloc()");
+	}
+	memset(ring, 0, sizeof(struct ring));
+	ring->size = sz;
+	// Reserve room for both mappings, then map the same memory over either half
+	if ((fd = memfd_create("bte-ring", MFD_CLOEXEC)) < 0) {
+		die_err("memfd_create()");
+	}
+	if (ftruncate(fd, sz) < 0) {
+		die_err("ftruncate()");
+	}
+	if ((base = mmap(NULL, 2 * sz, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0))
+			== MAP_FAILED) {
+		die_err("mmap()");
+	}
+	if (mmap(base, sz, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED
+			|| mmap(base + sz, sz, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0)
+			== MAP_FAILED) {
+		die_err("mmap()");
+	}
+	close(fd);
+	ring->data = base;
+	return ring;
+}
+
+
+// Free ring
+void ring_free(struct ring *ring) {
+	if (!ring) {
+		return;
+	}
+	munmap(ring->data, 2 * ring->size);
+	free(ring);
+}
+
+
+// Get the memory of ring
+void ring_memory(const struct ring *ring, char **p, size_t *n) {
+	*p = ring->data;
+	*n = 2 * ring->size;
+}
+
+
+// Get free space to produce into
+size_t ring_write_space(struct ring *ring, char **p) {
+	size_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+	*p = ring->data + (ring->head & (ring->size - 1));
+	return ring->size - (ring->head - tail);
+}
+
+
+// Make n bytes written into the free space available to the consumer
+void ring_produce(struct ring *ring, size_t n) {
+	__atomic_store_n(&ring->head, ring->head + n, __ATOMIC_RELEASE);
+}
+
+
+// Get bytes to consume
+size_t ring_read_space(struct ring *ring, const char **p) {
+	size_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+	*p = ring->data + (ring->tail & (ring->size - 1));
+	return head - ring->tail;
+}
+
+
+// Give the first n bytes to consume back to the producer
+void ring_consume(struct ring *ring, size_t n) {
+	__atomic_store_n(&ring->tail, ring->tail + n, __ATOMIC_RELEASE);
+}
@@ -0,0 +1,447 @@
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "lz.h"
+#include "render.h"
+#include "boxdraw.h"
+#include "grapheme.h"
+#include "scrollback.h"
+
+
+// Size of pages compressed blocks are stored in
+#define SCROLLBACK_PAGE_SZ 4096
+
+// Size of uncompressed blocks
+#define SCROLLBACK_BLOCK_SZ 65536
+
+// Maximum number of pages a block takes
+#define SCROLLBACK_BLOCK_PAGES \
+	((LZ_BOUND(SCROLLBACK_BLOCK_SZ) + SCROLLBACK_PAGE_SZ - 1) / SCROLLBACK_PAGE_SZ)
+
+// Maximum number of lines in a block (all empty)
+#define SCROLLBACK_BLOCK_LINES (SCROLLBACK_BLOCK_SZ / sizeof(struct sb_line))
+
+// Stored cells are a codepoint (or, for grapheme clusters, their number of codepoints) in the
+// low 24 bits, and flags in the high 8 bits. SCROLLBACK_CELL_DRAW is above enum
+// renderer_cell_flag
+#define SCROLLBACK_CELL_DRAW     0x80
+#define SCROLLBACK_CELL(cp, fl)  ((uint32_t) (cp) | ((uint32_t) (fl) << 24))
+#define SCROLLBACK_CELL_CP(c)    ((c) & 0xffffff)
+#define SCROLLBACK_CELL_FLAGS(c) ((c) >> 24)
+
+// Template for the name of the spill file
+#define SCROLLBACK_SPILL_TEMPLATE "/tmp/bte-scrollback-XXXXXX"
+
+
+// Header of a stored line. Followed by n_runs runs of cells with the same colors and
+// attributes, n_cells cells, and then the codepoints of grapheme clusters in those cells, in
+// order. Everything is 4-byte aligned. Box codes aren't stored, since they are derived from
+// codepoints
+struct sb_line {
+	uint16_t n_cells; // Number of cells
+	uint16_t n_runs;  // Number of runs
+	uint16_t n_cps;   // Number of codepoints of grapheme clusters
+	uint16_t pad;
+};
+
+// A run of cells with the same colors and attributes
+struct sb_run {
+	uint32_t fg;    // Foreground color
+	uint32_t bg;    // Background color
+	uint16_t attrs; // Attributes
+	uint16_t len;   // Number of cells
+};
+
+// A compressed block of lines
+struct sb_block {
+	uint64_t first;                         // Number of first line
+	uint32_t n_lines;                       // Number of lines
+	uint32_t size;                          // Size of stored data
+	bool     compressed;                    // Is data compressed? (Stored raw otherwise)
+	uint32_t n_pages;                       // Number of pages
+	uint32_t pages[SCROLLBACK_BLOCK_PAGES]; // Pages holding data, in order
+};
+
+
+// Scrollback store
+struct scrollback {
+	// Pages for compressed blocks
+	uint8_t         *pool;       // Pages
+	size_t          pool_sz;     // Size of mapping
+	uint32_t        *free_pages; // Stack of free pages
+	uint32_t        n_free;      // Number of free pages
+	// Compressed blocks, oldest first
+	struct sb_block *blocks;     // Ring of blocks
+	uint32_t        blocks_cap;  // Capacity of ring
+	uint32_t        blocks_head; // Index of oldest block
+	uint32_t        n_blocks;    // Number of blocks
+	// Most recent lines, uncompressed
+	uint8_t         *hot;        // Lines
+	size_t          hot_sz;      // Bytes used
+	uint32_t        *hot_off;    // Offsets of lines
+	uint32_t        hot_lines;   // Number of lines
+	uint64_t        hot_first;   // Number of first line
+	unsigned        width;       // Length of the longest line added
+	// Most recently decompressed block
+	uint8_t         *cache;      // Lines
+	uint32_t        *cache_off;  // Offsets of lines
+	uint64_t        cache_first; // Number of first line (UINT64_MAX if none)
+	// Scratch space for compressed data
+	uint8_t         *zbuf;
+};
+
+
+// Get block i (0 is the oldest)
+static struct sb_block* _block(struct scrollback *sb, uint32_t i) {
+	return &sb->blocks[(sb->blocks_head + i) % sb->blocks_cap];
+}
+
+
+// Drop oldest block
+static void _drop_oldest(struct scrollback *sb) {
+	struct sb_block *b = _block(sb, 0);
+	uint32_t i;
+	for (i = 0; i < b->n_pages; i++) {
+		sb->free_pages[sb->n_free++] = b->pages[i];
+	}
+	if (b->first == sb->cache_first) {
+		sb->cache_first = UINT64_MAX;
+	}
+	sb->blocks_head = (sb->blocks_head + 1) % sb->blocks_cap;
+	sb->n_blocks--;
+}
+
+
+// Compress the hot block into pages, dropping the oldest blocks if needed, and start a new one
+static void _seal_hot(struct scrollback *sb) {
+	struct sb_block *b;
+	const uint8_t *data;
+	size_t size, off, chunk;
+	uint32_t i;
+	if (sb->hot_lines == 0) {
+		return;
+	}
+	size = lz_compress(sb->hot, sb->hot_sz, sb->zbuf);
+	data = sb->zbuf;
+	if (size >= sb->hot_sz) {
+		// Incompressible
+		size = sb->hot_sz;
+		data = sb->hot;
+	}
+	while (sb->n_free * SCROLLBACK_PAGE_SZ < size) {
+		_drop_oldest(sb);
+	}
+	b = _block(sb, sb->n_blocks++);
+	b->first = sb->hot_first;
+	b->n_lines = sb->hot_lines;
+	b->size = size;
+	b->compressed = data == sb->zbuf;
+	b->n_pages = 0;
+	for (off = 0; off < size; off += chunk) {
+		chunk = size - off < SCROLLBACK_PAGE_SZ ? size - off : SCROLLBACK_PAGE_SZ;
+		i = sb->free_pages[--sb->n_free];
+		memcpy(sb->pool + (size_t) i * SCROLLBACK_PAGE_SZ, data + off, chunk);
+		b->pages[b->n_pages++] = i;
+	}
+	sb->hot_first += sb->hot_lines;
+	sb->hot_lines = 0;
+	sb->hot_sz = 0;
+}
+
+
+// Get size of stored line
+static size_t _line_size(const struct sb_line *l) {
+	return sizeof(struct sb_line) + l->n_runs * sizeof(struct sb_run)
+		+ (l->n_cells + l->n_cps) * sizeof(uint32_t);
+}
+
+
+// Load block into the cache
+static void _load_block(struct scrollback *sb, struct sb_block *b) {
+	size_t off, size, chunk;
+	uint32_t i, line;
+	if (b->first == sb->cache_first) {
+		return;
+	}
+	for (i = 0, off = 0; i < b->n_pages; i++, off += chunk) {
+		chunk = b->size - off < SCROLLBACK_PAGE_SZ ? b->size - off : SCROLLBACK_PAGE_SZ;
+		memcpy((b->compressed ? sb->zbuf : sb->cache) + off,
+				sb->pool + (size_t) b->pages[i] * SCROLLBACK_PAGE_SZ, chunk);
+	}
+	size = b->size;
+	if (b->compressed && !lz_decompress(sb->zbuf, b->size, sb->cache, SCROLLBACK_BLOCK_SZ, &size)) {
+		die("Corrupt scrollback block");
+	}
+	for (line = 0, off = 0; line < b->n_lines && off < size; line++) {
+		sb->cache_off[line] = off;
+		off += _line_size((const struct sb_line*) (sb->cache + off));
+	}
+	sb->cache_first = b->first;
+}
+
+
+// Map pages, either anonymous or backed by an unlinked temporary file
+static uint8_t* _map_pool(size_t size, bool spill) {
+	char path[] = SCROLLBACK_SPILL_TEMPLATE;
+	void *ret;
+	int fd;
+	if (!spill) {
+		if ((ret = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1,
+						0)) == MAP_FAILED) {
+			die_err("mmap()");
+		}
+		return ret;
+	}
+	if ((fd = mkstemp(path)) < 0) {
+		warn_err("mkstemp()");
+		return _map_pool(size, false);
+	}
+	unlink(path);
+	if (ftruncate(fd, size) < 0) {
+		warn_err("ftruncate()");
+		close(fd);
+		return _map_pool(size, false);
+	}
+	ret = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (ret == MAP_FAILED) {
+		warn_err("mmap()");
+		return _map_pool(size, false);
+	}
+	return ret;
+}
+
+
+// Create scrollback using about budget bytes
+struct scrollback* scrollback_new(size_t budget, bool spill) {
+	struct scrollback *sb;
+	uint32_t n_pages, i;
+	if (budget == 0) {
+		return NULL;
+	}
+	// The hot block counts towards the budget. There must be room for at least two blocks
+	n_pages = budget > SCROLLBACK_BLOCK_SZ ? (budget - SCROLLBACK_BLOCK_SZ) / SCROLLBACK_PAGE_SZ : 0;
+	if (n_pages < 2 * SCROLLBACK_BLOCK_PAGES) {
+		n_pages = 2 * SCROLLBACK_BLOCK_PAGES;
+	}
+	if (!(sb = calloc(1, sizeof(struct scrollback)))) {
+		die_err("calloc()");
+	}
+	sb->pool_sz = (size_t) n_pages * SCROLLBACK_PAGE_SZ;
+	sb->pool = _map_pool(sb->pool_sz, spill);
+	// Every block takes at least one page
+	sb->blocks_cap = n_pages;
+	if (!(sb->free_pages = calloc(n_pages, sizeof(uint32_t)))
+			|| !(sb->blocks = calloc(sb->blocks_cap, sizeof(struct sb_block)))
+			|| !(sb->hot = malloc(SCROLLBACK_BLOCK_SZ))
+			|| !(sb->hot_off = calloc(SCROLLBACK_BLOCK_LINES, sizeof(uint32_t)))
+			|| !(sb->cache = malloc(SCROLLBACK_BLOCK_SZ))
+			|| !(sb->cache_off = calloc(SCROLLBACK_BLOCK_LINES, sizeof(uint32_t)))
+			|| !(sb->zbuf = malloc(LZ_BOUND(SCROLLBACK_BLOCK_SZ)))) {
+		die_err("calloc()");
+	}
+	// Hand out low pages first
+	for (i = 0; i < n_pages; i++) {
+		sb->free_pages[i] = n_pages - i - 1;
+	}
+	sb->n_free = n_pages;
+	sb->cache_first = UINT64_MAX;
+	return sb;
+}
+
+
+// Free scrollback
+void scrollback_free(struct scrollback *sb) {
+	if (!sb) {
+		return;
+	}
+	munmap(sb->pool, sb->pool_sz);
+	free(sb->free_pages);
+	free(sb->blocks);
+	free(sb->hot);
+	free(sb->hot_off);
+	free(sb->cache);
+	free(sb->cache_off);
+	free(sb->zbuf);
+	free(sb);
+}
+
+
+// Is cell c in the same run as cell p?
+static bool _same_run(const struct termchar *p, const struct termchar *c) {
+	return p->fg == c->fg && p->bg == c->bg && p->attrs == c->attrs;
+}
+
+
+// Append line of n cells
+void scrollback_push(struct scrollback *sb, const struct termchar *line, unsigned n,
+		const struct graphemes *clusters) {
+	const uint32_t *src;
+	struct sb_line *l;
+	struct sb_run *run;
+	uint32_t *cells, *cps;
+	size_t size, n_cps;
+	unsigned i, n_runs;
+	bool wrapped = n > 0 && (line[n - 1].flags & RENDERER_CELL_WRAPPED);
+	// Trailing empty cells aren't stored, unless the line is soft-wrapped, so that it is
+	// rejoined with the next one as it was. The line is cut short if it doesn't fit in a block
+	for ( ; n > 0 && !wrapped && !line[n - 1].to_draw; n--);
+	size = sizeof(struct sb_line);
+	for (i = 0, n_runs = 0; i < n; i++) {
+		n_cps = 0;
+		if (line[i].flags & RENDERER_CELL_CLUSTER) {
+			graphemes_get(clusters, line[i].cp, &n_cps);
+		}
+		n_runs += i == 0 || !_same_run(&line[i - 1], &line[i]);
+		if (size + sizeof(struct sb_run) * n_runs + (i + 1 + n_cps) * sizeof(uint32_t)
+				> SCROLLBACK_BLOCK_SZ) {
+			break;
+		}
+		size += n_cps * sizeof(uint32_t);
+	}
+	n = i;
+	for (i = 0, n_runs = 0; i < n; i++) {
+		n_runs += i == 0 || !_same_run(&line[i - 1], &line[i]);
+	}
+	size += n_runs * sizeof(struct sb_run) + n * sizeof(uint32_t);
+	if (sb->hot_sz + size > SCROLLBACK_BLOCK_SZ || sb->hot_lines == SCROLLBACK_BLOCK_LINES) {
+		_seal_hot(sb);
+	}
+	sb->hot_off[sb->hot_lines++] = sb->hot_sz;
+	l = (struct sb_line*) (sb->hot + sb->hot_sz);
+	run = (struct sb_run*) (l + 1) - 1;
+	cells = (uint32_t*) (run + 1 + n_runs);
+	cps = cells + n;
+	if (n > sb->width) {
+		sb->width = n;
+	}
+	l->n_cells = n;
+	l->n_runs = n_runs;
+	l->n_cps = 0;
+	l->pad = 0;
+	for (i = 0; i < n; i++) {
+		if (i == 0 || !_same_run(&line[i - 1], &line[i])) {
+			run++;
+			run->fg = line[i].fg;
+			run->bg = line[i].bg;
+			run->attrs = line[i].attrs;
+			run->len = 0;
+		}
+		run->len++;
+		// Only the last cell is flagged as wrapped
+		cells[i] = SCROLLBACK_CELL(line[i].cp, (line[i].flags & ~RENDERER_CELL_WRAPPED)
+				| (line[i].to_draw ? SCROLLBACK_CELL_DRAW : 0));
+		if (!(line[i].flags & RENDERER_CELL_CLUSTER)) {
+			continue;
+		}
+		// Clusters are stored inline, since cluster ids belong to the screen. One that is
+		// gone is stored as an empty cell
+		n_cps = 0;
+		if ((src = graphemes_get(clusters, line[i].cp, &n_cps)) && n_cps > 0) {
+			memcpy(&cps[l->n_cps], src, n_cps * sizeof(uint32_t));
+			l->n_cps += n_cps;
+			cells[i] = SCROLLBACK_CELL(n_cps, SCROLLBACK_CELL_FLAGS(cells[i]));
+		} else {
+			cells[i] = SCROLLBACK_CELL(0, SCROLLBACK_CELL_FLAGS(cells[i])
+					& ~(RENDERER_CELL_CLUSTER | SCROLLBACK_CELL_DRAW));
+		}
+	}
+	if (wrapped && n > 0) {
+		cells[n - 1] |= SCROLLBACK_CELL(0, RENDERER_CELL_WRAPPED);
+	}
+	sb->hot_sz += size;
+}
+
+
+// Get number of lines stored
+size_t scrollback_size(const struct scrollback *sb) {
+	uint64_t first = sb->n_blocks ? sb->blocks[sb->blocks_head].first : sb->hot_first;
+	return sb->hot_first + sb->hot_lines - first;
+}
+
+
+// Get number of the line after the most recent one
+uint64_t scrollback_end(const struct scrollback *sb) {
+	return sb->hot_first + sb->hot_lines;
+}
+
+
+// Get length of the longest line added
+unsigned scrollback_width(const struct scrollback *sb) {
+	return sb->width;
+}
+
+
+// Get line idx (0 is the most recent) into n cells
+unsigned scrollback_get(struct scrollback *sb, size_t idx, struct termchar *line, unsigned n,
+		struct graphemes *clusters) {
+	const struct sb_line *l;
+	const struct sb_run *run;
+	const uint32_t *cells, *cps;
+	struct sb_block *b;
+	uint64_t num;
+	uint32_t lo, hi, mid, cp, fg = 0, bg = 0;
+	uint16_t attrs = 0;
+	uint8_t flags;
+	unsigned i, run_left;
+	memset(line, 0, n * sizeof(struct termchar));
+	if (idx >= scrollback_size(sb)) {
+		return 0;
+	}
+	num = sb->hot_first + sb->hot_lines - 1 - idx;
+	if (num >= sb->hot_first) {
+		l = (const struct sb_line*) (sb->hot + sb->hot_off[num - sb->hot_first]);
+	} else {
+		// Find block holding the line
+		for (lo = 0, hi = sb->n_blocks - 1; lo < hi; ) {
+			mid = (lo + hi + 1) / 2;
+			if (_block(sb, mid)->first <= num) {
+				lo = mid;
+			} else {
+				hi = mid - 1;
+			}
+		}
+		b = _block(sb, lo);
+		_load_block(sb, b);
+		l = (const struct sb_line*) (sb->cache + sb->cache_off[num - b->first]);
+	}
+	run = (const struct sb_run*) (l + 1);
+	cells = (const uint32_t*) (run + l->n_runs);
+	cps = cells + l->n_cells;
+	for (i = 0, run_left = 0; i < l->n_cells && i < n; i++) {
+		for ( ; run_left == 0; run++) {
+			run_left = run->len;
+			fg = run->fg;
+			bg = run->bg;
+			attrs = run->attrs;
+		}
+		run_left--;
+		cp = SCROLLBACK_CELL_CP(cells[i]);
+		flags = SCROLLBACK_CELL_FLAGS(cells[i]);
+		if ((flags & RENDERER_CELL_CLUSTER) && cp > 0) {
+			line[i].cp = clusters ? graphemes_intern(clusters, cps, cp) : 0;
+			line[i].box = boxdraw_code(cps[0]);
+			cps += cp;
+		} else {
+			line[i].cp = cp;
+			line[i].box = boxdraw_code(cp);
+		}
+		line[i].fg = fg;
+		line[i].bg = bg;
+		line[i].attrs = attrs;
+		line[i].flags = flags & ~SCROLLBACK_CELL_DRAW;
+		line[i].to_draw = (flags & SCROLLBACK_CELL_DRAW) != 0;
+	}
+	return i;
+}
+
+
+// Drop all lines
+void scrollback_clear(struct scrollback *sb) {
+	while (sb->n_blocks > 0) {
+		_drop_oldest(sb);
+	}
+	sb->hot_first += sb->hot_lines;
+	sb->hot_lines = 0;
+	sb->hot_sz = 0;
+}
@@ -0,0 +1,561 @@
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "render.h"
+#include "search.h"
+#include "grapheme.h"
+#include "scrollback.h"
+
+
+// Text of lines of scrollback is cached in chunks of this many lines
+#define SEARCH_CHUNK_LINES 256
+
+// The text cache is flushed when it reaches this many bytes
+#define SEARCH_CACHE_MAX (16 << 20)
+
+// Maximum length of query in bytes (UTF-8). Longer queries are cut short
+#define SEARCH_QUERY_MAX 256
+
+// Maximum length of the text of a cell
+#define SEARCH_CELL_MAX (GRAPHEME_MAX * UTF8_MAX)
+
+// The time budget is checked every this many lines
+#define SEARCH_CHECK_LINES 64
+
+
+// A match
+struct search_match {
+	uint64_t line;  // Line number
+	uint32_t start; // Offset in text of line
+};
+
+// Text of a chunk of lines of scrollback
+struct search_chunk {
+	uint64_t first;                         // Number of first line
+	char     *text;                         // Text of lines
+	uint32_t off[SEARCH_CHUNK_LINES + 1];   // Offsets of lines in text
+};
+
+
+// Incremental search
+struct search {
+	// Query
+	char                q[SEARCH_QUERY_MAX]; // Query (UTF-8)
+	size_t              qn;                  // Length of query (0 if none)
+	bool                fold;                // Do ASCII letters match either case?
+	// Matches in scrollback, most recent first. Kept in found[head, tail), with room to grow
+	// at both ends
+	struct search_match *found;
+	size_t              head;
+	size_t              tail;
+	size_t              cap;
+	// Matches in rows of the screen, most recent first. Found again on every step
+	struct search_match *screen;
+	size_t              n_screen;
+	size_t              screen_cap;
+	// Current match
+	struct search_match cur;
+	bool                has_cur;
+	// Progress. Lines in [old_next, new_from) have been searched
+	bool                started;             // Has searching started?
+	uint64_t            end;                 // Scrollback end at the last step
+	uint64_t            new_from;            // First line added since searching started
+	uint64_t            old_next;            // Line after the next older line to search
+	// Text of lines
+	struct htu32        *chunks;             // Chunk number to text of chunk
+	size_t              cache_sz;            // Bytes of text in chunks
+	unsigned            width;               // Width lines of scrollback are decoded with
+	struct termchar     *row;                // Decoded line of scrollback
+	struct graphemes    *clusters;           // Grapheme clusters of decoded lines
+	char                *text;               // Text of a row
+};
+
+
+// Free chunk of text
+static void _chunk_free(void *chunk) {
+	free(((struct search_chunk*) chunk)->text);
+	free(chunk);
+}
+
+
+// Drop all cached text
+static void _flush(struct search *s) {
+	if (s->chunks) {
+		htu32_free(s->chunks, _chunk_free);
+	}
+	s->chunks = htu32_new();
+	s->cache_sz = 0;
+}
+
+
+// Create a new search
+struct search* search_new() {
+	struct search *s;
+	if (!(s = calloc(1, sizeof(struct search)))) {
+		die_err("calloc()");
+	}
+	s->clusters = graphemes_new();
+	_flush(s);
+	return s;
+}
+
+
+// Free search
+void search_free(struct search *s) {
+	if (!s) {
+		return;
+	}
+	htu32_free(s->chunks, _chunk_free);
+	graphemes_free(s->clusters);
+	free(s->found);
+	free(s->screen);
+	free(s->row);
+	free(s->text);
+	free(s);
+}
+
+
+// Forget matches, and start searching from the most recent line
+static void _restart(struct search *s) {
+	s->head = s->tail = s->cap / 2;
+	s->n_screen = 0;
+	s->has_cur = false;
+	s->started = false;
+}
+
+
+// Set query of n codepoints
+void search_set_query(struct search *s, const uint32_t *query, size_t n) {
+	char buf[UTF8_MAX];
+	size_t i, len;
+	s->qn = 0;
+	s->fold = true;
+	for (i = 0; i < n; i++) {
+		if ((len = utf8_encode(query[i], buf)) + s->qn > SEARCH_QUERY_MAX) {
+			break;
+		}
+		memcpy(&s->q[s->qn], buf, len);
+		s->qn += len;
+		if (query[i] >= 'A' && query[i] <= 'Z') {
+			s->fold = false;
+		}
+	}
+	_restart(s);
+}
+
+
+// Is there a query?
+bool search_active(const struct search *s) {
+	return s->qn > 0;
+}
+
+
+// Get text of cell into out (at least SEARCH_CELL_MAX bytes). Continuation cells of wide
+// characters have none, and empty cells are spaces. Return its length
+static size_t _cell_text(const struct termchar *c, const struct graphemes *clusters, char *out) {
+	const uint32_t *cps;
+	size_t n, i, len;
+	if (c->flags & RENDERER_CELL_WIDE_CONT) {
+		return 0;
+	}
+	if (!c->to_draw || (c->flags & RENDERER_CELL_IMAGE)) {
+		*out = ' ';
+		return 1;
+	}
+	if (!(c->flags & RENDERER_CELL_CLUSTER)) {
+		return utf8_encode(c->cp, out);
+	}
+	cps = graphemes_get(clusters, c->cp, &n);
+	for (i = 0, len = 0; i < n; i++) {
+		len += utf8_encode(cps[i], &out[len]);
+	}
+	return len;
+}
+
+
+// Get text of row of n cells into out (at least n * SEARCH_CELL_MAX bytes), without trailing
+// empty cells. Return its length
+static size_t _row_text(const struct termchar *row, unsigned n, const struct graphemes *clusters,
+		char *out) {
+	size_t len = 0, used = 0;
+	unsigned i;
+	for (i = 0; i < n; i++) {
+		len += _cell_text(&row[i], clusters, &out[len]);
+		if (row[i].to_draw) {
+			used = len;
+		}
+	}
+	return used;
+}
+
+
+// Get text of line num of sb into the scratch text. Return its length
+static size_t _decode_line(struct search *s, struct scrollback *sb, uint64_t num) {
+	// Nothing refers to clusters of earlier lines
+	if (graphemes_should_collect(s->clusters)) {
+		graphemes_sweep(s->clusters);
+	}
+	scrollback_get(sb, scrollback_end(sb) - 1 - num, s->row, s->width, s->clusters);
+	return _row_text(s->row, s->width, s->clusters, s->text);
+}
+
+
+// Decode chunk of lines starting at first into the cache
+static struct search_chunk* _load_chunk(struct search *s, struct scrollback *sb, uint64_t first) {
+	struct search_chunk *chunk, *old;
+	size_t size = 0, cap = SEARCH_CHUNK_LINES * 64, len;
+	unsigned i;
+	if (!(chunk = calloc(1, sizeof(struct search_chunk)))
+			|| !(chunk->text = malloc(cap))) {
+		die_err("malloc()");
+	}
+	chunk->first = first;
+	for (i = 0; i < SEARCH_CHUNK_LINES; i++) {
+		len = _decode_line(s, sb, first + i);
+		if (size + len > cap) {
+			cap = (size + len) * 2;
+			if (!(chunk->text = realloc(chunk->text, cap))) {
+				die_err("realloc()");
+			}
+		}
+		memcpy(chunk->text + size, s->text, len);
+		chunk->off[i] = size;
+		size += len;
+	}
+	chunk->off[i] = size;
+	if (s->cache_sz + size > SEARCH_CACHE_MAX) {
+		_flush(s);
+	}
+	// Chunk numbers wrap around after 2^32 chunks. Replace the chunk that was there
+	if ((old = htu32_pop(s->chunks, first / SEARCH_CHUNK_LINES, NULL))) {
+		s->cache_sz -= old->off[SEARCH_CHUNK_LINES];
+		_chunk_free(old);
+	}
+	htu32_set(s->chunks, first / SEARCH_CHUNK_LINES, chunk);
+	s->cache_sz += size;
+	return chunk;
+}
+
+
+// Get text of line num of sb, and set *len to its length. Lines in whole chunks are
+// cached, others are decoded every time
+static const char* _line_text(struct search *s, struct scrollback *sb, uint64_t num, size_t *len) {
+	struct search_chunk *chunk;
+	uint64_t end = scrollback_end(sb), first = num - num % SEARCH_CHUNK_LINES;
+	unsigned i = num - first;
+	if (first < end - scrollback_size(sb) || first + SEARCH_CHUNK_LINES > end) {
+		*len = _decode_line(s, sb, num);
+		return s->text;
+	}
+	chunk = htu32_get(s->chunks, first / SEARCH_CHUNK_LINES, NULL);
+	if (!chunk || chunk->first != first) {
+		chunk = _load_chunk(s, sb, first);
+	}
+	*len = chunk->off[i + 1] - chunk->off[i];
+	return chunk->text + chunk->off[i];
+}
+
+
+// Get mask to OR byte c of query and text with, to ignore case when comparing
+static char _fold_mask(const struct search *s, char c) {
+	return (s->fold && c >= 'a' && c <= 'z') ? 0x20 : 0;
+}
+
+
+// Does the query match at text?
+static bool _match(const struct search *s, const char *text) {
+	size_t i;
+	char c;
+	if (!s->fold) {
+		return !memcmp(text, s->q, s->qn);
+	}
+	for (i = 0; i < s->qn; i++) {
+		c = (text[i] >= 'A' && text[i] <= 'Z') ? text[i] | 0x20 : text[i];
+		if (c != s->q[i]) {
+			return false;
+		}
+	}
+	return true;
+}
+
+
+// Find first match in text of n bytes, at or after from. Return its offset, or n if none.
+// Candidates are the positions where both the first and the last byte of the query match,
+// 16 at a time with SSE2
+static size_t _find(const struct search *s, const char *text, size_t n, size_t from) {
+	size_t i = from, last = s->qn - 1;
+#ifdef __SSE2__
+	__m128i first_b = _mm_set1_epi8(s->q[0]), last_b = _mm_set1_epi8(s->q[last]);
+	__m128i first_m = _mm_set1_epi8(_fold_mask(s, s->q[0]));
+	__m128i last_m = _mm_set1_epi8(_fold_mask(s, s->q[last]));
+	__m128i a, b;
+	unsigned mask;
+	for ( ; i + last + 16 <= n; i += 16) {
+		a = _mm_or_si128(_mm_loadu_si128((const __m128i*) (text + i)), first_m);
+		b = _mm_or_si128(_mm_loadu_si128((const __m128i*) (text + i + last)), last_m);
+		mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(a, first_b),
+					_mm_cmpeq_epi8(b, last_b)));
+		for ( ; mask; mask &= mask - 1) {
+			if (_match(s, text + i + __builtin_ctz(mask))) {
+				return i + __builtin_ctz(mask);
+			}
+		}
+	}
+#endif
+	for ( ; i + s->qn <= n; i++) {
+		if (_match(s, text + i)) {
+			return i;
+		}
+	}
+	return n;
+}
+
+
+// Reverse order of n matches
+static void _reverse(struct search_match *m, size_t n) {
+	struct search_match tmp;
+	size_t i;
+	for (i = 0; i < n / 2; i++) {
+		tmp = m[i];
+		m[i] = m[n - 1 - i];
+		m[n - 1 - i] = tmp;
+	}
+}
+
+
+// Make room in found, at the front or at the back
+static void _grow(struct search *s) {
+	struct search_match *tmp;
+	size_t n = s->tail - s->head, cap = s->cap ? s->cap * 2 : 256, head = (cap - n) / 2;
+	if (!(tmp = malloc(cap * sizeof(struct search_match)))) {
+		die_err("malloc()");
+	}
+	if (n > 0) {
+		memcpy(&tmp[head], &s->found[s->head], n * sizeof(struct search_match));
+	}
+	free(s->found);
+	s->found = tmp;
+	s->cap = cap;
+	s->head = head;
+	s->tail = head + n;
+}
+
+
+// Search line num of sb. Matches of lines newer than all others go to the front of found,
+// and of lines older than all others to the back
+static void _search_line(struct search *s, struct scrollback *sb, uint64_t num, bool newer) {
+	const char *text;
+	size_t n, off, added = 0;
+	text = _line_text(s, sb, num, &n);
+	for (off = _find(s, text, n, 0); off < n; off = _find(s, text, n, off + s->qn)) {
+		if ((newer && s->head == 0) || (!newer && s->tail == s->cap)) {
+			_grow(s);
+		}
+		if (newer) {
+			s->found[--s->head] = (struct search_match) { num, off };
+		} else {
+			s->found[s->tail++] = (struct search_match) { num, off };
+		}
+		added++;
+	}
+	// Matches in a line are found from the left. At the back, they need to be reversed
+	if (!newer) {
+		_reverse(&s->found[s->tail - added], added);
+	}
+}
+
+
+// Search rows of the screen, following line end
+static void _search_screen(struct search *s, struct termchar *const *rows, uvec2_t dim,
+		const struct graphemes *clusters, uint64_t end) {
+	struct search_match *tmp;
+	size_t n, off, start;
+	unsigned y;
+	s->n_screen = 0;
+	for (y = dim.y; y-- > 0; ) {
+		n = _row_text(rows[y], dim.x, clusters, s->text);
+		start = s->n_screen;
+		for (off = _find(s, s->text, n, 0); off < n; off = _find(s, s->text, n, off + s->qn)) {
+			if (s->n_screen == s->screen_cap) {
+				s->screen_cap = s->screen_cap ? s->screen_cap * 2 : 64;
+				if (!(tmp = realloc(s->screen, s->screen_cap * sizeof(*tmp)))) {
+					die_err("realloc()");
+				}
+				s->screen = tmp;
+			}
+			s->screen[s->n_screen++] = (struct search_match) { end + y, off };
+		}
+		_reverse(&s->screen[start], s->n_screen - start);
+	}
+}
+
+
+// Set width lines are decoded with. Cached text of another width is dropped
+static void _set_width(struct search *s, unsigned width) {
+	if (width == s->width) {
+		return;
+	}
+	s->width = width;
+	free(s->row);
+	free(s->text);
+	if (!(s->row = calloc(width, sizeof(struct termchar)))
+			|| !(s->text = malloc((size_t) width * SEARCH_CELL_MAX))) {
+		die_err("calloc()");
+	}
+	_flush(s);
+	_restart(s);
+}
+
+
+// Search rows of the screen and lines of sb for about budget_ns nanoseconds
+bool search_step(struct search *s, struct scrollback *sb, struct termchar *const *rows,
+		uvec2_t dim, const struct graphemes *clusters, uint64_t budget_ns) {
+	uint64_t start = now_ns(), first;
+	unsigned k;
+	if (s->qn == 0) {
+		return false;
+	}
+	// Lines of scrollback may be wider than the screen, if it was resized
+	_set_width(s, (sb && scrollback_width(sb) > dim.x) ? scrollback_width(sb) : dim.x);
+	s->end = sb ? scrollback_end(sb) : 0;
+	_search_screen(s, rows, dim, clusters, s->end);
+	if (!sb) {
+		return false;
+	}
+	first = s->end - scrollback_size(sb);
+	if (!s->started) {
+		s->new_from = s->old_next = s->end;
+		s->started = true;
+	}
+	// Forget lines dropped from scrollback
+	for ( ; s->tail > s->head && s->found[s->tail - 1].line < first; s->tail--);
+	if (s->old_next < first) {
+		s->old_next = first;
+	}
+	for (k = 0; s->new_from < s->end; ) {
+		_search_line(s, sb, s->new_from++, true);
+		if (++k % SEARCH_CHECK_LINES == 0 && now_ns() - start > budget_ns) {
+			return true;
+		}
+	}
+	while (s->old_next > first) {
+		_search_line(s, sb, --s->old_next, false);
+		if (++k % SEARCH_CHECK_LINES == 0 && now_ns() - start > budget_ns) {
+			return s->old_next > first;
+		}
+	}
+	return false;
+}
+
+
+// Is match a older than match b?
+static bool _older(const struct search_match *a, const struct search_match *b) {
+	return a->line < b->line || (a->line == b->line && a->start < b->start);
+}
+
+
+// Get index in found of the first match older than m (tail if none)
+static size_t _first_older(const struct search *s, const struct search_match *m) {
+	size_t lo = s->head, hi = s->tail, mid;
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (_older(&s->found[mid], m)) {
+			hi = mid;
+		} else {
+			lo = mid + 1;
+		}
+	}
+	return lo;
+}
+
+
+// Mark cells of row covered by matches in marks
+void search_mark_row(const struct search *s, uint64_t line, const struct termchar *row,
+		unsigned n, const struct graphemes *clusters, uint8_t *marks) {
+	const struct search_match *matches;
+	struct search_match key = { line, UINT32_MAX };
+	char buf[SEARCH_CELL_MAX];
+	size_t n_matches, i, pos, len;
+	unsigned j;
+	uint8_t mark;
+	if (s->qn == 0) {
+		return;
+	}
+	if (line >= s->end) {
+		matches = s->screen;
+		n_matches = s->n_screen;
+	} else {
+		// Matches of the line are the ones older than the end of it, and not older than its
+		// start
+		matches = &s->found[_first_older(s, &key)];
+		n_matches = &s->found[s->tail] - matches;
+	}
+	for (i = 0; i < n_matches && matches[i].line >= line; i++) {
+		if (matches[i].line != line) {
+			continue;
+		}
+		mark = (s->has_cur && s->cur.line == line && s->cur.start == matches[i].start)
+			? SEARCH_MARK_CURRENT : SEARCH_MARK_MATCH;
+		for (j = 0, pos = 0; j < n && pos < matches[i].start + s->qn; j++, pos += len) {
+			len = _cell_text(&row[j], clusters, buf);
+			if (pos + len > matches[i].start) {
+				marks[j] = mark;
+				if ((row[j].flags & RENDERER_CELL_WIDE) && j + 1 < n) {
+					marks[j + 1] = mark;
+				}
+			}
+		}
+	}
+}
+
+
+// Make the next older (or newer) match the current one
+bool search_next(struct search *s, bool older, uint64_t *line) {
+	size_t i, n = s->tail - s->head;
+	const struct search_match *m = NULL;
+	if (!s->has_cur) {
+		// Most recent match
+		m = s->n_screen > 0 ? &s->screen[0] : (n > 0 ? &s->found[s->head] : NULL);
+	} else if (older) {
+		for (i = 0; i < s->n_screen && !m; i++) {
+			if (_older(&s->screen[i], &s->cur)) {
+				m = &s->screen[i];
+			}
+		}
+		if (!m && (i = _first_older(s, &s->cur)) < s->tail) {
+			m = &s->found[i];
+		}
+	} else {
+		// The last match newer than the current one
+		for (i = _first_older(s, &s->cur); i > s->head && !m; i--) {
+			if (_older(&s->cur, &s->found[i - 1])) {
+				m = &s->found[i - 1];
+			}
+		}
+		for (i = s->n_screen; i > 0 && !m; i--) {
+			if (_older(&s->cur, &s->screen[i - 1])) {
+				m = &s->screen[i - 1];
+			}
+		}
+	}
+	if (!m) {
+		return false;
+	}
+	s->cur = *m;
+	s->has_cur = true;
+	*line = m->line;
+	return true;
+}
+
+
+// Does the search have a current match?
+bool search_has_current(const struct search *s) {
+	return s->has_cur;
+}
+
+
+// Get number of matches found so far
+size_t search_count(const struct search *s) {
+	return s->n_screen + s->tail - s->head;
+}
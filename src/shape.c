@@ -0,0 +1,260 @@
+#include "shape.h"
+
+
+#ifdef BTE_HARFBUZZ
+
+#include <hb.h>
+#include <hb-ft.h>
+
+
+// The cache is flushed when it reaches this many runs
+#define SHAPER_CACHE_MAX 4096
+
+
+// A cached run
+struct shape_entry {
+	uint32_t          hash;  // Hash of codepoints, style and size
+	uint32_t          *cps;  // Codepoints
+	size_t            n;     // Number of codepoints
+	unsigned          style; // Font style
+	unsigned          px;    // Font size
+	struct shaped_run run;   // Result
+};
+
+
+// Shapes runs of text with HarfBuzz, caching the results
+struct shaper {
+	struct fonts        *fonts;                  // Fonts to shape with
+	hb_font_t           *hb_fonts[FONTS_N_STYLES]; // HarfBuzz fonts for styles (created lazily)
+	unsigned            hb_px;                   // Size HarfBuzz fonts were last updated for
+	hb_buffer_t         *buf;                    // Buffer for shaping
+	struct shape_entry  *entries;                // Cached runs
+	size_t              n_entries;               // Number of cached runs
+	struct htu32        *index;                  // Hash (linearly probed) to entry index + 1
+	struct shaper_stats stats;                   // Statistics
+};
+
+
+// Hash run (FNV-1a)
+static uint32_t _hash_run(const uint32_t *cps, size_t n, unsigned style, unsigned px) {
+	uint32_t h = 2166136261u;
+	size_t i;
+	h = (h ^ style) * 16777619u;
+	h = (h ^ px) * 16777619u;
+	for (i = 0; i < n; i++) {
+		h = (h ^ cps[i]) * 16777619u;
+	}
+	return h;
+}
+
+
+// Free cached runs, and start with an empty cache
+static void _flush(struct shaper *shaper) {
+	size_t i;
+	for (i = 0; i < shaper->n_entries; i++) {
+		free(shaper->entries[i].cps);
+		free(shaper->entries[i].run.glyphs);
+	}
+	shaper->n_entries = 0;
+	if (shaper->index) {
+		htu32_free(shaper->index, NULL);
+	}
+	shaper->index = htu32_new();
+}
+
+
+// Get HarfBuzz font for style, for the current size
+static hb_font_t* _hb_font(struct shaper *shaper, enum fonts_style style) {
+	unsigned i;
+	if (shaper->hb_px != shaper->fonts->font_sz) {
+		// Faces have been resized
+		for (i = 0; i < FONTS_N_STYLES; i++) {
+			if (shaper->hb_fonts[i]) {
+				hb_ft_font_changed(shaper->hb_fonts[i]);
+			}
+		}
+		shaper->hb_px = shaper->fonts->font_sz;
+	}
+	if (!shaper->hb_fonts[style]) {
+		shaper->hb_fonts[style] = hb_ft_font_create_referenced(
+				fonts_get_face(shaper->fonts, style));
+	}
+	return shaper->hb_fonts[style];
+}
+
+
+// Shape run into result. A run is plain if every cell got its nominal glyph, without offset
+static void _shape(struct shaper *shaper, const uint32_t *cps, size_t n, enum fonts_style style,
+		struct shaped_run *run) {
+	hb_font_t *font = _hb_font(shaper, style);
+	hb_glyph_info_t *info;
+	hb_glyph_position_t *pos;
+	hb_codepoint_t nominal;
+	unsigned i, n_glyphs, cluster = 0;
+	hb_position_t pen = 0, cluster_pen = 0;
+	hb_buffer_clear_contents(shaper->buf);
+	hb_buffer_add_utf32(shaper->buf, cps, n, 0, n);
+	hb_buffer_guess_segment_properties(shaper->buf);
+	hb_shape(font, shaper->buf, NULL, 0);
+	info = hb_buffer_get_glyph_infos(shaper->buf, &n_glyphs);
+	pos = hb_buffer_get_glyph_positions(shaper->buf, &n_glyphs);
+	run->plain = n_glyphs == n;
+	for (i = 0; i < n_glyphs && run->plain; i++) {
+		run->plain = info[i].cluster == i && pos[i].x_offset == 0
+			&& hb_font_get_nominal_glyph(font, cps[i], &nominal)
+			&& nominal == info[i].codepoint;
+	}
+	run->glyphs = NULL;
+	run->n_glyphs = 0;
+	if (run->plain) {
+		return;
+	}
+	if (!(run->glyphs = calloc(n_glyphs, sizeof(struct shaped_glyph)))) {
+		die_err("calloc()");
+	}
+	for (i = 0; i < n_glyphs; i++) {
+		if (info[i].codepoint == 0) {
+			// Missing from the font. Fallback fonts only work per cell
+			free(run->glyphs);
+			run->glyphs = NULL;
+			run->plain = true;
+			return;
+		}
+		if (i == 0 || info[i].cluster != cluster) {
+			cluster = info[i].cluster;
+			cluster_pen = pen;
+		}
+		// Positions are in 26.6 fixed point
+		run->glyphs[i].id = info[i].codepoint;
+		run->glyphs[i].cell = cluster;
+		run->glyphs[i].x = (pen - cluster_pen + pos[i].x_offset) >> 6;
+		pen += pos[i].x_advance;
+	}
+	run->n_glyphs = n_glyphs;
+}
+
+
+// Create a new shaper
+struct shaper* shaper_new(struct fonts *fonts) {
+	struct shaper *shaper;
+	if (!fonts) {
+		die("NULL fonts");
+	}
+	if (!(shaper = calloc(1, sizeof(struct shaper)))) {
+		die_err("calloc()");
+	}
+	if (!(shaper->entries = calloc(SHAPER_CACHE_MAX, sizeof(struct shape_entry)))) {
+		die_err("calloc()");
+	}
+	shaper->fonts = fonts;
+	shaper->hb_px = fonts->font_sz;
+	shaper->buf = hb_buffer_create();
+	_flush(shaper);
+	return shaper;
+}
+
+
+// Free shaper
+void shaper_free(struct shaper *shaper) {
+	unsigned i;
+	if (!shaper) {
+		return;
+	}
+	_flush(shaper);
+	htu32_free(shaper->index, NULL);
+	for (i = 0; i < FONTS_N_STYLES; i++) {
+		if (shaper->hb_fonts[i]) {
+			hb_font_destroy(shaper->hb_fonts[i]);
+		}
+	}
+	hb_buffer_destroy(shaper->buf);
+	free(shaper->entries);
+	free(shaper);
+}
+
+
+// Shape run of n codepoints in style, at the current font size
+const struct shaped_run* shaper_shape(struct shaper *shaper, const uint32_t *cps, size_t n,
+		enum fonts_style style) {
+	unsigned px = shaper->fonts->font_sz;
+	uint32_t hash = _hash_run(cps, n, style, px), k = hash;
+	struct shape_entry *e;
+	uint64_t start;
+	uintptr_t v;
+	// Look for run in the cache
+	while ((v = (uintptr_t) htu32_get(shaper->index, k, NULL))) {
+		e = &shaper->entries[v - 1];
+		if (e->hash == hash && e->n == n && e->style == style && e->px == px
+				&& !memcmp(e->cps, cps, n * sizeof(uint32_t))) {
+			shaper->stats.hits++;
+			return &e->run;
+		}
+		k++;
+	}
+	// Shape it, and add it to the cache
+	shaper->stats.misses++;
+	start = now_ns();
+	if (shaper->n_entries == SHAPER_CACHE_MAX) {
+		_flush(shaper);
+	}
+	e = &shaper->entries[shaper->n_entries];
+	if (!(e->cps = malloc(n * sizeof(uint32_t)))) {
+		die_err("malloc()");
+	}
+	memcpy(e->cps, cps, n * sizeof(uint32_t));
+	e->hash = hash;
+	e->n = n;
+	e->style = style;
+	e->px = px;
+	_shape(shaper, cps, n, style, &e->run);
+	while (htu32_set(shaper->index, k, (void*) (uintptr_t) (shaper->n_entries + 1)) != HTRES_OK) {
+		k++;
+	}
+	shaper->n_entries++;
+	shaper->stats.shape_ns += now_ns() - start;
+	return &e->run;
+}
+
+
+// Count a rendered frame in the statistics
+void shaper_end_frame(struct shaper *shaper) {
+	shaper->stats.frames++;
+}
+
+
+// Get statistics since the shaper was created
+void shaper_get_stats(const struct shaper *shaper, struct shaper_stats *stats) {
+	*stats = shaper->stats;
+}
+
+
+#else // BTE_HARFBUZZ
+
+
+// Built without HarfBuzz. Text is drawn per cell
+struct shaper* shaper_new(struct fonts *fonts) {
+	(void) fonts;
+	return NULL;
+}
+
+void shaper_free(struct shaper *shaper) {
+	(void) shaper;
+}
+
+const struct shaped_run* shaper_shape(struct shaper *shaper, const uint32_t *cps, size_t n,
+		enum fonts_style style) {
+	(void) shaper, (void) cps, (void) n, (void) style;
+	return NULL;
+}
+
+void shaper_end_frame(struct shaper *shaper) {
+	(void) shaper;
+}
+
+void shaper_get_stats(const struct shaper *shaper, struct shaper_stats *stats) {
+	(void) shaper;
+	memset(stats, 0, sizeof(struct shaper_stats));
+}
+
+
+#endif // BTE_HARFBUZZ
@@ -0,0 +1,355 @@
+#include <unistd.h>
+
+#include "uring.h"
+
+
+#ifdef BTE_IO_URING
+
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+
+// Number of buffers that can be registered
+#define URING_BUFFERS 256
+
+// Completion queue size, per entry of the submission queue. Reads and writes of sessions are
+// done as they become ready, so the completions of several rounds of submissions may pile up
+#define URING_CQ_FACTOR 8
+
+
+struct uring {
+	int                 fd;
+	// Submission queue (shared with kernel)
+	unsigned            *sq_head;
+	unsigned            *sq_tail;
+	unsigned            *sq_flags;
+	unsigned            *sq_array;
+	unsigned            sq_mask;
+	unsigned            sq_entries;
+	struct io_uring_sqe *sqes;
+	unsigned            tail;      // Tail, including operations not submitted yet
+	unsigned            queued;    // Operations queued, not submitted yet
+	// Completion queue (shared with kernel)
+	unsigned            *cq_head;
+	unsigned            *cq_tail;
+	unsigned            cq_mask;
+	struct io_uring_cqe *cqes;
+	// Mappings
+	void                *sq_map;
+	size_t              sq_len;
+	void                *cq_map;
+	size_t              cq_len;
+	size_t              sqes_len;
+	// Registered buffers
+	bool                fixed;     // Can buffers be registered?
+	bool                bufs[URING_BUFFERS]; // Is buffer in use?
+};
+
+
+static int _setup(unsigned entries, struct io_uring_params *p) {
+	return syscall(__NR_io_uring_setup, entries, p);
+}
+
+
+static int _enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags) {
+	return syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+
+static int _register(int fd, unsigned op, void *arg, unsigned nr_args) {
+	return syscall(__NR_io_uring_register, fd, op, arg, nr_args);
+}
+
+
+// Map part of the rings
+static void* _map(int fd, size_t len, off_t off) {
+	void *p;
+	if ((p = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, off))
+			== MAP_FAILED) {
+		die_err("mmap()");
+	}
+	return p;
+}
+
+
+// Create a new io_uring
+struct uring* uring_new(unsigned entries) {
+	struct io_uring_params p = { 0 };
+	struct io_uring_rsrc_register reg = { 0 };
+	struct uring *u;
+	char *sq, *cq;
+	int fd;
+	p.flags = IORING_SETUP_CQSIZE;
+	p.cq_entries = entries * URING_CQ_FACTOR;
+	if ((fd = _setup(entries, &p)) < 0) {
+		// Not in the kernel (5.1), or not allowed (seccomp, io_uring_disabled)
+		return NULL;
+	}
+	// Completions must not be dropped, and reads and writes of ptys must wait for them to
+	// become ready by polling, rather than on a kernel worker thread each (5.7)
+	if (!(p.features & IORING_FEAT_NODROP) || !(p.features & IORING_FEAT_FAST_POLL)
+			|| !(p.features & IORING_FEAT_RW_CUR_POS)) {
+		close(fd);
+		return NULL;
+	}
+	if (!(u = calloc(1, sizeof(struct uring)))) {
+		die_err("calloc()");
+	}
+	u->fd = fd;
+	// Map rings
+	u->sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	u->cq_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		u->sq_len = u->cq_len = u->sq_len > u->cq_len ? u->sq_len : u->cq_len;
+	}
+	u->sq_map = _map(fd, u->sq_len, IORING_OFF_SQ_RING);
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		u->cq_map = u->sq_map;
+	} else {
+		u->cq_map = _map(fd, u->cq_len, IORING_OFF_CQ_RING);
+	}
+	u->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+	u->sqes = _map(fd, u->sqes_len, IORING_OFF_SQES);
+	sq = u->sq_map;
+	cq = u->cq_map;
+	u->sq_head = (unsigned*) (sq + p.sq_off.head);
+	u->sq_tail = (unsigned*) (sq + p.sq_off.tail);
+	u->sq_flags = (unsigned*) (sq + p.sq_off.flags);
+	u->sq_array = (unsigned*) (sq + p.sq_off.array);
+	u->sq_mask = *(unsigned*) (sq + p.sq_off.ring_mask);
+	u->sq_entries = p.sq_entries;
+	u->tail = *u->sq_tail;
+	u->cq_head = (unsigned*) (cq + p.cq_off.head);
+	u->cq_tail = (unsigned*) (cq + p.cq_off.tail);
+	u->cq_mask = *(unsigned*) (cq + p.cq_off.ring_mask);
+	u->cqes = (struct io_uring_cqe*) (cq + p.cq_off.cqes);
+	// Make an empty table of buffers, filled in as they are registered (5.13)
+	reg.nr = URING_BUFFERS;
+	reg.flags = IORING_RSRC_REGISTER_SPARSE;
+	u->fixed = _register(fd, IORING_REGISTER_BUFFERS2, &reg, sizeof(reg)) == 0;
+	return u;
+}
+
+
+// Free io_uring
+void uring_free(struct uring *u) {
+	if (!u) {
+		return;
+	}
+	munmap(u->sqes, u->sqes_len);
+	if (u->cq_map != u->sq_map) {
+		munmap(u->cq_map, u->cq_len);
+	}
+	munmap(u->sq_map, u->sq_len);
+	close(u->fd);
+	free(u);
+}
+
+
+// Get file descriptor of io_uring
+int uring_fd(const struct uring *u) {
+	return u->fd;
+}
+
+
+// Set buffer of index buf to n bytes at p (NULL to unregister it)
+static bool _set_buffer(struct uring *u, int buf, void *p, size_t n) {
+	struct iovec iov = { .iov_base = p, .iov_len = n };
+	struct io_uring_rsrc_update2 up = { 0 };
+	up.offset = buf;
+	up.data = (uintptr_t) &iov;
+	up.nr = 1;
+	return _register(u->fd, IORING_REGISTER_BUFFERS_UPDATE, &up, sizeof(up)) == 1;
+}
+
+
+// Register n bytes at p as a buffer
+int uring_add_buffer(struct uring *u, void *p, size_t n) {
+	int buf;
+	if (!u->fixed) {
+		return -1;
+	}
+	for (buf = 0; buf < URING_BUFFERS && u->bufs[buf]; buf++);
+	// Older kernels can't register some memory, such as shared mappings of files
+	if (buf == URING_BUFFERS || !_set_buffer(u, buf, p, n)) {
+		return -1;
+	}
+	u->bufs[buf] = true;
+	return buf;
+}
+
+
+// Unregister buffer of index buf
+void uring_del_buffer(struct uring *u, int buf) {
+	if (buf < 0 || buf >= URING_BUFFERS || !u->bufs[buf]) {
+		return;
+	}
+	_set_buffer(u, buf, NULL, 0);
+	u->bufs[buf] = false;
+}
+
+
+// Get next entry of the submission queue, submitting those queued if it is full
+static struct io_uring_sqe* _get_sqe(struct uring *u) {
+	struct io_uring_sqe *sqe;
+	unsigned i;
+	if (u->tail - __atomic_load_n(u->sq_head, __ATOMIC_ACQUIRE) == u->sq_entries) {
+		uring_submit(u);
+		if (u->tail - __atomic_load_n(u->sq_head, __ATOMIC_ACQUIRE) == u->sq_entries) {
+			die("io_uring submission queue full");
+		}
+	}
+	i = u->tail & u->sq_mask;
+	sqe = &u->sqes[i];
+	memset(sqe, 0, sizeof(struct io_uring_sqe));
+	u->sq_array[i] = i;
+	u->tail++;
+	u->queued++;
+	return sqe;
+}
+
+
+// Queue wait for fd to become ready for poll events
+void uring_poll(struct uring *u, int fd, unsigned events, bool link, uint64_t user) {
+	struct io_uring_sqe *sqe = _get_sqe(u);
+	sqe->opcode = IORING_OP_POLL_ADD;
+	sqe->flags = link ? IOSQE_IO_LINK : 0;
+	sqe->fd = fd;
+	sqe->poll32_events = events;
+	sqe->user_data = user;
+}
+
+
+// Queue read of up to n bytes from fd into p
+void uring_read(struct uring *u, int fd, void *p, size_t n, int buf, uint64_t user) {
+	struct io_uring_sqe *sqe = _get_sqe(u);
+	sqe->opcode = buf >= 0 ? IORING_OP_READ_FIXED : IORING_OP_READ;
+	sqe->fd = fd;
+	sqe->off = (uint64_t) -1;
+	sqe->addr = (uintptr_t) p;
+	sqe->len = n < INT32_MAX ? n : INT32_MAX;
+	sqe->buf_index = buf >= 0 ? buf : 0;
+	sqe->user_data = user;
+}
+
+
+// Queue write of n bytes from p to fd
+void uring_write(struct uring *u, int fd, const void *p, size_t n, bool link, uint64_t user) {
+	struct io_uring_sqe *sqe = _get_sqe(u);
+	sqe->opcode = IORING_OP_WRITE;
+	sqe->flags = link ? IOSQE_IO_LINK : 0;
+	sqe->fd = fd;
+	sqe->off = (uint64_t) -1;
+	sqe->addr = (uintptr_t) p;
+	sqe->len = n < INT32_MAX ? n : INT32_MAX;
+	sqe->user_data = user;
+}
+
+
+// Queue cancelling of the first operation in flight with user data user
+void uring_cancel(struct uring *u, uint64_t user) {
+	struct io_uring_sqe *sqe = _get_sqe(u);
+	sqe->opcode = IORING_OP_ASYNC_CANCEL;
+	sqe->fd = -1;
+	sqe->addr = user;
+	sqe->user_data = 0;
+}
+
+
+// Submit operations queued
+void uring_submit(struct uring *u) {
+	int ret;
+	if (u->queued == 0) {
+		return;
+	}
+	__atomic_store_n(u->sq_tail, u->tail, __ATOMIC_RELEASE);
+	while ((ret = _enter(u->fd, u->queued, 0, 0)) < 0 && errno == EINTR);
+	if (ret < 0) {
+		if (errno != EAGAIN && errno != EBUSY) {
+			die_err("io_uring_enter()");
+		}
+		// Out of memory for now, or completions to take first. Tried again next time
+		return;
+	}
+	u->queued -= ret;
+}
+
+
+// Take the result of the next operation done
+bool uring_reap(struct uring *u, uint64_t *user, int *res) {
+	struct io_uring_cqe *cqe;
+	unsigned head = *u->cq_head;
+	if (head == __atomic_load_n(u->cq_tail, __ATOMIC_ACQUIRE)) {
+		// Completions that didn't fit are kept by the kernel, until asked for
+		if (!(__atomic_load_n(u->sq_flags, __ATOMIC_RELAXED) & IORING_SQ_CQ_OVERFLOW)) {
+			return false;
+		}
+		while (_enter(u->fd, 0, 0, IORING_ENTER_GETEVENTS) < 0 && errno == EINTR);
+		if (head == __atomic_load_n(u->cq_tail, __ATOMIC_ACQUIRE)) {
+			return false;
+		}
+	}
+	cqe = &u->cqes[head & u->cq_mask];
+	*user = cqe->user_data;
+	*res = cqe->res;
+	__atomic_store_n(u->cq_head, head + 1, __ATOMIC_RELEASE);
+	return true;
+}
+
+
+#else // BTE_IO_URING
+
+
+// Built without io_uring. I/O is done with epoll
+struct uring* uring_new(unsigned entries) {
+	(void) entries;
+	return NULL;
+}
+
+void uring_free(struct uring *u) {
+	(void) u;
+}
+
+int uring_fd(const struct uring *u) {
+	(void) u;
+	return -1;
+}
+
+int uring_add_buffer(struct uring *u, void *p, size_t n) {
+	(void) u, (void) p, (void) n;
+	return -1;
+}
+
+void uring_del_buffer(struct uring *u, int buf) {
+	(void) u, (void) buf;
+}
+
+void uring_poll(struct uring *u, int fd, unsigned events, bool link, uint64_t user) {
+	(void) u, (void) fd, (void) events, (void) link, (void) user;
+}
+
+void uring_read(struct uring *u, int fd, void *p, size_t n, int buf, uint64_t user) {
+	(void) u, (void) fd, (void) p, (void) n, (void) buf, (void) user;
+}
+
+void uring_write(struct uring *u, int fd, const void *p, size_t n, bool link, uint64_t user) {
+	(void) u, (void) fd, (void) p, (void) n, (void) link, (void) user;
+}
+
+void uring_cancel(struct uring *u, uint64_t user) {
+	(void) u, (void) user;
+}
+
+void uring_submit(struct uring *u) {
+	(void) u;
+}
+
+bool uring_reap(struct uring *u, uint64_t *user, int *res) {
+	(void) u, (void) user, (void) res;
+	return false;
+}
+
+
+#endif // BTE_IO_URING
@@ -1,5 +1,6 @@
 #include "glad/glad.h"
 
+#include <time.h>
 #include <stddef.h>
 #include <stdlib.h>
 #include <stdbool.h>
@@ -39,6 +40,45 @@ void _gl_check_error(const char *file, const char *func, int line) {
 }
 
 
+// -------- UTF-8 ----------------
+
+
+// Encode codepoint as UTF-8
+size_t utf8_encode(uint32_t cp, char *out) {
+	if (cp < 0x80) {
+		out[0] = cp;
+		return 1;
+	}
+	if (cp < 0x800) {
+		out[0] = 0xc0 | (cp >> 6);
+		out[1] = 0x80 | (cp & 0x3f);
+		return 2;
+	}
+	if (cp < 0x10000) {
+		out[0] = 0xe0 | (cp >> 12);
+		out[1] = 0x80 | ((cp >> 6) & 0x3f);
+		out[2] = 0x80 | (cp & 0x3f);
+		return 3;
+	}
+	out[0] = 0xf0 | (cp >> 18);
+	out[1] = 0x80 | ((cp >> 12) & 0x3f);
+	out[2] = 0x80 | ((cp >> 6) & 0x3f);
+	out[3] = 0x80 | (cp & 0x3f);
+	return 4;
+}
+
+
+// -------- TIME ----------------
+
+
+// Get monotonic time
+uint64_t now_ns() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+
 // -------- HASH TABLE ----------------
 
 
@@ -161,9 +201,11 @@ void* htu32_get(struct htu32 *ht, uint32_t k, enum htres *res) {
 }
 
 
-// Get value for key, and remove it from table. If res is not NULL, set res to result
+// Get value for key, and remove it from table. If res is not NULL, set res to result. Entries
+// after it that were probed past it are moved back, so that they can still be found
 void* htu32_pop(struct htu32 *ht, uint32_t k, enum htres *res) {
-	uint32_t i;
+	uint32_t i, j, h;
+	void *v;
 	if (!ht) {
 		die("NULL ht");
 	}
@@ -178,9 +220,20 @@ void* htu32_pop(struct htu32 *ht, uint32_t k, enum htres *res) {
 			if (res) {
 				*res = HTRES_OK;
 			}
+			v = ht->b[i].v;
 			ht->b[i].p = false;
 			ht->sz--;
-			return ht->b[i].v;
+			for (j = (i + 1) % ht->cap; ht->b[j].p; j = (j + 1) % ht->cap) {
+				// Leave entries whose home is cyclically in (i, j]
+				h = _hash_u32(ht->b[j].k) % ht->cap;
+				if (i <= j ? (i < h && h <= j) : (i < h || h <= j)) {
+					continue;
+				}
+				ht->b[i] = ht->b[j];
+				ht->b[j].p = false;
+				i = j;
+			}
+			return v;
 		}
 	}
 	if (res) {
@@ -190,6 +243,29 @@ void* htu32_pop(struct htu32 *ht, uint32_t k, enum htres *res) {
 }
 
 
+// Get number of entries in hash table
+size_t htu32_size(const struct htu32 *ht) {
+	if (!ht) {
+		die("NULL ht");
+	}
+	return ht->sz;
+}
+
+
+// Call cb for every key-value pair in hash table, in no particular order
+void htu32_foreach(struct htu32 *ht, htu32_foreach_cb_t cb, void *arg) {
+	size_t i;
+	if (!ht) {
+		die("NULL ht");
+	}
+	for (i = 0; i < ht->cap; i++) {
+		if (ht->b[i].p) {
+			cb(ht->b[i].k, ht->b[i].v, arg);
+		}
+	}
+}
+
+
 // -------- LINKED LIST ----------------
 
 
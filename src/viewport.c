@@ -0,0 +1,235 @@
+#include "render.h"
+#include "search.h"
+#include "reflow.h"
+#include "grapheme.h"
+#include "viewport.h"
+#include "scrollback.h"
+
+
+// Rows are kept for this many screens, so that scrolling back and forth over that distance
+// decodes nothing
+#define VIEWPORT_SCREENS 3
+
+// Smooth scrolling covers the remaining distance over this many milliseconds, slowing down as
+// it gets closer
+#define VIEWPORT_SMOOTH_MS 60
+
+// Frames are taken to be at most this far apart, so that the first frame after idling doesn't
+// jump all the way
+#define VIEWPORT_MAX_FRAME_MS 17
+
+// Smooth scrolling stops when it is this close to its target (in rows)
+#define VIEWPORT_SNAP (1.0 / 64)
+
+
+// Create a new viewport, following output
+struct viewport* viewport_new(bool smooth) {
+	struct viewport *vp;
+	if (!(vp = calloc(1, sizeof(struct viewport)))) {
+		die_err("calloc()");
+	}
+	vp->smooth = smooth;
+	vp->clusters = graphemes_new();
+	vp->reflow = reflow_new();
+	return vp;
+}
+
+
+// Free viewport
+void viewport_free(struct viewport *vp) {
+	if (!vp) {
+		return;
+	}
+	graphemes_free(vp->clusters);
+	reflow_free(vp->reflow);
+	free(vp->cells);
+	free(vp->nums);
+	free(vp->scratch);
+	free(vp->srcs);
+	free(vp->marks);
+	free(vp);
+}
+
+
+// Scroll back by rows
+void viewport_scroll(struct viewport *vp, double rows) {
+	viewport_scroll_to(vp, vp->target + rows);
+}
+
+
+// Scroll to pos rows back from the bottom
+void viewport_scroll_to(struct viewport *vp, double pos) {
+	vp->target = pos > 0 ? pos : 0;
+	if (!vp->smooth) {
+		vp->pos = vp->target;
+	}
+}
+
+
+// Jump back to the bottom, following output
+void viewport_reset(struct viewport *vp) {
+	vp->pos = vp->target = 0;
+}
+
+
+// Rewrap lines of sb added so far to width
+void viewport_reflow(struct viewport *vp, struct scrollback *sb, unsigned width) {
+	uint64_t line = UINT64_MAX;
+	unsigned i;
+	if (width == vp->width) {
+		return;
+	}
+	vp->width = width;
+	if (sb && vp->target > 0) {
+		line = reflow_get(vp->reflow, sb, (int64_t) vp->end - (int64_t) vp->target, NULL, 0,
+				NULL, NULL);
+	}
+	reflow_reset(vp->reflow, sb, width);
+	if (line != UINT64_MAX) {
+		vp->pos = vp->target = (double) vp->end - reflow_row(vp->reflow, sb, line);
+	}
+	// Rows are numbered anew
+	for (i = 0; i < vp->cap; i++) {
+		vp->nums[i] = INT64_MIN;
+	}
+}
+
+
+// Rewrap more of sb, in the background
+bool viewport_step(struct viewport *vp, struct scrollback *sb, uint64_t budget_ns) {
+	return sb ? reflow_step(vp->reflow, sb, budget_ns) : false;
+}
+
+
+// Update position for a frame, ms milliseconds after the last one
+bool viewport_update(struct viewport *vp, struct scrollback *sb, uint64_t ms) {
+	uint64_t end = sb ? scrollback_end(sb) : 0;
+	double max = sb ? reflow_size(vp->reflow, sb) : 0, dist;
+	// Stay on the same lines as output comes in, unless following it
+	if (vp->target > 0 && end > vp->end) {
+		vp->pos += end - vp->end;
+		vp->target += end - vp->end;
+	}
+	vp->end = end;
+	if (vp->target > max) {
+		vp->target = max;
+	}
+	if (vp->pos > max) {
+		vp->pos = max;
+	}
+	if (ms > VIEWPORT_MAX_FRAME_MS) {
+		ms = VIEWPORT_MAX_FRAME_MS;
+	}
+	dist = vp->target - vp->pos;
+	if (!vp->smooth || (dist < VIEWPORT_SNAP && dist > -VIEWPORT_SNAP)) {
+		vp->pos = vp->target;
+	} else {
+		vp->pos += dist * ms / VIEWPORT_SMOOTH_MS;
+	}
+	return vp->pos != vp->target;
+}
+
+
+// Reallocate rows for screen dimensions dim, dropping all decoded rows
+static void _resize(struct viewport *vp, uvec2_t dim) {
+	unsigned i;
+	free(vp->cells);
+	free(vp->nums);
+	free(vp->scratch);
+	free(vp->srcs);
+	vp->dim = dim;
+	vp->cap = VIEWPORT_SCREENS * (dim.y + 1);
+	if (!(vp->cells = calloc((size_t) vp->cap * dim.x, sizeof(struct termchar)))
+			|| !(vp->nums = calloc(vp->cap, sizeof(int64_t)))
+			|| !(vp->scratch = calloc(dim.x, sizeof(struct termchar)))
+			|| !(vp->srcs = calloc(dim.x, sizeof(struct reflow_pos)))) {
+		die_err("calloc()");
+	}
+	for (i = 0; i < vp->cap; i++) {
+		vp->nums[i] = INT64_MIN;
+	}
+	graphemes_free(vp->clusters);
+	vp->clusters = graphemes_new();
+}
+
+
+// Free grapheme clusters no longer referenced by any decoded row, if the table has grown enough
+static void _collect(struct viewport *vp) {
+	const struct termchar *row;
+	unsigned i, j;
+	if (!graphemes_should_collect(vp->clusters)) {
+		return;
+	}
+	for (i = 0; i < vp->cap; i++) {
+		if (vp->nums[i] == INT64_MIN) {
+			continue;
+		}
+		row = &vp->cells[(size_t) i * vp->dim.x];
+		for (j = 0; j < vp->dim.x; j++) {
+			if (row[j].flags & RENDERER_CELL_CLUSTER) {
+				graphemes_mark(vp->clusters, row[j].cp);
+			}
+		}
+	}
+	graphemes_sweep(vp->clusters);
+}
+
+
+// Get row num of sb as dim.x cells, decoding it if it isn't in the window of rows
+const struct termchar* viewport_row(struct viewport *vp, struct scrollback *sb, int64_t num,
+		uvec2_t dim) {
+	struct termchar *row;
+	unsigned i;
+	if (dim.x != vp->dim.x || dim.y != vp->dim.y) {
+		_resize(vp, dim);
+	}
+	// Rows may be numbered below 0
+	i = ((num % vp->cap) + vp->cap) % vp->cap;
+	row = &vp->cells[(size_t) i * dim.x];
+	if (vp->nums[i] != num) {
+		// The row being replaced no longer needs its clusters
+		vp->nums[i] = INT64_MIN;
+		_collect(vp);
+		reflow_get(vp->reflow, sb, num, row, dim.x, vp->clusters, NULL);
+		vp->nums[i] = num;
+	}
+	return row;
+}
+
+
+// Mark cells of row num of sb covered by matches of s in marks. Matches are found in lines as
+// they are stored, so each line the row is made from is marked, and its marks are carried over
+void viewport_mark_row(struct viewport *vp, struct scrollback *sb, const struct search *s,
+		int64_t num, uint8_t *marks) {
+	const struct termchar *line;
+	uint64_t last = UINT64_MAX;
+	unsigned j, n = 0;
+	reflow_get(vp->reflow, sb, num, vp->scratch, vp->dim.x, NULL, vp->srcs);
+	for (j = 0; j < vp->dim.x; j++) {
+		if (vp->srcs[j].line == UINT64_MAX) {
+			continue;
+		}
+		if (vp->srcs[j].line != last) {
+			last = vp->srcs[j].line;
+			line = reflow_line(vp->reflow, sb, last, vp->clusters, &n);
+			if (vp->marks_cap < n) {
+				free(vp->marks);
+				if (!(vp->marks = malloc(n))) {
+					die_err("malloc()");
+				}
+				vp->marks_cap = n;
+			}
+			memset(vp->marks, SEARCH_MARK_NONE, n);
+			search_mark_row(s, last, line, n, vp->clusters, vp->marks);
+		}
+		if (vp->srcs[j].col < n) {
+			marks[j] = vp->marks[vp->srcs[j].col];
+		}
+	}
+}
+
+
+// Get number of the row holding the start of line of sb
+int64_t viewport_line_row(struct viewport *vp, struct scrollback *sb, uint64_t line) {
+	return sb ? reflow_row(vp->reflow, sb, line) : (int64_t) line;
+}
@@ -0,0 +1,19 @@
+#include "width.h"
+
+// Generated at build time by tools/gen_width.py
+#include "width_table.h"
+
+
+// Get number of columns taken by codepoint. Two table lookups, no libc calls
+unsigned width_get(uint32_t cp) {
+	const uint8_t *block;
+	if (cp >= 0x20 && cp < 0x7f) {
+		return 1;
+	}
+	if (cp >= 0x110000) {
+		return 1;
+	}
+	block = width_stage2[width_stage1[cp >> WIDTH_BLOCK_BITS]];
+	cp &= (1 << WIDTH_BLOCK_BITS) - 1;
+	return (block[cp >> 2] >> ((cp & 3) * 2)) & 3;
+}
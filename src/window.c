@@ -3,9 +3,19 @@
 #include <stdlib.h>
 #include <inttypes.h>
 
+#include "probe.h"
 #include "window.h"
 
 
+// Rows scrolled per step of the mouse wheel
+#define WINDOW_WHEEL_ROWS 3
+
+// The grid is resized once the window has kept its size for this long (seconds), and at most
+// this often while it keeps changing
+#define WINDOW_RESIZE_SETTLE   0.03
+#define WINDOW_RESIZE_INTERVAL 0.1
+
+
 // Update projection matrix for window
 static void _update_projmat(struct window *window) {
 	memset(window->projmat, 0, sizeof(window->projmat));
@@ -24,9 +34,26 @@ static void glfw_cleanup() {
 }
 
 
-// Callback for resize
-static void _glfw_fb_resize_cb(GLFWwindow *window, int width, int height) {
+// Resize terminal grid to match window dimensions and font size. The child is only told
+// (and signalled) if the number of rows or columns changed
+static void _resize_grid(struct window *w) {
 	uvec2_t r_dim;
+	w->resize_pending = false;
+	w->grid_at = glfwGetTime();
+	if (!w->renderer) {
+		return;
+	}
+	r_dim = renderer_resize(w->renderer);
+	if (w->child && (r_dim.x != w->grid.x || r_dim.y != w->grid.y)) {
+		child_resize_cb(w->child, r_dim);
+		w->grid = r_dim;
+	}
+}
+
+
+// Callback for resize. The grid is resized later (see window_get_events()), so that a
+// drag resizes it (and redraws the child) a few times rather than at every step
+static void _glfw_fb_resize_cb(GLFWwindow *window, int width, int height) {
 	struct window *w;
 	if (width <= 0 || height <= 0) {
 		return;
@@ -36,12 +63,173 @@ static void _glfw_fb_resize_cb(GLFWwindow *window, int width, int height) {
 	w->dim.y = height;
 	glViewport(0, 0, width, height);
 	_update_projmat(w);
+	w->resized_at = glfwGetTime();
+	w->resize_pending = true;
 	if (w->renderer) {
-		r_dim = renderer_resize(w->renderer);
+		renderer_render(w->renderer);
+	}
+}
+
+
+// Callback for content scale changes (e.g. moving to a monitor with different DPI)
+static void _glfw_scale_cb(GLFWwindow *window, float xscale, float yscale) {
+	struct window *w = (struct window*) glfwGetWindowUserPointer(window);
+	if (w->renderer) {
+		fonts_set_scale(w->renderer->fonts, xscale);
+	}
+}
+
+
+// Handle font zoom keys. Return true if the key was handled
+static bool _handle_zoom_key(struct window *w, int key, int mods) {
+	if (!(mods & GLFW_MOD_CONTROL) || !w->renderer) {
+		return false;
+	}
+	switch (key) {
+	case GLFW_KEY_EQUAL:
+	case GLFW_KEY_KP_ADD:
+		fonts_zoom(w->renderer->fonts, 1);
+		return true;
+	case GLFW_KEY_MINUS:
+	case GLFW_KEY_KP_SUBTRACT:
+		fonts_zoom(w->renderer->fonts, -1);
+		return true;
+	case GLFW_KEY_0:
+		fonts_zoom(w->renderer->fonts, 0);
+		return true;
+	}
+	return false;
+}
+
+
+// Handle keys scrolling through scrollback (Shift + Page Up/Down). Return true if the key
+// was handled
+static bool _handle_scroll_key(struct window *w, int key, int mods) {
+	float page;
+	if (!(mods & GLFW_MOD_SHIFT) || !w->renderer) {
+		return false;
+	}
+	page = w->renderer->mod_buf->dim.y > 1 ? w->renderer->mod_buf->dim.y - 1 : 1;
+	switch (key) {
+	case GLFW_KEY_PAGE_UP:
+		renderer_scroll(w->renderer, page);
+		return true;
+	case GLFW_KEY_PAGE_DOWN:
+		renderer_scroll(w->renderer, -page);
+		return true;
+	}
+	return false;
+}
+
+
+// Is key a modifier? Those don't scroll the view back to the bottom
+static bool _is_modifier_key(int key) {
+	return key >= GLFW_KEY_LEFT_SHIFT && key <= GLFW_KEY_RIGHT_SUPER;
+}
+
+
+// Show search query in the title
+static void _show_search(struct window *w) {
+	char title[WINDOW_SEARCH_MAX * UTF8_MAX + 64];
+	size_t len, i;
+	// The window's own title is cut short if it doesn't fit
+	len = snprintf(title, 64, "%s - search: ", w->title);
+	if (len > 63) {
+		len = 63;
+	}
+	for (i = 0; i < w->search_len; i++) {
+		len += utf8_encode(w->search[i], &title[len]);
+	}
+	title[len] = 0;
+	glfwSetWindowTitle(w->window, title);
+}
+
+
+// Show search query in the title, and search for it
+static void _update_search(struct window *w) {
+	_show_search(w);
+	renderer_search(w->renderer, w->search, w->search_len);
+}
+
+
+// Pick up title set by the child, if any. However often it is set, the window title is set at
+// most once a frame
+static void _update_title(struct window *w) {
+	char title[RENDERER_TITLE_MAX];
+	char *tmp;
+	if (!w->renderer || !renderer_get_title(w->renderer, title, sizeof(title))) {
+		return;
+	}
+	if (!strcmp(title, w->title)) {
+		return;
+	}
+	if (!(tmp = strdup(title))) {
+		die_err("strdup()");
+	}
+	free(w->title);
+	w->title = tmp;
+	if (w->searching) {
+		_show_search(w);
+	} else {
+		glfwSetWindowTitle(w->window, w->title);
+	}
+}
+
+
+// Handle keys opening the search prompt (Ctrl + Shift + F), and keys while it is open.
+// Enter jumps to the next older match, and Shift + Enter to the next newer one. Return true
+// if the key was handled
+static bool _handle_search_key(struct window *w, int key, int mods) {
+	if (!w->renderer) {
+		return false;
+	}
+	if (!w->searching) {
+		if (key != GLFW_KEY_F || (mods & (GLFW_MOD_CONTROL | GLFW_MOD_SHIFT))
+				!= (GLFW_MOD_CONTROL | GLFW_MOD_SHIFT)) {
+			return false;
+		}
+		w->searching = true;
+		w->search_len = 0;
+		_update_search(w);
+		return true;
+	}
+	switch (key) {
+	case GLFW_KEY_ESCAPE:
+		w->searching = false;
+		renderer_search(w->renderer, NULL, 0);
+		glfwSetWindowTitle(w->window, w->title);
+		break;
+	case GLFW_KEY_ENTER:
+	case GLFW_KEY_KP_ENTER:
+		renderer_search_next(w->renderer, !(mods & GLFW_MOD_SHIFT));
+		break;
+	case GLFW_KEY_BACKSPACE:
+		if (w->search_len > 0) {
+			w->search_len--;
+			_update_search(w);
+		}
+		break;
+	}
+	// Other keys are typed into the prompt, or ignored
+	return true;
+}
+
+
+// Handle keys pasting the clipboard (Ctrl + Shift + V, or Shift + Insert). Return true if the
+// key was handled
+static bool _handle_paste_key(struct window *w, int key, int mods) {
+	if (!((key == GLFW_KEY_V && (mods & (GLFW_MOD_CONTROL | GLFW_MOD_SHIFT))
+					== (GLFW_MOD_CONTROL | GLFW_MOD_SHIFT))
+				|| (key == GLFW_KEY_INSERT && (mods & GLFW_MOD_SHIFT)))) {
+		return false;
+	}
+	if (w->renderer) {
+		renderer_scroll_reset(w->renderer);
 	}
 	if (w->child) {
-		child_resize_cb(w->child, r_dim);
+		child_paste(w->child, glfwGetClipboardString(w->window));
 	}
+	return true;
 }
 
 
@@ -49,11 +237,21 @@ static void _glfw_fb_resize_cb(GLFWwindow *window, int width, int height) {
 static void _glfw_key_cb(GLFWwindow *window, int key, int scancode, int action, int mods) {
 	// TODO
 	struct window *w = (struct window*) glfwGetWindowUserPointer(window);
+	uint64_t t = probe_key();
 	if (action == GLFW_RELEASE) {
 		return;
 	}
+	if (_handle_zoom_key(w, key, mods) || _handle_scroll_key(w, key, mods)
+			|| _handle_search_key(w, key, mods) || _handle_paste_key(w, key, mods)) {
+		return;
+	}
+	// Typing goes back to the bottom
+	if (w->renderer && !_is_modifier_key(key)) {
+		renderer_scroll_reset(w->renderer);
+	}
 	if (w->child) {
 		child_key_cb(w->child, key, mods);
+		probe_key_sent(t);
 	}
 }
 
@@ -62,10 +260,27 @@ static void _glfw_key_cb(GLFWwindow *window, int key, int scancode, int action,
 static void _glfw_char_cb(GLFWwindow *window, uint32_t codepoint) {
 	// TODO
 	struct window *w = (struct window*) glfwGetWindowUserPointer(window);
+	uint64_t t = probe_key();
+	if (w->searching) {
+		if (w->search_len < WINDOW_SEARCH_MAX) {
+			w->search[w->search_len++] = codepoint;
+			_update_search(w);
+		}
+		return;
+	}
 	if (w->child) {
 		child_char_cb(w->child, codepoint);
+		probe_key_sent(t);
 	}
+}
+
 
+// Callback for mouse wheel and touchpad scrolling. Touchpads scroll by fractions of steps
+static void _glfw_scroll_cb(GLFWwindow *window, double xoffset, double yoffset) {
+	struct window *w = (struct window*) glfwGetWindowUserPointer(window);
+	if (w->renderer) {
+		renderer_scroll(w->renderer, yoffset * WINDOW_WHEEL_ROWS);
+	}
 }
 
 
@@ -96,6 +311,8 @@ struct window* window_new(unsigned width, unsigned height, const char *title) {
 	glfwSetInputMode(window->window, GLFW_LOCK_KEY_MODS, GLFW_TRUE);
 	glfwSetKeyCallback(window->window, _glfw_key_cb);
 	glfwSetCharCallback(window->window, _glfw_char_cb);
+	glfwSetScrollCallback(window->window, _glfw_scroll_cb);
+	glfwSetWindowContentScaleCallback(window->window, _glfw_scale_cb);
 	// Initialize cursor to be text ibeam
 	if (!(window->cursor = glfwCreateStandardCursor(GLFW_IBEAM_CURSOR))) {
 		die("Failed to create GLFW cursor");
@@ -122,10 +339,16 @@ struct window* window_new(unsigned width, unsigned height, const char *title) {
 
 // Set renderer pointer for window
 void window_set_renderer(struct window *window, struct renderer *renderer) {
+	float xscale, yscale;
 	if (!window) {
 		die("NULL window");
 	}
 	window->renderer = renderer;
+	// Match font size to the monitor the window starts on
+	if (renderer) {
+		glfwGetWindowContentScale(window->window, &xscale, &yscale);
+		fonts_set_scale(renderer->fonts, xscale);
+	}
 }
 
 
@@ -156,7 +379,7 @@ bool window_should_close(const struct window *window) {
 	if (!window) {
 		die("NULL window");
 	}
-	return window->should_close;
+	return __atomic_load_n(&window->should_close, __ATOMIC_ACQUIRE);
 }
 
 
@@ -165,21 +388,71 @@ void window_set_should_close(struct window *window) {
 	if (!window) {
 		die("NULL window");
 	}
-	window->should_close = true;
+	__atomic_store_n(&window->should_close, true, __ATOMIC_RELEASE);
+	glfwPostEmptyEvent();
+}
+
+
+// Is there nothing to draw until something happens? Resizing and font size changes are
+// finished from here, so they aren't
+static bool _idle(const struct window *w) {
+	return !w->resize_pending && !(w->renderer && (renderer_animating(w->renderer)
+				|| fonts_size_pending(w->renderer->fonts)));
+}
+
+
+// Wake window_get_events() up for a frame, unless there is nothing to draw
+void window_wake(struct window *window) {
+	if (!window) {
+		die("NULL window");
+	}
+	if (!__atomic_load_n(&window->idle, __ATOMIC_ACQUIRE)
+			|| (window->renderer && renderer_pending(window->renderer))) {
+		glfwPostEmptyEvent();
+	}
 }
 
 
 // Wait for events on the window and process callbacks
 void window_get_events(struct window *window) {
+	uint32_t cp;
+	double now;
 	if (!window) {
 		die("NULL window");
 	}
 	if (!window->should_close) {
-		glfwPollEvents();
+		__atomic_store_n(&window->idle, _idle(window), __ATOMIC_RELEASE);
+		glfwWaitEvents();
 		if (glfwWindowShouldClose(window->window)) {
 			window->should_close = true;
 		}
+		if ((cp = __atomic_exchange_n(&window->typed, 0, __ATOMIC_ACQ_REL))) {
+			_glfw_char_cb(window->window, cp);
+		}
+		// Input of all the events goes to the child in one write
+		if (window->child) {
+			child_flush(window->child);
+		}
+		now = glfwGetTime();
+		if (window->renderer && fonts_size_ready(window->renderer->fonts)) {
+			// Switch font size once a requested size has been rasterized
+			_resize_grid(window);
+		} else if (window->resize_pending && (now - window->resized_at >= WINDOW_RESIZE_SETTLE
+					|| now - window->grid_at >= WINDOW_RESIZE_INTERVAL)) {
+			_resize_grid(window);
+		}
+		_update_title(window);
+	}
+}
+
+
+// Type codepoint as if on the keyboard
+void window_type(struct window *window, uint32_t codepoint) {
+	if (!window) {
+		die("NULL window");
 	}
+	__atomic_store_n(&window->typed, codepoint, __ATOMIC_RELEASE);
+	glfwPostEmptyEvent();
 }
 
 
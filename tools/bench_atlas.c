@@ -0,0 +1,137 @@
+// Benchmark of glyph atlases, bitmap against signed distance field. For each, times building
+// the atlas (loading fonts with ASCII, then more glyphs on demand), zooming through sizes,
+// and rendering frames of a fixed screen of text.
+//
+// Usage: bte-bench-atlas [FRAMES] [FONT]
+//
+// FRAMES (500) frames are rendered with FONT ("monospace"), into a hidden window. Frames are
+// waited for with glFinish(), so that time on the GPU is counted. Built with -DBTE_BENCH=ON
+
+#define _GNU_SOURCE
+#include "glad/glad.h"
+
+#include <time.h>
+#include <locale.h>
+
+#include "window.h"
+
+
+// Window size (px)
+#define BENCH_WIDTH  1360
+#define BENCH_HEIGHT 720
+
+// Font size (px)
+#define BENCH_FONTSZ 13
+
+// Zoom steps timed, one pixel each
+#define BENCH_ZOOM_STEPS 10
+
+// Cursor codepoint (full block)
+#define BENCH_CURSOR 9608
+
+
+// Lines of the screen, repeated to fill it. Escape sequences are logged by the renderer, so
+// there are none
+static const char *const _lines[] = {
+	"drwxr-xr-x  2 user user  4096 Oct 18 13:39 include",
+	"-rw-r--r--  1 user user 12288 Oct 18 13:39 CMakeLists.txt",
+	"+\tif (fonts->sdf) {   -\treturn load_glyph(f, cp);",
+	"warning: unused variable 'glyph' [-Wunused-variable] { } [ ] ( ) < > ~",
+	"The quick brown fox jumps over the lazy dog. 0123456789 !@#$%^&*_+-=|\\;:'\",./?",
+	"THE QUICK BROWN FOX JUMPS OVER THE LAZY DOG",
+};
+
+
+// Wait for fonts to switch to the size last requested
+static void _wait_size(struct fonts *fonts) {
+	const struct timespec ts = { 0, 100000 };
+	while (!fonts_size_ready(fonts)) {
+		nanosleep(&ts, NULL);
+	}
+	fonts_apply_size(fonts);
+}
+
+
+// Fill screen of renderer with text
+static void _fill(struct renderer *r) {
+	uint32_t cps[256];
+	const char *s;
+	unsigned i, n;
+	for (i = 0; i < 128; i++) {
+		for (s = _lines[i % (sizeof(_lines) / sizeof(_lines[0]))], n = 0; *s; s++) {
+			cps[n++] = (unsigned char) *s;
+		}
+		cps[n++] = '\r';
+		cps[n++] = '\n';
+		renderer_add_codepoints(r, cps, n);
+	}
+}
+
+
+// Time atlas of glyphs rasterized as signed distance fields if sdf, else as bitmaps
+static void _run(struct window *window, const char *font, bool sdf, long frames) {
+	static const struct color palette[16] = { { 0 } };
+	struct renderer *r;
+	struct fonts *fonts;
+	uint64_t start, build, lazy, zoom, frame;
+	uint32_t cp;
+	unsigned i;
+	long f;
+	// Atlas of ASCII, and glyphs loaded on demand (Latin-1)
+	start = now_ns();
+	fonts = fonts_new(font, BENCH_FONTSZ, sdf);
+	build = now_ns() - start;
+	start = now_ns();
+	for (cp = 0xa1; cp < 0x100; cp++) {
+		fonts_get_glyph(fonts, cp, FONTS_STYLE_REGULAR);
+	}
+	lazy = now_ns() - start;
+	// Sizes on the way in are new, so they are rasterized (bitmap) or laid out (SDF)
+	start = now_ns();
+	for (i = 0; i < BENCH_ZOOM_STEPS; i++) {
+		fonts_zoom(fonts, 1);
+		_wait_size(fonts);
+	}
+	zoom = now_ns() - start;
+	fonts_zoom(fonts, 0);
+	_wait_size(fonts);
+	// Frames of a full screen
+	r = renderer_new(window, fonts, "#d5c4a1", "#282828", BENCH_CURSOR, palette, false, 0,
+			false, false);
+	_fill(r);
+	renderer_render(r);
+	renderer_update(r);
+	glFinish();
+	start = now_ns();
+	for (f = 0; f < frames; f++) {
+		renderer_render(r);
+		renderer_update(r);
+		glFinish();
+	}
+	frame = now_ns() - start;
+	printf("%-6s atlas %.2f ms, %u more glyphs %.2f ms, %d zoom steps %.2f ms, "
+			"frame %.3f ms\n", sdf ? "sdf" : "bitmap", build * 1e-6, 0x100 - 0xa1,
+			lazy * 1e-6, BENCH_ZOOM_STEPS, zoom * 1e-6, frame * 1e-6 / frames);
+	renderer_free(r);
+	fonts_free(fonts);
+}
+
+
+int main(int argc, char **argv) {
+	struct window *window;
+	long frames = argc > 1 ? atol(argv[1]) : 500;
+	const char *font = argc > 2 ? argv[2] : "monospace";
+	setlocale(LC_ALL, "C.UTF-8");
+	if (frames <= 0) {
+		die_fmt("Usage: %s [FRAMES] [FONT]", argv[0]);
+	}
+	glfwInit();
+	glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+	window = window_new(BENCH_WIDTH, BENCH_HEIGHT, "bte-bench-atlas");
+	// Frames aren't to wait for the display
+	glfwSwapInterval(0);
+	_run(window, font, false, frames);
+	_run(window, font, true, frames);
+	window_free(window);
+	return 0;
+}
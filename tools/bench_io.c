@@ -0,0 +1,163 @@
+// Benchmark of pty I/O through epoll and through io_uring. Children flood their ptys with
+// output, which is read and decoded as bte would, but not rendered. Both paths are run with
+// the same load, one after the other, and compared on throughput, context switches and CPU
+// time.
+//
+// Usage: bte-bench [SESSIONS] [MB] [PASTE_BYTES]
+//
+// Each of SESSIONS (1) children writes MB (100) megabytes of lines. With PASTE_BYTES, that
+// many bytes are also pasted into the first child, to time the input side. Built with
+// -DBTE_BENCH=ON (and -DBTE_IO_URING=ON for the io_uring path)
+
+#define _GNU_SOURCE
+#include <locale.h>
+#include <unistd.h>
+#include <sys/resource.h>
+
+#include "loop.h"
+#include "child.h"
+#include "render.h"
+
+
+// Most sessions run at once
+#define BENCH_SESSIONS_MAX 64
+
+// Time given to a run before it is given up on (s)
+#define BENCH_TIMEOUT 60
+
+
+// Codepoints decoded over all sessions. The output is ASCII, so one per byte
+static size_t decoded;
+
+// Window handed to children. Only ever passed back to window_set_should_close()
+static char window;
+
+
+// ---- Stand-ins for the renderer and window ----
+
+
+size_t renderer_add_codepoints(struct renderer *r, uint32_t *cps, size_t n_cps) {
+	__atomic_add_fetch(&decoded, n_cps, __ATOMIC_RELAXED);
+	return n_cps;
+}
+
+
+void renderer_render(struct renderer *r) {
+}
+
+
+bool renderer_bracketed_paste(struct renderer *r) {
+	return false;
+}
+
+
+void window_set_should_close(struct window *w) {
+}
+
+
+// ---- Benchmark ----
+
+
+// Get current time (s)
+static double _now() {
+	return now_ns() * 1e-9;
+}
+
+
+// Get CPU time used (s)
+static double _cpu(const struct rusage *ru) {
+	return ru->ru_utime.tv_sec + ru->ru_utime.tv_usec * 1e-6 + ru->ru_stime.tv_sec
+		+ ru->ru_stime.tv_usec * 1e-6;
+}
+
+
+// Run sessions children writing mb megabytes each, reading their ptys through io_uring if
+// uring, else epoll. Paste paste (if not NULL) into the first. Return false if io_uring isn't
+// available
+static bool _run(bool uring, unsigned sessions, long mb, const char *paste) {
+	static struct termbuf tb = { .dim = { 80, 24 } };
+	static struct renderer r = { .mod_buf = &tb };
+	const char *envp[] = { "TERM=xterm", NULL };
+	const char *argv[] = { "/bin/sh", "-c", NULL, NULL };
+	struct child *children[BENCH_SESSIONS_MAX];
+	struct loop *io, *parser;
+	struct rusage ru_start, ru_end;
+	double start, t;
+	char cmd[256];
+	size_t total = sessions * mb * 1000000;
+	unsigned i;
+	io = loop_new();
+	parser = loop_new();
+	if (uring && !loop_use_uring(io)) {
+		loop_free(io);
+		loop_free(parser);
+		return false;
+	}
+	decoded = 0;
+	// Input pasted is read and thrown away, not echoed
+	snprintf(cmd, sizeof(cmd), "stty raw -echo; cat > /dev/null & yes %s | head -c %ld",
+			"the quick brown fox jumps over the lazy dog", mb * 1000000);
+	argv[2] = cmd;
+	getrusage(RUSAGE_SELF, &ru_start);
+	start = _now();
+	for (i = 0; i < sessions; i++) {
+		children[i] = child_new(argv, envp, io, parser, &r, (struct window*) &window);
+	}
+	// Pasted once output has started, and the echo is off
+	while (paste && __atomic_load_n(&decoded, __ATOMIC_RELAXED) == 0
+			&& _now() - start < BENCH_TIMEOUT) {
+		usleep(1000);
+	}
+	if (paste) {
+		child_paste(children[0], paste);
+		child_flush(children[0]);
+	}
+	// Done once the output of all children has been decoded
+	while (__atomic_load_n(&decoded, __ATOMIC_RELAXED) < total
+			&& _now() - start < BENCH_TIMEOUT) {
+		usleep(1000);
+	}
+	t = _now() - start;
+	getrusage(RUSAGE_SELF, &ru_end);
+	printf("%-8s %u x %ld MB: %.1f MB/s, %zu bytes in %.2f s, cpu %.2f s, "
+			"switches %ld voluntary, %ld involuntary\n", uring ? "io_uring" : "epoll",
+			sessions, mb, decoded / t / 1e6, decoded, t, _cpu(&ru_end) - _cpu(&ru_start),
+			ru_end.ru_nvcsw - ru_start.ru_nvcsw, ru_end.ru_nivcsw - ru_start.ru_nivcsw);
+	if (decoded < total) {
+		printf("%-8s timed out after %d s, %zu bytes short\n", "", BENCH_TIMEOUT,
+				total - decoded);
+	}
+	for (i = 0; i < sessions; i++) {
+		child_fini(children[i]);
+	}
+	loop_free(io);
+	loop_free(parser);
+	return true;
+}
+
+
+int main(int argc, char **argv) {
+	unsigned sessions = argc > 1 ? atoi(argv[1]) : 1;
+	long mb = argc > 2 ? atol(argv[2]) : 100;
+	size_t paste_len = argc > 3 ? atol(argv[3]) : 0;
+	char *paste = NULL;
+	setlocale(LC_ALL, "C.UTF-8");
+	if (sessions == 0 || sessions > BENCH_SESSIONS_MAX || mb <= 0) {
+		die_fmt("Usage: %s [SESSIONS (1-%d)] [MB] [PASTE_BYTES]", argv[0],
+				BENCH_SESSIONS_MAX);
+	}
+	if (paste_len > 0) {
+		if (!(paste = malloc(paste_len + 1))) {
+			die_err("malloc()");
+		}
+		memset(paste, 'x', paste_len);
+		paste[paste_len] = '\0';
+	}
+	_run(false, sessions, mb, paste);
+	if (!_run(true, sessions, mb, paste)) {
+		printf("io_uring not available (built without BTE_IO_URING, or the kernel lacks "
+				"it)\n");
+	}
+	free(paste);
+	return 0;
+}
@@ -0,0 +1,112 @@
+// Benchmark of search over scrollback. A scrollback is filled with a synthetic build log, and
+// searched whole in one step, first cold (lines are decoded from scrollback), then warm (text
+// of lines comes from the search's cache), as when a query is refined. Throughput is reported
+// in lines/s.
+//
+// Usage: bte-bench-search [LINES] [QUERY]
+//
+// LINES (100000) lines are added, and searched for QUERY ("undefined reference"). The warm
+// pass only hits the cache if the text of all lines fits in it (16 MB). Built with
+// -DBTE_BENCH=ON
+
+#define _GNU_SOURCE
+#include <locale.h>
+
+#include "render.h"
+
+
+// Columns of the screen and of lines
+#define BENCH_COLS 120
+
+// Rows of the screen
+#define BENCH_ROWS 40
+
+// Bytes of scrollback. Enough for a million lines of the corpus
+#define BENCH_SCROLLBACK (256 << 20)
+
+// One line in this many is an error
+#define BENCH_ERROR_EVERY 997
+
+// Warm passes timed
+#define BENCH_WARM_PASSES 5
+
+
+// Write line num of the corpus into cells of line. Compiler invocations, with an error now
+// and then
+static void _corpus_line(uint64_t num, struct termchar *line) {
+	char text[BENCH_COLS + 1];
+	unsigned i, n;
+	if (num % BENCH_ERROR_EVERY == 0) {
+		n = snprintf(text, sizeof(text), "/usr/bin/ld: module_%03u.o: in function `init_%"
+				PRIu64 "': undefined reference to `frobnicate'", (unsigned) (num % 1000), num);
+	} else {
+		n = snprintf(text, sizeof(text), "[%" PRIu64 "] cc -O2 -Wall -Iinclude -c "
+				"src/module_%03u.c -o build/module_%03u.o", num, (unsigned) (num % 1000),
+				(unsigned) (num % 1000));
+	}
+	for (i = 0; i < BENCH_COLS; i++) {
+		line[i] = (struct termchar) {
+			.cp = i < n ? (uint32_t) text[i] : ' ',
+			.fg = RENDERER_COLOR_FG,
+			.bg = RENDERER_COLOR_BG,
+			.to_draw = i < n,
+		};
+	}
+}
+
+
+// Search sb and the screen (rows of dim) whole for query, and return time taken (s)
+static double _pass(struct search *s, struct scrollback *sb, struct termchar *const *rows,
+		struct graphemes *clusters, const uint32_t *query, size_t n) {
+	uvec2_t dim = { BENCH_COLS, BENCH_ROWS };
+	uint64_t start = now_ns();
+	search_set_query(s, query, n);
+	while (search_step(s, sb, rows, dim, clusters, UINT64_MAX));
+	return (now_ns() - start) * 1e-9;
+}
+
+
+int main(int argc, char **argv) {
+	struct termchar *screen, *rows[BENCH_ROWS], line[BENCH_COLS];
+	uint32_t query[BENCH_COLS];
+	struct graphemes *clusters = graphemes_new();
+	struct scrollback *sb = scrollback_new(BENCH_SCROLLBACK, false);
+	struct search *s = search_new();
+	long lines = argc > 1 ? atol(argv[1]) : 100000;
+	const char *q = argc > 2 ? argv[2] : "undefined reference";
+	double cold, warm = 0;
+	size_t n, i;
+	setlocale(LC_ALL, "C.UTF-8");
+	if (lines <= 0 || !*q) {
+		die_fmt("Usage: %s [LINES] [QUERY]", argv[0]);
+	}
+	for (n = 0; q[n] && n < BENCH_COLS; n++) {
+		query[n] = (unsigned char) q[n];
+	}
+	// The screen is empty
+	if (!(screen = calloc(BENCH_ROWS * BENCH_COLS, sizeof(struct termchar)))) {
+		die_err("calloc()");
+	}
+	for (i = 0; i < BENCH_ROWS; i++) {
+		rows[i] = &screen[i * BENCH_COLS];
+	}
+	for (i = 0; i < (size_t) lines; i++) {
+		_corpus_line(i, line);
+		scrollback_push(sb, line, BENCH_COLS, clusters);
+	}
+	printf("%zu lines in scrollback (of %ld added)\n", scrollback_size(sb), lines);
+	cold = _pass(s, sb, rows, clusters, query, n);
+	printf("cold: %.1f ms, %.0f lines/s, %zu matches\n", cold * 1e3,
+			scrollback_size(sb) / cold, search_count(s));
+	for (i = 0; i < BENCH_WARM_PASSES; i++) {
+		warm += _pass(s, sb, rows, clusters, query, n);
+	}
+	warm /= BENCH_WARM_PASSES;
+	printf("warm: %.1f ms, %.0f lines/s, %zu matches\n", warm * 1e3,
+			scrollback_size(sb) / warm, search_count(s));
+	search_free(s);
+	scrollback_free(sb);
+	graphemes_free(clusters);
+	free(screen);
+	return 0;
+}
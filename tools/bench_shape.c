@@ -0,0 +1,133 @@
+// Benchmark of the shaping cache. A fixed screen of source code is split into runs as the
+// renderer does (at spaces), and shaped with shaper_shape() frame by frame. The last row
+// changes on every frame, as a prompt being typed into would, so that a few runs miss. Prints
+// the cache hit rate, and the time per frame.
+//
+// Usage: bte-bench-shape [FRAMES] [FONT]
+//
+// FRAMES (10000) frames are shaped with FONT ("monospace"). Built with -DBTE_BENCH=ON and
+// -DBTE_HARFBUZZ=ON. Fonts need an OpenGL context, so a hidden window is opened
+
+#define _GNU_SOURCE
+#include "glad/glad.h"
+
+#include <locale.h>
+
+#include "window.h"
+
+
+// Font size (px)
+#define BENCH_FONTSZ 13
+
+// Columns of the screen. Longer rows are cut short
+#define BENCH_COLS 120
+
+
+// Rows of the screen, with the ligatures of common programming fonts
+static const char *const _rows[] = {
+	"static int _parse(const struct parser *p, const char *s, size_t n) {",
+	"	if (p == NULL || n == 0) {",
+	"		return -1;",
+	"	}",
+	"	for (size_t i = 0; i < n && s[i] != '\\0'; i++) {",
+	"		if (s[i] >= '0' && s[i] <= '9') {",
+	"			p->value = p->value * 10 + (s[i] - '0');",
+	"		} else if (s[i] == '-' || s[i] == '+') {",
+	"			p->sign = s[i] == '-' ? -1 : 1;",
+	"		} else if (s[i] != ' ') {",
+	"			return i;",
+	"		}",
+	"	}",
+	"	return p->value != 0 ? 0 : -1;",
+	"}",
+	"",
+	"fn main() -> Result<(), Box<dyn Error>> {",
+	"    let args: Vec<String> = env::args().collect();",
+	"    let path = args.get(1).ok_or(\"usage: prog <path>\")?;",
+	"    let data = fs::read_to_string(path)?;",
+	"    for (n, line) in data.lines().enumerate() {",
+	"        match line.split_once(\"=>\") {",
+	"            Some((k, v)) if !k.is_empty() => println!(\"{n}: {k} -> {v}\"),",
+	"            _ => eprintln!(\"{n}: skipped\"),",
+	"        }",
+	"    }",
+	"    Ok(())",
+	"}",
+	"",
+	"const reduce = (xs) => xs.filter((x) => x !== null).map((x) => x ** 2);",
+	"if (a === b && c !== d || e <= f && g >= h) { return a ?? b; }",
+	"x |> f >>= g <<= h <=> i ::: j ... k /* comment */ // comment",
+	"<!-- html --> <| |> <$> <*> <+> www ~~> ~~ ++ -- ** && || :: ;;",
+	"$ make -j8 2>&1 | grep -E 'error|warning' >> build.log",
+	"",
+};
+
+
+// Shape the runs of row (n cells), as the renderer splits them
+static void _shape_row(struct shaper *shaper, const uint32_t *row, unsigned n) {
+	unsigned j, k;
+	for (j = 0; j < n; j = k) {
+		if (row[j] <= ' ') {
+			k = j + 1;
+			continue;
+		}
+		for (k = j + 1; k < n && row[k] > ' '; k++);
+		shaper_shape(shaper, &row[j], k - j, FONTS_STYLE_REGULAR);
+	}
+}
+
+
+// Get cells of string s into row (BENCH_COLS cells), padded with spaces
+static void _row_cells(const char *s, uint32_t *row) {
+	unsigned i;
+	for (i = 0; i < BENCH_COLS; i++) {
+		row[i] = *s ? (unsigned char) *s++ : ' ';
+	}
+}
+
+
+int main(int argc, char **argv) {
+	const unsigned n_rows = sizeof(_rows) / sizeof(_rows[0]);
+	uint32_t rows[sizeof(_rows) / sizeof(_rows[0])][BENCH_COLS];
+	char prompt[BENCH_COLS + 1];
+	struct shaper_stats st;
+	struct window *window;
+	struct fonts *fonts;
+	struct shaper *shaper;
+	long frames = argc > 1 ? atol(argv[1]) : 10000, f;
+	const char *font = argc > 2 ? argv[2] : "monospace";
+	uint64_t start;
+	unsigned i;
+	setlocale(LC_ALL, "C.UTF-8");
+	if (frames <= 0) {
+		die_fmt("Usage: %s [FRAMES] [FONT]", argv[0]);
+	}
+	glfwInit();
+	glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+	window = window_new(640, 480, "bte-bench-shape");
+	fonts = fonts_new(font, BENCH_FONTSZ, false);
+	if (!(shaper = shaper_new(fonts))) {
+		die("Built without HarfBuzz (-DBTE_HARFBUZZ=ON)");
+	}
+	for (i = 0; i < n_rows; i++) {
+		_row_cells(_rows[i], rows[i]);
+	}
+	start = now_ns();
+	for (f = 0; f < frames; f++) {
+		snprintf(prompt, sizeof(prompt), "$ git log --oneline -n %ld | grep -v '=>'", f);
+		_row_cells(prompt, rows[n_rows - 1]);
+		for (i = 0; i < n_rows; i++) {
+			_shape_row(shaper, rows[i], BENCH_COLS);
+		}
+		shaper_end_frame(shaper);
+	}
+	shaper_get_stats(shaper, &st);
+	printf("%" PRIu64 " frames, %" PRIu64 " runs, %.2f%% cache hits\n", st.frames,
+			st.hits + st.misses, 100.0 * st.hits / (st.hits + st.misses));
+	printf("%.0f ns per frame, of which %.0f ns shaping misses\n",
+			(double) (now_ns() - start) / st.frames, (double) st.shape_ns / st.frames);
+	shaper_free(shaper);
+	fonts_free(fonts);
+	window_free(window);
+	return 0;
+}
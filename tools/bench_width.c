@@ -0,0 +1,91 @@
+// Benchmark of character width lookups. width_get() is timed per codepoint over ASCII, and
+// over random codepoints of planes 0-2, against wcwidth() from libc for reference. Codepoints
+// are drawn before timing, so that the random number generator isn't timed.
+//
+// Usage: bte-bench-width [MILLIONS]
+//
+// Each set is looked up MILLIONS (100) million times. Built with -DBTE_BENCH=ON
+
+#define _GNU_SOURCE
+#include <wchar.h>
+#include <locale.h>
+
+#include "width.h"
+
+
+// Codepoints in each set. Small enough for the L2 cache, so that memory isn't timed
+#define BENCH_CPS (1 << 16)
+
+
+// A set of codepoints looked up
+struct bench_set {
+	const char *name;
+	uint32_t   first; // First codepoint drawn from
+	uint32_t   n;     // Number of codepoints drawn from
+};
+
+
+static const struct bench_set _sets[] = {
+	{ "ascii", 0x20, 0x5f },
+	{ "planes 0-2", 0, 0x30000 },
+};
+
+
+// Get random number (xorshift), so that sets are the same from run to run
+static uint32_t _rand(uint32_t *state) {
+	*state ^= *state << 13;
+	*state ^= *state >> 17;
+	*state ^= *state << 5;
+	return *state;
+}
+
+
+// Look up cps, loops times, with width_get() or wcwidth(). Return time per codepoint (ns),
+// and store the sum of widths in sum, so that lookups aren't optimized out
+static double _run(const uint32_t *cps, unsigned loops, bool libc, unsigned long *sum) {
+	uint64_t start = now_ns();
+	unsigned long s = 0;
+	unsigned i, k;
+	for (k = 0; k < loops; k++) {
+		if (libc) {
+			for (i = 0; i < BENCH_CPS; i++) {
+				s += wcwidth(cps[i]);
+			}
+		} else {
+			for (i = 0; i < BENCH_CPS; i++) {
+				s += width_get(cps[i]);
+			}
+		}
+	}
+	*sum += s;
+	return (double) (now_ns() - start) / ((double) loops * BENCH_CPS);
+}
+
+
+int main(int argc, char **argv) {
+	uint32_t *cps, state = 1;
+	unsigned long sum = 0;
+	unsigned loops, i, k;
+	long millions = argc > 1 ? atol(argv[1]) : 100;
+	if (millions <= 0) {
+		die_fmt("Usage: %s [MILLIONS]", argv[0]);
+	}
+	loops = (millions * 1000000 + BENCH_CPS - 1) / BENCH_CPS;
+	setlocale(LC_ALL, "C.UTF-8");
+	if (!(cps = malloc(BENCH_CPS * sizeof(uint32_t)))) {
+		die_err("malloc()");
+	}
+	for (k = 0; k < sizeof(_sets) / sizeof(_sets[0]); k++) {
+		for (i = 0; i < BENCH_CPS; i++) {
+			cps[i] = _sets[k].first + _rand(&state) % _sets[k].n;
+		}
+		// Warm up caches and branch predictors
+		_run(cps, 1, false, &sum);
+		printf("%-10s width_get %.2f ns/codepoint, wcwidth %.2f ns/codepoint\n",
+				_sets[k].name, _run(cps, loops, false, &sum), _run(cps, loops, true, &sum));
+	}
+	// Printed, so that the lookups have an effect
+	printf("(sum of widths %lu)\n", sum);
+	free(cps);
+	return 0;
+}
@@ -0,0 +1,116 @@
+#!/usr/bin/env python3
+# Generate two-stage lookup table of character widths (0, 1 or 2 columns).
+#
+# Usage: gen_width.py OUTPUT [UCD_DIR]
+#
+# If UCD_DIR is given, widths are derived from EastAsianWidth.txt and UnicodeData.txt in it.
+# Otherwise, the Unicode database bundled with Python is used.
+
+import os
+import sys
+
+
+MAX_CP = 0x110000
+BLOCK_BITS = 8
+BLOCK_SZ = 1 << BLOCK_BITS
+
+
+# Categories of zero-width characters: combining marks and formatting characters
+ZERO_CATEGORIES = ('Mn', 'Me', 'Cf', 'Cc')
+
+# Planes where unassigned codepoints default to wide
+WIDE_DEFAULT = ((0x20000, 0x2fffd), (0x30000, 0x3fffd))
+
+
+def _parse_ranges(path):
+    # Yield (first, last, fields) for each line of a UCD file in "XXXX..YYYY ; A" format
+    with open(path) as f:
+        for line in f:
+            line = line.split('#', 1)[0].strip()
+            if not line:
+                continue
+            fields = [x.strip() for x in line.split(';')]
+            cps = fields[0].split('..')
+            yield int(cps[0], 16), int(cps[-1], 16), fields[1:]
+
+
+def _from_files(ucd_dir):
+    eaw, cat = {}, {}
+    for first, last, fields in _parse_ranges(os.path.join(ucd_dir, 'EastAsianWidth.txt')):
+        for cp in range(first, last + 1):
+            eaw[cp] = fields[0]
+    first = None
+    with open(os.path.join(ucd_dir, 'UnicodeData.txt')) as f:
+        for line in f:
+            fields = line.split(';')
+            cp = int(fields[0], 16)
+            if fields[1].endswith('First>'):
+                first = cp
+                continue
+            for c in range(first if fields[1].endswith('Last>') else cp, cp + 1):
+                cat[c] = fields[2]
+    return lambda cp: eaw.get(cp, 'N'), lambda cp: cat.get(cp, 'Cn')
+
+
+def _from_python():
+    import unicodedata
+    return (lambda cp: unicodedata.east_asian_width(chr(cp)),
+            lambda cp: unicodedata.category(chr(cp)))
+
+
+def _width(cp, eaw, cat):
+    if cp == 0xad:
+        # Soft hyphen is visible
+        return 1
+    if 0x1160 <= cp <= 0x11ff or cp == 0x200b:
+        # Hangul medial vowels and final consonants, zero width space
+        return 0
+    if cat(cp) in ZERO_CATEGORIES:
+        return 0
+    if eaw(cp) in ('W', 'F'):
+        return 2
+    for first, last in WIDE_DEFAULT:
+        if first <= cp <= last:
+            return 2
+    return 1
+
+
+def main():
+    if len(sys.argv) not in (2, 3):
+        sys.exit('Usage: %s OUTPUT [UCD_DIR]' % sys.argv[0])
+    if len(sys.argv) == 3 and sys.argv[2]:
+        eaw, cat = _from_files(sys.argv[2])
+        source = 'Unicode data files'
+    else:
+        import unicodedata
+        eaw, cat = _from_python()
+        source = 'Unicode %s database bundled with Python' % unicodedata.unidata_version
+    # Split into blocks of 2-bit widths, packed 4 per byte, and deduplicate blocks
+    blocks, stage1 = {}, []
+    for base in range(0, MAX_CP, BLOCK_SZ):
+        packed = bytearray(BLOCK_SZ // 4)
+        for i in range(BLOCK_SZ):
+            packed[i >> 2] |= _width(base + i, eaw, cat) << ((i & 3) * 2)
+        stage1.append(blocks.setdefault(bytes(packed), len(blocks)))
+    if len(blocks) > 256:
+        sys.exit('Too many unique blocks: %d' % len(blocks))
+    with open(sys.argv[1], 'w') as out:
+        out.write('// Generated by tools/gen_width.py from the %s. Do not edit\n\n' % source)
+        out.write('#define WIDTH_BLOCK_BITS %d\n\n' % BLOCK_BITS)
+        out.write('// Block index for each block of %d codepoints\n' % BLOCK_SZ)
+        out.write('static const uint8_t width_stage1[%d] = {\n' % len(stage1))
+        for i in range(0, len(stage1), 16):
+            out.write('\t' + ', '.join('%d' % x for x in stage1[i:i + 16]) + ',\n')
+        out.write('};\n\n')
+        out.write('// Blocks of widths, 2 bits per codepoint\n')
+        out.write('static const uint8_t width_stage2[%d][%d] = {\n' % (len(blocks), BLOCK_SZ // 4))
+        for block in sorted(blocks, key=blocks.get):
+            out.write('\t{\n')
+            for i in range(0, len(block), 16):
+                out.write('\t\t' + ', '.join('0x%02x' % x for x in block[i:i + 16]) + ',\n')
+            out.write('\t},\n')
+        out.write('};\n')
+
+
+if __name__ == '__main__':
+    main()
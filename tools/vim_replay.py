@@ -0,0 +1,131 @@
+#!/usr/bin/env python3
+# Record the same vim editing session twice, once on a terminal with insert/delete line and
+# character operations (IL/DL, ICH/DCH, ECH) and once without, and compare the output.
+#
+# Usage: vim_replay.py [OUT_DIR]
+#
+# Without the operations (and scroll regions), vim has to redraw the lines they would have
+# moved. The streams are written to OUT_DIR, if given, as with-ops.vt and without-ops.vt, to be
+# replayed in bte (cat them on an 80x24 screen).
+
+import fcntl
+import os
+import pty
+import random
+import select
+import struct
+import subprocess
+import sys
+import tempfile
+import termios
+
+
+COLS, ROWS = 80, 24
+
+# Capabilities taken out of xterm for the terminal without the operations
+DROPPED = ('il', 'il1', 'dl', 'dl1', 'ich', 'ich1', 'dch', 'dch1', 'ech', 'smir', 'rmir',
+           'csr', 'indn', 'rin', 'ri')
+
+# Keys typed: open lines, delete lines, insert and delete characters mid-line, scroll
+SESSION = (['20G', 'dd', 'dd', '3dd', 'O', 'new line\x1b', 'o', 'another\x1b', 'P']
+           + ['5G', '10l', 'x', 'x', '5x', 'i', 'inserted ', '\x1b', 'A', ' tail\x1b']
+           + ['30G', '2dd', 'u', 'u', '\x04', '\x04', '\x15', 'dd', 'p'] * 3
+           + [':q!\r'])
+
+# Words of the file edited
+WORDS = ('static', 'struct', 'return', 'unsigned', 'while', 'renderer', 'cursor', 'scroll',
+         'region', 'cells', 'row', 'if', 'else', 'break', 'size_t', 'termbuf', 'memmove')
+
+# Operations counted in the output, as the CSI final characters they end with
+OPS = {'L': 'IL', 'M': 'DL', '@': 'ICH', 'P': 'DCH', 'X': 'ECH', 'r': 'DECSTBM'}
+
+
+def _terminfo(tmp):
+    # Compile xterm without the operations as "bte-noops", into tmp
+    src = subprocess.run(['infocmp', '-x', '-1', 'xterm'], capture_output=True, text=True,
+                         check=True).stdout
+    lines = []
+    for line in src.splitlines():
+        cap = line.strip().rstrip(',').split('=')[0].split('#')[0]
+        if line.startswith('xterm|'):
+            line = 'bte-noops|xterm without insert/delete operations,'
+        elif cap in DROPPED or cap.startswith('use'):
+            continue
+        lines.append(line)
+    path = os.path.join(tmp, 'bte-noops.src')
+    with open(path, 'w') as f:
+        f.write('\n'.join(lines) + '\n')
+    subprocess.run(['tic', '-x', '-o', tmp, path], check=True, capture_output=True)
+
+
+def _drain(fd, out, quiet):
+    # Read output until there has been none for quiet seconds
+    while select.select([fd], [], [], quiet)[0]:
+        try:
+            data = os.read(fd, 65536)
+        except OSError:
+            return False
+        if not data:
+            return False
+        out += data
+    return True
+
+
+def _record(path, term, env):
+    pid, fd = pty.fork()
+    if pid == 0:
+        os.environ.update(env)
+        os.environ['TERM'] = term
+        os.execvp('vim', ['vim', '-u', 'NONE', '-N', '-n', '-i', 'NONE', path])
+    fcntl.ioctl(fd, termios.TIOCSWINSZ, struct.pack('HHHH', ROWS, COLS, 0, 0))
+    out = bytearray()
+    _drain(fd, out, 1.0)
+    start = len(out)
+    for keys in SESSION:
+        os.write(fd, keys.encode())
+        if not _drain(fd, out, 0.1):
+            break
+    os.waitpid(pid, 0)
+    os.close(fd)
+    # The initial screen is the same either way
+    return bytes(out[start:])
+
+
+def _count_ops(data):
+    counts = dict.fromkeys(OPS.values(), 0)
+    i = 0
+    while (i := data.find(b'\x1b[', i)) >= 0:
+        j = i + 2
+        while j < len(data) and data[j] in b'0123456789;?':
+            j += 1
+        if j < len(data) and chr(data[j]) in OPS:
+            counts[OPS[chr(data[j])]] += 1
+        i = j
+    return counts
+
+
+def main():
+    with tempfile.TemporaryDirectory() as tmp:
+        _terminfo(tmp)
+        text = os.path.join(tmp, 'text.txt')
+        # Lines of different words, so that vim can't redraw a line by patching the one there
+        rand = random.Random(1)
+        with open(text, 'w') as f:
+            for _ in range(200):
+                f.write(' '.join(rand.choice(WORDS) for _ in range(rand.randint(4, 12))) + '\n')
+        results = []
+        for name, term in (('with-ops', 'xterm'), ('without-ops', 'bte-noops')):
+            results.append((name, _record(text, term, {'TERMINFO': tmp})))
+    for name, data in results:
+        ops = ', '.join('%s %d' % kv for kv in _count_ops(data).items() if kv[1])
+        print('%-12s %7d bytes  (%s)' % (name, len(data), ops or 'no operations'))
+    print('saved %.0f%%' % (100 * (1 - len(results[0][1]) / len(results[1][1]))))
+    if len(sys.argv) > 1:
+        os.makedirs(sys.argv[1], exist_ok=True)
+        for name, data in results:
+            with open(os.path.join(sys.argv[1], name + '.vt'), 'wb') as f:
+                f.write(data)
+
+
+if __name__ == '__main__':
+    main()